@@ -0,0 +1,101 @@
+#include "minicc.h"
+
+/*
+ * in-process compile API
+ *
+ * A COMPILER owns all per-unit state, so separate contexts may be used
+ * from separate threads at the same time.  A context can be reused for
+ * any number of buffers; everything allocated for a unit is released
+ * when compile_buffer() returns.
+ */
+COMPILER *new_compiler(void)
+{
+    COMPILER *cc = (COMPILER*) alloc(sizeof (COMPILER));
+    memset(cc, 0, sizeof (COMPILER));
+    return cc;
+}
+
+void free_compiler(COMPILER *cc)
+{
+    COMPILER *save;
+
+    if (cc == NULL)
+        return;
+    save = g_compiler;
+    g_compiler = cc;
+    reset_stats();
+    term_arena();
+    g_compiler = save;
+    free(cc);
+}
+
+bool compile_buffer(COMPILER *cc, const char *name, const char *text,
+                    FILE *out)
+{
+    COMPILER *save = g_compiler;
+    PARSER *pars;
+    bool result = false;
+
+    g_compiler = cc;
+    reset_stats();
+    pars = open_parser_text(name, text);
+    if (pars != NULL) {
+        int n_error = get_num_errors();
+        init_symtab();
+        result = parse(pars) && get_num_errors() == n_error;
+        close_parser(pars);
+        if (result)
+            result = generate(out);
+        term_symtab();
+    }
+    clear_string_pool();
+    arena_release();
+    g_compiler = save;
+    return result;
+}
+
+/*
+ * write the statistics of the last unit compiled with cc as a JSON
+ * object.  Times are in seconds.
+ */
+void fprint_stats(FILE *fp, const COMPILER *cc)
+{
+    static const char *phase_name[NUM_PHASE] = {
+        "scan", "parse", "type_check", "optimize", "codegen",
+    };
+    const STATS *st = &cc->stats;
+    const char *sep = "";
+    int i;
+
+    fprintf(fp, "{\"phases\": {");
+    for (i = 0; i < NUM_PHASE; i++) {
+        fprintf(fp, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}",
+                i ? ", " : "", phase_name[i], st->wall[i], st->cpu[i]);
+    }
+    fprintf(fp, "}, \"tokens\": %ld, \"nodes\": {", st->tokens);
+    for (i = 0; i < NUM_NODE_KIND; i++) {
+        if (st->nodes[i] == 0)
+            continue;
+        fprintf(fp, "%s\"%s\": %ld", sep,
+                get_node_kind_string((NODE_KIND) i), st->nodes[i]);
+        sep = ", ";
+    }
+    fprintf(fp, "}, \"symbols\": %ld, \"types\": %ld, \"idents\": %ld, "
+                "\"strings\": %ld, \"folded\": %ld, \"peephole\": {",
+            st->symbols, st->types, st->idents, st->strings, st->folded);
+    for (i = 0; i < NUM_PEEPHOLE_RULE; i++) {
+        fprintf(fp, "%s\"%s\": %ld", i ? ", " : "",
+                get_peephole_rule_name((PEEPHOLE_RULE) i), st->peephole[i]);
+    }
+    fprintf(fp, "}, \"functions\": [");
+    for (i = 0; i < st->num_func; i++) {
+        fprintf(fp, "%s{\"name\": \"%s\", \"tail_recursion\": %ld, "
+                    "\"inlined\": %ld, \"dce_removed\": %ld, "
+                    "\"hoisted\": %ld, \"iv_reduced\": %ld, "
+                    "\"vectorized\": %ld}",
+                i ? ", " : "", st->func[i].name, st->func[i].tail_recursion,
+                st->func[i].inlined, st->func[i].removed, st->func[i].hoisted,
+                st->func[i].reduced, st->func[i].vectorized);
+    }
+    fprintf(fp, "], \"alloc_bytes\": %lu}", (unsigned long) st->alloc_bytes);
+}
@@ -0,0 +1,249 @@
+#include "minicc.h"
+
+/*
+ * dead code elimination on the IR (-O2)
+ *
+ * Repeated until nothing changes:
+ *  - a br or switch on constants becomes a jmp, as does a br whose
+ *    targets are the same block;
+ *  - jumps to a block holding nothing but a jmp go to its target;
+ *  - blocks unreachable from the entry are removed;
+ *  - a block is merged into its only predecessor when that ends with a
+ *    jmp to it;
+ *  - instructions assigning a variable or temporary that is not live
+ *    afterwards are removed, unless they call a function.
+ */
+
+static int count_insns(const IR_FUNC *ir)
+{
+    const IR_BLOCK *bp;
+    const IR_INSN *ip;
+    int n = 0;
+
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        for (ip = bp->head; ip != NULL; ip = ip->next)
+            n++;
+    }
+    return n;
+}
+
+static void remove_insn(IR_BLOCK *bp, IR_INSN *ip)
+{
+    if (ip->prev)
+        ip->prev->next = ip->next;
+    else
+        bp->head = ip->next;
+    if (ip->next)
+        ip->next->prev = ip->prev;
+    else
+        bp->tail = ip->prev;
+}
+
+static void make_jmp(IR_INSN *ip, IR_BLOCK *target)
+{
+    ip->op = IR_JMP;
+    memset(&ip->a, 0, sizeof (OPERAND));
+    memset(&ip->b, 0, sizeof (OPERAND));
+    ip->num_case = 0;
+    ip->target[0] = target;
+    ip->target[1] = NULL;
+}
+
+static bool eval_cond(IR_COND cond, bool is_unsigned, int x, int y)
+{
+    unsigned ux = (unsigned) x, uy = (unsigned) y;
+
+    switch (cond) {
+    case IC_EQ: return x == y;
+    case IC_NE: return x != y;
+    case IC_LT: return is_unsigned ? ux < uy : x < y;
+    case IC_GT: return is_unsigned ? ux > uy : x > y;
+    case IC_LE: return is_unsigned ? ux <= uy : x <= y;
+    case IC_GE: return is_unsigned ? ux >= uy : x >= y;
+    }
+    return false;
+}
+
+static bool fold_branches(IR_FUNC *ir)
+{
+    bool changed = false;
+    IR_BLOCK *bp;
+    IR_INSN *ip;
+    int i;
+
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        ip = bp->tail;
+        if (ip->op == IR_BR && (ip->target[0] == ip->target[1]
+                    || (ip->a.kind == OPD_IMM && ip->b.kind == OPD_IMM))) {
+            bool taken = ip->target[0] == ip->target[1]
+                    || eval_cond(ip->cond, ip->is_unsigned,
+                                    ip->a.num, ip->b.num);
+            make_jmp(ip, ip->target[taken ? 0 : 1]);
+            changed = true;
+        } else if (ip->op == IR_SWITCH && ip->a.kind == OPD_IMM) {
+            IR_BLOCK *target = ip->target[0];
+            for (i = 0; i < ip->num_case; i++) {
+                if (ip->cases[i].value == ip->a.num)
+                    target = ip->cases[i].block;
+            }
+            make_jmp(ip, target);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/* make every jump to from go to to */
+static void retarget(IR_FUNC *ir, IR_BLOCK *from, IR_BLOCK *to)
+{
+    IR_BLOCK *bp;
+    IR_INSN *ip;
+    int i;
+
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        ip = bp->tail;
+        for (i = 0; i < 2; i++) {
+            if (ip->target[i] == from)
+                ip->target[i] = to;
+        }
+        for (i = 0; i < ip->num_case; i++) {
+            if (ip->cases[i].block == from)
+                ip->cases[i].block = to;
+        }
+    }
+}
+
+static bool thread_jumps(IR_FUNC *ir)
+{
+    bool changed = false;
+    IR_BLOCK *bp;
+
+    for (bp = ir->entry->next; bp != NULL; bp = bp->next) {
+        if (bp->head == bp->tail && bp->tail->op == IR_JMP
+                && bp->tail->target[0] != bp && bp->num_pred > 0) {
+            retarget(ir, bp, bp->tail->target[0]);
+            bp->num_pred = 0;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static void mark_reachable(IR_BLOCK *bp, bool *reached)
+{
+    int i;
+
+    if (reached[bp->id])
+        return;
+    reached[bp->id] = true;
+    for (i = 0; i < bp->num_succ; i++)
+        mark_reachable(bp->succ[i], reached);
+}
+
+static bool remove_unreachable(IR_FUNC *ir)
+{
+    bool *reached = (bool*) alloc(sizeof (bool) * (ir->num_block + 1));
+    bool changed = false;
+    IR_BLOCK *bp;
+
+    memset(reached, 0, sizeof (bool) * (ir->num_block + 1));
+    mark_reachable(ir->entry, reached);
+    for (bp = ir->entry; bp->next != NULL; ) {
+        if (!reached[bp->next->id]) {
+            bp->next = bp->next->next;
+            changed = true;
+        } else {
+            bp = bp->next;
+        }
+    }
+    free(reached);
+    return changed;
+}
+
+static bool merge_blocks(IR_FUNC *ir)
+{
+    bool changed = false;
+    IR_BLOCK *bp, *s, *p;
+
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        while (bp->tail->op == IR_JMP && (s = bp->tail->target[0]) != bp
+                && s != ir->entry && s->num_pred == 1) {
+            remove_insn(bp, bp->tail);
+            if (bp->tail) {
+                bp->tail->next = s->head;
+                s->head->prev = bp->tail;
+            } else {
+                bp->head = s->head;
+            }
+            bp->tail = s->tail;
+            bp->succ = s->succ;
+            bp->num_succ = s->num_succ;
+            for (p = ir->entry; p->next != s; p = p->next)
+                ;
+            p->next = s->next;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static bool has_side_effect(const IR_INSN *ip)
+{
+    return ip->op == IR_CALL || ir_is_terminator(ip->op);
+}
+
+static bool remove_dead_stores(IR_FUNC *ir)
+{
+    int words = SET_WORDS(ir_num_vreg(ir));
+    unsigned *live = (unsigned*) alloc(sizeof (unsigned) * (words + 1));
+    const OPERAND *use[MAX_ARGS + 2];
+    bool changed = false;
+    IR_BLOCK *bp;
+    IR_INSN *ip, *prev;
+    int j, v;
+
+    ir_liveness(ir);
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        memcpy(live, bp->live_out, sizeof (unsigned) * words);
+        for (ip = bp->tail; ip != NULL; ip = prev) {
+            prev = ip->prev;
+            v = ir_vreg(ir, &ip->dst);
+            if (v >= 0 && !has_side_effect(ip) && (!SET_HAS(live, v)
+                    || (ip->op == IR_MOV && ir_vreg(ir, &ip->a) == v))) {
+                remove_insn(bp, ip);
+                changed = true;
+                continue;
+            }
+            if (v >= 0)
+                SET_DEL(live, v);
+            for (j = ir_uses(ip, use, MAX_ARGS + 2) - 1; j >= 0; j--) {
+                if ((v = ir_vreg(ir, use[j])) >= 0)
+                    SET_ADD(live, v);
+            }
+        }
+    }
+    free(live);
+    return changed;
+}
+
+/* returns the number of instructions removed */
+int eliminate_dead_code(IR_FUNC *ir)
+{
+    int before = count_insns(ir);
+    bool changed = true;
+
+    while (changed) {
+        changed = fold_branches(ir);
+        ir_build_cfg(ir);
+        changed |= thread_jumps(ir);
+        ir_build_cfg(ir);
+        changed |= remove_unreachable(ir);
+        ir_number_blocks(ir);
+        ir_build_cfg(ir);
+        changed |= merge_blocks(ir);
+        ir_number_blocks(ir);
+        ir_build_cfg(ir);
+        changed |= remove_dead_stores(ir);
+    }
+    return before - count_insns(ir);
+}
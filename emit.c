@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include "minicc.h"
+
+/*
+ * buffered assembly emitter
+ *
+ * Instructions are appended to a large buffer by the specialized
+ * routines below, without format string parsing or stdio locking, and
+ * the buffer is written out with write(2) when it fills up.
+ */
+#define EMIT_BUFFER_SIZE    (256 * 1024)
+
+struct emitter {
+    int fd;         /* -1 when out has no descriptor (memory stream) */
+    FILE *out;
+    char *buf;
+    size_t len;
+    bool error;
+    FILE *fp;       /* stdio view for the fprint_*() helpers */
+    bool capture;   /* collecting a function for the peephole optimizer */
+    char *func;
+    size_t func_len;
+    size_t func_max;
+};
+
+static void flush(EMITTER *em)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    if (em->fd < 0) {
+        if (fwrite(em->buf, 1, em->len, em->out) != em->len)
+            em->error = true;
+        em->len = 0;
+        return;
+    }
+    while (done < em->len) {
+        n = write(em->fd, em->buf + done, em->len - done);
+        if (n <= 0) {
+            em->error = true;
+            break;
+        }
+        done += n;
+    }
+    em->len = 0;
+}
+
+static void capture(EMITTER *em, const char *s, size_t len)
+{
+    if (em->func_len + len > em->func_max) {
+        while (em->func_len + len > em->func_max)
+            em->func_max = (em->func_max == 0) ? 64 * 1024 : em->func_max * 2;
+        em->func = (char*) realloc(em->func, em->func_max);
+        if (em->func == NULL) {
+            fprintf(stderr, "out of memory\n");
+            abort();
+        }
+    }
+    memcpy(em->func + em->func_len, s, len);
+    em->func_len += len;
+}
+
+static void append(EMITTER *em, const char *s, size_t len)
+{
+    if (em->capture) {
+        capture(em, s, len);
+        return;
+    }
+    if (em->len + len > EMIT_BUFFER_SIZE) {
+        flush(em);
+        if (len > EMIT_BUFFER_SIZE && em->fd < 0) {
+            if (fwrite(s, 1, len, em->out) != len)
+                em->error = true;
+            return;
+        } else if (len > EMIT_BUFFER_SIZE) {
+            ssize_t n;
+            while (len > 0 && (n = write(em->fd, s, len)) > 0) {
+                s += n;
+                len -= n;
+            }
+            if (len > 0)
+                em->error = true;
+            return;
+        }
+    }
+    memcpy(em->buf + em->len, s, len);
+    em->len += len;
+}
+
+static ssize_t cookie_write(void *cookie, const char *s, size_t len)
+{
+    append((EMITTER*) cookie, s, len);
+    return len;
+}
+
+EMITTER *open_emitter(FILE *fp)
+{
+    static cookie_io_functions_t io = { NULL, cookie_write, NULL, NULL };
+    EMITTER *em = (EMITTER*) alloc(sizeof (EMITTER));
+
+    fflush(fp);
+    em->out = fp;
+    em->fd = fileno(fp);
+    em->buf = (char*) alloc(EMIT_BUFFER_SIZE);
+    em->len = 0;
+    em->error = false;
+    em->capture = false;
+    em->func = NULL;
+    em->func_len = em->func_max = 0;
+    em->fp = fopencookie(em, "w", io);
+    if (em->fp == NULL) {
+        free(em->buf);
+        free(em);
+        return NULL;
+    }
+    setvbuf(em->fp, NULL, _IONBF, 0);
+    return em;
+}
+
+bool close_emitter(EMITTER *em)
+{
+    bool result;
+    if (em == NULL)
+        return false;
+    fclose(em->fp);
+    flush(em);
+    result = !em->error;
+    free(em->func);
+    free(em->buf);
+    free(em);
+    return result;
+}
+
+FILE *emit_fp(EMITTER *em)
+{
+    return em->fp;
+}
+
+/*
+ * The text emitted between emit_begin_func() and emit_end_func() is
+ * held back and passed through the peephole optimizer if optimize is set.
+ */
+void emit_begin_func(EMITTER *em)
+{
+    em->capture = true;
+    em->func_len = 0;
+}
+
+void emit_end_func(EMITTER *em, bool optimize)
+{
+    em->capture = false;
+    if (optimize)
+        peephole(em, em->func, em->func_len);
+    else
+        append(em, em->func, em->func_len);
+}
+
+void emit_text(EMITTER *em, const char *s, size_t len)
+{
+    append(em, s, len);
+}
+
+void emit_str(EMITTER *em, const char *s)
+{
+    append(em, s, strlen(s));
+}
+
+void emit_char(EMITTER *em, int c)
+{
+    char ch = c;
+
+    if (em->capture) {
+        capture(em, &ch, 1);
+        return;
+    }
+    if (em->len == EMIT_BUFFER_SIZE)
+        flush(em);
+    em->buf[em->len++] = c;
+}
+
+void emit_int(EMITTER *em, int n)
+{
+    char buf[16];
+    char *p = buf + sizeof buf;
+    unsigned u = (n < 0) ? -(unsigned) n : (unsigned) n;
+
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+    if (n < 0)
+        *--p = '-';
+    append(em, p, buf + sizeof buf - p);
+}
+
+void emit_label(EMITTER *em, int num)
+{
+    append(em, ".L", 2);
+    emit_int(em, num);
+}
+
+void emit_label_def(EMITTER *em, int num)
+{
+    emit_label(em, num);
+    append(em, ":\n", 2);
+}
+
+void emit_op(EMITTER *em, const char *op)
+{
+    append(em, "    ", 4);
+    emit_str(em, op);
+    emit_char(em, '\n');
+}
+
+void emit_op1(EMITTER *em, const char *op, const char *a)
+{
+    append(em, "    ", 4);
+    emit_str(em, op);
+    emit_char(em, ' ');
+    emit_str(em, a);
+    emit_char(em, '\n');
+}
+
+void emit_op2(EMITTER *em, const char *op, const char *a, const char *b)
+{
+    append(em, "    ", 4);
+    emit_str(em, op);
+    emit_char(em, ' ');
+    emit_str(em, a);
+    append(em, ", ", 2);
+    emit_str(em, b);
+    emit_char(em, '\n');
+}
+
+void emit_op3(EMITTER *em, const char *op, const char *a, const char *b,
+                const char *c)
+{
+    append(em, "    ", 4);
+    emit_str(em, op);
+    emit_char(em, ' ');
+    emit_str(em, a);
+    append(em, ", ", 2);
+    emit_str(em, b);
+    append(em, ", ", 2);
+    emit_str(em, c);
+    emit_char(em, '\n');
+}
+
+void emit_op2_imm(EMITTER *em, const char *op, const char *a, int n)
+{
+    append(em, "    ", 4);
+    emit_str(em, op);
+    emit_char(em, ' ');
+    emit_str(em, a);
+    append(em, ", ", 2);
+    emit_int(em, n);
+    emit_char(em, '\n');
+}
+
+void emit_jump(EMITTER *em, const char *op, int label)
+{
+    append(em, "    ", 4);
+    emit_str(em, op);
+    emit_char(em, ' ');
+    emit_label(em, label);
+    emit_char(em, '\n');
+}
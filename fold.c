@@ -0,0 +1,327 @@
+#include "minicc.h"
+
+/*
+ * constant folding
+ *
+ * Each function body is folded once it has been parsed.  A use of an
+ * enumeration constant becomes an int literal, and an operator whose
+ * operands are integer literals is replaced by a literal of its result
+ * type.  The value is computed with the integral promotions and
+ * usual arithmetic conversions of type.c and wrapped to the width of
+ * that type, so gen.c never sees an operation on two constants.
+ * Operations with undefined results (division by zero, shift counts out
+ * of range) and values a literal node cannot hold are left alone.
+ */
+
+static bool is_int_lit(const NODE *np)
+{
+    return np != NULL && (np->kind == NK_CHAR_LIT || np->kind == NK_INT_LIT);
+}
+
+static int type_bits(const TYPE *t)
+{
+    switch (t->kind) {
+    case T_CHAR:
+    case T_UCHAR:
+        return BYTE_CHAR * 8;
+    case T_SHORT:
+    case T_USHORT:
+        return BYTE_SHORT * 8;
+    case T_LONG:
+    case T_ULONG:
+        return BYTE_LONG * 8;
+    default:
+        return BYTE_INT * 8;
+    }
+}
+
+/* v converted to type t */
+static long wrap(unsigned long v, const TYPE *t)
+{
+    int bits = type_bits(t);
+
+    if (bits < 64) {
+        v &= (1UL << bits) - 1;
+        if (!is_unsigned_type(t) && (v >> (bits - 1)) != 0)
+            v |= ~0UL << bits;
+    }
+    return (long) v;
+}
+
+static long lit_value(const NODE *np)
+{
+    return wrap((unsigned long) (long) np->u.num, np->type);
+}
+
+/* the literal for v of type t, or NULL if u.num cannot hold it */
+static NODE *new_lit(const NODE *np, TYPE *t, long v)
+{
+    if (wrap((unsigned long) (long) (int) v, t) != v)
+        return NULL;
+    if (v == 0 && t == &g_type_int)
+        t = &g_type_null;
+    g_compiler->stats.folded++;
+    return new_node_num(NK_INT_LIT, &np->pos, t, (int) v);
+}
+
+static NODE *fold_binary(NODE *np)
+{
+    NODE *left = np->u.link.left;
+    NODE *right = np->u.link.right;
+    TYPE *t;
+    unsigned long a, b, r;
+    bool uns;
+
+    if (np->kind == NK_SHL || np->kind == NK_SHR)
+        t = promote_type(left->type);
+    else
+        t = arith_conv_type(left->type, right->type);
+    uns = is_unsigned_type(t);
+    a = wrap(lit_value(left), t);
+    b = wrap(lit_value(right), t);
+
+    switch (np->kind) {
+    case NK_EQ:     return new_lit(np, &g_type_int, a == b);
+    case NK_NEQ:    return new_lit(np, &g_type_int, a != b);
+    case NK_LT:
+        return new_lit(np, &g_type_int, uns ? a < b : (long) a < (long) b);
+    case NK_GT:
+        return new_lit(np, &g_type_int, uns ? a > b : (long) a > (long) b);
+    case NK_LE:
+        return new_lit(np, &g_type_int, uns ? a <= b : (long) a <= (long) b);
+    case NK_GE:
+        return new_lit(np, &g_type_int, uns ? a >= b : (long) a >= (long) b);
+    case NK_ADD:    r = a + b; break;
+    case NK_SUB:    r = a - b; break;
+    case NK_MUL:    r = a * b; break;
+    case NK_AND:    r = a & b; break;
+    case NK_OR:     r = a | b; break;
+    case NK_XOR:    r = a ^ b; break;
+    case NK_DIV:
+    case NK_MOD:
+        if (b == 0) {
+            warning(&np->pos, "division by zero");
+            return NULL;
+        }
+        if (uns)
+            r = (np->kind == NK_DIV) ? a / b : a % b;
+        else if ((long) b == -1)
+            r = (np->kind == NK_DIV) ? -a : 0;  /* LONG_MIN / -1 */
+        else if (np->kind == NK_DIV)
+            r = (long) a / (long) b;
+        else
+            r = (long) a % (long) b;
+        break;
+    case NK_SHL:
+    case NK_SHR:
+        b = lit_value(right);
+        if ((long) b < 0 || (long) b >= type_bits(t))
+            return NULL;
+        if (np->kind == NK_SHL)
+            r = a << b;
+        else
+            r = uns ? a >> b : (unsigned long) ((long) a >> b);
+        break;
+    default:
+        return NULL;
+    }
+    return new_lit(np, t, wrap(r, t));
+}
+
+static NODE *fold_unary(NODE *np)
+{
+    NODE *e = np->u.link.left;
+    TYPE *t = promote_type(e->type);
+    unsigned long a = wrap(lit_value(e), t);
+
+    switch (np->kind) {
+    case NK_UPLUS:      return new_lit(np, t, wrap(a, t));
+    case NK_UMINUS:     return new_lit(np, t, wrap(-a, t));
+    case NK_COMPLEMENT: return new_lit(np, t, wrap(~a, t));
+    case NK_NOT:        return new_lit(np, &g_type_int, a == 0);
+    default:
+        break;
+    }
+    return NULL;
+}
+
+/* && and || only need the left operand when it decides the result */
+static NODE *fold_logical(NODE *np)
+{
+    NODE *left = np->u.link.left;
+    NODE *right = np->u.link.right;
+    bool l;
+
+    if (!is_int_lit(left))
+        return NULL;
+    l = (lit_value(left) != 0);
+    if (np->kind == NK_LAND && !l)
+        return new_lit(np, &g_type_int, 0);
+    if (np->kind == NK_LOR && l)
+        return new_lit(np, &g_type_int, 1);
+    if (!is_int_lit(right))
+        return NULL;
+    return new_lit(np, &g_type_int, lit_value(right) != 0);
+}
+
+/*
+ * the arm a constant condition selects, converted to the type of the
+ * conditional; NULL if that would need a cast node
+ */
+static NODE *fold_cond(NODE *np)
+{
+    NODE *arm = (lit_value(np->u.link.left) != 0)
+        ? np->u.link.right->u.link.left : np->u.link.right->u.link.right;
+    TYPE *t = np->type;
+
+    if (arm == NULL || arm->type == NULL || t == NULL)
+        return NULL;
+    if (is_int_lit(arm) && is_integer_type(t))
+        return new_lit(np, t, wrap(lit_value(arm), t));
+    /* a narrower signed or unsigned integer reads as its promotion */
+    if (equal_type(arm->type, t) || (is_integer_type(arm->type)
+            && is_integer_type(t) && promote_type(arm->type)->kind == t->kind)) {
+        g_compiler->stats.folded++;
+        return arm;
+    }
+    return NULL;
+}
+
+static void fold_args(NODE *np)
+{
+    for (; np != NULL; np = np->u.link.right)
+        np->u.link.left = fold_expr(np->u.link.left);
+}
+
+/* fold np bottom up, returning the node that replaces it */
+NODE *fold_expr(NODE *np)
+{
+    NODE *folded = NULL;
+
+    if (np == NULL)
+        return NULL;
+    switch (np->kind) {
+    case NK_ID:
+        if (np->u.sym && np->u.sym->kind == SK_ENUM)
+            return new_lit(np, &g_type_int, np->u.sym->num);
+        return np;
+    case NK_CHAR_LIT: case NK_INT_LIT: case NK_UINT_LIT: case NK_LONG_LIT:
+    case NK_ULONG_LIT: case NK_FLOAT_LIT: case NK_DOUBLE_LIT:
+    case NK_STRING_LIT:
+        return np;
+    case NK_DOT:
+    case NK_PTR:
+        np->u.idnode.node = fold_expr(np->u.idnode.node);
+        return np;
+    case NK_CALL:
+        np->u.link.left = fold_expr(np->u.link.left);
+        fold_args(np->u.link.right);
+        return np;
+    case NK_COND:
+        np->u.link.left = fold_expr(np->u.link.left);
+        np->u.link.right->u.link.left
+            = fold_expr(np->u.link.right->u.link.left);
+        np->u.link.right->u.link.right
+            = fold_expr(np->u.link.right->u.link.right);
+        if (is_int_lit(np->u.link.left))
+            folded = fold_cond(np);
+        return folded ? folded : np;
+    default:
+        break;
+    }
+    np->u.link.left = fold_expr(np->u.link.left);
+    np->u.link.right = fold_expr(np->u.link.right);
+
+    switch (np->kind) {
+    case NK_EQ: case NK_NEQ: case NK_LT: case NK_GT: case NK_LE: case NK_GE:
+    case NK_SHL: case NK_SHR: case NK_ADD: case NK_SUB: case NK_MUL:
+    case NK_DIV: case NK_MOD: case NK_OR: case NK_XOR: case NK_AND:
+        if (is_int_lit(np->u.link.left) && is_int_lit(np->u.link.right))
+            folded = fold_binary(np);
+        break;
+    case NK_UPLUS: case NK_UMINUS: case NK_COMPLEMENT: case NK_NOT:
+        if (is_int_lit(np->u.link.left))
+            folded = fold_unary(np);
+        break;
+    case NK_LAND:
+    case NK_LOR:
+        folded = fold_logical(np);
+        break;
+    case NK_CAST:
+        if (is_int_lit(np->u.link.left) && np->type
+                && is_integer_type(np->type))
+            folded = new_lit(np, np->type,
+                                wrap(lit_value(np->u.link.left), np->type));
+        break;
+    default:
+        break;
+    }
+    return folded ? folded : np;
+}
+
+static NODE *fold_stmt(NODE *np)
+{
+    NODE *p;
+
+    if (np == NULL)
+        return NULL;
+    switch (np->kind) {
+    case NK_COMPOUND:
+        np->u.comp.node = fold_stmt(np->u.comp.node);
+        break;
+    case NK_LINK:
+        np->u.link.left = fold_stmt(np->u.link.left);
+        np->u.link.right = fold_stmt(np->u.link.right);
+        break;
+    case NK_IF:
+        np->u.link.left = fold_expr(np->u.link.left);
+        p = np->u.link.right;
+        p->u.link.left = fold_stmt(p->u.link.left);
+        p->u.link.right = fold_stmt(p->u.link.right);
+        break;
+    case NK_SWITCH:
+    case NK_WHILE:
+        np->u.link.left = fold_expr(np->u.link.left);
+        np->u.link.right = fold_stmt(np->u.link.right);
+        break;
+    case NK_DO:
+        np->u.link.left = fold_stmt(np->u.link.left);
+        np->u.link.right = fold_expr(np->u.link.right);
+        break;
+    case NK_FOR:
+        np->u.link.left = fold_expr(np->u.link.left);
+        p = np->u.link.right;
+        p->u.link.left = fold_expr(p->u.link.left);
+        p = p->u.link.right;
+        p->u.link.left = fold_expr(p->u.link.left);
+        p->u.link.right = fold_stmt(p->u.link.right);
+        break;
+    case NK_CASE:
+        np->u.num_node.node = fold_stmt(np->u.num_node.node);
+        break;
+    case NK_DEFAULT:
+        np->u.link.left = fold_stmt(np->u.link.left);
+        break;
+    case NK_LABEL:
+        np->u.idnode.node = fold_stmt(np->u.idnode.node);
+        break;
+    case NK_GOTO:
+    case NK_CONTINUE:
+    case NK_BREAK:
+        break;
+    case NK_RETURN:
+    case NK_EXPR:
+        np->u.link.left = fold_expr(np->u.link.left);
+        break;
+    default:
+        return fold_expr(np);
+    }
+    return np;
+}
+
+void fold_constants(SYMBOL *func)
+{
+    stats_begin(PH_OPT);
+    func->body = fold_stmt(func->body);
+    stats_end();
+}
@@ -1,11 +1,12 @@
 #include "minicc.h"
 
-static int s_param_start = 0;
-static int s_label_num = 0;
-#define NUM_REG_PARAM 6
+#define STACK_ARG_SIZE 8    /* arguments beyond the sixth are pushed */
 static const char *s_param_reg32[NUM_REG_PARAM] = {
     "edi", "esi", "edx", "ecx", "r8d", "r9d",
 };
+static const char *s_param_reg64[NUM_REG_PARAM] = {
+    "rdi", "rsi", "rdx", "rcx", "r8", "r9",
+};
 
 static int iround(int m, int n)
 {
@@ -14,34 +15,328 @@ static int iround(int m, int n)
 
 static int new_label(void)
 {
-    return s_label_num++;
+    return g_compiler->label_num++;
+}
+
+/*
+ * Leaf functions omit the frame pointer from -O1 on unless
+ * -fno-omit-frame-pointer is given, when their frame fits in the red
+ * zone: the 128 bytes below rsp, which signal handlers leave alone.
+ * Frame offsets are kept relative to where rbp would point, 8 bytes
+ * below rsp, since nothing is pushed.
+ */
+bool can_omit_frame(int frame_size)
+{
+    return g_compiler->opt_level >= 1 && !g_compiler->keep_frame_pointer
+        && frame_size + 8 <= RED_ZONE;
+}
+
+/* the register rbp+*disp is addressed from, *disp adjusted to it */
+const char *frame_base(int *disp)
+{
+    if (!g_compiler->frameless)
+        return "rbp";
+    *disp -= 8;
+    return "rsp";
+}
+
+/* the memory operand at rbp+disp */
+void format_frame_addr(char *buf, int disp)
+{
+    const char *r = frame_base(&disp);
+
+    sprintf(buf, "[%s%+d]", r, disp);
 }
 
-static const char *get_var_addr(const SYMBOL *sym)
+/* the memory operand of a variable */
+void format_var_addr(char *buf, const SYMBOL *sym)
 {
-    static char buf[64];
     switch (sym->kind) {
     case SK_GLOBAL:
         sprintf(buf, "_%s", sym->id);
         break;
     case SK_LOCAL:
-        sprintf(buf, "[rbp-%d]", sym->offset + 4);
+        format_frame_addr(buf, -(sym->offset + 4));
         break;
     case SK_PARAM:
         if (sym->num < NUM_REG_PARAM)
-            sprintf(buf, "[rbp-%d]", s_param_start + sym->num * BYTE_INT);
+            format_frame_addr(buf, -(g_compiler->param_start
+                                    + (sym->num + 1) * BYTE_INT));
         else
-            sprintf(buf, "[rbp+%d]", sym->offset + 16 - NUM_REG_PARAM * BYTE_INT);
+            format_frame_addr(buf,
+                    16 + (sym->num - NUM_REG_PARAM) * STACK_ARG_SIZE);
         break;
     default:
         assert(0);
-        buf[0] = 0;
         break;
     }
-    return buf;
 }
 
-static bool gen_assign_expr(FILE *fp, NODE *np)
+static void emit_var_addr(EMITTER *em, const SYMBOL *sym)
+{
+    char buf[MAX_VAR_ADDR];
+
+    format_var_addr(buf, sym);
+    emit_str(em, buf);
+}
+
+/* the register a variable was allocated to, or its stack slot */
+static void emit_var(EMITTER *em, const SYMBOL *sym)
+{
+    if (sym->reg != REG_NONE)
+        emit_str(em, get_reg_name(sym->reg, 32));
+    else
+        emit_var_addr(em, sym);
+}
+
+/* "# file(line)" followed by s */
+static void emit_pos_comment(EMITTER *em, const NODE *np, const char *s)
+{
+    emit_str(em, "# ");
+    emit_str(em, np->pos.filename);
+    emit_char(em, '(');
+    emit_int(em, np->pos.line);
+    emit_char(em, ')');
+    emit_str(em, s);
+}
+
+static void emit_node_comment(EMITTER *em, const NODE *np, const char *s,
+                                const NODE *expr)
+{
+    emit_pos_comment(em, np, s);
+    if (expr)
+        fprint_node(emit_fp(em), 0, expr);
+    emit_char(em, '\n');
+}
+
+/* restores the callee-saved registers and pops the frame */
+void gen_leave(EMITTER *em)
+{
+    char buf[MAX_VAR_ADDR];
+    int i;
+
+    for (i = 0; i < g_compiler->num_saved; i++) {
+        format_frame_addr(buf, -(g_compiler->save_start + (i + 1) * 8));
+        emit_str(em, "    mov ");
+        emit_str(em, get_reg_name(g_compiler->saved_reg[i], 64));
+        emit_char(em, ',');
+        emit_str(em, buf);
+        emit_char(em, '\n');
+    }
+    if (g_compiler->frameless)
+        return;
+    emit_op2(em, "mov", "rsp", "rbp");
+    emit_op1(em, "pop", "rbp");
+}
+
+/* the callee-saved registers into their frame slots */
+void gen_save_regs(EMITTER *em)
+{
+    char buf[MAX_VAR_ADDR];
+    int i;
+
+    for (i = 0; i < g_compiler->num_saved; i++) {
+        format_frame_addr(buf, -(g_compiler->save_start + (i + 1) * 8));
+        emit_str(em, "    mov ");
+        emit_str(em, buf);
+        emit_char(em, ',');
+        emit_str(em, get_reg_name(g_compiler->saved_reg[i], 64));
+        emit_char(em, '\n');
+    }
+}
+
+void gen_epilogue(EMITTER *em)
+{
+    gen_leave(em);
+    emit_op(em, "ret");
+}
+
+/*
+ * expression evaluation
+ *
+ * An expression is evaluated into the scratch register pool[k], using
+ * only pool[k] and above.  The operand that needs more registers
+ * (its Sethi-Ullman number) is evaluated first, so a tree needs no more
+ * registers than its label.  pool[0] is always eax, so the value of a
+ * full expression ends up there.  When the pool runs out the right
+ * operand is pushed and popped into ecx, which is otherwise reserved for
+ * that fallback; edx is never in the pool because idiv clobbers it.
+ */
+typedef struct {
+    const char *r8;
+    const char *r32;
+    const char *r64;
+} SCRATCH_REG;
+
+static const SCRATCH_REG s_scratch_reg[MAX_SCRATCH] = {
+    { "al",   "eax",  "rax" },
+    { "r11b", "r11d", "r11" },
+    { "r10b", "r10d", "r10" },
+    { "r9b",  "r9d",  "r9"  },
+    { "r8b",  "r8d",  "r8"  },
+    { "dil",  "edi",  "rdi" },
+    { "sil",  "esi",  "rsi" },
+};
+
+#define NEED_CALL   100     /* calls are evaluated before anything else */
+
+/* the pool[] excludes registers the allocator gave to variables */
+static void init_scratch_pool(unsigned reg_used)
+{
+    int i, r, n = 0;
+
+    for (i = 0; i < MAX_SCRATCH; i++) {
+        for (r = 0; r < NUM_ALLOC_REG; r++) {
+            if ((reg_used & (1u << r))
+                    && strcmp(get_reg_name(r, 32), s_scratch_reg[i].r32) == 0)
+                break;
+        }
+        if (r == NUM_ALLOC_REG)
+            g_compiler->pool[n++] = i;
+    }
+    g_compiler->pool_size = n;
+    g_compiler->push_depth = 0;
+}
+
+static const char *pool_reg(int k, int bits)
+{
+    const SCRATCH_REG *r = &s_scratch_reg[g_compiler->pool[k]];
+    assert(k < g_compiler->pool_size);
+    return (bits == 8) ? r->r8 : (bits == 64) ? r->r64 : r->r32;
+}
+
+static void emit_push(EMITTER *em, const char *r64)
+{
+    if (g_compiler->frameless)
+        g_compiler->pushed = true;
+    emit_op1(em, "push", r64);
+    g_compiler->push_depth++;
+}
+
+static void emit_pop(EMITTER *em, const char *r64)
+{
+    emit_op1(em, "pop", r64);
+    g_compiler->push_depth--;
+}
+
+bool is_leaf_expr(const NODE *np)
+{
+    switch (np->kind) {
+    case NK_ID:
+        return np->u.sym->kind != SK_FUNC;
+    case NK_CHAR_LIT:
+    case NK_INT_LIT:
+    case NK_STRING_LIT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool is_binary_op(NODE_KIND kind)
+{
+    switch (kind) {
+    case NK_EQ: case NK_NEQ: case NK_LT: case NK_GT: case NK_LE: case NK_GE:
+    case NK_SHL: case NK_SHR: case NK_ADD: case NK_SUB: case NK_MUL:
+    case NK_DIV: case NK_MOD: case NK_OR: case NK_XOR: case NK_AND:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool is_compare(NODE_KIND kind)
+{
+    return kind >= NK_EQ && kind <= NK_GE;
+}
+
+static bool is_imm_leaf(const NODE *np)
+{
+    return np->kind == NK_INT_LIT || np->kind == NK_CHAR_LIT;
+}
+
+/* the literal operand of np that is used as an immediate, or NULL */
+static const NODE *get_imm_operand(const NODE *np)
+{
+    switch (np->kind) {
+    case NK_MUL:
+        if (is_imm_leaf(np->u.link.left))
+            return np->u.link.left;
+        /*FALLTHROUGH*/
+    case NK_EQ: case NK_NEQ: case NK_LT: case NK_GT: case NK_LE: case NK_GE:
+    case NK_DIV: case NK_MOD:
+        return is_imm_leaf(np->u.link.right) ? np->u.link.right : NULL;
+    default:
+        return NULL;
+    }
+}
+
+/* Sethi-Ullman number: registers needed to evaluate np without spills */
+int get_expr_need(const NODE *np)
+{
+    const NODE *imm;
+    int l, r;
+
+    if (np == NULL)
+        return 0;
+    switch (np->kind) {
+    case NK_ASSIGN:
+        return get_expr_need(np->u.link.right);
+    case NK_CALL:
+        return NEED_CALL;
+    case NK_NOT:
+        return get_expr_need(np->u.link.left);
+    case NK_LAND:
+    case NK_LOR:
+        /* operands are evaluated one after the other */
+        l = get_expr_need(np->u.link.left);
+        r = get_expr_need(np->u.link.right);
+        return (l > r) ? l : r;
+    default:
+        if (!is_binary_op(np->kind))
+            return 1;
+        if ((imm = get_imm_operand(np)) != NULL)
+            return get_expr_need((imm == np->u.link.left)
+                                    ? np->u.link.right : np->u.link.left);
+        l = get_expr_need(np->u.link.left);
+        r = get_expr_need(np->u.link.right);
+        return (l == r) ? l + 1 : (l > r) ? l : r;
+    }
+}
+
+/* mov <reg>, <leaf> */
+static void gen_leaf(EMITTER *em, const NODE *np, const char *r32)
+{
+    switch (np->kind) {
+    case NK_ID:
+        emit_str(em, "    mov ");
+        emit_str(em, r32);
+        emit_char(em, ',');
+        emit_var(em, np->u.sym);
+        emit_str(em, " # ");
+        emit_str(em, np->u.sym->id);
+        emit_char(em, '\n');
+        break;
+    case NK_CHAR_LIT:
+    case NK_INT_LIT:
+        emit_op2_imm(em, "mov", r32, np->u.num);
+        break;
+    case NK_STRING_LIT:
+        emit_str(em, "    mov ");
+        emit_str(em, r32);
+        emit_str(em, ", .L_S");
+        emit_int(em, np->u.str->num);
+        emit_char(em, '\n');
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+static bool gen_expr_reg(EMITTER *em, NODE *np, int k);
+
+static bool gen_assign_expr(EMITTER *em, NODE *np, int k)
 {
     SYMBOL *sym;
     if (np == NULL)
@@ -52,7 +347,13 @@ static bool gen_assign_expr(FILE *fp, NODE *np)
         sym = np->u.sym;
         if (sym->kind == SK_FUNC)
             break;
-        fprintf(fp, "    mov %s,eax # %s\n", get_var_addr(sym), sym->id);
+        emit_str(em, "    mov ");
+        emit_var(em, sym);
+        emit_char(em, ',');
+        emit_str(em, pool_reg(k, 32));
+        emit_str(em, " # ");
+        emit_str(em, sym->id);
+        emit_char(em, '\n');
         return true;
     case NK_DOT:
     case NK_PTR:
@@ -64,52 +365,610 @@ static bool gen_assign_expr(FILE *fp, NODE *np)
     return false;
 }
 
-static bool gen_expr(FILE *fp, NODE *np);
+static int arg_count(const NODE *args)
+{
+    int n = 0;
+    for (; args != NULL; args = args->u.link.right)
+        n++;
+    return n;
+}
+
+/*
+ * return f(...) at -O1, when f is called directly and its stack
+ * arguments fit where our own were passed
+ */
+static bool is_tail_call(const NODE *np)
+{
+    int n;
+
+    if (g_compiler->opt_level < 1 || np == NULL || np->kind != NK_CALL)
+        return false;
+    if (np->u.link.left->kind != NK_ID
+            || np->u.link.left->u.sym->kind != SK_FUNC)
+        return false;
+    n = arg_count(np->u.link.right);
+    return n <= MAX_ARGS && (n <= NUM_REG_PARAM || n <= g_compiler->func->num);
+}
+
+/*
+ * the end of a tail call: the stack arguments, pushed last to first,
+ * replace our own, then a call to ourselves jumps back to the parameter
+ * moves of the prologue, and any other leaves the frame and jumps to
+ * the callee, which returns to our caller
+ */
+static void gen_tail_jump(EMITTER *em, const SYMBOL *func, int num_stack)
+{
+    char buf[32];
+    int i;
+
+    for (i = 0; i < num_stack; i++) {
+        sprintf(buf, "qword ptr [rbp+%d]", 16 + i * STACK_ARG_SIZE);
+        emit_pop(em, buf);
+    }
+    if (func == g_compiler->func) {
+        emit_jump(em, "jmp", g_compiler->entry_label);
+        return;
+    }
+    gen_leave(em);
+    emit_str(em, "    jmp _");
+    emit_str(em, func->id);
+    emit_char(em, '\n');
+}
 
-static bool gen_an_arg(FILE *fp, int n, NODE *a)
+/*
+ * Live scratch registers are saved around the call.  Arguments that are
+ * not leaves are evaluated first, the ones still to be followed by
+ * another are parked on the stack; leaves are loaded straight into their
+ * parameter register last, since that clobbers nothing.  A tail call
+ * (k is 0) jumps rather than calls, see gen_tail_jump().
+ */
+static bool gen_call(EMITTER *em, NODE *np, int k, bool tail)
 {
-    if (a == NULL)
+    NODE *arg[MAX_ARGS];
+    NODE *a;
+    int n, i, last, num_stack, pad = 0;
+
+    n = arg_count(np->u.link.right);
+    if (n > MAX_ARGS) {
+        error(&np->pos, "too many arguments");
+        return false;
+    }
+    for (i = 0, a = np->u.link.right; a != NULL; a = a->u.link.right)
+        arg[i++] = a->u.link.left;
+    num_stack = (n > NUM_REG_PARAM) ? n - NUM_REG_PARAM : 0;
+
+    emit_str(em, "# CALL\n");
+    for (i = 0; i < k; i++)
+        emit_push(em, pool_reg(i, 64));
+    /* keep rsp 16-byte aligned at the call */
+    if (!tail && (g_compiler->push_depth + num_stack) % 2 != 0) {
+        pad = 1;
+        emit_op2_imm(em, "sub", "rsp", 8);
+        g_compiler->push_depth++;
+    }
+    for (i = n - 1; i >= NUM_REG_PARAM; i--) {
+        if (!gen_expr_reg(em, arg[i], 0))
+            return false;
+        emit_push(em, "rax");
+    }
+    assert(np->u.link.left);
+    if (np->u.link.left->kind != NK_ID) {
+        if (!gen_expr_reg(em, np->u.link.left, 0))
+            return false;
+        emit_push(em, "rax");
+    }
+
+    last = -1;
+    for (i = (n < NUM_REG_PARAM ? n : NUM_REG_PARAM) - 1; i >= 0; i--) {
+        if (is_leaf_expr(arg[i]))
+            continue;
+        if (last >= 0)
+            emit_push(em, "rax");
+        if (!gen_expr_reg(em, arg[i], 0))
+            return false;
+        last = i;
+    }
+    if (last >= 0) {
+        emit_str(em, "    mov ");
+        emit_str(em, s_param_reg32[last]);
+        emit_str(em, ",eax\n");
+        for (i = last + 1; i < NUM_REG_PARAM && i < n; i++) {
+            if (!is_leaf_expr(arg[i]))
+                emit_pop(em, s_param_reg64[i]);
+        }
+    }
+    for (i = (n < NUM_REG_PARAM ? n : NUM_REG_PARAM) - 1; i >= 0; i--) {
+        if (is_leaf_expr(arg[i]))
+            gen_leaf(em, arg[i], s_param_reg32[i]);
+    }
+
+    if (tail) {
+        gen_tail_jump(em, np->u.link.left->u.sym, num_stack);
         return true;
-    assert(a->kind == NK_ARG);
-    if (a->u.link.right) {
-        if (!gen_an_arg(fp, n+1, a->u.link.right))
+    }
+    if (np->u.link.left->kind == NK_ID) {
+        emit_str(em, "    call _");
+        emit_str(em, np->u.link.left->u.sym->id);
+        emit_char(em, '\n');
+    } else {
+        emit_pop(em, "rax");
+        emit_op1(em, "call", "[eax]");
+    }
+    if (num_stack + pad > 0) {
+        emit_str(em, "    add rsp,");
+        emit_int(em, (num_stack + pad) * STACK_ARG_SIZE);
+        emit_char(em, '\n');
+        g_compiler->push_depth -= num_stack + pad;
+    }
+    if (k > 0)
+        emit_op2(em, "mov", pool_reg(k, 32), "eax");
+    for (i = k - 1; i >= 0; i--)
+        emit_pop(em, pool_reg(i, 64));
+    return true;
+}
+
+/* dst = dst <op> src, leaving the result in dst */
+static void gen_binary_op(EMITTER *em, NODE_KIND kind,
+                            const char *dst, const char *src)
+{
+    switch (kind) {
+    case NK_ADD:
+        /*TODO consider type (bits) */
+        emit_op2(em, "add", dst, src);
+        break;
+    case NK_SUB:
+        emit_op2(em, "sub", dst, src);
+        break;
+    case NK_MUL:
+        emit_op2(em, "imul", dst, src);
+        break;
+    case NK_AND:
+        emit_op2(em, "and", dst, src);
+        break;
+    case NK_OR:
+        emit_op2(em, "or", dst, src);
+        break;
+    case NK_XOR:
+        emit_op2(em, "xor", dst, src);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+/* dst = dst << count (or >>), the count goes through cl */
+static void gen_shift(EMITTER *em, NODE_KIND kind, bool is_unsigned,
+                        const char *dst, const char *count)
+{
+    if (strcmp(count, "ecx") != 0)
+        emit_op2(em, "mov", "ecx", count);
+    emit_op2(em, (kind == NK_SHL) ? "shl" : is_unsigned ? "shr" : "sar",
+             dst, "cl");
+}
+
+/* pool[k] = dividend / divisor (or %), divisor is neither eax nor edx */
+static void gen_div(EMITTER *em, NODE_KIND kind, bool is_unsigned, int k,
+                        const char *dividend, const char *divisor)
+{
+    bool save_eax = (k > 0);
+
+    if (strcmp(divisor, "eax") == 0) {
+        emit_op2(em, "mov", "ecx", "eax");
+        divisor = "ecx";
+        save_eax = false;
+    }
+    if (strcmp(dividend, "eax") != 0) {
+        if (save_eax)
+            emit_push(em, "rax");
+        emit_op2(em, "mov", "eax", dividend);
+    }
+    if (is_unsigned) {
+        emit_op2(em, "xor", "edx", "edx");
+        emit_op1(em, "div", divisor);
+    } else {
+        emit_op(em, "cdq");
+        emit_op1(em, "idiv", divisor);
+    }
+    if (kind == NK_MOD)
+        emit_op2(em, "mov", pool_reg(k, 32), "edx");
+    else if (k > 0)
+        emit_op2(em, "mov", pool_reg(k, 32), "eax");
+    if (strcmp(dividend, "eax") != 0 && save_eax)
+        emit_pop(em, "rax");
+}
+
+static bool is_unsigned_expr(const NODE *np)
+{
+    return np->type != NULL && is_unsigned_type(np->type);
+}
+
+/* op dst, src, n */
+static void emit_op3_imm(EMITTER *em, const char *op, const char *dst,
+                            const char *src, int n)
+{
+    emit_str(em, "    ");
+    emit_str(em, op);
+    emit_char(em, ' ');
+    emit_str(em, dst);
+    emit_str(em, ", ");
+    emit_str(em, src);
+    emit_str(em, ", ");
+    emit_int(em, n);
+    emit_char(em, '\n');
+}
+
+/*
+ * r *= c
+ *
+ * c = m << s with m 1, 3, 5 or 9 is a lea and a shift, negated if c is
+ * negative; any other c is an imul by an immediate.
+ */
+void gen_mul_imm(EMITTER *em, const char *r32, const char *r64, int c)
+{
+    unsigned m = (c < 0) ? -(unsigned) c : (unsigned) c;
+    int shift = 0;
+
+    if (c == 0) {
+        emit_op2_imm(em, "mov", r32, 0);
+        return;
+    }
+    while ((m & 1) == 0) {
+        m >>= 1;
+        shift++;
+    }
+    if (m != 1 && m != 3 && m != 5 && m != 9) {
+        emit_op3_imm(em, "imul", r32, r32, c);
+        return;
+    }
+    if (m != 1) {
+        emit_str(em, "    lea ");
+        emit_str(em, r32);
+        emit_str(em, ", [");
+        emit_str(em, r64);
+        emit_char(em, '+');
+        emit_str(em, r64);
+        emit_char(em, '*');
+        emit_int(em, m - 1);
+        emit_str(em, "]\n");
+    }
+    if (shift > 0)
+        emit_op2_imm(em, "shl", r32, shift);
+    if (c < 0)
+        emit_op1(em, "neg", r32);
+}
+
+/*
+ * r /= d or r %= d as planned by plan_div(), using ecx and edx.
+ * eval_div_plan() mirrors these sequences.
+ */
+void gen_div_const(EMITTER *em, const DIV_PLAN *plan, const char *r, bool mod)
+{
+
+    switch (plan->method) {
+    case DM_IDENTITY:
+    case DM_NEGATE:
+        if (mod)
+            emit_op2_imm(em, "mov", r, 0);
+        else if (plan->method == DM_NEGATE)
+            emit_op1(em, "neg", r);
+        return;
+    case DM_SHIFT:
+        if (plan->is_unsigned) {
+            if (mod)
+                emit_op2_imm(em, "and", r, (int) (plan->divisor - 1));
+            else
+                emit_op2_imm(em, "shr", r, plan->shift);
+            return;
+        }
+        /* a negative dividend is biased by divisor - 1 */
+        emit_op2(em, "mov", "ecx", r);
+        if (plan->shift > 1)
+            emit_op2_imm(em, "sar", "ecx", 31);
+        emit_op2_imm(em, "shr", "ecx", 32 - plan->shift);
+        if (mod) {
+            emit_op2(em, "add", "ecx", r);
+            emit_op2_imm(em, "and", "ecx", (int) -plan->divisor);
+            emit_op2(em, "sub", r, "ecx");
+            return;
+        }
+        emit_op2(em, "add", r, "ecx");
+        emit_op2_imm(em, "sar", r, plan->shift);
+        break;
+    case DM_MAGIC:
+        if (plan->is_unsigned) {
+            emit_op2(em, "mov", "ecx", r);
+            emit_op2_imm(em, "mov", "edx", (int) plan->magic);
+            emit_op2(em, "imul", "rcx", "rdx");
+            if (plan->add) {
+                emit_op2_imm(em, "shr", "rcx", 32);
+                emit_op2(em, "mov", "edx", r);
+                emit_op2(em, "sub", "edx", "ecx");
+                emit_op2_imm(em, "shr", "edx", 1);
+                emit_op2(em, "add", "ecx", "edx");
+                if (plan->shift > 1)
+                    emit_op2_imm(em, "shr", "ecx", plan->shift - 1);
+            } else {
+                emit_op2_imm(em, "shr", "rcx", 32 + plan->shift);
+            }
+        } else {
+            emit_op2(em, "movsxd", "rcx", r);
+            emit_op3_imm(em, "imul", "rcx", "rcx", (int) plan->magic);
+            if (plan->add) {
+                emit_op2_imm(em, "sar", "rcx", 32);
+                emit_op2(em, "add", "ecx", r);
+                if (plan->shift > 0)
+                    emit_op2_imm(em, "sar", "ecx", plan->shift);
+            } else {
+                emit_op2_imm(em, "sar", "rcx", 32 + plan->shift);
+            }
+            /* round towards zero */
+            emit_op2(em, "mov", "edx", "ecx");
+            emit_op2_imm(em, "shr", "edx", 31);
+            emit_op2(em, "add", "ecx", "edx");
+        }
+        if (mod) {
+            emit_op3_imm(em, "imul", "ecx", "ecx", (int) plan->divisor);
+            emit_op2(em, "sub", r, "ecx");
+            return;
+        }
+        emit_op2(em, "mov", r, "ecx");
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    if (plan->negative)
+        emit_op1(em, "neg", r);
+}
+
+/*
+ * evaluate both operands of np, using pool[k] and above.  *left and
+ * *right are set to the registers holding them; one of them is pool[k].
+ */
+static bool gen_operands(EMITTER *em, NODE *np, int k,
+                            const char **left, const char **right)
+{
+    NODE *l = np->u.link.left;
+    NODE *r = np->u.link.right;
+
+    if (k + 1 >= g_compiler->pool_size) {
+        /* out of scratch registers, spill the first operand */
+        if (get_expr_need(l) >= get_expr_need(r)) {
+            if (!gen_expr_reg(em, l, k))
+                return false;
+            emit_push(em, pool_reg(k, 64));
+            if (!gen_expr_reg(em, r, k))
+                return false;
+            emit_op2(em, "mov", "ecx", pool_reg(k, 32));
+            emit_pop(em, pool_reg(k, 64));
+        } else {
+            if (!gen_expr_reg(em, r, k))
+                return false;
+            emit_push(em, pool_reg(k, 64));
+            if (!gen_expr_reg(em, l, k))
+                return false;
+            emit_pop(em, "rcx");
+        }
+        *left = pool_reg(k, 32);
+        *right = "ecx";
+    } else if (get_expr_need(l) >= get_expr_need(r)) {
+        if (!gen_expr_reg(em, l, k) || !gen_expr_reg(em, r, k + 1))
             return false;
+        *left = pool_reg(k, 32);
+        *right = pool_reg(k + 1, 32);
+    } else {
+        if (!gen_expr_reg(em, r, k) || !gen_expr_reg(em, l, k + 1))
+            return false;
+        *left = pool_reg(k + 1, 32);
+        *right = pool_reg(k, 32);
+    }
+    return true;
+}
+
+static bool gen_binary(EMITTER *em, NODE *np, int k)
+{
+    const NODE *imm = get_imm_operand(np);
+    const char *dst, *src;
+    DIV_PLAN plan;
+
+    if (imm != NULL) {
+        /* strength reduction of a constant operand */
+        NODE *e = (imm == np->u.link.left)
+                    ? np->u.link.right : np->u.link.left;
+
+        if (np->kind == NK_MUL) {
+            if (!gen_expr_reg(em, e, k))
+                return false;
+            gen_mul_imm(em, pool_reg(k, 32), pool_reg(k, 64), imm->u.num);
+            return true;
+        }
+        plan_div(&plan, imm->u.num, is_unsigned_expr(np));
+        if (plan.method != DM_DIVIDE) {
+            if (!gen_expr_reg(em, e, k))
+                return false;
+            gen_div_const(em, &plan, pool_reg(k, 32), np->kind == NK_MOD);
+            return true;
+        }
     }
-    if (!gen_expr(fp, a->u.link.left))
+    if (!gen_operands(em, np, k, &dst, &src))
         return false;
-    if (n < NUM_REG_PARAM)
-        fprintf(fp, "    mov %s,eax\n", s_param_reg32[n]);
-    else
-        fprintf(fp, "    push rax\n");
+    if (np->kind == NK_DIV || np->kind == NK_MOD) {
+        gen_div(em, np->kind, is_unsigned_expr(np), k, dst, src);
+        return true;
+    }
+    if (np->kind == NK_SHL || np->kind == NK_SHR) {
+        /* ecx is never in the pool, it only holds spilled operands */
+        gen_shift(em, np->kind, is_unsigned_expr(np), dst, src);
+        if (dst != pool_reg(k, 32))
+            emit_op2(em, "mov", pool_reg(k, 32), dst);
+        return true;
+    }
+    if (dst != pool_reg(k, 32)) {
+        switch (np->kind) {
+        case NK_ADD: case NK_MUL: case NK_AND: case NK_OR: case NK_XOR:
+            /* commutative, operate on pool[k] directly */
+            gen_binary_op(em, np->kind, src, dst);
+            return true;
+        default:
+            gen_binary_op(em, np->kind, dst, src);
+            emit_op2(em, "mov", src, dst);
+            return true;
+        }
+    }
+    gen_binary_op(em, np->kind, dst, src);
     return true;
 }
 
-static bool gen_arg(FILE *fp, NODE *arg_list)
+/*
+ * conditions
+ *
+ * A relational operator sets the flags with cmp and is consumed by a
+ * jcc, or by setcc when its value is needed.  In a condition, !, && and
+ * || only rearrange the branches, so they never produce a 0/1 value.
+ */
+bool is_unsigned_compare(const NODE *np)
 {
-    if (arg_list == NULL)
+    TYPE *l = np->u.link.left->type;
+    TYPE *r = np->u.link.right->type;
+
+    if (l == NULL || r == NULL)
+        return false;
+    if (l->kind == T_POINTER || r->kind == T_POINTER)
         return true;
-    assert(arg_list->kind == NK_ARG);
-    return gen_an_arg(fp, 0, arg_list);
+    if (!is_integer_type(l) || !is_integer_type(r))
+        return false;
+    return is_unsigned_type(arith_conv_type(l, r));
 }
 
-static int arg_count(const NODE *args)
+/* the condition code for "np is sense" after gen_compare() */
+static const char *cond_code(const NODE *np, bool sense)
 {
-    int n = 0;
-    for (; args != NULL; args = args->u.link.right)
-        n++;
-    return n;
+    static const char *cc[][2] = {      /* signed, unsigned */
+        { "e", "e" }, { "ne", "ne" }, { "l", "b" },
+        { "g", "a" }, { "le", "be" }, { "ge", "ae" },
+    };
+    static const int negate[] = { 1, 0, 5, 4, 3, 2 };
+    int i = np->kind - NK_EQ;
+
+    assert(is_compare(np->kind));
+    if (!sense)
+        i = negate[i];
+    return cc[i][is_unsigned_compare(np)];
 }
 
+static void emit_jcc(EMITTER *em, const char *cc, int label)
+{
+    emit_str(em, "    j");
+    emit_str(em, cc);
+    emit_char(em, ' ');
+    emit_label(em, label);
+    emit_char(em, '\n');
+}
 
-static bool gen_expr(FILE *fp, NODE *np)
+/* cmp the operands of the relational operator np */
+static bool gen_compare(EMITTER *em, NODE *np, int k)
+{
+    const char *left, *right;
+
+    if (is_imm_leaf(np->u.link.right)) {
+        if (!gen_expr_reg(em, np->u.link.left, k))
+            return false;
+        emit_op2_imm(em, "cmp", pool_reg(k, 32), np->u.link.right->u.num);
+        return true;
+    }
+    if (!gen_operands(em, np, k, &left, &right))
+        return false;
+    emit_op2(em, "cmp", left, right);
+    return true;
+}
+
+/* jump to label if the value of np is sense (non-zero for true) */
+static bool gen_branch(EMITTER *em, NODE *np, int k, bool sense, int label)
+{
+    int skip;
+
+    switch (np->kind) {
+    case NK_EQ: case NK_NEQ: case NK_LT: case NK_GT: case NK_LE: case NK_GE:
+        if (!gen_compare(em, np, k))
+            return false;
+        emit_jcc(em, cond_code(np, sense), label);
+        return true;
+    case NK_NOT:
+        return gen_branch(em, np->u.link.left, k, !sense, label);
+    case NK_LAND:
+    case NK_LOR:
+        if ((np->kind == NK_LOR) == sense) {
+            /* either operand decides */
+            return gen_branch(em, np->u.link.left, k, sense, label)
+                && gen_branch(em, np->u.link.right, k, sense, label);
+        }
+        skip = new_label();
+        if (!gen_branch(em, np->u.link.left, k, !sense, skip)
+                || !gen_branch(em, np->u.link.right, k, sense, label))
+            return false;
+        emit_label_def(em, skip);
+        return true;
+    case NK_CHAR_LIT:
+    case NK_INT_LIT:
+        if ((np->u.num != 0) == sense)
+            emit_jump(em, "jmp", label);
+        return true;
+    default:
+        if (!gen_expr_reg(em, np, k))
+            return false;
+        emit_op2(em, "test", pool_reg(k, 32), pool_reg(k, 32));
+        emit_jump(em, sense ? "jne" : "je", label);
+        return true;
+    }
+}
+
+/* the 0/1 value of a condition in pool[k] */
+static bool gen_cond_value(EMITTER *em, NODE *np, int k)
+{
+    int l1, l2;
+
+    switch (np->kind) {
+    case NK_EQ: case NK_NEQ: case NK_LT: case NK_GT: case NK_LE: case NK_GE:
+        if (!gen_compare(em, np, k))
+            return false;
+        emit_str(em, "    set");
+        emit_str(em, cond_code(np, true));
+        emit_char(em, ' ');
+        emit_str(em, pool_reg(k, 8));
+        emit_char(em, '\n');
+        break;
+    case NK_NOT:
+        if (!gen_expr_reg(em, np->u.link.left, k))
+            return false;
+        emit_op2(em, "test", pool_reg(k, 32), pool_reg(k, 32));
+        emit_op1(em, "sete", pool_reg(k, 8));
+        break;
+    default:
+        l1 = new_label();
+        l2 = new_label();
+        if (!gen_branch(em, np, k, false, l1))
+            return false;
+        emit_op2_imm(em, "mov", pool_reg(k, 32), 1);
+        emit_jump(em, "jmp", l2);
+        emit_label_def(em, l1);
+        emit_op2_imm(em, "mov", pool_reg(k, 32), 0);
+        emit_label_def(em, l2);
+        return true;
+    }
+    emit_op2(em, "movzx", pool_reg(k, 32), pool_reg(k, 8));
+    return true;
+}
+
+static bool gen_expr_reg(EMITTER *em, NODE *np, int k)
 {
     if (np == NULL)
         return true;
     switch (np->kind) {
     case NK_ASSIGN:
-        if (!gen_expr(fp, np->u.link.right))
+        if (!gen_expr_reg(em, np->u.link.right, k))
             return false;
-        if (!gen_assign_expr(fp, np->u.link.left))
+        if (!gen_assign_expr(em, np->u.link.left, k))
             return false;
         break;
     case NK_AS_MUL: case NK_AS_DIV: case NK_AS_MOD:
@@ -117,74 +976,13 @@ static bool gen_expr(FILE *fp, NODE *np)
     case NK_AS_AND: case NK_AS_XOR: case NK_AS_OR:
         break;
     case NK_EQ: case NK_NEQ: case NK_LT: case NK_GT: case NK_LE: case NK_GE:
+    case NK_LOR: case NK_LAND: case NK_NOT:
+        return gen_cond_value(em, np, k);
     case NK_SHL: case NK_SHR: case NK_ADD: case NK_SUB: case NK_MUL:
     case NK_DIV: case NK_MOD: case NK_OR: case NK_XOR: case NK_AND:
-        gen_expr(fp, np->u.link.right);
-        fprintf(fp, "    push rax\n");
-        gen_expr(fp, np->u.link.left);
-        fprintf(fp, "    pop rdi\n");
-        switch (np->kind) {
-        case NK_EQ:
-            fprintf(fp, "    cmp eax, edi\n");
-            fprintf(fp, "    sete al\n");
-            fprintf(fp, "    movzx eax, al\n");
-            break;
-        case NK_NEQ:
-            fprintf(fp, "    cmp eax, edi\n");
-            fprintf(fp, "    setne al\n");
-            fprintf(fp, "    movzx eax, al\n");
-            break;
-        case NK_LT:
-            fprintf(fp, "    cmp eax, edi\n");
-            fprintf(fp, "    setl al\n");
-            fprintf(fp, "    movzx eax, al\n");
-            break;
-        case NK_GT:
-            fprintf(fp, "    cmp eax, edi\n");
-            fprintf(fp, "    setg al\n");
-            fprintf(fp, "    movzx eax, al\n");
-            break;
-        case NK_LE:
-            fprintf(fp, "    cmp eax, edi\n");
-            fprintf(fp, "    setle al\n");
-            fprintf(fp, "    movzx eax, al\n");
-            break;
-        case NK_GE:
-            fprintf(fp, "    cmp eax, edi\n");
-            fprintf(fp, "    setge al\n");
-            fprintf(fp, "    movzx eax, al\n");
-            break;
-        case NK_SHL:
-        case NK_SHR:
-            /*TODO*/
-            break;
-        case NK_ADD:
-            /*TODO consider type (bits) */
-            fprintf(fp, "    add eax, edi\n");
-            break;
-        case NK_SUB:
-            fprintf(fp, "    sub eax, edi\n");
-            break;
-        case NK_MUL:
-            fprintf(fp, "    imul edi\n");
-            break;
-        case NK_DIV:
-            fprintf(fp, "    cdq\n");
-            fprintf(fp, "    idiv edi\n");
-            break;
-        case NK_MOD:
-        case NK_OR:
-        case NK_XOR:
-        case NK_AND:
-            /*TODO*/
-            break;
-        default:
-            break;
-        }
-        break;
-    case NK_LOR: case NK_LAND:
+        return gen_binary(em, np, k);
     case NK_ADDR: case NK_DEREF: case NK_UPLUS: case NK_UMINUS:
-    case NK_COMPLEMENT: case NK_NOT: case NK_PREINC:
+    case NK_COMPLEMENT: case NK_PREINC:
     case NK_PREDEC: case NK_SIZEOF:
         break;
     case NK_POSTINC:
@@ -195,35 +993,11 @@ static bool gen_expr(FILE *fp, NODE *np)
     case NK_COND2:
         break;
     case NK_ARRAY:
-        fprintf(fp, "# TODO ARRAY\n");
+        emit_str(em, "# TODO ARRAY\n");
         /*TODO*/
         break;
     case NK_CALL:
-        {
-            int n = arg_count(np->u.link.right);
-            fprintf(fp, "# CALL\n");
-            if (n > NUM_REG_PARAM) {
-                int size = (n - NUM_REG_PARAM) * BYTE_INT;
-                if (iround(size, 16) - size  > 0)
-                    fprintf(fp, "    sub rsp, %d\n",
-                        iround(size, 16) - size);
-            }
-            if (!gen_arg(fp, np->u.link.right))
-                return false;
-            assert(np->u.link.left);
-            if (np->u.link.left->kind == NK_ID) {
-                fprintf(fp, "    call _%s\n", np->u.link.left->u.sym->id);
-            } else {
-                if (!gen_expr(fp, np->u.link.left))
-                    return false;
-                fprintf(fp, "    call [eax]\n");
-            }
-            if (n > NUM_REG_PARAM) {
-                fprintf(fp, "    add rsp,%d\n",
-                    iround((n - NUM_REG_PARAM)*BYTE_INT, 16));
-            }
-        }
-        break;
+        return gen_call(em, np, k, false);
     case NK_ARG:
         assert(0);
         break;
@@ -233,19 +1007,21 @@ static bool gen_expr(FILE *fp, NODE *np)
     case NK_ID:
         assert(np->u.sym);
         if (np->u.sym->kind == SK_FUNC) {
-            fprintf(fp, "# FUNC %s\n", np->u.sym->id);
+            emit_str(em, "# FUNC ");
+            emit_str(em, np->u.sym->id);
+            emit_char(em, '\n');
             /*TODO*/
         } else {
-            fprintf(fp, "    mov eax,%s # %s\n",
-                        get_var_addr(np->u.sym), np->u.sym->id);
+            gen_leaf(em, np, pool_reg(k, 32));
         }
         break;
     case NK_CHAR_LIT:
-        fprintf(fp, "    mov al, %d\n", np->u.num);
+        emit_op2_imm(em, "mov", pool_reg(k, 8), np->u.num);
         /*TODO*/
         break;
     case NK_INT_LIT:
-        fprintf(fp, "    mov eax, %d\n", np->u.num);
+    case NK_STRING_LIT:
+        gen_leaf(em, np, pool_reg(k, 32));
         break;
     case NK_UINT_LIT:
     case NK_LONG_LIT:
@@ -253,9 +1029,6 @@ static bool gen_expr(FILE *fp, NODE *np)
     case NK_FLOAT_LIT:
     case NK_DOUBLE_LIT:
         break;
-    case NK_STRING_LIT:
-        fprintf(fp, "    mov eax, .L_S%d\n", np->u.str->num); 
-        break;
     default:
         error(&np->pos, "couldn't generate expression code");
         return false;
@@ -263,119 +1036,345 @@ static bool gen_expr(FILE *fp, NODE *np)
     return true;
 }
 
-static bool gen_stmt(FILE *fp, NODE *np)
+/* evaluate np into eax */
+static bool gen_expr(EMITTER *em, NODE *np)
+{
+    return gen_expr_reg(em, np, 0);
+}
+
+/*
+ * switch statements
+ *
+ * The case labels of a switch are collected before its body is
+ * generated.  A range of values that is at least switch_density percent
+ * full (and has SWITCH_TABLE_MIN cases) is dispatched through a bounds
+ * checked jump table in .rodata; sparser switches get a balanced tree of
+ * compares.
+ */
+#define SWITCH_DENSITY      40      /* percent */
+#define SWITCH_TABLE_MIN    4
+
+struct switch_info {
+    CASE_LABEL *cases;  /* in the order they appear */
+    int num_case;
+    int max_case;
+    int next_case;      /* first case gen_stmt() has not reached yet */
+    int default_label;
+    bool is_unsigned;
+};
+
+static void add_case_label(struct switch_info *sw, const NODE *np)
+{
+    CASE_LABEL *cp;
+
+    if (sw->num_case == sw->max_case) {
+        sw->max_case = (sw->max_case == 0) ? 16 : sw->max_case * 2;
+        sw->cases = (CASE_LABEL*) realloc(sw->cases,
+                                    sizeof (CASE_LABEL) * sw->max_case);
+        if (sw->cases == NULL) {
+            fprintf(stderr, "out of memory\n");
+            abort();
+        }
+    }
+    cp = &sw->cases[sw->num_case++];
+    cp->key = sw->is_unsigned ? (long) (unsigned) np->u.num_node.num
+                              : (long) np->u.num_node.num;
+    cp->label = new_label();
+    cp->node = np;
+}
+
+/* the case and default labels of a switch body, not of nested switches */
+static void collect_cases(struct switch_info *sw, const NODE *np)
+{
+    if (np == NULL)
+        return;
+    switch (np->kind) {
+    case NK_COMPOUND:
+        collect_cases(sw, np->u.comp.node);
+        break;
+    case NK_LINK:
+        collect_cases(sw, np->u.link.left);
+        collect_cases(sw, np->u.link.right);
+        break;
+    case NK_IF:
+        collect_cases(sw, np->u.link.right->u.link.left);
+        collect_cases(sw, np->u.link.right->u.link.right);
+        break;
+    case NK_WHILE:
+        collect_cases(sw, np->u.link.right);
+        break;
+    case NK_DO:
+        collect_cases(sw, np->u.link.left);
+        break;
+    case NK_FOR:
+        collect_cases(sw, np->u.link.right->u.link.right->u.link.right);
+        break;
+    case NK_LABEL:
+        collect_cases(sw, np->u.idnode.node);
+        break;
+    case NK_CASE:
+        add_case_label(sw, np);
+        collect_cases(sw, np->u.num_node.node);
+        break;
+    case NK_DEFAULT:
+        sw->default_label = new_label();
+        collect_cases(sw, np->u.link.left);
+        break;
+    default:
+        break;
+    }
+}
+
+static int compare_case(const void *a, const void *b)
+{
+    const CASE_LABEL *x = (const CASE_LABEL*) a;
+    const CASE_LABEL *y = (const CASE_LABEL*) b;
+    return (x->key < y->key) ? -1 : (x->key > y->key);
+}
+
+/* the value to switch on is in eax, edx is free */
+static void gen_case_table(EMITTER *em, const CASE_LABEL *c, int n, int def)
+{
+    int table = new_label();
+    long v;
+    int i;
+
+    if (c[0].key != 0)
+        emit_op2_imm(em, "sub", "eax", (int) c[0].key);
+    emit_op2_imm(em, "cmp", "eax", (int) (c[n - 1].key - c[0].key));
+    emit_jump(em, "ja", def);
+    /* entries are relative to the table, so the code is position independent */
+    emit_str(em, "    lea rdx, [rip+");
+    emit_label(em, table);
+    emit_str(em, "]\n");
+    emit_op2(em, "movsxd", "rax", "dword ptr [rdx+rax*4]");
+    emit_op2(em, "add", "rax", "rdx");
+    emit_op1(em, "jmp", "rax");
+    emit_str(em, ".section .rodata\n");
+    emit_str(em, "    .align 4\n");
+    emit_label_def(em, table);
+    for (v = c[0].key, i = 0; i < n; v++) {
+        emit_str(em, "    .long ");
+        emit_label(em, (v == c[i].key) ? c[i++].label : def);
+        emit_char(em, '-');
+        emit_label(em, table);
+        emit_char(em, '\n');
+    }
+    emit_str(em, ".text\n");
+}
+
+static void gen_case_tree(EMITTER *em, const CASE_LABEL *c, int n, int def,
+                            bool is_unsigned)
+{
+    int i, mid, right;
+
+    if (n <= 3) {
+        for (i = 0; i < n; i++) {
+            emit_op2_imm(em, "cmp", "eax", (int) c[i].key);
+            emit_jump(em, "je", c[i].label);
+        }
+        emit_jump(em, "jmp", def);
+        return;
+    }
+    mid = n / 2;
+    right = new_label();
+    emit_op2_imm(em, "cmp", "eax", (int) c[mid].key);
+    emit_jump(em, "je", c[mid].label);
+    emit_jump(em, is_unsigned ? "ja" : "jg", right);
+    gen_case_tree(em, c, mid, def, is_unsigned);
+    emit_label_def(em, right);
+    gen_case_tree(em, c + mid + 1, n - mid - 1, def, is_unsigned);
+}
+
+/* jump to the label of the case matching eax, or to def */
+void gen_case_dispatch(EMITTER *em, const CASE_LABEL *cases, int n, int def,
+                        bool is_unsigned)
+{
+    CASE_LABEL *sorted;
+    int density = g_compiler->switch_density;
+
+    sorted = (CASE_LABEL*) alloc(sizeof (CASE_LABEL) * (n + 1));
+    memcpy(sorted, cases, sizeof (CASE_LABEL) * n);
+    qsort(sorted, n, sizeof (CASE_LABEL), compare_case);
+    if (density <= 0)
+        density = SWITCH_DENSITY;
+    if (n >= SWITCH_TABLE_MIN
+            && n * 100L >= (sorted[n - 1].key - sorted[0].key + 1) * density)
+        gen_case_table(em, sorted, n, def);
+    else
+        gen_case_tree(em, sorted, n, def, is_unsigned);
+    free(sorted);
+}
+
+static bool gen_stmt(EMITTER *em, NODE *np);
+
+static bool gen_switch(EMITTER *em, NODE *np)
+{
+    struct switch_info sw;
+    struct switch_info *save_switch = g_compiler->switch_info;
+    int save_break = g_compiler->break_label;
+    int end = new_label();
+    int def;
+    bool result;
+
+    memset(&sw, 0, sizeof sw);
+    sw.default_label = -1;
+    sw.is_unsigned = is_unsigned_type(promote_type(np->u.link.left->type));
+    collect_cases(&sw, np->u.link.right);
+    def = (sw.default_label >= 0) ? sw.default_label : end;
+
+    emit_node_comment(em, np, " SWITCH ", np->u.link.left);
+    if (!gen_expr(em, np->u.link.left)) {
+        free(sw.cases);
+        return false;
+    }
+    gen_case_dispatch(em, sw.cases, sw.num_case, def, sw.is_unsigned);
+
+    g_compiler->switch_info = &sw;
+    g_compiler->break_label = end;
+    result = gen_stmt(em, np->u.link.right);
+    g_compiler->switch_info = save_switch;
+    g_compiler->break_label = save_break;
+    emit_label_def(em, end);
+    free(sw.cases);
+    return result;
+}
+
+static bool gen_stmt(EMITTER *em, NODE *np)
 {
     int l1, l2;
+    int save_break, save_continue;
+    struct switch_info *sw;
 
     if (np == NULL)
         return true;
 
     switch (np->kind) {
     case NK_COMPOUND:
-        fprintf(fp, "# %s(%d)\n", np->pos.filename, np->pos.line);
-        if (!gen_stmt(fp, np->u.comp.node))
+        emit_pos_comment(em, np, "\n");
+        if (!gen_stmt(em, np->u.comp.node))
             return false;
         break;
     case NK_LINK:
-        if (!gen_stmt(fp, np->u.link.left))
+        if (!gen_stmt(em, np->u.link.left))
             return false;
-        if (!gen_stmt(fp, np->u.link.right))
+        if (!gen_stmt(em, np->u.link.right))
             return false;
         break;
     case NK_IF:
-        fprintf(fp, "# %s(%d) IF ", np->pos.filename, np->pos.line);
-        fprint_node(fp, 0, np->u.link.left);
-        fprintf(fp, "\n");
-        gen_expr(fp, np->u.link.left);
-        fprintf(fp, "    cmp eax, 0\n");
+        emit_node_comment(em, np, " IF ", np->u.link.left);
         l1 = new_label();
-        fprintf(fp, "    je .L%d\n", l1);
+        if (!gen_branch(em, np->u.link.left, 0, false, l1))
+            return false;
         assert(np->u.link.right);
         assert(np->u.link.right->kind == NK_THEN);
-        gen_stmt(fp, np->u.link.right->u.link.left);
-        l2 = new_label();
-        fprintf(fp, "    jmp .L%d\n", l2);
-        fprintf(fp, "# %s(%d) ELSE ", np->pos.filename, np->pos.line);
-        fprintf(fp, ".L%d:\n", l1);
-        if (np->u.link.right->u.link.right) {
-            gen_stmt(fp, np->u.link.right->u.link.right);
+        gen_stmt(em, np->u.link.right->u.link.left);
+        if (np->u.link.right->u.link.right == NULL) {
+            emit_label_def(em, l1);
+            break;
         }
-        fprintf(fp, ".L%d:\n", l2);
+        l2 = new_label();
+        emit_jump(em, "jmp", l2);
+        emit_pos_comment(em, np, " ELSE\n");
+        emit_label_def(em, l1);
+        gen_stmt(em, np->u.link.right->u.link.right);
+        emit_label_def(em, l2);
         break;
     case NK_SWITCH:
-        fprintf(fp, "# %s(%d) SWITCH\n", np->pos.filename, np->pos.line);
-        /*TODO*/
+        if (!gen_switch(em, np))
+            return false;
         break;
     case NK_CASE:
-        fprintf(fp, "# %s(%d) CASE\n", np->pos.filename, np->pos.line);
-        /*TODO*/
+        sw = g_compiler->switch_info;
+        assert(sw);
+        while (sw->cases[sw->next_case].node != np)
+            sw->next_case++;
+        emit_pos_comment(em, np, " CASE ");
+        emit_int(em, np->u.num_node.num);
+        emit_char(em, '\n');
+        emit_label_def(em, sw->cases[sw->next_case].label);
+        if (!gen_stmt(em, np->u.num_node.node))
+            return false;
         break;
     case NK_DEFAULT:
-        fprintf(fp, "# %s(%d) DEFAULT\n", np->pos.filename, np->pos.line);
-        /*TODO*/
+        assert(g_compiler->switch_info);
+        emit_pos_comment(em, np, " DEFAULT\n");
+        emit_label_def(em, g_compiler->switch_info->default_label);
+        if (!gen_stmt(em, np->u.link.left))
+            return false;
         break;
     case NK_WHILE:
-        fprintf(fp, "# %s(%d) WHILE ", np->pos.filename, np->pos.line);
-        fprint_node(fp, 0, np->u.link.left);
-        fprintf(fp, "\n");
+        emit_node_comment(em, np, " WHILE ", np->u.link.left);
         l1 = new_label();
-        fprintf(fp, ".L%d:\n", l1);
-        gen_expr(fp, np->u.link.left);
-        fprintf(fp, "    cmp eax, 0\n");
+        emit_label_def(em, l1);
         l2 = new_label();
-        fprintf(fp, "    je .L%d\n", l2);
-        gen_stmt(fp, np->u.link.right);
-        fprintf(fp, "    jmp .L%d\n", l1);
-        fprintf(fp, ".L%d:\n", l2);
+        if (!gen_branch(em, np->u.link.left, 0, false, l2))
+            return false;
+        save_break = g_compiler->break_label;
+        save_continue = g_compiler->continue_label;
+        g_compiler->break_label = l2;
+        g_compiler->continue_label = l1;
+        gen_stmt(em, np->u.link.right);
+        g_compiler->break_label = save_break;
+        g_compiler->continue_label = save_continue;
+        emit_jump(em, "jmp", l1);
+        emit_label_def(em, l2);
         break;
     case NK_DO:
-        fprintf(fp, "# %s(%d) DO\n", np->pos.filename, np->pos.line);
+        emit_pos_comment(em, np, " DO\n");
         /*TODO*/
         break;
     case NK_FOR:
-        fprintf(fp, "# %s(%d) FOR\n", np->pos.filename, np->pos.line);
+        emit_pos_comment(em, np, " FOR\n");
         /*TODO*/
         break;
     case NK_GOTO:
-        fprintf(fp, "# %s(%d) GOTO\n", np->pos.filename, np->pos.line);
+        emit_pos_comment(em, np, " GOTO\n");
         /*TODO*/
         break;
     case NK_CONTINUE:
-        fprintf(fp, "# %s(%d) CONTINUE\n", np->pos.filename, np->pos.line);
-        /*TODO*/
+        emit_pos_comment(em, np, " CONTINUE\n");
+        if (g_compiler->continue_label < 0) {
+            error(&np->pos, "continue statement not within a loop");
+            return false;
+        }
+        emit_jump(em, "jmp", g_compiler->continue_label);
         break;
     case NK_BREAK:
-        fprintf(fp, "# %s(%d) BREAK\n", np->pos.filename, np->pos.line);
-        /*TODO*/
+        emit_pos_comment(em, np, " BREAK\n");
+        if (g_compiler->break_label < 0) {
+            error(&np->pos, "break statement not within loop or switch");
+            return false;
+        }
+        emit_jump(em, "jmp", g_compiler->break_label);
         break;
     case NK_RETURN:
-        fprintf(fp, "# %s(%d) RETURN ", np->pos.filename, np->pos.line);
+        emit_node_comment(em, np, " RETURN ", np->u.link.left);
+        if (is_tail_call(np->u.link.left)) {
+            if (!gen_call(em, np->u.link.left, 0, true))
+                return false;
+            break;
+        }
         if (np->u.link.left) {
-            fprint_node(fp, 0, np->u.link.left);
-            fprintf(fp, "\n");
-            if (!gen_expr(fp, np->u.link.left))
+            if (!gen_expr(em, np->u.link.left))
                 return false;
-        } else
-            fprintf(fp, "\n");
-        fprintf(fp, "    mov rsp, rbp\n");
-        fprintf(fp, "    pop rbp\n");
-        fprintf(fp, "    ret\n");
+        }
+        gen_epilogue(em);
         break;
     case NK_LABEL:
-        fprintf(fp, "# %s(%d) LABEL %s\n", np->pos.filename, np->pos.line,
-                    np->u.idnode.id);
+        emit_pos_comment(em, np, " LABEL ");
+        emit_str(em, np->u.idnode.id);
+        emit_char(em, '\n');
         break;
     case NK_EXPR:
-        fprintf(fp, "# %s(%d) EXPR ", np->pos.filename, np->pos.line);
-        fprint_node(fp, 0, np->u.link.left);
-        fprintf(fp, "\n");
-        if (!gen_expr(fp, np->u.link.left))
+        emit_node_comment(em, np, " EXPR ", np->u.link.left);
+        if (!gen_expr(em, np->u.link.left))
             return false;
         break;
     case NK_EXPR_LINK:
-        if (!gen_expr(fp, np->u.link.left))
+        if (!gen_expr(em, np->u.link.left))
             return false;
-        if (!gen_expr(fp, np->u.link.right))
+        if (!gen_expr(em, np->u.link.right))
             return false;
         break;
     default:
@@ -386,115 +1385,350 @@ static bool gen_stmt(FILE *fp, NODE *np)
 }
 
 
-static bool gen_func(FILE *fp, SYMBOL *sym)
+void gen_func_header(EMITTER *em, const SYMBOL *sym)
 {
     if (sym->body) {
-        if (!sym_is_static(sym))
-            fprintf(fp, ".global _%s\n", sym->id);
-        if (!sym_is_extern(sym))
-            fprintf(fp, "_%s:\n", sym->id);
+        if (!sym_is_static(sym)) {
+            emit_str(em, ".global _");
+            emit_str(em, sym->id);
+            emit_char(em, '\n');
+        }
+        if (!sym_is_extern(sym)) {
+            emit_char(em, '_');
+            emit_str(em, sym->id);
+            emit_str(em, ":\n");
+        }
+    }
+    fprint_func_comment(emit_fp(em), sym);
+}
+
+/* whether a statement of np is a return that is_tail_call() to func */
+static bool has_tail_recursion(const NODE *np, const SYMBOL *func)
+{
+    if (np == NULL)
+        return false;
+    switch (np->kind) {
+    case NK_COMPOUND:
+        return has_tail_recursion(np->u.comp.node, func);
+    case NK_LINK:
+        return has_tail_recursion(np->u.link.left, func)
+            || has_tail_recursion(np->u.link.right, func);
+    case NK_IF:
+        return has_tail_recursion(np->u.link.right->u.link.left, func)
+            || has_tail_recursion(np->u.link.right->u.link.right, func);
+    case NK_WHILE:
+    case NK_SWITCH:
+        return has_tail_recursion(np->u.link.right, func);
+    case NK_DO:
+    case NK_DEFAULT:
+        return has_tail_recursion(np->u.link.left, func);
+    case NK_FOR:
+        return has_tail_recursion(
+                    np->u.link.right->u.link.right->u.link.right, func);
+    case NK_LABEL:
+        return has_tail_recursion(np->u.idnode.node, func);
+    case NK_CASE:
+        return has_tail_recursion(np->u.num_node.node, func);
+    case NK_RETURN:
+        return is_tail_call(np->u.link.left)
+            && np->u.link.left->u.link.left->u.sym == func;
+    default:
+        return false;
     }
-    fprint_func_comment(fp, sym);
+}
+
+/* omit_frame allows a leaf function to do without one */
+static bool gen_func_body(EMITTER *em, SYMBOL *sym, bool omit_frame)
+{
+    gen_func_header(em, sym);
     if (sym->body) {
         int i;
         int param_size = sym->num * BYTE_INT;   /*TODO*/
         int local_size = sym->offset;
         int frame_size = iround(param_size, 8) + iround(local_size, 16);
-        s_param_start = frame_size - param_size;
-        fprintf(fp, "    push rbp\n");
-        fprintf(fp, "    mov rbp, rsp\n");
-        fprintf(fp, "    sub rsp, %d\n", frame_size);
+        const SYMBOL *param[NUM_REG_PARAM];
+        const SYMBOL *p;
+        unsigned reg_used = 0;
+        bool is_leaf = false;
+        char buf[MAX_VAR_ADDR];
+
+        g_compiler->num_saved = 0;
+        if (g_compiler->opt_level >= 1)
+            g_compiler->num_saved = alloc_registers(sym,
+                                g_compiler->saved_reg, &reg_used, &is_leaf);
+        init_scratch_pool(reg_used);
+        g_compiler->break_label = g_compiler->continue_label = -1;
+        g_compiler->switch_info = NULL;
+        g_compiler->func = sym;
+        g_compiler->entry_label = has_tail_recursion(sym->body, sym)
+                                    ? new_label() : -1;
+        g_compiler->param_start = frame_size - param_size;
+        g_compiler->save_start = frame_size;
+        frame_size = iround(frame_size + g_compiler->num_saved * 8, 16);
+        g_compiler->frameless = omit_frame && is_leaf
+                                && can_omit_frame(frame_size);
+        g_compiler->pushed = false;
+
+        for (i = 0; i < NUM_REG_PARAM; i++)
+            param[i] = NULL;
+        for (p = sym->tab ? sym->tab->head : NULL; p != NULL; p = p->next) {
+            if (p->kind == SK_PARAM && p->num < NUM_REG_PARAM)
+                param[p->num] = p;
+        }
+
+        if (!g_compiler->frameless) {
+            emit_op1(em, "push", "rbp");
+            emit_op2(em, "mov", "rbp", "rsp");
+            emit_op2_imm(em, "sub", "rsp", frame_size);
+        }
+        gen_save_regs(em);
+        if (g_compiler->entry_label >= 0)
+            emit_label_def(em, g_compiler->entry_label);
         for (i = 0; i < sym->num; i++) {
-            fprintf(fp, "    mov [rbp-%d],%s\n",
-                    s_param_start + i * BYTE_INT, s_param_reg32[i]);
-            /*TODO consider type (bits) */
+            if (i < NUM_REG_PARAM && param[i] && param[i]->reg != REG_NONE) {
+                emit_str(em, "    mov ");
+                emit_str(em, get_reg_name(param[i]->reg, 32));
+                emit_char(em, ',');
+                emit_str(em, s_param_reg32[i]);
+                emit_char(em, '\n');
+            } else if (i < NUM_REG_PARAM) {
+                format_frame_addr(buf, -(g_compiler->param_start
+                                        + (i + 1) * BYTE_INT));
+                emit_str(em, "    mov ");
+                emit_str(em, buf);
+                emit_char(em, ',');
+                emit_str(em, s_param_reg32[i]);
+                emit_char(em, '\n');
+                /*TODO consider type (bits) */
+            }
         }
-        if (!gen_stmt(fp, sym->body))
+        /* parameters passed on the stack are loaded into their register */
+        for (p = sym->tab ? sym->tab->head : NULL; p != NULL; p = p->next) {
+            if (p->kind == SK_PARAM && p->num >= NUM_REG_PARAM
+                    && p->reg != REG_NONE) {
+                emit_str(em, "    mov ");
+                emit_str(em, get_reg_name(p->reg, 32));
+                emit_char(em, ',');
+                emit_var_addr(em, p);
+                emit_char(em, '\n');
+            }
+        }
+        if (!gen_stmt(em, sym->body))
             return false;
-        fprintf(fp, "    mov rsp, rbp\n");
-        fprintf(fp, "    pop rbp\n");
-        fprintf(fp, "    ret\n");
+        gen_epilogue(em);
     }
     return true;
 }
 
+/*
+ * A leaf function whose frame fits in the red zone is generated without
+ * one, see can_omit_frame().  Should its code push after all, when the
+ * scratch pool runs out or to divide, which would overwrite the red
+ * zone, the text captured so far is dropped and the function is
+ * generated again with a frame.
+ */
+static bool gen_func(EMITTER *em, SYMBOL *sym)
+{
+    int label_num = g_compiler->label_num;
+    int n_error = get_num_errors();
+    bool result;
+
+    result = gen_func_body(em, sym, true);
+    if (g_compiler->frameless && g_compiler->pushed
+            && get_num_errors() == n_error) {
+        emit_begin_func(em);
+        g_compiler->label_num = label_num;
+        result = gen_func_body(em, sym, false);
+    }
+    g_compiler->frameless = false;
+    return result;
+}
+
 
-static bool gen_data(FILE *fp, SYMBOL *sym)
+static bool gen_data(EMITTER *em, SYMBOL *sym)
 {
-    fprintf(fp, "_%s:\n    .zero 8\n", sym->id);
+    emit_char(em, '_');
+    emit_str(em, sym->id);
+    emit_str(em, ":\n    .zero 8\n");
     return true;
 }
 
-static void fprint_asciz(FILE *fp, const char *s)
+static void emit_asciz(EMITTER *em, const char *s)
 {
+    static const char hex[] = "0123456789abcdef";
     int c;
     while ((c = *s++) != '\0') {
         switch (c) {
-        case '\a':  fprintf(fp, "\\a"); break;
-        case '\b':  fprintf(fp, "\\b"); break;
-        case '\f':  fprintf(fp, "\\f"); break;
-        case '\n':  fprintf(fp, "\\n"); break;
-        case '\r':  fprintf(fp, "\\r"); break;
-        case '\t':  fprintf(fp, "\\t"); break;
-        case '\v':  fprintf(fp, "\\v"); break;
-        case '\\':  fprintf(fp, "\\\\"); break;
-        case '\'':  fprintf(fp, "\\'"); break;
-        case '"':   fprintf(fp, "\\\""); break;
+        case '\a':  emit_str(em, "\\a"); break;
+        case '\b':  emit_str(em, "\\b"); break;
+        case '\f':  emit_str(em, "\\f"); break;
+        case '\n':  emit_str(em, "\\n"); break;
+        case '\r':  emit_str(em, "\\r"); break;
+        case '\t':  emit_str(em, "\\t"); break;
+        case '\v':  emit_str(em, "\\v"); break;
+        case '\\':  emit_str(em, "\\\\"); break;
+        case '\'':  emit_str(em, "\\'"); break;
+        case '"':   emit_str(em, "\\\""); break;
         default:
             if (isprint(c))
-                fprintf(fp, "%c", c);
-            else
-                fprintf(fp, "\\x%x", c);
+                emit_char(em, c);
+            else {
+                unsigned u = (unsigned) c;
+                int shift = 28;
+                emit_str(em, "\\x");
+                while (shift > 0 && (u >> shift) == 0)
+                    shift -= 4;
+                for (; shift >= 0; shift -= 4)
+                    emit_char(em, hex[(u >> shift) & 0xf]);
+            }
             break;
         }
     }
 }
 
-static void gen_string(FILE *fp, STRING *str)
+static void gen_string(EMITTER *em, STRING *str)
+{
+    emit_str(em, ".L_S");
+    emit_int(em, str->num);
+    emit_str(em, ":\n    .asciz \"");
+    emit_asciz(em, str->s);
+    emit_str(em, "\"\n");
+}
+
+/* the IR of sym, optimized at -O2, or NULL if it is not covered */
+static IR_FUNC *prepare_ir(SYMBOL *sym)
+{
+    IR_FUNC *ir;
+
+    stats_begin(PH_OPT);
+    ir = build_ir(sym);
+    if (ir && g_compiler->opt_level >= 2) {
+        FUNC_STATS *fs = add_func_stats(sym->id);
+        fs->inlined = inline_calls(ir);
+        fs->tail_recursion = eliminate_tail_recursion(ir);
+        fs->removed = eliminate_dead_code(ir);
+        fs->hoisted = hoist_invariants(ir);
+        fs->vectorized = vectorize_loops(ir);
+        fs->reduced = reduce_induction_vars(ir);
+        if (fs->hoisted > 0 || fs->vectorized > 0 || fs->reduced > 0)
+            fs->removed += eliminate_dead_code(ir);
+    }
+    stats_end();
+    if (ir && is_debug("ir"))
+        fprint_ir(stdout, ir);
+    return ir;
+}
+
+static bool is_called(const SYMBOL *func, IR_FUNC **ir, int n)
 {
-    fprintf(fp, ".L_S%d:\n    .asciz \"", str->num);
-    fprint_asciz(fp, str->s);
-    fprintf(fp, "\"\n");
+    const IR_BLOCK *bp;
+    const IR_INSN *ip;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        for (bp = ir[i] ? ir[i]->entry : NULL; bp != NULL; bp = bp->next) {
+            for (ip = bp->head; ip != NULL; ip = ip->next) {
+                if (ip->op == IR_CALL && ip->a.sym == func)
+                    return true;
+            }
+        }
+    }
+    return false;
 }
 
-static bool gen_symtab(FILE *fp, SYMTAB *tab)
+static bool gen_symtab(EMITTER *em, SYMTAB *tab)
 {
     SYMBOL *sym;
     STRING *s;
+    IR_FUNC **ir;
+    bool all_ir = true;
+    int i, n = 0;
+
     if (tab == NULL)
         return true;
     if (is_debug("gen"))
         printf("gen function...\n");
+    /*
+     * the IR of every function is prepared first, so that a static
+     * function whose calls were all inlined can be left out.  Only the
+     * IR is searched for calls, so nothing is left out unless every
+     * function has one.
+     */
     for (sym = tab->head; sym != NULL; sym = sym->next) {
-        if (sym->kind == SK_FUNC && !gen_func(fp, sym))
+        if (sym->kind == SK_FUNC)
+            n++;
+    }
+    ir = (IR_FUNC**) alloc(sizeof (IR_FUNC*) * (n + 1));
+    for (i = 0, sym = tab->head; sym != NULL; sym = sym->next) {
+        if (sym->kind != SK_FUNC)
+            continue;
+        ir[i] = NULL;
+        if (sym->body && (g_compiler->opt_level >= 2 || is_debug("ir")))
+            ir[i] = prepare_ir(sym);
+        if (sym->body && ir[i] == NULL)
+            all_ir = false;
+        i++;
+    }
+    for (i = 0, sym = tab->head; sym != NULL; sym = sym->next) {
+        bool ok;
+        if (sym->kind != SK_FUNC)
+            continue;
+        if (g_compiler->opt_level >= 2 && all_ir && sym->body
+                && sym_is_static(sym) && !is_called(sym, ir, n)) {
+            i++;
+            continue;
+        }
+        emit_begin_func(em);
+        if (ir[i] && g_compiler->opt_level >= 2)
+            ok = lower_ir(em, ir[i]);
+        else
+            ok = gen_func(em, sym);
+        emit_end_func(em, g_compiler->opt_level >= 1);
+        i++;
+        if (!ok) {
+            free(ir);
             return false;
+        }
     }
+    free(ir);
     if (is_debug("gen"))
         printf("gen data...\n");
+    /* the text is read only */
+    emit_str(em, ".data\n");
     for (sym = tab->head; sym != NULL; sym = sym->next) {
-        if (sym->kind == SK_GLOBAL && !gen_data(fp, sym))
+        if (sym->kind == SK_GLOBAL && !gen_data(em, sym))
             return false;
     }
-    for (s = g_string_pool.head; s != NULL; s = s->next) {
-        gen_string(fp, s);
+    for (s = g_compiler->string_pool.head; s != NULL; s = s->next) {
+        gen_string(em, s);
     }
     return true;
 }
 
-static void gen_header(FILE *fp)
+static void gen_header(EMITTER *em)
 {
-    fprintf(fp, ".intel_syntax noprefix\n");
+    emit_str(em, ".intel_syntax noprefix\n");
 }
 
-static void gen_footer(FILE *fp)
+static void gen_footer(EMITTER *em)
 {
 }
 
 bool generate(FILE *fp)
 {
+    EMITTER *em;
     bool result;
-    gen_header(fp);
-    result = gen_symtab(fp, get_global_symtab());
-    gen_footer(fp);
+
+    em = open_emitter(fp);
+    if (em == NULL)
+        return false;
+    g_compiler->label_num = 0;
+    stats_begin(PH_GEN);
+    gen_header(em);
+    result = gen_symtab(em, get_global_symtab());
+    gen_footer(em);
+    stats_end();
+    if (!close_emitter(em))
+        result = false;
     return result;
 }
@@ -0,0 +1,626 @@
+#include <limits.h>
+#include "minicc.h"
+
+/*
+ * induction variable strength reduction on the IR (-O2)
+ *
+ * A basic induction variable is assigned in its loop only by one
+ * i = i + k (or i - k) with a constant k.  Each i * c or i << c in the
+ * loop then reads a new temporary s instead, which the preheader sets
+ * to i * c and which is advanced by k * c next to the step of i, so
+ * s == i * c holds everywhere in the loop.  Indexing a row of an array
+ * is the case this is for.
+ *
+ * The counter itself is eliminated when all that is left of it in the
+ * loop is its step and one test against a constant, the loop has no
+ * inner loops, every iteration passes the test, and the value of i on
+ * entry is a known constant: then the values i takes are bounded, and
+ * when their multiples do not overflow the test is rewritten on s.
+ */
+
+typedef struct {
+    OPERAND var;
+    IR_INSN *step;      /* var = var + k */
+    IR_BLOCK *step_block;
+    bool init_known;    /* var is init on entry */
+    int init;
+    IR_INSN *test;      /* to be rewritten on the first sum */
+    bool removed;       /* only its step is left in the loop */
+} COUNTER;
+
+typedef struct {
+    IR_INSN *insn;      /* var * scale */
+    COUNTER *counter;
+    int scale;
+} CAND;
+
+typedef struct {
+    COUNTER *counter;
+    int scale;
+    OPERAND sum;        /* var * scale */
+} REDUCED;
+
+/* the state of one loop, analysed before anything is changed */
+typedef struct {
+    IR_FUNC *ir;
+    IR_LOOPS *li;
+    const IR_LOOP *loop;
+    IR_INSN **step;     /* by vreg, the step of a basic induction variable */
+    IR_BLOCK *pre;
+    COUNTER *counter;
+    int num_counter;
+    CAND *cand;
+    int num_cand;
+    REDUCED *red;
+    int num_red;
+} IV;
+
+/* the step of the basic induction variable o, or NULL */
+static IR_INSN *get_step(const IV *iv, const OPERAND *o)
+{
+    int v = ir_vreg(iv->ir, o);
+
+    return (v >= 0) ? iv->step[v] : NULL;
+}
+
+static int step_value(const IR_INSN *step)
+{
+    int k = (step->b.kind == OPD_IMM) ? step->b.num : step->a.num;
+
+    return (step->op == IR_SUB) ? (int) -(unsigned) k : k;
+}
+
+static bool same_vreg(const IR_FUNC *ir, const OPERAND *a, const OPERAND *b)
+{
+    int v = ir_vreg(ir, a);
+
+    return v >= 0 && v == ir_vreg(ir, b);
+}
+
+static bool is_step(const IR_FUNC *ir, const IR_INSN *ip)
+{
+    if (ip->op == IR_ADD) {
+        return (same_vreg(ir, &ip->dst, &ip->a) && ip->b.kind == OPD_IMM)
+            || (same_vreg(ir, &ip->dst, &ip->b) && ip->a.kind == OPD_IMM);
+    }
+    return ip->op == IR_SUB && same_vreg(ir, &ip->dst, &ip->a)
+        && ip->b.kind == OPD_IMM;
+}
+
+/*
+ * if ip computes a basic induction variable times a constant, returns
+ * the scale and sets *opd to the variable
+ */
+static int get_scale(const IV *iv, const IR_INSN *ip, const OPERAND **opd)
+{
+    if (ip->op == IR_MUL) {
+        if (ip->b.kind == OPD_IMM && get_step(iv, &ip->a))
+            *opd = &ip->a;
+        else if (ip->a.kind == OPD_IMM && get_step(iv, &ip->b))
+            *opd = &ip->b;
+        else
+            return 0;
+        return (*opd == &ip->a) ? ip->b.num : ip->a.num;
+    }
+    if (ip->op == IR_SHL && ip->b.kind == OPD_IMM && ip->b.num > 0
+            && ip->b.num < 31 && get_step(iv, &ip->a)) {
+        *opd = &ip->a;
+        return 1 << ip->b.num;
+    }
+    return 0;
+}
+
+static IR_INSN *new_insn(IR_OP op, const POS *pos)
+{
+    IR_INSN *ip = (IR_INSN*) arena_alloc(AK_IR, sizeof (IR_INSN));
+    memset(ip, 0, sizeof (IR_INSN));
+    ip->op = op;
+    ip->pos = pos;
+    return ip;
+}
+
+static void insert_after(IR_BLOCK *bp, IR_INSN *at, IR_INSN *ip)
+{
+    ip->prev = at;
+    ip->next = at->next;
+    if (at->next)
+        at->next->prev = ip;
+    else
+        bp->tail = ip;
+    at->next = ip;
+}
+
+static void remove_insn(IR_BLOCK *bp, IR_INSN *ip)
+{
+    if (ip->prev)
+        ip->prev->next = ip->next;
+    else
+        bp->head = ip->next;
+    if (ip->next)
+        ip->next->prev = ip->prev;
+    else
+        bp->tail = ip->prev;
+}
+
+/* the temporary holding var * scale, made on first use */
+static OPERAND get_sum(IV *iv, COUNTER *cp, int scale)
+{
+    IR_INSN *ip, *jmp;
+    REDUCED *rp;
+    int i;
+
+    for (i = 0; i < iv->num_red; i++) {
+        rp = &iv->red[i];
+        if (rp->counter == cp && rp->scale == scale)
+            return rp->sum;
+    }
+    rp = &iv->red[iv->num_red++];
+    rp->counter = cp;
+    rp->scale = scale;
+    memset(&rp->sum, 0, sizeof (OPERAND));
+    rp->sum.kind = OPD_TEMP;
+    rp->sum.num = iv->ir->num_temp++;
+
+    /* s = i * c on entry */
+    if (iv->pre == NULL)
+        iv->pre = ir_make_preheader(iv->ir, iv->loop);
+    jmp = iv->pre->tail;
+    ip = new_insn(cp->init_known ? IR_MOV : IR_MUL, jmp->pos);
+    ip->dst = rp->sum;
+    if (cp->init_known) {
+        ip->a.kind = OPD_IMM;
+        ip->a.num = (int) ((unsigned) cp->init * (unsigned) scale);
+    } else {
+        ip->a = cp->var;
+        ip->b.kind = OPD_IMM;
+        ip->b.num = scale;
+    }
+    ip->prev = jmp->prev;
+    ip->next = jmp;
+    if (jmp->prev)
+        jmp->prev->next = ip;
+    else
+        iv->pre->head = ip;
+    jmp->prev = ip;
+
+    /* s += k * c with the step */
+    ip = new_insn(IR_ADD, cp->step->pos);
+    ip->dst = rp->sum;
+    ip->a = rp->sum;
+    ip->b.kind = OPD_IMM;
+    ip->b.num = (int) ((unsigned) step_value(cp->step) * (unsigned) scale);
+    insert_after(cp->step_block, cp->step, ip);
+    return rp->sum;
+}
+
+/*
+ * counter elimination
+ */
+static bool has_inner_loop(const IV *iv)
+{
+    int i;
+
+    for (i = 0; i < iv->li->num_loop; i++) {
+        const IR_LOOP *lp = &iv->li->loop[i];
+        if (lp != iv->loop && iv->loop->body[lp->header->id])
+            return true;
+    }
+    return false;
+}
+
+/* bp is on every path around the loop */
+static bool on_every_iteration(const IV *iv, const IR_BLOCK *bp)
+{
+    const IR_BLOCK *header = iv->loop->header;
+    int i;
+
+    for (i = 0; i < header->num_pred; i++) {
+        const IR_BLOCK *latch = header->pred[i];
+        if (iv->loop->body[latch->id] && !SET_HAS(iv->li->dom[latch->id],
+                                                        bp->id))
+            return false;
+    }
+    return true;
+}
+
+static bool is_live_out(const IV *iv, const OPERAND *var)
+{
+    int v = ir_vreg(iv->ir, var);
+    IR_BLOCK *bp;
+    int i;
+
+    for (bp = iv->ir->entry; bp != NULL; bp = bp->next) {
+        if (!iv->loop->body[bp->id])
+            continue;
+        for (i = 0; i < bp->num_succ; i++) {
+            if (!iv->loop->body[bp->succ[i]->id]
+                    && SET_HAS(bp->succ[i]->live_in, v))
+                return true;
+        }
+    }
+    return false;
+}
+
+/* the constant var holds on entry to the loop */
+static bool get_init(const IV *iv, const OPERAND *var, int *init)
+{
+    const IR_BLOCK *header = iv->loop->header;
+    const IR_BLOCK *bp = NULL;
+    const IR_INSN *ip;
+    int i, n = 0;
+
+    for (i = 0; i < header->num_pred; i++) {
+        if (!iv->loop->body[header->pred[i]->id]) {
+            bp = header->pred[i];
+            n++;
+        }
+    }
+    for (i = 0; n == 1 && i < iv->ir->num_block; i++) {
+        for (ip = bp->tail; ip != NULL; ip = ip->prev) {
+            if (same_vreg(iv->ir, &ip->dst, var)) {
+                if (ip->op != IR_MOV || ip->a.kind != OPD_IMM)
+                    return false;
+                *init = ip->a.num;
+                return true;
+            }
+        }
+        n = bp->num_pred;
+        bp = (n == 1) ? bp->pred[0] : NULL;
+    }
+    return false;
+}
+
+static IR_COND swap_cond(IR_COND cond)
+{
+    switch (cond) {
+    case IC_LT: return IC_GT;
+    case IC_GT: return IC_LT;
+    case IC_LE: return IC_GE;
+    case IC_GE: return IC_LE;
+    default:    return cond;
+    }
+}
+
+static IR_COND negate_cond(IR_COND cond)
+{
+    switch (cond) {
+    case IC_EQ: return IC_NE;
+    case IC_NE: return IC_EQ;
+    case IC_LT: return IC_GE;
+    case IC_GT: return IC_LE;
+    case IC_LE: return IC_GT;
+    default:    return IC_LT;
+    }
+}
+
+static bool fits_int(long long n)
+{
+    return n >= INT_MIN && n <= INT_MAX;
+}
+
+/*
+ * the range of the values var takes at the test br, which continues the
+ * loop while var cond n, starting from init and stepping by k
+ */
+static bool get_range(IR_COND cond, long long init, long long n, long long k,
+                        long long *lo, long long *hi)
+{
+    if (k > 0) {
+        *lo = init;
+        switch (cond) {
+        case IC_LT: *hi = n - 1 + k; break;
+        case IC_LE: *hi = n + k; break;
+        case IC_NE:
+            if (init >= n || (n - init) % k != 0)
+                return false;
+            *hi = n;
+            break;
+        default:
+            return false;
+        }
+        if (*hi < init + k)
+            *hi = init + k;
+    } else {
+        *hi = init;
+        switch (cond) {
+        case IC_GT: *lo = n + 1 + k; break;
+        case IC_GE: *lo = n + k; break;
+        case IC_NE:
+            if (init <= n || (init - n) % k != 0)
+                return false;
+            *lo = n;
+            break;
+        default:
+            return false;
+        }
+        if (*lo > init + k)
+            *lo = init + k;
+    }
+    return true;
+}
+
+/*
+ * the br which is the only use of the counter in the loop but its step
+ * and the multiplications, if it can test the counter times scale instead
+ */
+static IR_INSN *find_test(const IV *iv, const COUNTER *cp, int scale)
+{
+    const OPERAND *use[MAX_ARGS + 2];
+    const OPERAND *var = &cp->var;
+    IR_INSN *test = NULL;
+    IR_BLOCK *bp, *test_block = NULL;
+    IR_INSN *ip;
+    IR_COND cond;
+    long long lo, hi, n;
+    int i, j;
+
+    if (!cp->init_known || has_inner_loop(iv) || is_live_out(iv, var))
+        return NULL;
+    for (bp = iv->ir->entry; bp != NULL; bp = bp->next) {
+        if (!iv->loop->body[bp->id])
+            continue;
+        for (ip = bp->head; ip != NULL; ip = ip->next) {
+            for (i = 0; i < iv->num_cand; i++) {
+                if (iv->cand[i].insn == ip)
+                    break;
+            }
+            if (ip == cp->step || i < iv->num_cand)
+                continue;
+            for (j = ir_uses(ip, use, MAX_ARGS + 2) - 1; j >= 0; j--) {
+                if (!same_vreg(iv->ir, use[j], var))
+                    continue;
+                if (test != NULL || ip->op != IR_BR)
+                    return NULL;
+                test = ip;
+                test_block = bp;
+            }
+        }
+    }
+    if (test == NULL || !on_every_iteration(iv, test_block)
+            || iv->loop->body[test->target[0]->id]
+                == iv->loop->body[test->target[1]->id])
+        return NULL;
+
+    /* the condition for staying in the loop, as var cond n */
+    if (same_vreg(iv->ir, &test->a, var) && test->b.kind == OPD_IMM) {
+        cond = test->cond;
+        n = test->b.num;
+    } else if (same_vreg(iv->ir, &test->b, var) && test->a.kind == OPD_IMM) {
+        cond = swap_cond(test->cond);
+        n = test->a.num;
+    } else {
+        return NULL;
+    }
+    if (!iv->loop->body[test->target[0]->id])
+        cond = negate_cond(cond);
+    if (!get_range(cond, cp->init, n, step_value(cp->step), &lo, &hi)
+            || !fits_int(lo) || !fits_int(hi) || !fits_int(lo * scale)
+            || !fits_int(hi * scale) || !fits_int(n * scale))
+        return NULL;
+    if (test->is_unsigned && (lo < 0 || n < 0 || scale < 0))
+        return NULL;
+    return test;
+}
+
+/* test sum against n * scale where the test had var against n */
+static void rewrite_test(IR_INSN *test, const IR_FUNC *ir, const OPERAND *var,
+                        OPERAND sum, int scale)
+{
+    OPERAND *v = same_vreg(ir, &test->a, var) ? &test->a : &test->b;
+    OPERAND *n = (v == &test->a) ? &test->b : &test->a;
+
+    *v = sum;
+    n->num *= scale;
+    if (scale < 0)
+        test->cond = swap_cond(test->cond);
+}
+
+static COUNTER *get_counter(IV *iv, IR_INSN *step, IR_BLOCK *bp)
+{
+    COUNTER *cp;
+    int i;
+
+    for (i = 0; i < iv->num_counter; i++) {
+        if (iv->counter[i].step == step)
+            return &iv->counter[i];
+    }
+    cp = &iv->counter[iv->num_counter++];
+    memset(cp, 0, sizeof (COUNTER));
+    cp->var = step->dst;
+    cp->step = step;
+    cp->step_block = bp;
+    cp->init_known = get_init(iv, &cp->var, &cp->init);
+    return cp;
+}
+
+/* find the multiplications of basic induction variables in the loop */
+static void analyze_loop(IV *iv)
+{
+    IR_FUNC *ir = iv->ir;
+    int num_vreg = ir_num_vreg(ir);
+    const OPERAND *var;
+    int *num_def = (int*) alloc(sizeof (int) * (num_vreg + 1));
+    IR_BLOCK **step_block;
+    IR_BLOCK *bp;
+    IR_INSN *ip;
+    int i, n = 0, v, scale;
+
+    iv->step = (IR_INSN**) alloc(sizeof (IR_INSN*) * (num_vreg + 1));
+    step_block = (IR_BLOCK**) alloc(sizeof (IR_BLOCK*) * (num_vreg + 1));
+    memset(num_def, 0, sizeof (int) * (num_vreg + 1));
+    memset(iv->step, 0, sizeof (IR_INSN*) * (num_vreg + 1));
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        if (!iv->loop->body[bp->id])
+            continue;
+        for (ip = bp->head; ip != NULL; ip = ip->next) {
+            n++;
+            if ((v = ir_vreg(ir, &ip->dst)) < 0)
+                continue;
+            num_def[v]++;
+            iv->step[v] = is_step(ir, ip) ? ip : NULL;
+            step_block[v] = bp;
+        }
+    }
+    for (v = 0; v < num_vreg; v++) {
+        if (num_def[v] != 1)
+            iv->step[v] = NULL;
+    }
+
+    iv->cand = (CAND*) alloc(sizeof (CAND) * (n + 1));
+    iv->counter = (COUNTER*) alloc(sizeof (COUNTER) * (n + 1));
+    iv->red = (REDUCED*) alloc(sizeof (REDUCED) * (n + 1));
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        if (!iv->loop->body[bp->id])
+            continue;
+        for (ip = bp->head; ip != NULL; ip = ip->next) {
+            scale = get_scale(iv, ip, &var);
+            if (scale == 0 || scale == 1)
+                continue;
+            v = ir_vreg(ir, var);
+            iv->cand[iv->num_cand].insn = ip;
+            iv->cand[iv->num_cand].scale = scale;
+            iv->cand[iv->num_cand].counter =
+                        get_counter(iv, iv->step[v], step_block[v]);
+            iv->num_cand++;
+        }
+    }
+    /* the first multiplication of a counter decides its test */
+    for (i = 0; i < iv->num_counter; i++) {
+        COUNTER *cp = &iv->counter[i];
+        int j;
+        for (j = 0; iv->cand[j].counter != cp; j++)
+            ;
+        cp->test = find_test(iv, cp, iv->cand[j].scale);
+    }
+    free(num_def);
+    free(step_block);
+}
+
+/*
+ * make the uses of the temporary ip assigns read sum directly, when they
+ * all follow ip in its block before sum changes.  ip is then dead.
+ */
+static void forward_sum(IR_FUNC *ir, IR_INSN *ip)
+{
+    const OPERAND *use[MAX_ARGS + 2];
+    const IR_INSN *end;
+    IR_BLOCK *bp;
+    IR_INSN *p;
+    int j, n = 0;
+
+    if (ip->dst.kind != OPD_TEMP)
+        return;
+    for (end = ip->next; end != NULL; end = end->next) {
+        if (same_vreg(ir, &end->dst, &ip->a)
+                || same_vreg(ir, &end->dst, &ip->dst))
+            break;
+    }
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        for (p = bp->head; p != NULL; p = p->next) {
+            for (j = ir_uses(p, use, MAX_ARGS + 2) - 1; j >= 0; j--) {
+                if (same_vreg(ir, use[j], &ip->dst))
+                    n++;
+            }
+        }
+    }
+    for (p = ip->next; p != end; p = p->next) {
+        for (j = ir_uses(p, use, MAX_ARGS + 2) - 1; j >= 0; j--) {
+            if (same_vreg(ir, use[j], &ip->dst))
+                n--;
+        }
+    }
+    if (n != 0)
+        return;
+    for (p = ip->next; p != end; p = p->next) {
+        OPERAND *o[4];
+        o[0] = &p->a;
+        o[1] = &p->b;
+        o[2] = &p->c;
+        o[3] = NULL;
+        for (j = 0; o[j] != NULL; j++) {
+            if (same_vreg(ir, o[j], &ip->dst))
+                *o[j] = ip->a;
+        }
+        for (j = 0; j < p->num_arg; j++) {
+            if (same_vreg(ir, &p->arg[j], &ip->dst))
+                p->arg[j] = ip->a;
+        }
+    }
+}
+
+/* returns the number of multiplications replaced in lp */
+static int reduce_loop(IR_FUNC *ir, IR_LOOPS *li, const IR_LOOP *lp)
+{
+    OPERAND sum;
+    IV iv;
+    int i;
+
+    memset(&iv, 0, sizeof iv);
+    iv.ir = ir;
+    iv.li = li;
+    iv.loop = lp;
+    analyze_loop(&iv);
+    for (i = 0; i < iv.num_cand; i++) {
+        CAND *c = &iv.cand[i];
+        COUNTER *cp = c->counter;
+        sum = get_sum(&iv, cp, c->scale);
+        if (cp->test) {
+            rewrite_test(cp->test, ir, &cp->var, sum, c->scale);
+            cp->test = NULL;
+            cp->removed = true;
+        }
+        c->insn->op = IR_MOV;
+        c->insn->a = sum;
+        memset(&c->insn->b, 0, sizeof (OPERAND));
+        forward_sum(ir, c->insn);
+    }
+    for (i = 0; i < iv.num_counter; i++) {
+        if (iv.counter[i].removed)
+            remove_insn(iv.counter[i].step_block, iv.counter[i].step);
+    }
+    free(iv.step);
+    free(iv.cand);
+    free(iv.counter);
+    free(iv.red);
+    return iv.num_cand;
+}
+
+/* returns the number of multiplications replaced by additions */
+int reduce_induction_vars(IR_FUNC *ir)
+{
+    IR_BLOCK **done = NULL;
+    int num_done = 0;
+    IR_LOOPS li;
+    int i, n = 0;
+
+    ir_liveness(ir);
+    for (;;) {
+        ir_find_loops(&li, ir);
+        for (i = 0; i < li.num_loop; i++) {
+            int j;
+            for (j = 0; j < num_done; j++) {
+                if (done[j] == li.loop[i].header)
+                    break;
+            }
+            if (j == num_done)
+                break;
+        }
+        if (i == li.num_loop) {
+            ir_free_loops(&li);
+            break;
+        }
+        done = (IR_BLOCK**) realloc(done, sizeof (IR_BLOCK*) * (num_done + 1));
+        if (done == NULL) {
+            fprintf(stderr, "out of memory\n");
+            abort();
+        }
+        done[num_done++] = li.loop[i].header;
+        n += reduce_loop(ir, &li, &li.loop[i]);
+        ir_free_loops(&li);
+        ir_number_blocks(ir);
+        ir_build_cfg(ir);
+        ir_liveness(ir);
+    }
+    free(done);
+    return n;
+}
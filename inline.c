@@ -0,0 +1,216 @@
+#include "minicc.h"
+
+/*
+ * inlining on the IR (-O2)
+ *
+ * A call to a function defined in the unit is replaced by a fresh copy
+ * of the callee's IR when that is small: after dead code elimination it
+ * must have no more instructions than the threshold
+ * (--inline-threshold).  Recursive callees are not inlined.  The
+ * callee's temporaries and variables become temporaries of the caller,
+ * its parameters are assigned the arguments, and each ret assigns the
+ * result and jumps to the code after the call, unless that is a ret of
+ * the result: then the rets stay, so a tail call of the copy remains one.
+ * Calls the copy makes are not inlined in turn.
+ */
+#define INLINE_THRESHOLD    20
+
+static int count_insns(const IR_FUNC *ir)
+{
+    const IR_BLOCK *bp;
+    const IR_INSN *ip;
+    int n = 0;
+
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        for (ip = bp->head; ip != NULL; ip = ip->next)
+            n++;
+    }
+    return n;
+}
+
+/* its arrays and pointers would need a frame and 64 bit temporaries */
+static bool uses_arrays(const IR_FUNC *ir)
+{
+    const IR_BLOCK *bp;
+    const IR_INSN *ip;
+    int i;
+
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        for (ip = bp->head; ip != NULL; ip = ip->next) {
+            if (ip->op == IR_LOAD || ip->op == IR_STORE)
+                return true;
+            for (i = 0; i < ip->num_arg; i++) {
+                if (ip->arg[i].kind == OPD_ARRAY
+                        || ir_is_pointer(ir, &ip->arg[i]))
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool calls(const IR_FUNC *ir, const SYMBOL *func)
+{
+    const IR_BLOCK *bp;
+    const IR_INSN *ip;
+
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        for (ip = bp->head; ip != NULL; ip = ip->next) {
+            if (ip->op == IR_CALL && ip->a.sym == func)
+                return true;
+        }
+    }
+    return false;
+}
+
+/* the IR to substitute for a call to func, or NULL */
+static IR_FUNC *inline_body(const IR_FUNC *caller, SYMBOL *func, int threshold)
+{
+    IR_FUNC *ir;
+
+    if (func == caller->func || func->body == NULL)
+        return NULL;
+    if ((ir = build_ir(func)) == NULL)
+        return NULL;
+    eliminate_dead_code(ir);
+    if (calls(ir, func) || uses_arrays(ir) || count_insns(ir) > threshold)
+        return NULL;
+    return ir;
+}
+
+static IR_INSN *new_insn(IR_OP op, const POS *pos)
+{
+    IR_INSN *ip = (IR_INSN*) arena_alloc(AK_IR, sizeof (IR_INSN));
+    memset(ip, 0, sizeof (IR_INSN));
+    ip->op = op;
+    ip->pos = pos;
+    return ip;
+}
+
+static void append_insn(IR_BLOCK *bp, IR_INSN *ip)
+{
+    ip->prev = bp->tail;
+    ip->next = NULL;
+    if (bp->tail)
+        bp->tail->next = ip;
+    else
+        bp->head = ip;
+    bp->tail = ip;
+}
+
+/* a callee operand as an operand of the caller */
+static void map_operand(const IR_FUNC *callee, int base, OPERAND *o)
+{
+    int v = ir_vreg(callee, o);
+
+    if (v < 0)
+        return;
+    o->kind = OPD_TEMP;
+    o->num = base + v;
+    o->sym = NULL;
+}
+
+/*
+ * replace call, an instruction of bp, by callee.  Returns the block
+ * holding the instructions that followed the call.
+ */
+static IR_BLOCK *substitute(IR_FUNC *ir, IR_BLOCK *bp, IR_INSN *call,
+                        IR_FUNC *callee)
+{
+    IR_BLOCK *cont = (IR_BLOCK*) arena_alloc(AK_IR, sizeof (IR_BLOCK));
+    int base = ir->num_temp;
+    IR_BLOCK *cb, *last = NULL;
+    IR_INSN *ip, *next;
+    bool tail = call->next == bp->tail && bp->tail->op == IR_RET
+                && (bp->tail->a.kind == OPD_NONE
+                    || (bp->tail->a.kind == call->dst.kind
+                        && bp->tail->a.num == call->dst.num));
+    int i;
+
+    ir->num_temp += ir_num_vreg(callee);
+
+    /* the instructions after the call continue in a block of their own */
+    memset(cont, 0, sizeof (IR_BLOCK));
+    cont->head = call->next;
+    cont->tail = bp->tail;
+    cont->head->prev = NULL;
+    bp->tail = call->prev;
+    if (bp->tail)
+        bp->tail->next = NULL;
+    else
+        bp->head = NULL;
+
+    for (i = 0; i < callee->num_var; i++) {
+        const SYMBOL *p = callee->var[i];
+        if (p->kind == SK_PARAM && p->num < call->num_arg) {
+            ip = new_insn(IR_MOV, call->pos);
+            ip->dst.kind = OPD_TEMP;
+            ip->dst.num = base + callee->num_temp + i;
+            ip->a = call->arg[p->num];
+            append_insn(bp, ip);
+        }
+    }
+    ip = new_insn(IR_JMP, call->pos);
+    ip->target[0] = callee->entry;
+    append_insn(bp, ip);
+
+    for (cb = callee->entry; cb != NULL; cb = cb->next) {
+        for (ip = cb->head; ip != NULL; ip = next) {
+            next = ip->next;
+            map_operand(callee, base, &ip->dst);
+            map_operand(callee, base, &ip->a);
+            map_operand(callee, base, &ip->b);
+            map_operand(callee, base, &ip->c);
+            for (i = 0; i < ip->num_arg; i++)
+                map_operand(callee, base, &ip->arg[i]);
+            if (ip->op != IR_RET || tail)
+                continue;
+            if (ip->a.kind != OPD_NONE) {
+                ip->op = IR_MOV;
+                ip->dst = call->dst;
+                ip = new_insn(IR_JMP, ip->pos);
+                append_insn(cb, ip);
+            } else {
+                ip->op = IR_JMP;
+            }
+            ip->target[0] = cont;
+        }
+        last = cb;
+    }
+    last->next = cont;
+    cont->next = bp->next;
+    bp->next = callee->entry;
+    return cont;
+}
+
+/* returns the number of calls inlined */
+int inline_calls(IR_FUNC *ir)
+{
+    int threshold = g_compiler->inline_threshold;
+    IR_FUNC *callee = NULL;
+    IR_BLOCK *bp;
+    IR_INSN *ip;
+    int n = 0;
+
+    if (threshold < 0)
+        return 0;
+    if (threshold == 0)
+        threshold = INLINE_THRESHOLD;
+    for (bp = ir->entry; bp != NULL; ) {
+        for (ip = bp->head; ip != NULL; ip = ip->next) {
+            if (ip->op == IR_CALL && ip->a.kind == OPD_FUNC
+                    && (callee = inline_body(ir, ip->a.sym, threshold)))
+                break;
+        }
+        if (ip == NULL) {
+            bp = bp->next;
+            continue;
+        }
+        /* carry on after the copy */
+        bp = substitute(ir, bp, ip, callee);
+        n++;
+    }
+    ir_number_blocks(ir);
+    ir_build_cfg(ir);
+    return n;
+}
@@ -0,0 +1,1362 @@
+#include "minicc.h"
+
+/*
+ * three-address IR: construction from the tree, CFG, liveness and loops
+ *
+ * build_ir() lowers the body of a function statement by statement into
+ * blocks.  Expressions are flattened into temporaries, conditions into
+ * br instructions with a true and a false block, so && and || only
+ * produce a value when one is needed.  Code following a terminator goes
+ * to a new block without predecessors.  A construct the IR does not
+ * cover yet makes build_ir() return NULL, and gen.c generates the
+ * function from the tree instead.
+ */
+
+typedef struct {
+    const char *id;
+    IR_BLOCK *block;
+    bool defined;
+} IR_LABEL;
+
+typedef struct {
+    IR_FUNC *ir;
+    IR_BLOCK *cur;          /* NULL after a terminator */
+    IR_BLOCK *last;         /* end of the layout */
+    IR_BLOCK *break_block;
+    IR_BLOCK *continue_block;
+    IR_INSN *sw;            /* innermost switch */
+    IR_LABEL *label;
+    int num_label;
+    int max_label;
+    const POS *pos;         /* of the statement being built */
+    bool ok;
+} BUILDER;
+
+static void *ir_alloc(size_t size)
+{
+    void *p = arena_alloc(AK_IR, size);
+    memset(p, 0, size);
+    return p;
+}
+
+/* grow an array allocated by ir_alloc() */
+static void *ir_grow(void *p, int num, int *max, size_t size)
+{
+    void *q;
+
+    *max = (*max == 0) ? 8 : *max * 2;
+    q = ir_alloc(*max * size);
+    if (p != NULL)
+        memcpy(q, p, num * size);
+    return q;
+}
+
+static void fail(BUILDER *b)
+{
+    b->ok = false;
+}
+
+/*
+ * blocks and instructions
+ */
+static IR_BLOCK *new_block(BUILDER *b)
+{
+    IR_BLOCK *bp = (IR_BLOCK*) ir_alloc(sizeof (IR_BLOCK));
+    bp->id = -1;
+    bp->label = -1;
+    return bp;
+}
+
+/* place bp at the end of the layout and continue there */
+static void start_block(BUILDER *b, IR_BLOCK *bp)
+{
+    assert(b->cur == NULL && bp->id < 0);
+    bp->id = b->ir->num_block++;
+    if (b->last)
+        b->last->next = bp;
+    else
+        b->ir->entry = bp;
+    b->last = bp;
+    b->cur = bp;
+}
+
+static IR_INSN *emit_insn(BUILDER *b, IR_OP op)
+{
+    IR_INSN *ip = (IR_INSN*) ir_alloc(sizeof (IR_INSN));
+    IR_BLOCK *bp;
+
+    if (b->cur == NULL)
+        start_block(b, new_block(b));  /* unreachable */
+    bp = b->cur;
+    ip->op = op;
+    ip->pos = b->pos;
+    ip->prev = bp->tail;
+    if (bp->tail)
+        bp->tail->next = ip;
+    else
+        bp->head = ip;
+    bp->tail = ip;
+    if (ir_is_terminator(op))
+        b->cur = NULL;
+    return ip;
+}
+
+static void emit_jmp(BUILDER *b, IR_BLOCK *target)
+{
+    if (b->cur != NULL)
+        emit_insn(b, IR_JMP)->target[0] = target;
+}
+
+/* fall or jump into bp and continue there */
+static void enter_block(BUILDER *b, IR_BLOCK *bp)
+{
+    emit_jmp(b, bp);
+    start_block(b, bp);
+}
+
+/*
+ * operands
+ */
+static OPERAND new_temp(BUILDER *b)
+{
+    OPERAND o;
+    memset(&o, 0, sizeof o);
+    o.kind = OPD_TEMP;
+    o.num = b->ir->num_temp++;
+    return o;
+}
+
+static OPERAND imm_operand(int n)
+{
+    OPERAND o;
+    memset(&o, 0, sizeof o);
+    o.kind = OPD_IMM;
+    o.num = n;
+    return o;
+}
+
+static OPERAND sym_operand(BUILDER *b, SYMBOL *sym)
+{
+    IR_FUNC *ir = b->ir;
+    OPERAND o;
+    int i;
+
+    memset(&o, 0, sizeof o);
+    o.sym = sym;
+    switch (sym->kind) {
+    case SK_GLOBAL:
+        o.kind = OPD_GLOBAL;
+        return o;
+    case SK_FUNC:
+        o.kind = OPD_FUNC;
+        return o;
+    default:
+        break;
+    }
+    o.kind = OPD_VAR;
+    for (i = 0; i < ir->num_var; i++) {
+        if (ir->var[i] == sym)
+            break;
+    }
+    if (i == ir->num_var) {
+        if (ir->num_var == ir->max_var)
+            ir->var = (SYMBOL**) ir_grow(ir->var, ir->num_var, &ir->max_var,
+                                            sizeof (SYMBOL*));
+        ir->var[ir->num_var++] = sym;
+    }
+    o.num = i;
+    return o;
+}
+
+static bool is_scalar(const TYPE *t)
+{
+    return t != NULL && (is_integer_type(t) || t->kind == T_ENUM);
+}
+
+/* a local array, or a parameter pointing to the elements */
+static bool is_array_base(const SYMBOL *sym)
+{
+    if (sym->type->kind == T_ARRAY)
+        return sym->kind == SK_LOCAL || sym->kind == SK_PARAM;
+    return sym->type->kind == T_POINTER && sym->kind == SK_PARAM;
+}
+
+static OPERAND base_operand(BUILDER *b, SYMBOL *sym)
+{
+    OPERAND o;
+
+    if (sym->kind == SK_PARAM)
+        return sym_operand(b, sym);
+    memset(&o, 0, sizeof o);
+    o.kind = OPD_ARRAY;
+    o.sym = sym;
+    return o;
+}
+
+/*
+ * expressions
+ */
+static OPERAND build_expr(BUILDER *b, NODE *np);
+static void build_effect(BUILDER *b, NODE *np);
+static void build_cond(BUILDER *b, NODE *np, IR_BLOCK *t, IR_BLOCK *f);
+
+static OPERAND emit_arith(BUILDER *b, IR_OP op, OPERAND a, OPERAND c,
+                        bool is_unsigned)
+{
+    IR_INSN *ip = emit_insn(b, op);
+    ip->dst = new_temp(b);
+    ip->a = a;
+    ip->b = c;
+    ip->is_unsigned = is_unsigned;
+    return ip->dst;
+}
+
+static void emit_mov(BUILDER *b, OPERAND dst, OPERAND src)
+{
+    IR_INSN *ip = emit_insn(b, IR_MOV);
+    ip->dst = dst;
+    ip->a = src;
+}
+
+static IR_OP binary_op(NODE_KIND kind)
+{
+    switch (kind) {
+    case NK_ADD: case NK_AS_ADD:    return IR_ADD;
+    case NK_SUB: case NK_AS_SUB:    return IR_SUB;
+    case NK_MUL: case NK_AS_MUL:    return IR_MUL;
+    case NK_DIV: case NK_AS_DIV:    return IR_DIV;
+    case NK_MOD: case NK_AS_MOD:    return IR_MOD;
+    case NK_AND: case NK_AS_AND:    return IR_AND;
+    case NK_OR:  case NK_AS_OR:     return IR_OR;
+    case NK_XOR: case NK_AS_XOR:    return IR_XOR;
+    case NK_SHL: case NK_AS_SHL:    return IR_SHL;
+    case NK_SHR: case NK_AS_SHR:    return IR_SHR;
+    default:
+        assert(0);
+        return IR_MOV;
+    }
+}
+
+/* what an assignment stores to: a variable or global, or an element */
+typedef struct {
+    OPERAND var;
+    OPERAND base;       /* of the element, OPD_NONE for var */
+    OPERAND index;
+} LVALUE;
+
+/*
+ * the base and the index in ints of the element np (NK_ARRAY) designates.
+ * Elements are ints and rows of them; np's array is a local array, a
+ * pointer parameter or a row.
+ */
+static bool build_index(BUILDER *b, NODE *np, OPERAND *base, OPERAND *index)
+{
+    NODE *arr = np->u.link.left;
+    int size = get_type_size(np->type);
+    OPERAND i;
+
+    if (size == 0 || size % BYTE_INT != 0) {
+        fail(b);
+        return false;
+    }
+    if (arr->kind == NK_ARRAY && arr->type->kind == T_ARRAY) {
+        if (!build_index(b, arr, base, index))
+            return false;
+    } else if (arr->kind == NK_ID && is_array_base(arr->u.sym)) {
+        *base = base_operand(b, arr->u.sym);
+        *index = imm_operand(0);
+    } else {
+        fail(b);
+        return false;
+    }
+    i = build_expr(b, np->u.link.right);
+    if (i.kind == OPD_IMM)
+        i.num *= size / BYTE_INT;
+    else if (size != BYTE_INT)
+        i = emit_arith(b, IR_MUL, i, imm_operand(size / BYTE_INT), false);
+    if (index->kind == OPD_IMM && index->num == 0)
+        *index = i;
+    else if (index->kind == OPD_IMM && i.kind == OPD_IMM)
+        index->num += i.num;
+    else
+        *index = emit_arith(b, IR_ADD, *index, i, false);
+    return true;
+}
+
+static bool is_int_element(const NODE *np)
+{
+    return np->kind == NK_ARRAY && is_scalar(np->type)
+        && get_type_size(np->type) == BYTE_INT;
+}
+
+static bool build_lvalue(BUILDER *b, NODE *np, LVALUE *lv)
+{
+    memset(lv, 0, sizeof (LVALUE));
+    if (is_int_element(np))
+        return build_index(b, np, &lv->base, &lv->index);
+    if (np->kind != NK_ID || np->u.sym->kind == SK_FUNC
+            || !is_scalar(np->u.sym->type)
+            || (np->u.sym->type->tqual & TQ_VOLATILE)) {
+        fail(b);
+        return false;
+    }
+    lv->var = sym_operand(b, np->u.sym);
+    return true;
+}
+
+/* the value of lv, loaded into a temporary unless it is a variable */
+static OPERAND load(BUILDER *b, const LVALUE *lv)
+{
+    IR_INSN *ip;
+    OPERAND t;
+
+    if (lv->base.kind != OPD_NONE) {
+        ip = emit_insn(b, IR_LOAD);
+        ip->dst = new_temp(b);
+        ip->a = lv->base;
+        ip->b = lv->index;
+        return ip->dst;
+    }
+    if (lv->var.kind != OPD_GLOBAL)
+        return lv->var;
+    t = new_temp(b);
+    emit_mov(b, t, lv->var);
+    return t;
+}
+
+/* lv = v, the value of the assignment */
+static OPERAND store(BUILDER *b, const LVALUE *lv, OPERAND v)
+{
+    IR_INSN *last = b->cur ? b->cur->tail : NULL;
+    IR_INSN *ip;
+
+    if (lv->base.kind != OPD_NONE) {
+        ip = emit_insn(b, IR_STORE);
+        ip->a = lv->base;
+        ip->b = lv->index;
+        ip->c = v;
+        return v;
+    }
+    /* a temporary just computed is computed into the variable instead */
+    if (lv->var.kind == OPD_VAR && v.kind == OPD_TEMP && last != NULL
+            && last->dst.kind == OPD_TEMP && last->dst.num == v.num) {
+        last->dst = lv->var;
+        return lv->var;
+    }
+    emit_mov(b, lv->var, v);
+    return (lv->var.kind == OPD_GLOBAL) ? v : lv->var;
+}
+
+static OPERAND build_assign(BUILDER *b, NODE *np)
+{
+    LVALUE lv;
+    OPERAND v;
+    NODE *left = np->u.link.left;
+
+    if (!build_lvalue(b, left, &lv))
+        return imm_operand(0);
+    v = build_expr(b, np->u.link.right);
+    if (np->kind != NK_ASSIGN) {
+        bool uns = (np->kind == NK_AS_SHL || np->kind == NK_AS_SHR)
+                    ? is_unsigned_type(promote_type(left->type))
+                    : is_unsigned_type(arith_conv_type(left->type,
+                                                np->u.link.right->type));
+        v = emit_arith(b, binary_op(np->kind), load(b, &lv), v, uns);
+    }
+    return store(b, &lv, v);
+}
+
+/* x++ whose value is not used is built as ++x (need_old false) */
+static OPERAND build_incdec(BUILDER *b, NODE *np, bool need_old)
+{
+    LVALUE lv;
+    OPERAND old, v;
+    IR_OP op = (np->kind == NK_PREINC || np->kind == NK_POSTINC)
+                ? IR_ADD : IR_SUB;
+
+    if (!build_lvalue(b, np->u.link.left, &lv))
+        return imm_operand(0);
+    old = load(b, &lv);
+    if (need_old && (np->kind == NK_POSTINC || np->kind == NK_POSTDEC)) {
+        if (old.kind != OPD_TEMP) {
+            OPERAND t = new_temp(b);
+            emit_mov(b, t, old);
+            old = t;
+        }
+        store(b, &lv, emit_arith(b, op, old, imm_operand(1), false));
+        return old;
+    }
+    v = emit_arith(b, op, old, imm_operand(1), false);
+    return store(b, &lv, v);
+}
+
+/* t = 1 if np holds, else 0 */
+static OPERAND build_cond_value(BUILDER *b, NODE *np)
+{
+    IR_BLOCK *t = new_block(b), *f = new_block(b), *join = new_block(b);
+    OPERAND v = new_temp(b);
+
+    build_cond(b, np, t, f);
+    start_block(b, t);
+    emit_mov(b, v, imm_operand(1));
+    emit_jmp(b, join);
+    start_block(b, f);
+    emit_mov(b, v, imm_operand(0));
+    enter_block(b, join);
+    return v;
+}
+
+static OPERAND build_select(BUILDER *b, NODE *np)
+{
+    IR_BLOCK *t = new_block(b), *f = new_block(b), *join = new_block(b);
+    OPERAND v = new_temp(b);
+
+    build_cond(b, np->u.link.left, t, f);
+    start_block(b, t);
+    emit_mov(b, v, build_expr(b, np->u.link.right->u.link.left));
+    emit_jmp(b, join);
+    start_block(b, f);
+    emit_mov(b, v, build_expr(b, np->u.link.right->u.link.right));
+    enter_block(b, join);
+    return v;
+}
+
+/* arguments are evaluated last to first, as gen.c does */
+static OPERAND build_call(BUILDER *b, NODE *np)
+{
+    NODE *arg[MAX_ARGS];
+    OPERAND *val;
+    OPERAND callee;
+    IR_INSN *ip;
+    NODE *a;
+    int i, n = 0;
+
+    for (a = np->u.link.right; a != NULL; a = a->u.link.right) {
+        if (n == MAX_ARGS) {
+            fail(b);
+            return imm_operand(0);
+        }
+        arg[n++] = a->u.link.left;
+    }
+    val = (OPERAND*) ir_alloc(sizeof (OPERAND) * (n + 1));
+    for (i = n - 1; i >= 0; i--) {
+        if (arg[i]->kind == NK_ID && is_array_base(arg[i]->u.sym))
+            val[i] = base_operand(b, arg[i]->u.sym);
+        else
+            val[i] = build_expr(b, arg[i]);
+    }
+    /* a call through a pointer leaves the function to the tree generator */
+    if (np->u.link.left->kind != NK_ID
+            || np->u.link.left->u.sym->kind != SK_FUNC) {
+        fail(b);
+        return imm_operand(0);
+    }
+    callee = sym_operand(b, np->u.link.left->u.sym);
+    ip = emit_insn(b, IR_CALL);
+    ip->dst = new_temp(b);
+    ip->a = callee;
+    ip->arg = val;
+    ip->num_arg = n;
+    return ip->dst;
+}
+
+static OPERAND build_expr(BUILDER *b, NODE *np)
+{
+    OPERAND v;
+
+    if (np == NULL || !b->ok) {
+        fail(b);
+        return imm_operand(0);
+    }
+    switch (np->kind) {
+    case NK_ID:
+    case NK_ARRAY:
+        {
+            LVALUE lv;
+            if (np->kind == NK_ARRAY && !is_int_element(np))
+                break;
+            if (!build_lvalue(b, np, &lv))
+                return imm_operand(0);
+            return load(b, &lv);
+        }
+    case NK_CHAR_LIT:
+    case NK_INT_LIT:
+        return imm_operand(np->u.num);
+    case NK_STRING_LIT:
+        memset(&v, 0, sizeof v);
+        v.kind = OPD_STR;
+        v.str = np->u.str;
+        return v;
+    case NK_ASSIGN:
+    case NK_AS_MUL: case NK_AS_DIV: case NK_AS_MOD:
+    case NK_AS_ADD: case NK_AS_SUB: case NK_AS_SHL: case NK_AS_SHR:
+    case NK_AS_AND: case NK_AS_XOR: case NK_AS_OR:
+        return build_assign(b, np);
+    case NK_PREINC: case NK_PREDEC:
+    case NK_POSTINC: case NK_POSTDEC:
+        return build_incdec(b, np, true);
+    case NK_EQ: case NK_NEQ: case NK_LT: case NK_GT: case NK_LE: case NK_GE:
+        v = build_expr(b, np->u.link.left);
+        {
+            OPERAND r = build_expr(b, np->u.link.right);
+            IR_INSN *ip = emit_insn(b, IR_SET);
+            ip->dst = new_temp(b);
+            ip->cond = (IR_COND) (np->kind - NK_EQ);
+            ip->is_unsigned = is_unsigned_compare(np);
+            ip->a = v;
+            ip->b = r;
+            return ip->dst;
+        }
+    case NK_LAND:
+    case NK_LOR:
+        return build_cond_value(b, np);
+    case NK_NOT:
+        {
+            IR_INSN *ip;
+            v = build_expr(b, np->u.link.left);
+            ip = emit_insn(b, IR_SET);
+            ip->dst = new_temp(b);
+            ip->cond = IC_EQ;
+            ip->a = v;
+            ip->b = imm_operand(0);
+            return ip->dst;
+        }
+    case NK_SHL: case NK_SHR:
+        v = build_expr(b, np->u.link.left);
+        return emit_arith(b, binary_op(np->kind), v,
+                        build_expr(b, np->u.link.right),
+                        is_unsigned_type(np->type));
+    case NK_ADD: case NK_SUB: case NK_MUL: case NK_DIV: case NK_MOD:
+    case NK_OR: case NK_XOR: case NK_AND:
+        if (!is_scalar(np->type))
+            break;
+        v = build_expr(b, np->u.link.left);
+        return emit_arith(b, binary_op(np->kind), v,
+                        build_expr(b, np->u.link.right),
+                        is_unsigned_type(np->type));
+    case NK_UPLUS:
+        return build_expr(b, np->u.link.left);
+    case NK_UMINUS:
+        return emit_arith(b, IR_NEG, build_expr(b, np->u.link.left),
+                        imm_operand(0), false);
+    case NK_COMPLEMENT:
+        return emit_arith(b, IR_NOT, build_expr(b, np->u.link.left),
+                        imm_operand(0), false);
+    case NK_COND:
+        return build_select(b, np);
+    case NK_CALL:
+        return build_call(b, np);
+    case NK_EXPR_LINK:
+        build_effect(b, np->u.link.left);
+        return build_expr(b, np->u.link.right);
+    default:
+        break;
+    }
+    fail(b);
+    return imm_operand(0);
+}
+
+/* np for its side effects only */
+static void build_effect(BUILDER *b, NODE *np)
+{
+    if (np->kind == NK_POSTINC || np->kind == NK_POSTDEC)
+        build_incdec(b, np, false);
+    else
+        build_expr(b, np);
+}
+
+static void emit_br(BUILDER *b, IR_COND cond, bool is_unsigned,
+                    OPERAND x, OPERAND y, IR_BLOCK *t, IR_BLOCK *f)
+{
+    static const IR_COND swapped[] = { IC_EQ, IC_NE, IC_GT, IC_LT, IC_GE, IC_LE };
+    IR_INSN *ip;
+
+    if (x.kind == OPD_IMM && y.kind != OPD_IMM) {
+        /* keep the immediate on the right */
+        OPERAND o = x;
+        x = y;
+        y = o;
+        cond = swapped[cond];
+    }
+    ip = emit_insn(b, IR_BR);
+    ip->cond = cond;
+    ip->is_unsigned = is_unsigned;
+    ip->a = x;
+    ip->b = y;
+    ip->target[0] = t;
+    ip->target[1] = f;
+}
+
+/* go to t if np holds, else to f */
+static void build_cond(BUILDER *b, NODE *np, IR_BLOCK *t, IR_BLOCK *f)
+{
+    IR_BLOCK *mid;
+    OPERAND x;
+
+    switch (np->kind) {
+    case NK_EQ: case NK_NEQ: case NK_LT: case NK_GT: case NK_LE: case NK_GE:
+        x = build_expr(b, np->u.link.left);
+        emit_br(b, (IR_COND) (np->kind - NK_EQ), is_unsigned_compare(np),
+                x, build_expr(b, np->u.link.right), t, f);
+        break;
+    case NK_NOT:
+        build_cond(b, np->u.link.left, f, t);
+        break;
+    case NK_LAND:
+        mid = new_block(b);
+        build_cond(b, np->u.link.left, mid, f);
+        start_block(b, mid);
+        build_cond(b, np->u.link.right, t, f);
+        break;
+    case NK_LOR:
+        mid = new_block(b);
+        build_cond(b, np->u.link.left, t, mid);
+        start_block(b, mid);
+        build_cond(b, np->u.link.right, t, f);
+        break;
+    case NK_CHAR_LIT:
+    case NK_INT_LIT:
+        emit_jmp(b, np->u.num ? t : f);
+        break;
+    default:
+        x = build_expr(b, np);
+        emit_br(b, IC_NE, false, x, imm_operand(0), t, f);
+        break;
+    }
+}
+
+/*
+ * statements
+ */
+static IR_BLOCK *get_label(BUILDER *b, const char *id)
+{
+    int i;
+
+    for (i = 0; i < b->num_label; i++) {
+        if (b->label[i].id == id || strcmp(b->label[i].id, id) == 0)
+            return b->label[i].block;
+    }
+    if (b->num_label == b->max_label)
+        b->label = (IR_LABEL*) ir_grow(b->label, b->num_label, &b->max_label,
+                                        sizeof (IR_LABEL));
+    b->label[b->num_label].id = id;
+    b->label[b->num_label].block = new_block(b);
+    return b->label[b->num_label++].block;
+}
+
+static void add_case(BUILDER *b, int value, IR_BLOCK *bp)
+{
+    IR_INSN *sw = b->sw;
+
+    if (sw->num_case == sw->max_case)
+        sw->cases = (IR_CASE*) ir_grow(sw->cases, sw->num_case, &sw->max_case,
+                                        sizeof (IR_CASE));
+    sw->cases[sw->num_case].value = value;
+    sw->cases[sw->num_case++].block = bp;
+}
+
+static void build_stmt(BUILDER *b, NODE *np);
+
+/* the body of a loop, with break and continue going to brk and cont */
+static void build_loop_body(BUILDER *b, NODE *np, IR_BLOCK *brk,
+                            IR_BLOCK *cont)
+{
+    IR_BLOCK *save_break = b->break_block;
+    IR_BLOCK *save_continue = b->continue_block;
+
+    b->break_block = brk;
+    b->continue_block = cont;
+    build_stmt(b, np);
+    b->break_block = save_break;
+    b->continue_block = save_continue;
+}
+
+static void build_switch(BUILDER *b, NODE *np)
+{
+    IR_INSN *save_switch = b->sw;
+    IR_BLOCK *save_break = b->break_block;
+    IR_BLOCK *end = new_block(b);
+    OPERAND v = build_expr(b, np->u.link.left);
+    IR_INSN *ip = emit_insn(b, IR_SWITCH);
+
+    ip->a = v;
+    ip->is_unsigned = is_unsigned_type(promote_type(np->u.link.left->type));
+    b->sw = ip;
+    b->break_block = end;
+    build_stmt(b, np->u.link.right);
+    b->sw = save_switch;
+    b->break_block = save_break;
+    if (ip->target[0] == NULL)
+        ip->target[0] = end;
+    enter_block(b, end);
+}
+
+static void build_stmt(BUILDER *b, NODE *np)
+{
+    IR_BLOCK *head, *body, *step, *exit, *bp;
+    NODE *p;
+
+    if (np == NULL || !b->ok)
+        return;
+    b->pos = &np->pos;
+    switch (np->kind) {
+    case NK_COMPOUND:
+        build_stmt(b, np->u.comp.node);
+        break;
+    case NK_LINK:
+        build_stmt(b, np->u.link.left);
+        build_stmt(b, np->u.link.right);
+        break;
+    case NK_EXPR:
+        if (np->u.link.left)
+            build_effect(b, np->u.link.left);
+        break;
+    case NK_IF:
+        body = new_block(b);
+        exit = new_block(b);
+        p = np->u.link.right;
+        bp = p->u.link.right ? new_block(b) : exit;
+        build_cond(b, np->u.link.left, body, bp);
+        start_block(b, body);
+        build_stmt(b, p->u.link.left);
+        if (p->u.link.right) {
+            emit_jmp(b, exit);
+            start_block(b, bp);
+            build_stmt(b, p->u.link.right);
+        }
+        enter_block(b, exit);
+        break;
+    case NK_WHILE:
+        head = new_block(b);
+        body = new_block(b);
+        exit = new_block(b);
+        enter_block(b, head);
+        build_cond(b, np->u.link.left, body, exit);
+        start_block(b, body);
+        build_loop_body(b, np->u.link.right, exit, head);
+        emit_jmp(b, head);
+        start_block(b, exit);
+        break;
+    case NK_DO:
+        body = new_block(b);
+        step = new_block(b);
+        exit = new_block(b);
+        enter_block(b, body);
+        build_loop_body(b, np->u.link.left, exit, step);
+        enter_block(b, step);
+        b->pos = &np->pos;
+        build_cond(b, np->u.link.right, body, exit);
+        start_block(b, exit);
+        break;
+    case NK_FOR:
+        if (np->u.link.left)
+            build_effect(b, np->u.link.left);
+        p = np->u.link.right;                   /* NK_FOR2 */
+        head = new_block(b);
+        body = new_block(b);
+        step = new_block(b);
+        exit = new_block(b);
+        enter_block(b, head);
+        if (p->u.link.left)
+            build_cond(b, p->u.link.left, body, exit);
+        else
+            emit_jmp(b, body);
+        start_block(b, body);
+        p = p->u.link.right;                    /* NK_FOR3 */
+        build_loop_body(b, p->u.link.right, exit, step);
+        enter_block(b, step);
+        b->pos = &np->pos;
+        if (p->u.link.left)
+            build_effect(b, p->u.link.left);
+        emit_jmp(b, head);
+        start_block(b, exit);
+        break;
+    case NK_SWITCH:
+        build_switch(b, np);
+        break;
+    case NK_CASE:
+    case NK_DEFAULT:
+        if (b->sw == NULL) {
+            fail(b);
+            break;
+        }
+        bp = new_block(b);
+        enter_block(b, bp);
+        if (np->kind == NK_CASE) {
+            add_case(b, np->u.num_node.num, bp);
+            build_stmt(b, np->u.num_node.node);
+        } else {
+            b->sw->target[0] = bp;
+            build_stmt(b, np->u.link.left);
+        }
+        break;
+    case NK_BREAK:
+    case NK_CONTINUE:
+        bp = (np->kind == NK_BREAK) ? b->break_block : b->continue_block;
+        if (bp == NULL) {
+            fail(b);
+            break;
+        }
+        emit_jmp(b, bp);
+        break;
+    case NK_GOTO:
+        emit_jmp(b, get_label(b, np->u.id));
+        break;
+    case NK_LABEL:
+        bp = get_label(b, np->u.idnode.id);
+        enter_block(b, bp);
+        build_stmt(b, np->u.idnode.node);
+        break;
+    case NK_RETURN:
+        {
+            OPERAND v;
+            IR_INSN *ip;
+            memset(&v, 0, sizeof v);
+            if (np->u.link.left)
+                v = build_expr(b, np->u.link.left);
+            ip = emit_insn(b, IR_RET);
+            ip->a = v;
+        }
+        break;
+    default:
+        fail(b);
+        break;
+    }
+}
+
+IR_FUNC *build_ir(SYMBOL *func)
+{
+    BUILDER b;
+    SYMBOL *p;
+    int i;
+
+    memset(&b, 0, sizeof b);
+    b.ok = true;
+    b.ir = (IR_FUNC*) ir_alloc(sizeof (IR_FUNC));
+    b.ir->func = func;
+    /* the parameters come first, in order */
+    for (p = func->tab ? func->tab->head : NULL; p != NULL; p = p->next) {
+        if (p->kind == SK_PARAM)
+            sym_operand(&b, p);
+    }
+    start_block(&b, new_block(&b));
+    build_stmt(&b, func->body);
+    if (b.cur != NULL)
+        emit_insn(&b, IR_RET);
+    for (i = 0; i < b.num_label; i++) {
+        if (b.label[i].block->id < 0)
+            fail(&b);           /* goto to an undefined label */
+    }
+    if (!b.ok)
+        return NULL;
+    ir_build_cfg(b.ir);
+    return b.ir;
+}
+
+/*
+ * CFG
+ */
+bool ir_is_terminator(IR_OP op)
+{
+    return op == IR_JMP || op == IR_BR || op == IR_SWITCH || op == IR_RET;
+}
+
+static void add_edge(IR_BLOCK *from, IR_BLOCK *to, int *max_succ)
+{
+    int i;
+
+    for (i = 0; i < from->num_succ; i++) {
+        if (from->succ[i] == to)
+            return;
+    }
+    if (from->num_succ == *max_succ)
+        from->succ = (IR_BLOCK**) ir_grow(from->succ, from->num_succ,
+                                            max_succ, sizeof (IR_BLOCK*));
+    from->succ[from->num_succ++] = to;
+    to->num_pred++;
+}
+
+/* number the blocks in layout order */
+void ir_number_blocks(IR_FUNC *ir)
+{
+    IR_BLOCK *bp;
+
+    ir->num_block = 0;
+    for (bp = ir->entry; bp != NULL; bp = bp->next)
+        bp->id = ir->num_block++;
+}
+
+/* recompute succ and pred from the terminators */
+void ir_build_cfg(IR_FUNC *ir)
+{
+    IR_BLOCK *bp;
+    IR_INSN *ip;
+    int i, max;
+
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        bp->succ = NULL;
+        bp->num_succ = bp->num_pred = 0;
+    }
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        ip = bp->tail;
+        max = 0;
+        assert(ip && ir_is_terminator(ip->op));
+        switch (ip->op) {
+        case IR_SWITCH:
+            for (i = 0; i < ip->num_case; i++)
+                add_edge(bp, ip->cases[i].block, &max);
+            add_edge(bp, ip->target[0], &max);
+            break;
+        case IR_BR:
+            add_edge(bp, ip->target[0], &max);
+            add_edge(bp, ip->target[1], &max);
+            break;
+        case IR_JMP:
+            add_edge(bp, ip->target[0], &max);
+            break;
+        default:
+            break;
+        }
+    }
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        bp->pred = (IR_BLOCK**) ir_alloc(sizeof (IR_BLOCK*)
+                                            * (bp->num_pred + 1));
+        bp->num_pred = 0;
+    }
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        for (i = 0; i < bp->num_succ; i++)
+            bp->succ[i]->pred[bp->succ[i]->num_pred++] = bp;
+    }
+}
+
+/*
+ * liveness
+ *
+ * Temporaries and variables are numbered together as vregs, the
+ * temporaries first.  live_in and live_out are bit sets over vregs.
+ */
+int ir_num_vreg(const IR_FUNC *ir)
+{
+    return ir->num_temp + ir->num_var;
+}
+
+int ir_vreg(const IR_FUNC *ir, const OPERAND *opd)
+{
+    switch (opd->kind) {
+    case OPD_TEMP:
+        return opd->num;
+    case OPD_VAR:
+        return ir->num_temp + opd->num;
+    default:
+        return -1;
+    }
+}
+
+/* a parameter holding the address of array elements */
+bool ir_is_pointer(const IR_FUNC *ir, const OPERAND *opd)
+{
+    const TYPE *t;
+
+    if (opd->kind != OPD_VAR)
+        return false;
+    t = ir->var[opd->num]->type;
+    return t->kind == T_POINTER || t->kind == T_ARRAY;
+}
+
+/* the operands ip reads, at most max */
+int ir_uses(const IR_INSN *ip, const OPERAND **use, int max)
+{
+    int i, n = 0;
+
+    if (ip->a.kind != OPD_NONE && n < max)
+        use[n++] = &ip->a;
+    if (ip->b.kind != OPD_NONE && n < max)
+        use[n++] = &ip->b;
+    if (ip->c.kind != OPD_NONE && n < max)
+        use[n++] = &ip->c;
+    for (i = 0; i < ip->num_arg && n < max; i++)
+        use[n++] = &ip->arg[i];
+    return n;
+}
+
+void ir_liveness(IR_FUNC *ir)
+{
+    int words = SET_WORDS(ir_num_vreg(ir));
+    const OPERAND *use[MAX_ARGS + 2];
+    unsigned *live = (unsigned*) ir_alloc(sizeof (unsigned) * (words + 1));
+    bool changed = true;
+    IR_BLOCK **order;
+    IR_BLOCK *bp;
+    IR_INSN *ip;
+    int i, j, w, n, v;
+
+    order = (IR_BLOCK**) ir_alloc(sizeof (IR_BLOCK*) * (ir->num_block + 1));
+    n = 0;
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        bp->live_in = (unsigned*) ir_alloc(sizeof (unsigned) * (words + 1));
+        bp->live_out = (unsigned*) ir_alloc(sizeof (unsigned) * (words + 1));
+        order[n++] = bp;
+    }
+    /* backwards over the layout converges fastest */
+    while (changed) {
+        changed = false;
+        for (i = n - 1; i >= 0; i--) {
+            bp = order[i];
+            for (j = 0; j < bp->num_succ; j++) {
+                for (w = 0; w < words; w++)
+                    bp->live_out[w] |= bp->succ[j]->live_in[w];
+            }
+            memcpy(live, bp->live_out, sizeof (unsigned) * words);
+            for (ip = bp->tail; ip != NULL; ip = ip->prev) {
+                if ((v = ir_vreg(ir, &ip->dst)) >= 0)
+                    SET_DEL(live, v);
+                for (j = ir_uses(ip, use, MAX_ARGS + 2) - 1; j >= 0; j--) {
+                    if ((v = ir_vreg(ir, use[j])) >= 0)
+                        SET_ADD(live, v);
+                }
+            }
+            for (w = 0; w < words; w++) {
+                if (live[w] != bp->live_in[w]) {
+                    bp->live_in[w] = live[w];
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * loops
+ *
+ * The natural loop of a back edge, an edge to a block that dominates its
+ * source, is the header and the blocks reaching the source without
+ * passing the header.  Back edges to the same header make one loop.
+ */
+static void compute_dominators(IR_LOOPS *li)
+{
+    IR_FUNC *ir = li->ir;
+    int n = ir->num_block, words = SET_WORDS(n);
+    unsigned *tmp = (unsigned*) alloc(sizeof (unsigned) * (words + 1));
+    bool changed = true;
+    IR_BLOCK *bp;
+    int i, j, w;
+
+    li->block = (IR_BLOCK**) alloc(sizeof (IR_BLOCK*) * (n + 1));
+    li->dom = (unsigned**) alloc(sizeof (unsigned*) * (n + 1));
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        li->block[bp->id] = bp;
+        li->dom[bp->id] = (unsigned*) alloc(sizeof (unsigned) * (words + 1));
+        memset(li->dom[bp->id], (bp == ir->entry) ? 0 : 0xff,
+                sizeof (unsigned) * words);
+        if (bp == ir->entry)
+            SET_ADD(li->dom[bp->id], bp->id);
+    }
+    while (changed) {
+        changed = false;
+        for (i = 1; i < n; i++) {
+            bp = li->block[i];
+            memset(tmp, (bp->num_pred > 0) ? 0xff : 0,
+                    sizeof (unsigned) * words);
+            for (j = 0; j < bp->num_pred; j++) {
+                for (w = 0; w < words; w++)
+                    tmp[w] &= li->dom[bp->pred[j]->id][w];
+            }
+            SET_ADD(tmp, i);
+            if (memcmp(tmp, li->dom[i], sizeof (unsigned) * words) != 0) {
+                memcpy(li->dom[i], tmp, sizeof (unsigned) * words);
+                changed = true;
+            }
+        }
+    }
+    free(tmp);
+}
+
+static IR_LOOP *get_loop(IR_LOOPS *li, IR_BLOCK *header)
+{
+    IR_LOOP *lp;
+    int i;
+
+    for (i = 0; i < li->num_loop; i++) {
+        if (li->loop[i].header == header)
+            return &li->loop[i];
+    }
+    if (li->num_loop == li->max_loop) {
+        li->max_loop = li->max_loop ? li->max_loop * 2 : 8;
+        li->loop = (IR_LOOP*) realloc(li->loop,
+                                        sizeof (IR_LOOP) * li->max_loop);
+        if (li->loop == NULL) {
+            fprintf(stderr, "out of memory\n");
+            abort();
+        }
+    }
+    lp = &li->loop[li->num_loop++];
+    lp->header = header;
+    lp->body = (bool*) alloc(sizeof (bool) * (li->ir->num_block + 1));
+    memset(lp->body, 0, sizeof (bool) * (li->ir->num_block + 1));
+    lp->body[header->id] = true;
+    lp->size = 1;
+    return lp;
+}
+
+/* add bp and what reaches it without passing the header */
+static void add_to_loop(IR_LOOP *lp, IR_BLOCK *bp)
+{
+    int i;
+
+    if (lp->body[bp->id])
+        return;
+    lp->body[bp->id] = true;
+    lp->size++;
+    for (i = 0; i < bp->num_pred; i++)
+        add_to_loop(lp, bp->pred[i]);
+}
+
+static int compare_size(const void *a, const void *b)
+{
+    const IR_LOOP *x = (const IR_LOOP*) a;
+    const IR_LOOP *y = (const IR_LOOP*) b;
+    if (x->size != y->size)
+        return x->size - y->size;
+    return x->header->id - y->header->id;
+}
+
+/* the loops of ir, innermost first */
+void ir_find_loops(IR_LOOPS *li, IR_FUNC *ir)
+{
+    IR_BLOCK *bp;
+    int i;
+
+    memset(li, 0, sizeof (IR_LOOPS));
+    li->ir = ir;
+    compute_dominators(li);
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        for (i = 0; i < bp->num_succ; i++) {
+            IR_BLOCK *h = bp->succ[i];
+            if (SET_HAS(li->dom[bp->id], h->id))
+                add_to_loop(get_loop(li, h), bp);
+        }
+    }
+    if (li->num_loop > 1)
+        qsort(li->loop, li->num_loop, sizeof (IR_LOOP), compare_size);
+}
+
+void ir_free_loops(IR_LOOPS *li)
+{
+    int i;
+
+    for (i = 0; i < li->num_loop; i++)
+        free(li->loop[i].body);
+    free(li->loop);
+    for (i = 0; i < li->ir->num_block; i++)
+        free(li->dom[i]);
+    free(li->dom);
+    free(li->block);
+}
+
+/*
+ * a block jumping to the header, which the entries from outside go to.
+ * The only block entering the loop is reused when it ends with a jmp.
+ */
+IR_BLOCK *ir_make_preheader(IR_FUNC *ir, const IR_LOOP *lp)
+{
+    IR_BLOCK *header = lp->header;
+    IR_BLOCK *pre = NULL;
+    IR_INSN *jmp;
+    IR_BLOCK *bp;
+    IR_INSN *ip;
+    int i, n = 0;
+
+    for (i = 0; i < header->num_pred; i++) {
+        if (!lp->body[header->pred[i]->id]) {
+            pre = header->pred[i];
+            n++;
+        }
+    }
+    if (n == 1 && pre->tail->op == IR_JMP)
+        return pre;
+    pre = (IR_BLOCK*) arena_alloc(AK_IR, sizeof (IR_BLOCK));
+    jmp = (IR_INSN*) arena_alloc(AK_IR, sizeof (IR_INSN));
+    memset(pre, 0, sizeof (IR_BLOCK));
+    memset(jmp, 0, sizeof (IR_INSN));
+    jmp->op = IR_JMP;
+    jmp->target[0] = header;
+    jmp->pos = header->head->pos;
+    pre->head = pre->tail = jmp;
+    pre->id = ir->num_block;
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        if (lp->body[bp->id])
+            continue;
+        ip = bp->tail;
+        for (i = 0; i < 2; i++) {
+            if (ip->target[i] == header)
+                ip->target[i] = pre;
+        }
+        for (i = 0; i < ip->num_case; i++) {
+            if (ip->cases[i].block == header)
+                ip->cases[i].block = pre;
+        }
+    }
+    if (ir->entry == header) {
+        ir->entry = pre;
+    } else {
+        for (bp = ir->entry; bp->next != header; bp = bp->next)
+            ;
+        bp->next = pre;
+    }
+    pre->next = header;
+    return pre;
+}
+
+/*
+ * -dI dump
+ */
+static void fprint_operand(FILE *fp, const IR_FUNC *ir, const OPERAND *o)
+{
+    switch (o->kind) {
+    case OPD_NONE:
+        break;
+    case OPD_TEMP:
+        fprintf(fp, "t%d", o->num);
+        break;
+    case OPD_VAR:
+        fprintf(fp, "%s", ir->var[o->num]->id);
+        break;
+    case OPD_GLOBAL:
+    case OPD_FUNC:
+        fprintf(fp, "@%s", o->sym->id);
+        break;
+    case OPD_IMM:
+        fprintf(fp, "%d", o->num);
+        break;
+    case OPD_STR:
+        fprintf(fp, ".L_S%d", o->str->num);
+        break;
+    case OPD_ARRAY:
+        fprintf(fp, "&%s", o->sym->id);
+        break;
+    case OPD_VEC:
+        fprintf(fp, "v%d", o->num);
+        break;
+    }
+}
+
+static const char *s_ir_op_name[NUM_IR_OP] = {
+    "", "-", "~", "+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>",
+    "", "call", "", "", "noalias", "jmp", "if", "switch", "ret",
+};
+
+static const char *s_ir_cond_name[] = {
+    "==", "!=", "<", ">", "<=", ">=",
+};
+
+static void fprint_insn(FILE *fp, const IR_FUNC *ir, const IR_INSN *ip)
+{
+    int i;
+
+    fprintf(fp, "    ");
+    if (ip->dst.kind != OPD_NONE) {
+        fprint_operand(fp, ir, &ip->dst);
+        fprintf(fp, " = ");
+    }
+    switch (ip->op) {
+    case IR_MOV:
+        fprint_operand(fp, ir, &ip->a);
+        break;
+    case IR_NEG:
+    case IR_NOT:
+        fprintf(fp, "%s", s_ir_op_name[ip->op]);
+        fprint_operand(fp, ir, &ip->a);
+        break;
+    case IR_SET:
+    case IR_BR:
+        if (ip->op == IR_BR)
+            fprintf(fp, "if ");
+        fprint_operand(fp, ir, &ip->a);
+        fprintf(fp, " %s%s ", s_ir_cond_name[ip->cond],
+                ip->is_unsigned ? "u" : "");
+        fprint_operand(fp, ir, &ip->b);
+        if (ip->op == IR_BR)
+            fprintf(fp, " goto B%d else B%d",
+                    ip->target[0]->id, ip->target[1]->id);
+        break;
+    case IR_CALL:
+        fprintf(fp, "call ");
+        fprint_operand(fp, ir, &ip->a);
+        fprintf(fp, "(");
+        for (i = 0; i < ip->num_arg; i++) {
+            if (i > 0)
+                fprintf(fp, ", ");
+            fprint_operand(fp, ir, &ip->arg[i]);
+        }
+        fprintf(fp, ")");
+        break;
+    case IR_LOAD:
+    case IR_STORE:
+        if (ip->a.kind == OPD_ARRAY)
+            fprintf(fp, "%s", ip->a.sym->id);
+        else
+            fprint_operand(fp, ir, &ip->a);
+        fprintf(fp, "[");
+        fprint_operand(fp, ir, &ip->b);
+        fprintf(fp, "]");
+        if (ip->op == IR_STORE) {
+            fprintf(fp, " = ");
+            fprint_operand(fp, ir, &ip->c);
+        }
+        break;
+    case IR_NOALIAS:
+        fprintf(fp, "noalias ");
+        fprint_operand(fp, ir, &ip->a);
+        fprintf(fp, " + %d, ", ip->c.num);
+        fprint_operand(fp, ir, &ip->b);
+        break;
+    case IR_JMP:
+        fprintf(fp, "jmp B%d", ip->target[0]->id);
+        break;
+    case IR_SWITCH:
+        fprintf(fp, "switch%s ", ip->is_unsigned ? "u" : "");
+        fprint_operand(fp, ir, &ip->a);
+        fprintf(fp, " [");
+        for (i = 0; i < ip->num_case; i++)
+            fprintf(fp, "%s%d: B%d", i ? ", " : "", ip->cases[i].value,
+                    ip->cases[i].block->id);
+        fprintf(fp, "] default B%d", ip->target[0]->id);
+        break;
+    case IR_RET:
+        fprintf(fp, "ret");
+        if (ip->a.kind != OPD_NONE) {
+            fprintf(fp, " ");
+            fprint_operand(fp, ir, &ip->a);
+        }
+        break;
+    default:
+        fprint_operand(fp, ir, &ip->a);
+        fprintf(fp, " %s%s ", s_ir_op_name[ip->op],
+                (ip->is_unsigned && (ip->op == IR_DIV || ip->op == IR_MOD
+                                        || ip->op == IR_SHR)) ? "u" : "");
+        fprint_operand(fp, ir, &ip->b);
+        break;
+    }
+    fprintf(fp, "\n");
+}
+
+void fprint_ir(FILE *fp, const IR_FUNC *ir)
+{
+    const IR_BLOCK *bp;
+    const IR_INSN *ip;
+    int i;
+
+    fprintf(fp, "IR %s (%d blocks, %d temps, %d vars)\n", ir->func->id,
+            ir->num_block, ir->num_temp, ir->num_var);
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        fprintf(fp, "B%d:", bp->id);
+        if (bp->num_pred > 0) {
+            fprintf(fp, "    ; preds");
+            for (i = 0; i < bp->num_pred; i++)
+                fprintf(fp, " B%d", bp->pred[i]->id);
+        }
+        fprintf(fp, "\n");
+        for (ip = bp->head; ip != NULL; ip = ip->next)
+            fprint_insn(fp, ir, ip);
+    }
+}
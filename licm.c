@@ -0,0 +1,197 @@
+#include "minicc.h"
+
+/*
+ * loop-invariant code motion on the IR (-O2)
+ *
+ * Loops are found as the natural loops of the back edges, an edge to a
+ * block that dominates its source, so while, do, for and goto loops are
+ * all covered.  Inner loops are done first.  An instruction is hoisted
+ * into a preheader, a new block on the way into the loop from outside,
+ * when:
+ *  - it computes a value without side effects (a load of a global counts
+ *    when the loop neither calls a function nor stores to the global;
+ *    a division only by a constant other than 0 and -1);
+ *  - its operands are constants or are assigned nowhere in the loop but
+ *    by instructions already hoisted;
+ *  - it is the only assignment of its destination in the loop, and the
+ *    destination is not live into the header, so every use in the loop
+ *    sees this assignment.
+ */
+
+/*
+ * hoisting
+ */
+static bool is_pure(const IR_INSN *ip)
+{
+    switch (ip->op) {
+    case IR_MOV: case IR_NEG: case IR_NOT:
+    case IR_ADD: case IR_SUB: case IR_MUL: case IR_AND: case IR_OR:
+    case IR_XOR: case IR_SHL: case IR_SHR: case IR_SET:
+        return true;
+    case IR_DIV: case IR_MOD:
+        return ip->b.kind == OPD_IMM && ip->b.num != 0
+            && (ip->is_unsigned || ip->b.num != -1);
+    default:
+        return false;
+    }
+}
+
+typedef struct {
+    IR_FUNC *ir;
+    const IR_LOOP *loop;
+    int *num_def;       /* by vreg, assignments in the loop */
+    bool *hoisted;      /* by vreg, assigned by a hoisted instruction */
+    bool has_call;
+} HOIST;
+
+static bool stores_global(const HOIST *h, const SYMBOL *sym)
+{
+    const IR_BLOCK *bp;
+    const IR_INSN *ip;
+
+    for (bp = h->ir->entry; bp != NULL; bp = bp->next) {
+        if (!h->loop->body[bp->id])
+            continue;
+        for (ip = bp->head; ip != NULL; ip = ip->next) {
+            if (ip->dst.kind == OPD_GLOBAL && ip->dst.sym == sym)
+                return true;
+        }
+    }
+    return false;
+}
+
+static bool is_invariant(const HOIST *h, const OPERAND *o)
+{
+    int v;
+
+    switch (o->kind) {
+    case OPD_NONE: case OPD_IMM: case OPD_STR: case OPD_FUNC: case OPD_ARRAY:
+        return true;
+    case OPD_GLOBAL:
+        return !h->has_call && !stores_global(h, o->sym);
+    default:
+        v = ir_vreg(h->ir, o);
+        return h->num_def[v] == 0 || h->hoisted[v];
+    }
+}
+
+static bool can_hoist(const HOIST *h, const IR_INSN *ip)
+{
+    int v = ir_vreg(h->ir, &ip->dst);
+
+    return v >= 0 && !h->hoisted[v] && is_pure(ip) && h->num_def[v] == 1
+        && !SET_HAS(h->loop->header->live_in, v)
+        && is_invariant(h, &ip->a) && is_invariant(h, &ip->b);
+}
+
+static void move_insn(IR_BLOCK *from, IR_INSN *ip, IR_BLOCK *to)
+{
+    IR_INSN *jmp = to->tail;
+
+    if (ip->prev)
+        ip->prev->next = ip->next;
+    else
+        from->head = ip->next;
+    if (ip->next)
+        ip->next->prev = ip->prev;
+    else
+        from->tail = ip->prev;
+    ip->prev = jmp->prev;
+    ip->next = jmp;
+    if (jmp->prev)
+        jmp->prev->next = ip;
+    else
+        to->head = ip;
+    jmp->prev = ip;
+}
+
+/* returns the number of instructions hoisted out of lp */
+static int hoist_loop(IR_FUNC *ir, const IR_LOOP *lp)
+{
+    int num_vreg = ir_num_vreg(ir);
+    IR_BLOCK *pre = NULL;
+    IR_BLOCK *bp;
+    IR_INSN *ip, *next;
+    bool changed = true;
+    HOIST h;
+    int v, n = 0;
+
+    memset(&h, 0, sizeof h);
+    h.ir = ir;
+    h.loop = lp;
+    h.num_def = (int*) alloc(sizeof (int) * (num_vreg + 1));
+    h.hoisted = (bool*) alloc(sizeof (bool) * (num_vreg + 1));
+    memset(h.num_def, 0, sizeof (int) * (num_vreg + 1));
+    memset(h.hoisted, 0, sizeof (bool) * (num_vreg + 1));
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        if (!lp->body[bp->id])
+            continue;
+        for (ip = bp->head; ip != NULL; ip = ip->next) {
+            if ((v = ir_vreg(ir, &ip->dst)) >= 0)
+                h.num_def[v]++;
+            if (ip->op == IR_CALL)
+                h.has_call = true;
+        }
+    }
+    while (changed) {
+        changed = false;
+        for (bp = ir->entry; bp != NULL; bp = bp->next) {
+            if (bp == pre || !lp->body[bp->id])
+                continue;
+            for (ip = bp->head; ip != NULL; ip = next) {
+                next = ip->next;
+                if (!can_hoist(&h, ip))
+                    continue;
+                if (pre == NULL)
+                    pre = ir_make_preheader(ir, lp);
+                h.hoisted[ir_vreg(ir, &ip->dst)] = true;
+                move_insn(bp, ip, pre);
+                changed = true;
+                n++;
+            }
+        }
+    }
+    free(h.num_def);
+    free(h.hoisted);
+    return n;
+}
+
+/* returns the number of instructions hoisted */
+int hoist_invariants(IR_FUNC *ir)
+{
+    IR_BLOCK **done = NULL;
+    int num_done = 0;
+    IR_LOOPS li;
+    int i, n = 0;
+
+    ir_liveness(ir);
+    for (;;) {
+        ir_find_loops(&li, ir);
+        for (i = 0; i < li.num_loop; i++) {
+            int j;
+            for (j = 0; j < num_done; j++) {
+                if (done[j] == li.loop[i].header)
+                    break;
+            }
+            if (j == num_done)
+                break;
+        }
+        if (i == li.num_loop) {
+            ir_free_loops(&li);
+            break;
+        }
+        done = (IR_BLOCK**) realloc(done, sizeof (IR_BLOCK*) * (num_done + 1));
+        if (done == NULL) {
+            fprintf(stderr, "out of memory\n");
+            abort();
+        }
+        done[num_done++] = li.loop[i].header;
+        n += hoist_loop(ir, &li.loop[i]);
+        ir_free_loops(&li);
+        ir_number_blocks(ir);
+        ir_build_cfg(ir);
+        ir_liveness(ir);
+    }
+    free(done);
+    return n;
+}
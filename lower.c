@@ -0,0 +1,1021 @@
+#include "minicc.h"
+
+/*
+ * lowering of the IR to x86-64 (-O2)
+ *
+ * Temporaries and variables share the allocatable registers of
+ * regalloc.c.  A vreg's interval is the hull of the instruction
+ * positions (in layout order) where it is live, parameters being live
+ * from the entry; as at -O1, intervals that contain a call may only use
+ * callee-saved registers and the one ending last is spilled when none is
+ * free.  A spilled variable stays in its frame slot, a spilled temporary
+ * gets a slot after the saved registers, as does a spilled pointer
+ * parameter since its frame slot only has 4 bytes.  eax, ecx and edx are
+ * left for the instruction sequences (rax and rcx address elements) and
+ * the parameter registers for the calls.  A function that calls nothing
+ * keeps its frame in the red zone when it fits, see can_omit_frame().
+ */
+#define FIRST_CALLEE_SAVED  (NUM_ALLOC_REG - NUM_CALLEE_SAVED)
+#define MAX_OPERAND_TEXT    MAX_VAR_ADDR
+
+static const char *s_param_reg32[NUM_REG_PARAM] = {
+    "edi", "esi", "edx", "ecx", "r8d", "r9d",
+};
+
+static const char *s_param_reg64[NUM_REG_PARAM] = {
+    "rdi", "rsi", "rdx", "rcx", "r8", "r9",
+};
+
+typedef struct {
+    int vreg;
+    int start;
+    int end;
+    bool cross_call;
+} RANGE;
+
+typedef struct {
+    IR_FUNC *ir;
+    EMITTER *em;
+    RANGE *range;       /* by vreg */
+    int *reg;           /* by vreg, REG_NONE if in memory */
+    int *slot;          /* by vreg, spill slot of a temporary or pointer */
+    int num_slot;
+    int spill_start;    /* frame offset of the spill slots */
+    int frame_size;
+    bool uses_ymm;      /* vzeroupper before calls and returns */
+    const POS *pos;     /* of the last position comment */
+} LOWER;
+
+static int iround(int m, int n)
+{
+    return (m + n - 1) & ~(n - 1);
+}
+
+/*
+ * register allocation
+ */
+static void extend(RANGE *r, int pos)
+{
+    if (r->end < 0 || pos < r->start)
+        r->start = pos;
+    if (pos > r->end)
+        r->end = pos;
+}
+
+/* position 0 is the entry, the instructions count from 1 */
+static void compute_ranges(LOWER *lw)
+{
+    IR_FUNC *ir = lw->ir;
+    int num_vreg = ir_num_vreg(ir);
+    const OPERAND *use[MAX_ARGS + 2];
+    int *call = NULL;
+    int num_call = 0, max_call = 0;
+    IR_BLOCK *bp;
+    IR_INSN *ip;
+    int i, j, v, pos = 0, first;
+
+    for (v = 0; v < num_vreg; v++) {
+        lw->range[v].vreg = v;
+        lw->range[v].start = 0;
+        lw->range[v].end = -1;
+    }
+    for (v = ir->num_temp; v < num_vreg; v++) {
+        if (ir->var[v - ir->num_temp]->kind == SK_PARAM
+                && SET_HAS(ir->entry->live_in, v))
+            extend(&lw->range[v], 0);
+    }
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        first = pos + 1;
+        for (ip = bp->head; ip != NULL; ip = ip->next) {
+            pos++;
+            for (j = ir_uses(ip, use, MAX_ARGS + 2) - 1; j >= 0; j--) {
+                if ((v = ir_vreg(ir, use[j])) >= 0)
+                    extend(&lw->range[v], pos);
+            }
+            if ((v = ir_vreg(ir, &ip->dst)) >= 0)
+                extend(&lw->range[v], pos);
+            if (ip->op == IR_CALL) {
+                if (num_call == max_call) {
+                    max_call = max_call ? max_call * 2 : 16;
+                    call = (int*) realloc(call, sizeof (int) * max_call);
+                    if (call == NULL) {
+                        fprintf(stderr, "out of memory\n");
+                        abort();
+                    }
+                }
+                call[num_call++] = pos;
+            }
+        }
+        for (v = 0; v < num_vreg; v++) {
+            if (SET_HAS(bp->live_in, v))
+                extend(&lw->range[v], first);
+            if (SET_HAS(bp->live_out, v))
+                extend(&lw->range[v], pos);
+        }
+    }
+    for (v = 0; v < num_vreg; v++) {
+        RANGE *r = &lw->range[v];
+        r->cross_call = false;
+        for (i = 0; i < num_call; i++) {
+            if (r->start < call[i] && call[i] < r->end)
+                r->cross_call = true;
+        }
+    }
+    free(call);
+}
+
+static int compare_start(const void *a, const void *b)
+{
+    const RANGE *x = *(const RANGE**) a;
+    const RANGE *y = *(const RANGE**) b;
+    if (x->start != y->start)
+        return (x->start < y->start) ? -1 : 1;
+    return x->vreg - y->vreg;
+}
+
+static bool reg_fits(const RANGE *r, int reg)
+{
+    return !r->cross_call || reg >= FIRST_CALLEE_SAVED;
+}
+
+static void spill(LOWER *lw, int v)
+{
+    IR_FUNC *ir = lw->ir;
+    const SYMBOL *var;
+
+    lw->reg[v] = REG_NONE;
+    if (v < ir->num_temp) {
+        lw->slot[v] = lw->num_slot++;
+        return;
+    }
+    var = ir->var[v - ir->num_temp];
+    if (var->num < NUM_REG_PARAM && (var->type->kind == T_POINTER
+                                    || var->type->kind == T_ARRAY)) {
+        /* two aligned slots, addressed by the second */
+        lw->num_slot = iround(lw->num_slot, 2);
+        lw->slot[v] = lw->num_slot + 1;
+        lw->num_slot += 2;
+    }
+}
+
+static void linear_scan(LOWER *lw, RANGE **list, int n)
+{
+    RANGE *active[NUM_ALLOC_REG];
+    int num_active = 0;
+    int i, j, reg;
+
+    for (i = 0; i < n; i++) {
+        RANGE *cur = list[i];
+
+        /* expire intervals that ended before this one starts */
+        for (j = 0; j < num_active; ) {
+            if (active[j]->end < cur->start)
+                active[j] = active[--num_active];
+            else
+                j++;
+        }
+        for (reg = 0; reg < NUM_ALLOC_REG; reg++) {
+            if (!reg_fits(cur, reg))
+                continue;
+            for (j = 0; j < num_active; j++) {
+                if (lw->reg[active[j]->vreg] == reg)
+                    break;
+            }
+            if (j == num_active)
+                break;
+        }
+        if (reg < NUM_ALLOC_REG) {
+            lw->reg[cur->vreg] = reg;
+            active[num_active++] = cur;
+            continue;
+        }
+        /* spill whichever of cur and the active intervals ends last */
+        for (j = -1, reg = 0; reg < num_active; reg++) {
+            if (reg_fits(cur, lw->reg[active[reg]->vreg])
+                    && active[reg]->end > cur->end
+                    && (j < 0 || active[reg]->end > active[j]->end))
+                j = reg;
+        }
+        if (j < 0) {
+            spill(lw, cur->vreg);
+            continue;
+        }
+        lw->reg[cur->vreg] = lw->reg[active[j]->vreg];
+        spill(lw, active[j]->vreg);
+        active[j] = cur;
+    }
+}
+
+/* returns the number of callee-saved registers used, listed in saved[] */
+static int alloc_vregs(LOWER *lw, int *saved)
+{
+    int num_vreg = ir_num_vreg(lw->ir);
+    RANGE **list;
+    bool used[NUM_ALLOC_REG];
+    int v, n = 0, num_saved = 0;
+
+    list = (RANGE**) alloc(sizeof (RANGE*) * (num_vreg + 1));
+    for (v = 0; v < num_vreg; v++) {
+        lw->reg[v] = REG_NONE;
+        lw->slot[v] = -1;
+        if (lw->range[v].end >= 0)
+            list[n++] = &lw->range[v];
+    }
+    qsort(list, n, sizeof (RANGE*), compare_start);
+    linear_scan(lw, list, n);
+    free(list);
+
+    memset(used, 0, sizeof used);
+    for (v = 0; v < num_vreg; v++) {
+        if (lw->reg[v] != REG_NONE)
+            used[lw->reg[v]] = true;
+    }
+    for (v = FIRST_CALLEE_SAVED; v < NUM_ALLOC_REG; v++) {
+        if (used[v])
+            saved[num_saved++] = v;
+    }
+    return num_saved;
+}
+
+/*
+ * operands
+ */
+static int opd_reg(const LOWER *lw, const OPERAND *o)
+{
+    int v = ir_vreg(lw->ir, o);
+    return (v < 0) ? REG_NONE : lw->reg[v];
+}
+
+/* the text of o as an instruction operand, in one of a few buffers */
+static const char *opd_text(const LOWER *lw, const OPERAND *o)
+{
+    static __thread char buf[4][MAX_OPERAND_TEXT];
+    static __thread int next;
+    char *s = buf[next++ % 4];
+    int v;
+
+    switch (o->kind) {
+    case OPD_TEMP:
+    case OPD_VAR:
+        v = ir_vreg(lw->ir, o);
+        if (lw->reg[v] != REG_NONE)
+            return get_reg_name(lw->reg[v],
+                                ir_is_pointer(lw->ir, o) ? 64 : 32);
+        if (lw->slot[v] >= 0)
+            format_frame_addr(s, -(lw->spill_start + (lw->slot[v] + 1) * 4));
+        else
+            format_var_addr(s, o->sym);
+        break;
+    case OPD_GLOBAL:
+    case OPD_ARRAY:
+        format_var_addr(s, o->sym);
+        break;
+    case OPD_VEC:
+        sprintf(s, "%cmm%d", g_compiler->avx2 ? 'y' : 'x', o->num);
+        break;
+    case OPD_IMM:
+        sprintf(s, "%d", o->num);
+        break;
+    case OPD_STR:
+        sprintf(s, ".L_S%d", o->str->num);
+        break;
+    case OPD_FUNC:
+        sprintf(s, "_%s", o->sym->id);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    return s;
+}
+
+static bool in_memory(const LOWER *lw, const OPERAND *o)
+{
+    return o->kind == OPD_GLOBAL
+        || ((o->kind == OPD_TEMP || o->kind == OPD_VAR)
+            && opd_reg(lw, o) == REG_NONE);
+}
+
+/* the 64 bit name of r, eax or an allocatable register */
+static const char *reg64(const char *r)
+{
+    int i;
+
+    if (strcmp(r, "eax") == 0)
+        return "rax";
+    for (i = 0; i < NUM_ALLOC_REG; i++) {
+        if (strcmp(r, get_reg_name(i, 32)) == 0)
+            return get_reg_name(i, 64);
+    }
+    assert(0);
+    return r;
+}
+
+/* r = o */
+static void load(LOWER *lw, const char *r, const OPERAND *o)
+{
+    const char *s = opd_text(lw, o);
+    if (strcmp(r, s) != 0)
+        emit_op2(lw->em, "mov", r, s);
+}
+
+/* o = r */
+static void store(LOWER *lw, const OPERAND *o, const char *r)
+{
+    const char *d = opd_text(lw, o);
+    if (strcmp(r, d) != 0)
+        emit_op2(lw->em, "mov", d, r);
+}
+
+/* r = the address o, a local array or a pointer */
+static void load_address(LOWER *lw, const char *r, const OPERAND *o)
+{
+    if (o->kind == OPD_ARRAY)
+        emit_op2(lw->em, "lea", r, opd_text(lw, o));
+    else
+        load(lw, r, o);
+}
+
+/*
+ * the text of the element base[index], of size ("dword" or a vector),
+ * addressed with rax and rcx
+ */
+static const char *elem_text(LOWER *lw, const OPERAND *base,
+                        const OPERAND *index, const char *size)
+{
+    static __thread char buf[MAX_OPERAND_TEXT + 32];
+    const char *r = "rbp";
+    int disp = 0;
+
+    if (base->kind == OPD_ARRAY) {
+        disp = -(base->sym->offset + BYTE_INT);
+        r = frame_base(&disp);
+    } else if (opd_reg(lw, base) != REG_NONE) {
+        r = opd_text(lw, base);
+    } else {
+        load(lw, "rax", base);
+        r = "rax";
+    }
+    if (index->kind == OPD_IMM) {
+        disp += index->num * BYTE_INT;
+        sprintf(buf, "%s ptr [%s", size, r);
+    } else {
+        emit_op2(lw->em, "movsxd", "rcx", opd_text(lw, index));
+        sprintf(buf, "%s ptr [%s+rcx*4", size, r);
+    }
+    if (disp != 0)
+        sprintf(buf + strlen(buf), "%+d", disp);
+    strcat(buf, "]");
+    return buf;
+}
+
+/* the register the result of ip is computed in */
+static const char *result_reg(LOWER *lw, const IR_INSN *ip)
+{
+    return in_memory(lw, &ip->dst) ? "eax" : opd_text(lw, &ip->dst);
+}
+
+/*
+ * instructions
+ */
+static void lower_mov(LOWER *lw, const IR_INSN *ip)
+{
+    char buf[MAX_OPERAND_TEXT + 16];
+
+    if (!in_memory(lw, &ip->dst)) {
+        load(lw, opd_text(lw, &ip->dst), &ip->a);
+    } else if (ip->a.kind == OPD_IMM) {
+        sprintf(buf, "dword ptr %s", opd_text(lw, &ip->dst));
+        emit_op2_imm(lw->em, "mov", buf, ip->a.num);
+    } else if (opd_reg(lw, &ip->a) != REG_NONE) {
+        store(lw, &ip->dst, opd_text(lw, &ip->a));
+    } else {
+        load(lw, "eax", &ip->a);
+        store(lw, &ip->dst, "eax");
+    }
+}
+
+static void lower_load(LOWER *lw, const IR_INSN *ip)
+{
+    const char *r = result_reg(lw, ip);
+
+    emit_op2(lw->em, "mov", r, elem_text(lw, &ip->a, &ip->b, "dword"));
+    store(lw, &ip->dst, r);
+}
+
+static void lower_store(LOWER *lw, const IR_INSN *ip)
+{
+    const char *v;
+
+    if (ip->c.kind == OPD_IMM) {
+        emit_op2_imm(lw->em, "mov", elem_text(lw, &ip->a, &ip->b, "dword"),
+                        ip->c.num);
+        return;
+    }
+    if (opd_reg(lw, &ip->c) != REG_NONE) {
+        v = opd_text(lw, &ip->c);
+    } else {
+        load(lw, "edx", &ip->c);
+        v = "edx";
+    }
+    emit_op2(lw->em, "mov", elem_text(lw, &ip->a, &ip->b, "dword"), v);
+}
+
+static bool is_commutative(IR_OP op)
+{
+    return op == IR_ADD || op == IR_MUL || op == IR_AND || op == IR_OR
+        || op == IR_XOR;
+}
+
+static void lower_arith(LOWER *lw, const IR_INSN *ip)
+{
+    static const char *op_name[NUM_IR_OP] = {
+        [IR_ADD] = "add", [IR_SUB] = "sub", [IR_MUL] = "imul",
+        [IR_AND] = "and", [IR_OR] = "or", [IR_XOR] = "xor",
+        [IR_SHL] = "shl",
+    };
+    const char *op = op_name[ip->op];
+    const OPERAND *a = &ip->a, *b = &ip->b;
+    const char *r = result_reg(lw, ip);
+
+    /* an immediate or the operand already in r goes on the left */
+    if (is_commutative(ip->op) && (a->kind == OPD_IMM
+                || strcmp(r, opd_text(lw, b)) == 0)) {
+        const OPERAND *t = a;
+        a = b;
+        b = t;
+    }
+    if (strcmp(r, opd_text(lw, b)) == 0 && strcmp(r, opd_text(lw, a)) != 0)
+        r = "eax";              /* r holds b, which is still needed */
+    load(lw, r, a);
+    switch (ip->op) {
+    case IR_MUL:
+        if (b->kind == OPD_IMM)
+            gen_mul_imm(lw->em, r, reg64(r), b->num);
+        else
+            emit_op2(lw->em, "imul", r, opd_text(lw, b));
+        break;
+    case IR_SHL:
+    case IR_SHR:
+        if (ip->op == IR_SHR)
+            op = ip->is_unsigned ? "shr" : "sar";
+        if (b->kind == OPD_IMM) {
+            emit_op2_imm(lw->em, op, r, b->num & 31);
+        } else {
+            load(lw, "ecx", b);
+            emit_op2(lw->em, op, r, "cl");
+        }
+        break;
+    default:
+        emit_op2(lw->em, op, r, opd_text(lw, b));
+        break;
+    }
+    store(lw, &ip->dst, r);
+}
+
+static void lower_unary(LOWER *lw, const IR_INSN *ip)
+{
+    const char *r = result_reg(lw, ip);
+
+    load(lw, r, &ip->a);
+    emit_op1(lw->em, (ip->op == IR_NEG) ? "neg" : "not", r);
+    store(lw, &ip->dst, r);
+}
+
+static void lower_div(LOWER *lw, const IR_INSN *ip)
+{
+    bool mod = (ip->op == IR_MOD);
+    DIV_PLAN plan;
+
+    if (ip->b.kind == OPD_IMM) {
+        plan_div(&plan, ip->b.num, ip->is_unsigned);
+        if (plan.method != DM_DIVIDE) {
+            load(lw, "eax", &ip->a);
+            gen_div_const(lw->em, &plan, "eax", mod);
+            store(lw, &ip->dst, "eax");
+            return;
+        }
+    }
+    load(lw, "eax", &ip->a);
+    load(lw, "ecx", &ip->b);
+    if (ip->is_unsigned) {
+        emit_op2(lw->em, "xor", "edx", "edx");
+        emit_op1(lw->em, "div", "ecx");
+    } else {
+        emit_op(lw->em, "cdq");
+        emit_op1(lw->em, "idiv", "ecx");
+    }
+    store(lw, &ip->dst, mod ? "edx" : "eax");
+}
+
+static const char *cond_code(IR_COND cond, bool is_unsigned, bool sense)
+{
+    static const char *cc[][2] = {      /* signed, unsigned */
+        { "e", "e" }, { "ne", "ne" }, { "l", "b" },
+        { "g", "a" }, { "le", "be" }, { "ge", "ae" },
+    };
+    static const IR_COND negate[] = {
+        IC_NE, IC_EQ, IC_GE, IC_LE, IC_GT, IC_LT,
+    };
+
+    if (!sense)
+        cond = negate[cond];
+    return cc[cond][is_unsigned];
+}
+
+static void lower_cmp(LOWER *lw, const IR_INSN *ip)
+{
+    const char *left;
+
+    if (opd_reg(lw, &ip->a) != REG_NONE) {
+        left = opd_text(lw, &ip->a);
+    } else {
+        load(lw, "eax", &ip->a);
+        left = "eax";
+    }
+    emit_op2(lw->em, "cmp", left, opd_text(lw, &ip->b));
+}
+
+static void lower_set(LOWER *lw, const IR_INSN *ip)
+{
+    char op[8];
+
+    lower_cmp(lw, ip);
+    sprintf(op, "set%s", cond_code(ip->cond, ip->is_unsigned, true));
+    emit_op1(lw->em, op, "al");
+    emit_op2(lw->em, "movzx", result_reg(lw, ip), "al");
+    store(lw, &ip->dst, result_reg(lw, ip));
+}
+
+static void emit_jcc(EMITTER *em, const char *cc, int label)
+{
+    emit_str(em, "    j");
+    emit_str(em, cc);
+    emit_char(em, ' ');
+    emit_label(em, label);
+    emit_char(em, '\n');
+}
+
+static void lower_br(LOWER *lw, const IR_BLOCK *bp, const IR_INSN *ip)
+{
+    const IR_BLOCK *t = ip->target[0], *f = ip->target[1];
+
+    if (t == f) {
+        if (t != bp->next)
+            emit_jump(lw->em, "jmp", t->label);
+        return;
+    }
+    lower_cmp(lw, ip);
+    if (t == bp->next) {
+        emit_jcc(lw->em, cond_code(ip->cond, ip->is_unsigned, false),
+                    f->label);
+        return;
+    }
+    emit_jcc(lw->em, cond_code(ip->cond, ip->is_unsigned, true), t->label);
+    if (f != bp->next)
+        emit_jump(lw->em, "jmp", f->label);
+}
+
+static void lower_switch(LOWER *lw, const IR_INSN *ip)
+{
+    CASE_LABEL *cases;
+    int i;
+
+    load(lw, "eax", &ip->a);
+    if (ip->num_case == 0) {
+        emit_jump(lw->em, "jmp", ip->target[0]->label);
+        return;
+    }
+    cases = (CASE_LABEL*) alloc(sizeof (CASE_LABEL) * ip->num_case);
+    for (i = 0; i < ip->num_case; i++) {
+        cases[i].key = ip->is_unsigned ? (long) (unsigned) ip->cases[i].value
+                                       : ip->cases[i].value;
+        cases[i].label = ip->cases[i].block->label;
+        cases[i].node = NULL;
+    }
+    gen_case_dispatch(lw->em, cases, ip->num_case, ip->target[0]->label,
+                        ip->is_unsigned);
+    free(cases);
+}
+
+static void push_arg(LOWER *lw, const OPERAND *o)
+{
+    if (o->kind == OPD_IMM) {
+        emit_op1(lw->em, "push", opd_text(lw, o));
+    } else if (opd_reg(lw, o) != REG_NONE) {
+        emit_op1(lw->em, "push", get_reg_name(opd_reg(lw, o), 64));
+    } else if (o->kind == OPD_ARRAY || ir_is_pointer(lw->ir, o)) {
+        load_address(lw, "rax", o);
+        emit_op1(lw->em, "push", "rax");
+    } else {
+        load(lw, "eax", o);
+        emit_op1(lw->em, "push", "rax");
+    }
+}
+
+/* the argument o into parameter register i */
+static void load_arg(LOWER *lw, int i, const OPERAND *o)
+{
+    if (o->kind == OPD_ARRAY || ir_is_pointer(lw->ir, o))
+        load_address(lw, s_param_reg64[i], o);
+    else
+        load(lw, s_param_reg32[i], o);
+}
+
+/* the frame is 16-byte aligned between the instructions */
+static void lower_call(LOWER *lw, const IR_INSN *ip)
+{
+    int n = ip->num_arg;
+    int num_stack = (n > NUM_REG_PARAM) ? n - NUM_REG_PARAM : 0;
+    int pad = num_stack % 2;
+    int i;
+
+    emit_str(lw->em, "# CALL\n");
+    if (pad)
+        emit_op2_imm(lw->em, "sub", "rsp", 8);
+    for (i = n - 1; i >= NUM_REG_PARAM; i--)
+        push_arg(lw, &ip->arg[i]);
+    for (i = 0; i < n && i < NUM_REG_PARAM; i++)
+        load_arg(lw, i, &ip->arg[i]);
+    if (lw->uses_ymm)
+        emit_op(lw->em, "vzeroupper");
+    emit_op1(lw->em, "call", opd_text(lw, &ip->a));
+    if (num_stack + pad > 0)
+        emit_op2_imm(lw->em, "add", "rsp", (num_stack + pad) * 8);
+    store(lw, &ip->dst, "eax");
+}
+
+/*
+ * a direct call followed by a ret of its result, whose stack arguments
+ * fit where our own were passed, and which is not given a local array
+ */
+static bool is_tail_call(const LOWER *lw, const IR_INSN *ip)
+{
+    const IR_INSN *ret = ip->next;
+    int i;
+
+    if (ip->op != IR_CALL || ip->a.kind != OPD_FUNC)
+        return false;
+    if (ret == NULL || ret->op != IR_RET)
+        return false;
+    if (ret->a.kind != OPD_NONE && (ret->a.kind != ip->dst.kind
+                                    || ret->a.num != ip->dst.num))
+        return false;
+    if (ip->num_arg > NUM_REG_PARAM && ip->num_arg > lw->ir->func->num)
+        return false;
+    for (i = 0; i < ip->num_arg; i++) {
+        if (ip->arg[i].kind == OPD_ARRAY)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * The register arguments are loaded first, the stack arguments may be
+ * read from our own, which they are then pushed and popped over.  The
+ * frame is left and the callee returns to our caller.
+ */
+static void lower_tail_call(LOWER *lw, const IR_INSN *ip)
+{
+    char buf[32];
+    int n = ip->num_arg;
+    int i;
+
+    emit_str(lw->em, "# TAIL CALL\n");
+    for (i = 0; i < n && i < NUM_REG_PARAM; i++)
+        load_arg(lw, i, &ip->arg[i]);
+    for (i = n - 1; i >= NUM_REG_PARAM; i--)
+        push_arg(lw, &ip->arg[i]);
+    for (i = NUM_REG_PARAM; i < n; i++) {
+        sprintf(buf, "qword ptr [rbp+%d]", 16 + (i - NUM_REG_PARAM) * 8);
+        emit_op1(lw->em, "pop", buf);
+    }
+    if (lw->uses_ymm)
+        emit_op(lw->em, "vzeroupper");
+    gen_leave(lw->em);
+    emit_op1(lw->em, "jmp", opd_text(lw, &ip->a));
+}
+
+/* dst = 1 if a + c and b are at least a vector apart */
+static void lower_noalias(LOWER *lw, const IR_INSN *ip)
+{
+    int w = g_compiler->avx2 ? 32 : 16;
+
+    load_address(lw, "rax", &ip->a);
+    load_address(lw, "rcx", &ip->b);
+    emit_op2(lw->em, "sub", "rax", "rcx");
+    emit_op2_imm(lw->em, "add", "rax", ip->c.num + w - 1);
+    emit_op2_imm(lw->em, "cmp", "rax", 2 * w - 1);
+    emit_op1(lw->em, "setae", "al");
+    emit_op2(lw->em, "movzx", result_reg(lw, ip), "al");
+    store(lw, &ip->dst, result_reg(lw, ip));
+}
+
+/*
+ * vector instructions, SSE2 or with -mavx2 their VEX forms; xmm14 and
+ * xmm15 are scratch registers
+ */
+static bool is_vector(const IR_INSN *ip)
+{
+    return ip->dst.kind == OPD_VEC || ip->c.kind == OPD_VEC;
+}
+
+/* d = a op b, b a register or a shift count */
+static void emit_vector_op(LOWER *lw, const char *op, const char *d,
+                        const char *a, const char *b)
+{
+    char name[16];
+
+    if (g_compiler->avx2) {
+        sprintf(name, "v%s", op);
+        emit_op3(lw->em, name, d, a, b);
+        return;
+    }
+    if (strcmp(d, a) != 0)
+        emit_op2(lw->em, "movdqa", d, a);
+    emit_op2(lw->em, op, d, b);
+}
+
+/* SSE2 has no pmulld: the even and the odd lanes go through pmuludq */
+static void lower_vector_mul(LOWER *lw, const char *d, const char *a,
+                        const char *b)
+{
+    if (g_compiler->avx2) {
+        emit_vector_op(lw, "pmulld", d, a, b);
+        return;
+    }
+    emit_vector_op(lw, "pmuludq", d, a, b);
+    emit_vector_op(lw, "psrlq", "xmm14", a, "32");
+    emit_vector_op(lw, "psrlq", "xmm15", b, "32");
+    emit_op2(lw->em, "pmuludq", "xmm14", "xmm15");
+    emit_op3(lw->em, "pshufd", d, d, "8");
+    emit_op3(lw->em, "pshufd", "xmm14", "xmm14", "8");
+    emit_op2(lw->em, "punpckldq", d, "xmm14");
+}
+
+/* every lane of dst = a */
+static void lower_splat(LOWER *lw, const IR_INSN *ip)
+{
+    const char *d = opd_text(lw, &ip->dst);
+    const char *r = "eax";
+    char x[8];
+
+    if (ip->a.kind == OPD_IMM && ip->a.num == 0) {
+        emit_vector_op(lw, "pxor", d, d, d);
+        return;
+    }
+    if (opd_reg(lw, &ip->a) != REG_NONE)
+        r = opd_text(lw, &ip->a);
+    else
+        load(lw, r, &ip->a);
+    if (g_compiler->avx2) {
+        sprintf(x, "xmm%d", ip->dst.num);
+        emit_op2(lw->em, "vmovd", x, r);
+        emit_op2(lw->em, "vpbroadcastd", d, x);
+    } else {
+        emit_op2(lw->em, "movd", d, r);
+        emit_op3(lw->em, "pshufd", d, d, "0");
+    }
+}
+
+static void lower_vector(LOWER *lw, const IR_INSN *ip)
+{
+    const char *mov = g_compiler->avx2 ? "vmovdqu" : "movdqu";
+    const char *size = g_compiler->avx2 ? "ymmword" : "xmmword";
+    const char *d, *a;
+
+    switch (ip->op) {
+    case IR_MOV:
+        lower_splat(lw, ip);
+        return;
+    case IR_LOAD:
+        d = opd_text(lw, &ip->dst);
+        emit_op2(lw->em, mov, d, elem_text(lw, &ip->a, &ip->b, size));
+        return;
+    case IR_STORE:
+        a = opd_text(lw, &ip->c);
+        emit_op2(lw->em, mov, elem_text(lw, &ip->a, &ip->b, size), a);
+        return;
+    default:
+        break;
+    }
+    d = opd_text(lw, &ip->dst);
+    a = opd_text(lw, &ip->a);
+    switch (ip->op) {
+    case IR_NEG:
+        emit_vector_op(lw, "pxor", d, d, d);
+        emit_vector_op(lw, "psubd", d, d, a);
+        break;
+    case IR_NOT:
+        emit_vector_op(lw, "pcmpeqd", d, d, d);
+        emit_vector_op(lw, "pxor", d, d, a);
+        break;
+    case IR_MUL:
+        lower_vector_mul(lw, d, a, opd_text(lw, &ip->b));
+        break;
+    case IR_ADD:
+        emit_vector_op(lw, "paddd", d, a, opd_text(lw, &ip->b));
+        break;
+    case IR_SUB:
+        emit_vector_op(lw, "psubd", d, a, opd_text(lw, &ip->b));
+        break;
+    case IR_AND:
+        emit_vector_op(lw, "pand", d, a, opd_text(lw, &ip->b));
+        break;
+    case IR_OR:
+        emit_vector_op(lw, "por", d, a, opd_text(lw, &ip->b));
+        break;
+    case IR_XOR:
+        emit_vector_op(lw, "pxor", d, a, opd_text(lw, &ip->b));
+        break;
+    case IR_SHL:
+        emit_vector_op(lw, "pslld", d, a, opd_text(lw, &ip->b));
+        break;
+    case IR_SHR:
+        emit_vector_op(lw, ip->is_unsigned ? "psrld" : "psrad", d, a,
+                        opd_text(lw, &ip->b));
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+static void emit_insn_pos(LOWER *lw, const IR_INSN *ip)
+{
+    if (ip->pos == NULL || (lw->pos && lw->pos->line == ip->pos->line
+                && lw->pos->filename == ip->pos->filename))
+        return;
+    lw->pos = ip->pos;
+    emit_str(lw->em, "# ");
+    emit_str(lw->em, ip->pos->filename);
+    emit_char(lw->em, '(');
+    emit_int(lw->em, ip->pos->line);
+    emit_str(lw->em, ")\n");
+}
+
+static void lower_insn(LOWER *lw, const IR_BLOCK *bp, const IR_INSN *ip)
+{
+    emit_insn_pos(lw, ip);
+    if (is_vector(ip)) {
+        lower_vector(lw, ip);
+        return;
+    }
+    switch (ip->op) {
+    case IR_MOV:
+        lower_mov(lw, ip);
+        break;
+    case IR_NEG:
+    case IR_NOT:
+        lower_unary(lw, ip);
+        break;
+    case IR_DIV:
+    case IR_MOD:
+        lower_div(lw, ip);
+        break;
+    case IR_SET:
+        lower_set(lw, ip);
+        break;
+    case IR_CALL:
+        if (is_tail_call(lw, ip))
+            lower_tail_call(lw, ip);
+        else
+            lower_call(lw, ip);
+        break;
+    case IR_LOAD:
+        lower_load(lw, ip);
+        break;
+    case IR_STORE:
+        lower_store(lw, ip);
+        break;
+    case IR_NOALIAS:
+        lower_noalias(lw, ip);
+        break;
+    case IR_JMP:
+        if (ip->target[0] != bp->next)
+            emit_jump(lw->em, "jmp", ip->target[0]->label);
+        break;
+    case IR_BR:
+        lower_br(lw, bp, ip);
+        break;
+    case IR_SWITCH:
+        lower_switch(lw, ip);
+        break;
+    case IR_RET:
+        if (ip->prev && is_tail_call(lw, ip->prev))
+            break;
+        if (ip->a.kind != OPD_NONE)
+            load(lw, "eax", &ip->a);
+        if (lw->uses_ymm)
+            emit_op(lw->em, "vzeroupper");
+        gen_epilogue(lw->em);
+        break;
+    default:
+        lower_arith(lw, ip);
+        break;
+    }
+}
+
+/* whether some predecessor jumps to bp rather than falling into it */
+static bool needs_label(const IR_BLOCK *bp)
+{
+    int i;
+
+    for (i = 0; i < bp->num_pred; i++) {
+        if (bp->pred[i]->next != bp || bp->pred[i]->tail->op == IR_SWITCH)
+            return true;
+    }
+    return false;
+}
+
+static void lower_prologue(LOWER *lw)
+{
+    IR_FUNC *ir = lw->ir;
+    int i, v;
+
+    if (!g_compiler->frameless) {
+        emit_op1(lw->em, "push", "rbp");
+        emit_op2(lw->em, "mov", "rbp", "rsp");
+        emit_op2_imm(lw->em, "sub", "rsp", lw->frame_size);
+    }
+    gen_save_regs(lw->em);
+    for (i = 0; i < ir->num_var; i++) {
+        const SYMBOL *p = ir->var[i];
+        char home[MAX_VAR_ADDR];
+        OPERAND o;
+
+        if (p->kind != SK_PARAM)
+            continue;
+        memset(&o, 0, sizeof o);
+        o.kind = OPD_VAR;
+        o.num = i;
+        o.sym = ir->var[i];
+        v = ir->num_temp + i;
+        /*
+         * a parameter dead on entry has no range there, so its register
+         * may be that of a live one
+         */
+        if (!SET_HAS(ir->entry->live_in, v))
+            continue;
+        if (p->num < NUM_REG_PARAM) {
+            store(lw, &o, ir_is_pointer(ir, &o) ? s_param_reg64[p->num]
+                                                : s_param_reg32[p->num]);
+        } else if (lw->reg[v] != REG_NONE) {
+            format_var_addr(home, p);
+            emit_op2(lw->em, "mov", opd_text(lw, &o), home);
+        }
+    }
+}
+
+bool lower_ir(EMITTER *em, IR_FUNC *ir)
+{
+    SYMBOL *func = ir->func;
+    int param_size = func->num * BYTE_INT;
+    int frame_size = iround(param_size, 8) + iround(func->offset, 16);
+    int num_vreg = ir_num_vreg(ir);
+    IR_BLOCK *bp;
+    IR_INSN *ip;
+    bool is_leaf = true;
+    LOWER lw;
+
+    memset(&lw, 0, sizeof lw);
+    lw.ir = ir;
+    lw.em = em;
+    lw.range = (RANGE*) alloc(sizeof (RANGE) * (num_vreg + 1));
+    lw.reg = (int*) alloc(sizeof (int) * (num_vreg + 1));
+    lw.slot = (int*) alloc(sizeof (int) * (num_vreg + 1));
+
+    ir_liveness(ir);
+    compute_ranges(&lw);
+    g_compiler->num_saved = alloc_vregs(&lw, g_compiler->saved_reg);
+    g_compiler->param_start = frame_size - param_size;
+    g_compiler->save_start = frame_size;
+    lw.spill_start = frame_size + g_compiler->num_saved * 8;
+    lw.frame_size = iround(lw.spill_start + lw.num_slot * 4, 16);
+
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        bp->label = g_compiler->label_num++;
+        for (ip = bp->head; ip != NULL; ip = ip->next) {
+            if (is_vector(ip) && g_compiler->avx2)
+                lw.uses_ymm = true;
+            if (ip->op == IR_CALL)
+                is_leaf = false;
+        }
+    }
+    g_compiler->frameless = is_leaf && can_omit_frame(lw.frame_size);
+
+    gen_func_header(em, func);
+    lower_prologue(&lw);
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        if (needs_label(bp))
+            emit_label_def(em, bp->label);
+        for (ip = bp->head; ip != NULL; ip = ip->next)
+            lower_insn(&lw, bp, ip);
+    }
+
+    g_compiler->frameless = false;
+    free(lw.range);
+    free(lw.reg);
+    free(lw.slot);
+    return true;
+}
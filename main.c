@@ -1,7 +1,27 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 #include "minicc.h"
 
 #define MAX_PATH    256
 
+typedef struct {
+    const char *filename;
+    pid_t pid;
+    FILE *out;          /* captured stdout/stderr of the child */
+    FILE *err;
+    FILE *stats;        /* JSON statistics of the unit (--stats) */
+    bool done;
+    bool result;
+    double start;
+    double time;
+} JOB;
+
+static int s_num_jobs = 1;
+static bool s_stats = false;
+static const char *s_stats_file = NULL;   /* NULL: stderr */
+
 static void change_filename_ext(char *name, const char *orig, const char *ext)
 {
     char *p;
@@ -10,49 +30,251 @@ static void change_filename_ext(char *name, const char *orig, const char *ext)
     if (p)
         strcpy(p, ext);
     else
-        strcat(p, ext);
+        strcat(name, ext);
 }
 
-static bool compile(const char *filename)
+static bool compile(const char *filename, FILE *stats)
 {
     char out_name[MAX_PATH+1];
     PARSER *pars;
     bool result;
+    int n_error;
 
+    g_compiler->stats.enabled = (stats != NULL);
+    reset_stats();
     pars = open_parser(filename);
     if (pars == NULL) {
         fprintf(stderr, "couldn't open '%s'\n", filename);
+        if (stats)
+            fprint_stats(stats, g_compiler);
         return false;
     }
+    init_symtab();
+    n_error = get_num_errors();
     result = parse(pars);
     close_parser(pars);
+    /* semantic errors do not stop the parser, but must stop generation */
+    if (get_num_errors() > n_error)
+        result = false;
 
     print_global_symtab();
 
-    if (result) {
+    if (result && strcmp(filename, "-") == 0) {
+        result = generate(stdout);
+    } else if (result) {
         FILE *fp;
         change_filename_ext(out_name, filename, ".s");
         fp = fopen(out_name, "w");
         if (fp == NULL) {
             fprintf(stderr, "couldn't open '%s'\n", out_name);
-            return false;
+            result = false;
+        } else {
+            result = generate(fp);
+            fclose(fp);
         }
-        result = generate(fp);
-        fclose(fp);
     }
 
+    if (stats)
+        fprint_stats(stats, g_compiler);
+    if (is_debug("memory"))
+        print_arena_report();
+    term_symtab();
+    clear_string_pool();
+    arena_release();
     return result;
 }
 
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* returns the number of bytes copied */
+static long copy_file(FILE *from, FILE *to)
+{
+    char buf[BUFSIZ];
+    size_t n;
+    long total = 0;
+
+    rewind(from);
+    while ((n = fread(buf, 1, sizeof buf, from)) > 0) {
+        fwrite(buf, 1, n, to);
+        total += n;
+    }
+    fclose(from);
+    return total;
+}
+
+static void run_job_here(JOB *job)
+{
+    if (s_stats)
+        job->stats = tmpfile();
+    job->start = now();
+    job->result = compile(job->filename, job->stats);
+    job->time = now() - job->start;
+    job->done = true;
+}
+
+/*
+ * compile one file in a child process
+ *
+ * All compiler state is process-global, so a child gets its own copy.
+ * Its stdout/stderr go to temporary files which are replayed in
+ * argument order, keeping the output independent of scheduling.
+ */
+static bool start_job(JOB *job)
+{
+    job->out = tmpfile();
+    job->err = tmpfile();
+    if (s_stats)
+        job->stats = tmpfile();
+    if (job->out == NULL || job->err == NULL || (s_stats && !job->stats))
+        goto fail;
+    fflush(stdout);
+    fflush(stderr);
+    job->start = now();
+    job->pid = fork();
+    if (job->pid < 0)
+        goto fail;
+    if (job->pid == 0) {
+        bool result;
+        dup2(fileno(job->out), 1);
+        dup2(fileno(job->err), 2);
+        result = compile(job->filename, job->stats);
+        fflush(stdout);
+        fflush(stderr);
+        if (job->stats)
+            fflush(job->stats);
+        _exit(result ? 0 : 1);
+    }
+    return true;
+
+fail:
+    if (job->out)
+        fclose(job->out);
+    if (job->err)
+        fclose(job->err);
+    if (job->stats)
+        fclose(job->stats);
+    job->out = job->err = job->stats = NULL;
+    return false;
+}
+
+static void finish_job(JOB *job)
+{
+    if (job->out)
+        copy_file(job->out, stdout);
+    if (job->err)
+        copy_file(job->err, stderr);
+    fflush(stdout);
+    fflush(stderr);
+}
+
+static void run_jobs(JOB *jobs, int n)
+{
+    int next = 0, printed = 0, running = 0;
+    int i, status;
+    pid_t pid;
+
+    while (printed < n) {
+        while (running < s_num_jobs && next < n) {
+            if (start_job(&jobs[next]))
+                running++;
+            else
+                run_job_here(&jobs[next]);
+            next++;
+        }
+        if (running > 0 && (pid = wait(&status)) > 0) {
+            for (i = 0; i < next; i++) {
+                if (jobs[i].pid == pid && !jobs[i].done) {
+                    jobs[i].time = now() - jobs[i].start;
+                    jobs[i].result = WIFEXITED(status)
+                                        && WEXITSTATUS(status) == 0;
+                    jobs[i].done = true;
+                    running--;
+                    break;
+                }
+            }
+        }
+        while (printed < next && jobs[printed].done)
+            finish_job(&jobs[printed++]);
+    }
+}
+
+static void fprint_json_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(fp, "\\%c", *s);
+        else if ((unsigned char) *s < ' ')
+            fprintf(fp, "\\u%04x", *s);
+        else
+            fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+/* the --stats report, one JSON document */
+static void print_stats(JOB *jobs, int n, double wall)
+{
+    FILE *fp = stderr;
+    int i;
+
+    if (s_stats_file && (fp = fopen(s_stats_file, "w")) == NULL) {
+        fprintf(stderr, "couldn't open '%s'\n", s_stats_file);
+        return;
+    }
+    fprintf(fp, "{\"jobs\": %d, \"wall\": %.6f, \"files\": [",
+            s_num_jobs, wall);
+    for (i = 0; i < n; i++) {
+        fprintf(fp, "%s\n  {\"file\": ", i ? "," : "");
+        fprint_json_string(fp, jobs[i].filename);
+        fprintf(fp, ", \"ok\": %s, \"time\": %.6f, \"stats\": ",
+                jobs[i].result ? "true" : "false", jobs[i].time);
+        /* a child that crashed has left no statistics */
+        if (jobs[i].stats == NULL || copy_file(jobs[i].stats, fp) == 0)
+            fprintf(fp, "null");
+        jobs[i].stats = NULL;
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n]}\n");
+    if (fp != stderr)
+        fclose(fp);
+}
+
 void usage()
 {
-    printf("usage: mcc [-d[istp]] filename\n");
+    printf("usage: mcc [-d[istp]] [-O[N]] [-mavx2] [-fno-omit-frame-pointer]\n"
+           "           [-j N] [--stats[=FILE]]"
+           " [--switch-density=N] [--inline-threshold=N]\n"
+           "           filename...\n");
+    printf(" filename '-' reads stdin and writes stdout\n");
     printf(" -di  debug ident\n");
     printf(" -ds  debug scanner\n");
     printf(" -dt  debug parser_trace\n");
     printf(" -dp  debug parser\n");
     printf(" -dn  debug node type\n");
     printf(" -dg  debug generate\n");
+    printf(" -dm  debug memory (arena report)\n");
+    printf(" -dr  debug register allocation\n");
+    printf(" -dI  debug IR (dump)\n");
+    printf(" -O1  optimize (register allocation)\n");
+    printf(" -O2  optimize on the IR\n");
+    printf(" -mavx2  vectorize loops with AVX2 rather than SSE2 (-O2)\n");
+    printf(" -fno-omit-frame-pointer  keep rbp in functions that call\n");
+    printf("                          nothing (-O1 and up)\n");
+    printf(" -j N compile N files in parallel\n");
+    printf(" --stats[=FILE]  report phase times and counters as JSON\n");
+    printf("                 (to stderr unless FILE is given)\n");
+    printf(" --switch-density=N  use a jump table for a switch whose case\n");
+    printf("                     values fill at least N%% of their range\n");
+    printf("                     (default 40)\n");
+    printf(" --inline-threshold=N  at -O2, inline calls to functions of at\n");
+    printf("                       most N IR instructions (default 20,\n");
+    printf("                       0 disables inlining)\n");
     exit(1);
 }
 
@@ -60,13 +282,47 @@ int main(int argc ,char* argv[])
 {
     int i, j;
     int result = 0;
+    JOB *jobs;
+    int num_files = 0;
+    double wall;
 
     if (argc < 2)
         usage();
-    init_symtab();
+    jobs = (JOB*) alloc(sizeof (JOB) * argc);
     for (i = 1; i < argc; i++) {
-        if (argv[i][0] == '-') {
-            if (argv[i][1] == 'd') {
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            if (strcmp(argv[i], "--stats") == 0) {
+                s_stats = true;
+            } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+                s_stats = true;
+                s_stats_file = &argv[i][8];
+            } else if (strncmp(argv[i], "--switch-density=", 17) == 0) {
+                g_compiler->switch_density = atoi(&argv[i][17]);
+                if (g_compiler->switch_density < 1
+                        || g_compiler->switch_density > 100)
+                    usage();
+            } else if (strncmp(argv[i], "--inline-threshold=", 19) == 0) {
+                g_compiler->inline_threshold = atoi(&argv[i][19]);
+                if (g_compiler->inline_threshold < 0)
+                    usage();
+                if (g_compiler->inline_threshold == 0)
+                    g_compiler->inline_threshold = -1;
+            } else if (strcmp(argv[i], "-mavx2") == 0) {
+                g_compiler->avx2 = true;
+            } else if (strcmp(argv[i], "-fno-omit-frame-pointer") == 0) {
+                g_compiler->keep_frame_pointer = true;
+            } else if (argv[i][1] == 'O') {
+                if (argv[i][2] == '\0')
+                    g_compiler->opt_level = 1;
+                else if (isdigit((unsigned char) argv[i][2]))
+                    g_compiler->opt_level = atoi(&argv[i][2]);
+                else
+                    usage();
+            } else if (argv[i][1] == 'j') {
+                const char *p = argv[i][2] ? &argv[i][2] : argv[++i];
+                if (p == NULL || (s_num_jobs = atoi(p)) < 1)
+                    usage();
+            } else if (argv[i][1] == 'd') {
                 for (j = 2; argv[i][j] != 0; j++) {
                     switch (argv[i][j]) {
                     case 'i': set_debug("ident"); break;
@@ -75,14 +331,35 @@ int main(int argc ,char* argv[])
                     case 'p': set_debug("parser"); break;
                     case 'n': set_debug("node_type"); break;
                     case 'g': set_debug("gen"); break;
+                    case 'm': set_debug("memory"); break;
+                    case 'r': set_debug("regalloc"); break;
+                    case 'I': set_debug("ir"); break;
                     default: usage();
                     }
                 }
             } else
                 usage();
-        } else if (!compile(argv[i]))
+        } else {
+            memset(&jobs[num_files], 0, sizeof (JOB));
+            jobs[num_files++].filename = argv[i];
+        }
+    }
+
+    wall = now();
+    if (s_num_jobs > 1 && num_files > 1) {
+        run_jobs(jobs, num_files);
+    } else {
+        for (i = 0; i < num_files; i++)
+            run_job_here(&jobs[i]);
+    }
+    wall = now() - wall;
+
+    for (i = 0; i < num_files; i++) {
+        if (!jobs[i].result)
             result = 1;
     }
-    term_symtab();
+    if (s_stats)
+        print_stats(jobs, num_files, wall);
+    free(jobs);
     return result;
 }
@@ -51,6 +51,16 @@ void error(const POS *pos, const char *s, ...);
 void *alloc(size_t size);
 char *str_dup(const char *s);
 
+typedef enum {
+    AK_NODE, AK_TYPE, AK_PARAM, AK_SYMBOL, AK_SYMTAB, AK_IDENT, AK_STRING,
+    AK_IR, NUM_ALLOC_KIND,
+} ALLOC_KIND;
+
+void *arena_alloc(ALLOC_KIND kind, size_t size);
+void arena_release(void);
+void term_arena(void);
+void print_arena_report(void);
+
 typedef struct string {
     struct string *next;
     char *s;
@@ -61,7 +71,7 @@ typedef struct string_pool {
     STRING *tail;
 } STRING_POOL;
 
-extern STRING_POOL g_string_pool;
+void clear_string_pool(void);
 
 
 typedef enum {
@@ -86,12 +96,14 @@ typedef enum {
 typedef struct {
     const char *source;
     int size;
-    int current;
-    int ch;
+    int current;        /* offset of the next unread character */
+    int line_mark;      /* pos.line counts newlines up to this offset */
     POS pos;
     int num;
     char *id;
     STRING *str;
+    char *buffer;       /* source owned by the scanner */
+    size_t map_size;    /* mapped length, 0 if buffer is on the heap */
 } SCANNER;
 
 SCANNER *open_scanner_text(const char *filename, const char *text);
@@ -116,6 +128,7 @@ typedef enum {
     NK_CHAR_LIT, NK_INT_LIT, NK_UINT_LIT, NK_LONG_LIT, NK_ULONG_LIT,
     NK_FLOAT_LIT, NK_DOUBLE_LIT, NK_STRING_LIT, NK_ARG,
     NK_ADDR, NK_DEREF, NK_UPLUS, NK_UMINUS, NK_COMPLEMENT, NK_NOT,
+    NUM_NODE_KIND
 } NODE_KIND;
 
 
@@ -161,6 +174,7 @@ void add_param(PARAM *top, PARAM *param);
 TYPE *new_type(TYPE_KIND kind, TYPE *typ);
 TYPE *dup_type(TYPE *typ);
 bool equal_type(const TYPE *tl, const TYPE *tr);
+int get_type_size(const TYPE *t);
 TYPE *type_check_array(const POS *pos, const TYPE *arr, const TYPE *e);
 TYPE *type_check_call(const POS *pos, const TYPE *fn, const TYPE *arg);
 TYPE *type_check_idnode(const POS *pos, NODE_KIND kind,
@@ -176,13 +190,17 @@ void type_check_assign_number_or_pointer(const POS *pos,
         const TYPE *lhs, const TYPE *rhs);
 void type_check_assign_integer(const POS *pos, const TYPE *lhs, const TYPE *rhs);
 bool is_const_type(const TYPE *t);
+bool is_integer_type(const TYPE *t);
+bool is_unsigned_type(const TYPE *t);
+TYPE *promote_type(TYPE *t);
+TYPE *arith_conv_type(TYPE *lhs, TYPE *rhs);
 
 const char *get_type_string(const TYPE *typ);
 void fprint_type(FILE *fp, const TYPE *typ);
 void print_type(const TYPE *typ);
 
 typedef enum {
-    SK_LOCAL, SK_GLOBAL, SK_PARAM, SK_FUNC,
+    SK_LOCAL, SK_GLOBAL, SK_PARAM, SK_FUNC, SK_ENUM,
 } SYMBOL_KIND;
 
 typedef struct symbol SYMBOL;
@@ -196,11 +214,15 @@ struct symbol {
     TYPE *type;
     int scope;
 
-    int num;    /* func: num of parameter, var: order */
+    int num;    /* func: num of parameter, var: order, enum: value */
     int offset; /* func: local size */
+    int reg;    /* var: register allocated at -O1, REG_NONE if in memory */
 
     SYMTAB *tab;
     NODE *body;
+
+    SYMTAB *owner;      /* scope the symbol is declared in */
+    SYMBOL *hash_next;  /* lookup hash chain, innermost first */
 };
 
 struct symtab {
@@ -208,12 +230,14 @@ struct symtab {
     SYMBOL *tail;
     struct symtab *up;
     int scope;
+    bool live;          /* false once the scope has been left */
 };
 
 SYMBOL *new_symbol(SYMBOL_KIND kind, const char *id, TYPE *type, int scope);
 SYMBOL *lookup_symbol(const char *id);
 
 SYMTAB *get_global_symtab(void);
+int get_current_scope(void);
 bool init_symtab(void);
 void term_symtab(void);
 SYMTAB *enter_scope(void);
@@ -224,7 +248,7 @@ bool sym_is_left_value(const SYMBOL *sym);
 bool sym_is_static(const SYMBOL *sym);
 bool sym_is_extern(const SYMBOL *sym);
 
-int get_current_func_local_offset(void);
+int get_current_func_local_offset(const TYPE *typ);
 
 void fprint_func_comment(FILE *fp, const SYMBOL *sym);
 void fprint_symbol(FILE *fp, int indent, const SYMBOL *sym);
@@ -273,14 +297,20 @@ NODE *new_node_num_node(NODE_KIND kind, const POS *pos, TYPE *typ,
         NODE *np, int num);
 NODE *new_node_string(const POS *pos, STRING *str);
 NODE *node_link(NODE_KIND kind, const POS *pos, NODE *n, NODE *top);
-bool calc_constant_expr(const NODE *np, int *result);
+bool calc_constant_expr(NODE *np, int *result);
 const char *get_node_op_string(NODE_KIND kind);
+const char *get_node_kind_string(NODE_KIND kind);
 void fprint_node(FILE *fp, int indent, const NODE *np);
 void print_node(const NODE *np);
 
 typedef struct {
     SCANNER *scan;
     TOKEN token;
+    int *case_value;    /* case values of the enclosing switches */
+    int num_case;
+    int max_case;
+    int case_base;      /* first value of the innermost switch, -1 outside */
+    bool has_default;
 } PARSER;
 
 PARSER *open_parser_text(const char *filename, const char *text);
@@ -290,4 +320,356 @@ bool parse(PARSER *pars);
 
 bool generate(FILE *fp);
 
+#define NUM_REG_PARAM       6
+#define MAX_ARGS            64
+#define REG_NONE            (-1)
+#define NUM_ALLOC_REG       7
+#define NUM_CALLEE_SAVED    5
+#define MAX_SCRATCH         7
+
+NODE *fold_expr(NODE *np);
+void fold_constants(SYMBOL *func);
+
+typedef enum {
+    DM_DIVIDE, DM_IDENTITY, DM_NEGATE, DM_SHIFT, DM_MAGIC
+} DIV_METHOD;
+
+typedef struct {
+    DIV_METHOD method;
+    bool is_unsigned;
+    bool negative;      /* signed divisor < 0, the quotient is negated */
+    unsigned divisor;   /* the absolute value if signed */
+    unsigned magic;
+    int shift;
+    bool add;           /* 33 bit magic (unsigned), negative magic (signed) */
+} DIV_PLAN;
+
+void plan_div(DIV_PLAN *plan, int d, bool is_unsigned);
+int eval_div_plan(const DIV_PLAN *plan, int n, bool mod);
+
+int alloc_registers(SYMBOL *func, int *saved, unsigned *used, bool *is_leaf);
+int get_expr_need(const NODE *np);
+bool is_leaf_expr(const NODE *np);
+const char *get_reg_name(int reg, int bits);
+
+/*
+ * compiler context
+ *
+ * Everything a translation unit allocates or counts lives here rather
+ * than in file-static variables.  Modules reach it through g_compiler,
+ * which is thread-local and points at a default context until
+ * compile_buffer() switches it, so each thread may compile with its own
+ * context.
+ */
+typedef enum {
+    PH_SCAN, PH_PARSE, PH_TYPE, PH_OPT, PH_GEN, NUM_PHASE
+} PHASE;
+
+#define MAX_PHASE_DEPTH 8
+
+typedef enum {
+    PR_PUSH_POP, PR_SETCC_BRANCH, PR_BRANCH_OVER_JUMP, PR_JUMP_NEXT,
+    PR_DEAD_CODE, PR_SELF_MOVE, PR_REDUNDANT_MOV, PR_CMP_ZERO,
+    PR_ZERO_ADJUST, NUM_PEEPHOLE_RULE
+} PEEPHOLE_RULE;
+
+/*
+ * --stats counters
+ *
+ * Phase times are exclusive: while the parser pulls a token the clock
+ * runs for PH_SCAN, not PH_PARSE.  PH_TYPE is charged once per declarator,
+ * for checking it against earlier declarations, and once per function
+ * definition; the type of an expression is checked as it is parsed and
+ * counts as PH_PARSE.  Times are only taken when enabled is set, the
+ * counters are always maintained.
+ */
+typedef struct {
+    char *name;
+    long tail_recursion; /* self tail calls turned into jumps */
+    long inlined;       /* calls inlined */
+    long removed;       /* IR instructions removed as dead */
+    long hoisted;       /* loop invariants moved out of their loop */
+    long reduced;       /* multiplications of induction variables replaced */
+    long vectorized;    /* loops vectorized */
+} FUNC_STATS;
+
+typedef struct {
+    bool enabled;
+    double wall[NUM_PHASE];
+    double cpu[NUM_PHASE];
+    double mark_wall;
+    double mark_cpu;
+    int depth;
+    PHASE stack[MAX_PHASE_DEPTH];
+    long tokens;
+    long nodes[NUM_NODE_KIND];
+    long symbols;
+    long types;
+    long idents;
+    long strings;
+    long folded;        /* operators replaced by a constant */
+    long peephole[NUM_PEEPHOLE_RULE];   /* rewrites per rule */
+    FUNC_STATS *func;   /* per function, -O2 */
+    int num_func;
+    int max_func;
+    size_t alloc_bytes;
+} STATS;
+
+void reset_stats(void);
+FUNC_STATS *add_func_stats(const char *name);
+void stats_begin(PHASE ph);
+void stats_end(void);
+
+typedef struct compiler {
+    /* scanner.c */
+    struct ident **ident_tab;
+    int ident_size;
+    int ident_count;
+    long ident_lookup;
+    long ident_probe;
+    int ident_max_probe;
+    STRING_POOL string_pool;
+    int string_num;
+    /* symbol.c */
+    SYMTAB *global_symtab;
+    SYMTAB *current_symtab;
+    SYMBOL *current_function;
+    SYMBOL **sym_hash;
+    int sym_hash_size;
+    int sym_hash_count;
+    /* misc.c */
+    int n_error;
+    int n_warning;
+    struct arena_block *arena;
+    struct arena_block *arena_spare;
+    int arena_blocks;
+    long arena_count[NUM_ALLOC_KIND];
+    size_t arena_bytes[NUM_ALLOC_KIND];
+    /* parser.c */
+    int trace_indent;
+    /* gen.c */
+    int opt_level;      /* -O level, kept across units */
+    int label_num;
+    int param_start;
+    int save_start;     /* frame offset of the callee-saved registers */
+    int num_saved;
+    int saved_reg[NUM_CALLEE_SAVED];
+    int switch_density; /* --switch-density, 0 for the default */
+    int inline_threshold;   /* --inline-threshold, 0 default, < 0 off */
+    bool avx2;          /* -mavx2, else vectors are SSE2 */
+    bool keep_frame_pointer;    /* -fno-omit-frame-pointer */
+    bool frameless;     /* no rbp, the frame is in the red zone */
+    bool pushed;        /* frameless code pushed, see gen_func() */
+    int break_label;    /* -1 outside loops and switches */
+    int continue_label; /* -1 outside loops */
+    struct switch_info *switch_info;
+    SYMBOL *func;       /* being generated */
+    int entry_label;    /* after the prologue for self tail calls, or -1 */
+    int pool[MAX_SCRATCH];  /* scratch registers free in this function */
+    int pool_size;
+    int push_depth;     /* 8-byte pushes since the prologue */
+    STATS stats;
+} COMPILER;
+
+extern __thread COMPILER *g_compiler;
+
+COMPILER *new_compiler(void);
+void free_compiler(COMPILER *cc);
+bool compile_buffer(COMPILER *cc, const char *name, const char *text,
+                    FILE *out);
+void fprint_stats(FILE *fp, const COMPILER *cc);
+
+typedef struct emitter EMITTER;
+
+EMITTER *open_emitter(FILE *fp);
+bool close_emitter(EMITTER *em);
+FILE *emit_fp(EMITTER *em);
+void emit_begin_func(EMITTER *em);
+void emit_end_func(EMITTER *em, bool optimize);
+void emit_text(EMITTER *em, const char *s, size_t len);
+void emit_str(EMITTER *em, const char *s);
+void emit_char(EMITTER *em, int c);
+void emit_int(EMITTER *em, int n);
+void emit_label(EMITTER *em, int num);
+void emit_label_def(EMITTER *em, int num);
+void emit_op(EMITTER *em, const char *op);
+void emit_op1(EMITTER *em, const char *op, const char *a);
+void emit_op2(EMITTER *em, const char *op, const char *a, const char *b);
+void emit_op3(EMITTER *em, const char *op, const char *a, const char *b,
+                const char *c);
+void emit_op2_imm(EMITTER *em, const char *op, const char *a, int n);
+void emit_jump(EMITTER *em, const char *op, int label);
+
+void peephole(EMITTER *em, const char *text, size_t len);
+const char *get_peephole_rule_name(PEEPHOLE_RULE rule);
+
+typedef struct {
+    long key;           /* value, ordered as the switch type compares */
+    int label;
+    const NODE *node;
+} CASE_LABEL;
+
+#define MAX_VAR_ADDR    (MAX_IDENT + 16)
+#define RED_ZONE        128     /* bytes below rsp a leaf may use */
+
+bool can_omit_frame(int frame_size);
+const char *frame_base(int *disp);
+void format_frame_addr(char *buf, int disp);
+void format_var_addr(char *buf, const SYMBOL *sym);
+void gen_func_header(EMITTER *em, const SYMBOL *sym);
+void gen_leave(EMITTER *em);
+void gen_save_regs(EMITTER *em);
+void gen_epilogue(EMITTER *em);
+void gen_mul_imm(EMITTER *em, const char *r32, const char *r64, int c);
+void gen_div_const(EMITTER *em, const DIV_PLAN *plan, const char *r, bool mod);
+void gen_case_dispatch(EMITTER *em, const CASE_LABEL *cases, int n, int def,
+                        bool is_unsigned);
+bool is_unsigned_compare(const NODE *np);
+
+/*
+ * three-address IR (-O2)
+ *
+ * A function body becomes a list of basic blocks in layout order.  Each
+ * block is a list of instructions ending with exactly one terminator
+ * (jmp, br, switch or ret), and succ/pred hold the CFG edges.
+ *
+ * Operands are temporaries, variables (the locals and parameters of the
+ * function, IR_FUNC.var), globals, immediates, strings and functions.
+ * A temporary is assigned by one instruction, except for the value of
+ * ?:, && and ||, which each arm assigns, and the variables of an inlined
+ * function, which become temporaries of the caller.  Variables may be assigned any
+ * number of times; an SSA form would rename their definitions (and
+ * those temporaries) using the pred lists for the phis.  Globals are
+ * only read and written by IR_MOV, so every memory access is explicit.
+ * Array elements are read by IR_LOAD and written by IR_STORE, indexed
+ * in ints from a base which is a local array or a pointer parameter;
+ * such a parameter is the only kind of 64 bit variable, see
+ * ir_is_pointer().
+ *
+ * The vectorizer adds vector operands, each a register of 4 ints (8
+ * with -mavx2).  On them IR_MOV broadcasts a scalar, IR_LOAD and IR_STORE
+ * access that many elements from the index and the arithmetic works
+ * lane by lane, a shift by a constant.  IR_NOALIAS sets its destination
+ * to 1 when the addresses a + c and b are at least a vector apart.
+ */
+typedef enum {
+    OPD_NONE, OPD_TEMP, OPD_VAR, OPD_GLOBAL, OPD_IMM, OPD_STR, OPD_FUNC,
+    OPD_ARRAY, OPD_VEC,
+} OPERAND_KIND;
+
+typedef struct {
+    OPERAND_KIND kind;
+    int num;            /* temp: number, var: index into var[], imm: value,
+                           vec: register */
+    SYMBOL *sym;        /* var, global, func, array */
+    STRING *str;
+} OPERAND;
+
+typedef enum {
+    IR_MOV, IR_NEG, IR_NOT,
+    IR_ADD, IR_SUB, IR_MUL, IR_DIV, IR_MOD, IR_AND, IR_OR, IR_XOR,
+    IR_SHL, IR_SHR, IR_SET, IR_CALL,
+    IR_LOAD, IR_STORE, IR_NOALIAS,
+    IR_JMP, IR_BR, IR_SWITCH, IR_RET,
+    NUM_IR_OP
+} IR_OP;
+
+typedef enum {
+    IC_EQ, IC_NE, IC_LT, IC_GT, IC_LE, IC_GE,
+} IR_COND;
+
+typedef struct ir_block IR_BLOCK;
+typedef struct ir_insn IR_INSN;
+
+typedef struct {
+    int value;
+    IR_BLOCK *block;
+} IR_CASE;
+
+struct ir_insn {
+    IR_OP op;
+    IR_COND cond;           /* IR_SET, IR_BR */
+    bool is_unsigned;       /* div, mod, shr, set, br, switch */
+    OPERAND dst;
+    OPERAND a;              /* load, store: the base */
+    OPERAND b;              /* load, store: the index */
+    OPERAND c;              /* store: the value, noalias: bytes added to a */
+    OPERAND *arg;           /* IR_CALL, a is the callee */
+    int num_arg;
+    IR_CASE *cases;         /* IR_SWITCH */
+    int num_case;
+    int max_case;
+    IR_BLOCK *target[2];    /* jmp; br true, false; switch default */
+    const POS *pos;
+    IR_INSN *prev;
+    IR_INSN *next;
+};
+
+struct ir_block {
+    int id;
+    int label;              /* assigned by lower_ir() */
+    IR_INSN *head;
+    IR_INSN *tail;          /* the terminator */
+    IR_BLOCK **succ;
+    int num_succ;
+    IR_BLOCK **pred;
+    int num_pred;
+    IR_BLOCK *next;         /* layout order */
+    unsigned *live_in;      /* by vreg, see ir_liveness() */
+    unsigned *live_out;
+};
+
+typedef struct {
+    SYMBOL *func;
+    IR_BLOCK *entry;
+    int num_block;
+    int num_temp;
+    SYMBOL **var;
+    int num_var;
+    int max_var;
+} IR_FUNC;
+
+/* bit sets over vregs */
+#define SET_WORDS(n)        (((n) + 31) / 32)
+#define SET_HAS(s, i)       (((s)[(i) / 32] >> ((i) % 32)) & 1)
+#define SET_ADD(s, i)       ((s)[(i) / 32] |= 1u << ((i) % 32))
+#define SET_DEL(s, i)       ((s)[(i) / 32] &= ~(1u << ((i) % 32)))
+
+/* a natural loop, see ir_find_loops() */
+typedef struct {
+    IR_BLOCK *header;
+    bool *body;             /* by block id */
+    int size;
+} IR_LOOP;
+
+typedef struct {
+    IR_FUNC *ir;
+    IR_BLOCK **block;       /* by id */
+    unsigned **dom;         /* by id, the blocks dominating it */
+    IR_LOOP *loop;          /* innermost first */
+    int num_loop;
+    int max_loop;
+} IR_LOOPS;
+
+IR_FUNC *build_ir(SYMBOL *func);
+void ir_number_blocks(IR_FUNC *ir);
+void ir_build_cfg(IR_FUNC *ir);
+int ir_num_vreg(const IR_FUNC *ir);
+int ir_vreg(const IR_FUNC *ir, const OPERAND *opd);
+bool ir_is_pointer(const IR_FUNC *ir, const OPERAND *opd);
+bool ir_is_terminator(IR_OP op);
+int ir_uses(const IR_INSN *ip, const OPERAND **use, int max);
+void ir_liveness(IR_FUNC *ir);
+void ir_find_loops(IR_LOOPS *li, IR_FUNC *ir);
+void ir_free_loops(IR_LOOPS *li);
+IR_BLOCK *ir_make_preheader(IR_FUNC *ir, const IR_LOOP *lp);
+void fprint_ir(FILE *fp, const IR_FUNC *ir);
+int eliminate_tail_recursion(IR_FUNC *ir);
+int eliminate_dead_code(IR_FUNC *ir);
+int inline_calls(IR_FUNC *ir);
+int hoist_invariants(IR_FUNC *ir);
+int reduce_induction_vars(IR_FUNC *ir);
+int vectorize_loops(IR_FUNC *ir);
+bool lower_ir(EMITTER *em, IR_FUNC *ir);
+
 #endif
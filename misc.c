@@ -1,3 +1,4 @@
+#include <time.h>
 #include "minicc.h"
 
 #ifdef NDEBUG
@@ -6,8 +7,8 @@
 # define ERR_OUT stdout
 #endif
 
-static int s_n_error;
-static int s_n_warning;
+static COMPILER s_default_compiler;
+__thread COMPILER *g_compiler = &s_default_compiler;
 
 #ifndef NDEBUG
 struct debug {
@@ -40,12 +41,12 @@ void set_debug(const char *s)
 
 int get_num_errors(void)
 {
-    return s_n_error;
+    return g_compiler->n_error;
 }
 
 int get_num_warning(void)
 {
-    return s_n_warning;
+    return g_compiler->n_warning;
 }
 
 void vwarning(const POS *pos, const char *s, va_list ap)
@@ -53,7 +54,7 @@ void vwarning(const POS *pos, const char *s, va_list ap)
     fprintf(ERR_OUT, "%s(%d): warning: ", pos->filename, pos->line);
     vfprintf(ERR_OUT, s, ap);
     fprintf(ERR_OUT, "\n");
-    s_n_warning++;
+    g_compiler->n_warning++;
 }
 
 void warning(const POS *pos, const char *s, ...)
@@ -69,7 +70,7 @@ void verror(const POS *pos, const char *s, va_list ap)
     fprintf(ERR_OUT, "%s(%d): error: ", pos->filename, pos->line);
     vfprintf(ERR_OUT, s, ap);
     fprintf(ERR_OUT, "\n");
-    s_n_error++;
+    g_compiler->n_error++;
 }
 
 void error(const POS *pos, const char *s, ...)
@@ -87,6 +88,8 @@ void *alloc(size_t size)
         fprintf(stderr, "out of memory\n");
         abort();
     }
+    /* the default context is shared by threads outside compile_buffer() */
+    __atomic_add_fetch(&g_compiler->stats.alloc_bytes, size, __ATOMIC_RELAXED);
     return p;
 }
 
@@ -98,3 +101,195 @@ char *str_dup(const char *s)
     return d;
 }
 
+
+void reset_stats(void)
+{
+    STATS *st = &g_compiler->stats;
+    bool enabled = st->enabled;
+    int i;
+
+    for (i = 0; i < st->num_func; i++)
+        free(st->func[i].name);
+    free(st->func);
+    memset(st, 0, sizeof (STATS));
+    st->enabled = enabled;
+}
+
+/* a zeroed record for the function name */
+FUNC_STATS *add_func_stats(const char *name)
+{
+    STATS *st = &g_compiler->stats;
+    FUNC_STATS *fs;
+
+    if (st->num_func == st->max_func) {
+        st->max_func = st->max_func ? st->max_func * 2 : 16;
+        st->func = (FUNC_STATS*) realloc(st->func,
+                                    sizeof (FUNC_STATS) * st->max_func);
+        if (st->func == NULL) {
+            fprintf(stderr, "out of memory\n");
+            abort();
+        }
+    }
+    fs = &st->func[st->num_func++];
+    memset(fs, 0, sizeof (FUNC_STATS));
+    fs->name = str_dup(name);
+    return fs;
+}
+
+/* charge the time since the last mark to the innermost phase */
+static void stats_mark(STATS *st)
+{
+    struct timespec ts;
+    double wall, cpu;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    wall = ts.tv_sec + ts.tv_nsec / 1e9;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+    if (st->depth > 0) {
+        st->wall[st->stack[st->depth - 1]] += wall - st->mark_wall;
+        st->cpu[st->stack[st->depth - 1]] += cpu - st->mark_cpu;
+    }
+    st->mark_wall = wall;
+    st->mark_cpu = cpu;
+}
+
+void stats_begin(PHASE ph)
+{
+    STATS *st = &g_compiler->stats;
+    if (!st->enabled)
+        return;
+    assert(st->depth < MAX_PHASE_DEPTH);
+    stats_mark(st);
+    st->stack[st->depth++] = ph;
+}
+
+void stats_end(void)
+{
+    STATS *st = &g_compiler->stats;
+    if (!st->enabled)
+        return;
+    assert(st->depth > 0);
+    stats_mark(st);
+    st->depth--;
+}
+
+
+/*
+ * translation unit arena
+ *
+ * Nodes, types, symbols and interned strings live until the unit has
+ * been generated, so they are bump allocated from a chain of blocks and
+ * released all at once by arena_release().
+ */
+#define ARENA_BLOCK_SIZE    (64 * 1024)
+#define ARENA_ALIGN         16
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+} ARENA_BLOCK;
+
+#define ARENA_HEADER_SIZE \
+    ((sizeof (ARENA_BLOCK) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+
+static ARENA_BLOCK *new_arena_block(size_t size)
+{
+    ARENA_BLOCK *b;
+    if (size <= ARENA_BLOCK_SIZE && g_compiler->arena_spare != NULL) {
+        b = g_compiler->arena_spare;
+        g_compiler->arena_spare = NULL;
+    } else {
+        if (size < ARENA_BLOCK_SIZE)
+            size = ARENA_BLOCK_SIZE;
+        b = (ARENA_BLOCK*) alloc(ARENA_HEADER_SIZE + size);
+        b->size = size;
+    }
+    b->used = 0;
+    g_compiler->arena_blocks++;
+    return b;
+}
+
+void *arena_alloc(ALLOC_KIND kind, size_t size)
+{
+    ARENA_BLOCK *b = g_compiler->arena;
+    void *p;
+
+    assert(kind < NUM_ALLOC_KIND);
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (b == NULL || b->used + size > b->size) {
+        b = new_arena_block(size);
+        if (g_compiler->arena != NULL && size > ARENA_BLOCK_SIZE / 4) {
+            /* keep filling the current block after a large request */
+            b->next = g_compiler->arena->next;
+            g_compiler->arena->next = b;
+        } else {
+            b->next = g_compiler->arena;
+            g_compiler->arena = b;
+        }
+    }
+    p = (char*) b + ARENA_HEADER_SIZE + b->used;
+    b->used += size;
+    g_compiler->arena_count[kind]++;
+    g_compiler->arena_bytes[kind] += size;
+    return p;
+}
+
+void arena_release(void)
+{
+    ARENA_BLOCK *b, *next;
+    int i;
+
+    for (b = g_compiler->arena; b != NULL; b = next) {
+        next = b->next;
+        if (g_compiler->arena_spare == NULL && b->size == ARENA_BLOCK_SIZE)
+            g_compiler->arena_spare = b;
+        else
+            free(b);
+    }
+    g_compiler->arena = NULL;
+    g_compiler->arena_blocks = 0;
+    for (i = 0; i < NUM_ALLOC_KIND; i++) {
+        g_compiler->arena_count[i] = 0;
+        g_compiler->arena_bytes[i] = 0;
+    }
+}
+
+/* release the arena together with its spare block */
+void term_arena(void)
+{
+    arena_release();
+    free(g_compiler->arena_spare);
+    g_compiler->arena_spare = NULL;
+}
+
+void print_arena_report(void)
+{
+    static const char *kind_name[NUM_ALLOC_KIND] = {
+        "node", "type", "param", "symbol", "symtab", "ident", "string",
+        "ir",
+    };
+    ARENA_BLOCK *b;
+    size_t used = 0, reserved = 0;
+    long count = 0;
+    int i;
+
+    printf("arena [\n");
+    for (i = 0; i < NUM_ALLOC_KIND; i++) {
+        printf(" %-8s %8ld objects %10lu bytes\n", kind_name[i],
+                g_compiler->arena_count[i],
+                (unsigned long) g_compiler->arena_bytes[i]);
+        count += g_compiler->arena_count[i];
+    }
+    for (b = g_compiler->arena; b != NULL; b = b->next) {
+        used += b->used;
+        reserved += b->size;
+    }
+    printf(" total    %8ld objects %10lu bytes\n",
+            count, (unsigned long) used);
+    printf(" blocks %d, reserved %lu bytes\n",
+            g_compiler->arena_blocks, (unsigned long) reserved);
+    printf("]\n");
+}
@@ -1,10 +1,13 @@
 #include "minicc.h"
 
-static TYPE *s_type_string = NULL;
+static TYPE s_type_string = {
+    T_POINTER, SC_DEFAULT, TQ_DEFAULT, &g_type_uchar, NULL, NULL
+};
 
 NODE *new_node(NODE_KIND kind, const POS *pos, TYPE *typ)
 {
-    NODE *np = (NODE*) alloc(sizeof (NODE));
+    NODE *np = (NODE*) arena_alloc(AK_NODE, sizeof (NODE));
+    g_compiler->stats.nodes[kind]++;
     np->kind = kind;
     np->pos = *pos;
     np->type = typ;
@@ -69,10 +72,7 @@ NODE *new_node_num_node(NODE_KIND kind, const POS *pos, TYPE *typ,
 
 NODE *new_node_string(const POS *pos, STRING *str)
 {
-    NODE *np;
-    if (s_type_string == NULL)
-        s_type_string = new_type(T_POINTER, &g_type_uchar);
-    np = new_node(NK_STRING_LIT, pos, s_type_string);
+    NODE *np = new_node(NK_STRING_LIT, pos, &s_type_string);
     np->u.str = str;
     return np;
 }
@@ -89,99 +89,19 @@ NODE *node_link(NODE_KIND kind, const POS *pos, NODE *n, NODE *top)
     return top;
 }
 
-bool calc_constant_expr(const NODE *np, int *result)
+/* the value of the integer constant expression np, see fold.c */
+bool calc_constant_expr(NODE *np, int *result)
 {
-    int lval, rval;
     assert(np);
     assert(result);
 
-    switch (np->kind) {
-    case NK_EQ:
-    case NK_NEQ:
-    case NK_LT:
-    case NK_GT:
-    case NK_LE:
-    case NK_GE:
-        /*TODO*/
-        return false;
-    case NK_SHL:
-    case NK_SHR:
-        /*TODO*/
-        return false;
-    case NK_ADD:
-    case NK_SUB:
-    case NK_MUL:
-    case NK_DIV:
-    case NK_MOD:
-        if (!calc_constant_expr(np->u.link.left, &lval))
-            return false;
-        if (!calc_constant_expr(np->u.link.right, &rval))
-            return false;
-        switch (np->kind) {
-        case NK_ADD:
-            *result = lval + rval;
-            break;
-        case NK_SUB:
-            *result = lval - rval;
-            break;
-        case NK_MUL:
-            *result = lval * rval;
-            break;
-        case NK_DIV:
-            if (rval == 0) {
-                error(&np->pos, "divide by zero");
-                return false;
-            }
-            *result = lval / rval;
-            break;
-        case NK_MOD:
-            if (rval == 0) {
-                error(&np->pos, "divide by zero");
-                return false;
-            }
-            *result = lval % rval;
-            break;
-        default: assert(0);
-        }
-        return true;
-    case NK_LOR:
-    case NK_LAND:
-        /*TODO*/
-        return false;
-    case NK_OR:
-    case NK_XOR:
-    case NK_AND:
-        /*TODO*/
-        return false;
-    case NK_UPLUS:
-    case NK_UMINUS:
-    case NK_COMPLEMENT:
-    case NK_NOT:
-        /*TODO*/
-        return false;
-    case NK_CAST:
-        /*TODO*/
-        return false;
-    case NK_COND:
-        /*TODO*/
-        return false;
-    case NK_ID:
-        /*TODO*/
-        return false;
-    case NK_CHAR_LIT:
-    case NK_INT_LIT:
-        *result = np->u.num;
-        return true;
-    case NK_UINT_LIT:
-    case NK_LONG_LIT:
-    case NK_ULONG_LIT:
-        /*TODO*/
-        return false;
-    default:
+    np = fold_expr(np);
+    if (np->kind != NK_CHAR_LIT && np->kind != NK_INT_LIT) {
         error(&np->pos, "expect integer constant expression");
-        break;
+        return false;
     }
-    return false;
+    *result = np->u.num;
+    return true;
 }
 
 const char *get_node_op_string(NODE_KIND kind)
@@ -232,6 +152,26 @@ const char *get_node_op_string(NODE_KIND kind)
     return NULL;
 }
 
+const char *get_node_kind_string(NODE_KIND kind)
+{
+    static const char *name[NUM_NODE_KIND] = {
+        "COMPOUND", "LINK", "IF", "THEN", "SWITCH", "CASE", "DEFAULT",
+        "WHILE", "DO", "FOR", "FOR2", "FOR3", "GOTO", "CONTINUE",
+        "BREAK", "RETURN", "LABEL", "EXPR",
+        "EXPR_LINK", "ASSIGN", "AS_MUL", "AS_DIV", "AS_MOD", "AS_ADD",
+        "AS_SUB", "AS_SHL", "AS_SHR", "AS_AND", "AS_XOR", "AS_OR",
+        "EQ", "NEQ", "LT", "GT", "LE", "GE", "SHL", "SHR", "ADD", "SUB",
+        "MUL", "DIV", "MOD", "CAST", "PREINC", "PREDEC", "SIZEOF",
+        "COND", "COND2", "LOR", "LAND", "OR", "XOR", "AND",
+        "ARRAY", "CALL", "DOT", "PTR", "POSTINC", "POSTDEC", "ID",
+        "CHAR_LIT", "INT_LIT", "UINT_LIT", "LONG_LIT", "ULONG_LIT",
+        "FLOAT_LIT", "DOUBLE_LIT", "STRING_LIT", "ARG",
+        "ADDR", "DEREF", "UPLUS", "UMINUS", "COMPLEMENT", "NOT",
+    };
+    assert(kind < NUM_NODE_KIND);
+    return name[kind];
+}
+
 void fprint_node(FILE *fp, int indent, const NODE *np)
 {
     if (np == NULL)
@@ -490,6 +430,9 @@ void fprint_node(FILE *fp, int indent, const NODE *np)
             fprint_type(fp, np->type);
         }
         break;
+    case NUM_NODE_KIND:
+        assert(0);
+        break;
     }
 }
 
@@ -0,0 +1,319 @@
+.intel_syntax noprefix
+# FUNC printf (param 0, local 0): FUNC int (POINTER to uchar,  ...)
+.global _print_board
+_print_board:
+# FUNC print_board (param 1, local 8): FUNC int (ARRAY [] of ARRAY [10] of int board)
+# PARAM board (num 0, offset 0): ARRAY [] of ARRAY [10] of int
+# LOCAL i (num 0, offset 0): int
+# LOCAL j (num 0, offset 4): int
+    push rbp
+    mov rbp, rsp
+    sub rsp, 64
+    mov [rbp-32],rbx
+    mov [rbp-40],r12
+    mov [rbp-48],r13
+    mov [rbp-56],r14
+    mov [rbp-64],r15
+    mov rbx, rdi
+# nqueen.c(5)
+    mov r12d, 0
+    mov r13d, 0
+.L1:
+    cmp r12d, 10
+    jge .L9
+# nqueen.c(6)
+    mov r14d, 0
+# nqueen.c(7)
+    mov r15d, r13d
+# nqueen.c(6)
+.L3:
+    cmp r14d, 10
+    jge .L8
+# nqueen.c(7)
+    mov r10d, r15d
+    add r10d, r14d
+    movsxd rcx, r10d
+    mov r11d, dword ptr [rbx+rcx*4]
+    test r11d, r11d
+    je .L6
+# nqueen.c(8)
+# CALL
+    mov edi, .L_S0
+    call _printf
+    mov r10d, eax
+    jmp .L7
+.L6:
+# nqueen.c(10)
+# CALL
+    mov edi, .L_S1
+    call _printf
+    mov r10d, eax
+.L7:
+# nqueen.c(6)
+    add r14d, 1
+    jmp .L3
+.L8:
+# nqueen.c(11)
+# CALL
+    mov edi, .L_S2
+    call _printf
+    mov r10d, eax
+# nqueen.c(5)
+    add r12d, 1
+    add r13d, 10
+    jmp .L1
+.L9:
+# nqueen.c(13)
+# TAIL CALL
+    mov edi, .L_S3
+    mov rbx,[rbp-32]
+    mov r12,[rbp-40]
+    mov r13,[rbp-48]
+    mov r14,[rbp-56]
+    mov r15,[rbp-64]
+    mov rsp, rbp
+    pop rbp
+    jmp _printf
+.global _conflict
+_conflict:
+# FUNC conflict (param 3, local 8): FUNC int (ARRAY [] of ARRAY [10] of int board, int row, int col)
+# PARAM board (num 0, offset 0): ARRAY [] of ARRAY [10] of int
+# PARAM row (num 1, offset 4): int
+# PARAM col (num 2, offset 8): int
+# LOCAL i (num 0, offset 0): int
+# LOCAL j (num 0, offset 4): int
+    mov [rsp-48],rbx
+    mov [rsp-56],r12
+    mov [rsp-64],r13
+    mov [rsp-72],r14
+    mov [rsp-80],r15
+    mov [rsp-88], rdi
+    mov r11d, esi
+    mov ebx, edx
+# nqueen.c(18)
+    mov r12d, 0
+    mov r13d, 0
+.L11:
+    cmp r12d, r11d
+    jge .L21
+# nqueen.c(19)
+    mov r14d, r13d
+    add r14d, ebx
+    mov rax, [rsp-88]
+    movsxd rcx, r14d
+    mov r15d, dword ptr [rax+rcx*4]
+    test r15d, r15d
+    je .L14
+# nqueen.c(20)
+    mov eax, 1
+    mov rbx,[rsp-48]
+    mov r12,[rsp-56]
+    mov r13,[rsp-64]
+    mov r14,[rsp-72]
+    mov r15,[rsp-80]
+    ret
+.L14:
+# nqueen.c(21)
+    mov r14d, r11d
+    sub r14d, r12d
+# nqueen.c(22)
+    mov r15d, ebx
+    sub r15d, r14d
+    mov r10d, r15d
+    add r10d, 1
+    test r10d, r10d
+    jle .L17
+    mov r10d, ebx
+    sub r10d, r14d
+    mov r15d, r13d
+    add r15d, r10d
+    mov rax, [rsp-88]
+    movsxd rcx, r15d
+    mov r10d, dword ptr [rax+rcx*4]
+    test r10d, r10d
+    je .L17
+# nqueen.c(23)
+    mov eax, 1
+    mov rbx,[rsp-48]
+    mov r12,[rsp-56]
+    mov r13,[rsp-64]
+    mov r14,[rsp-72]
+    mov r15,[rsp-80]
+    ret
+.L17:
+# nqueen.c(24)
+    mov r10d, ebx
+    add r10d, r14d
+    cmp r10d, 10
+    jge .L20
+    mov r10d, ebx
+    add r10d, r14d
+    mov r14d, r13d
+    add r14d, r10d
+    mov rax, [rsp-88]
+    movsxd rcx, r14d
+    mov r10d, dword ptr [rax+rcx*4]
+    test r10d, r10d
+    je .L20
+# nqueen.c(25)
+    mov eax, 1
+    mov rbx,[rsp-48]
+    mov r12,[rsp-56]
+    mov r13,[rsp-64]
+    mov r14,[rsp-72]
+    mov r15,[rsp-80]
+    ret
+.L20:
+# nqueen.c(18)
+    add r12d, 1
+    add r13d, 10
+    jmp .L11
+.L21:
+# nqueen.c(27)
+    mov eax, 0
+    mov rbx,[rsp-48]
+    mov r12,[rsp-56]
+    mov r13,[rsp-64]
+    mov r14,[rsp-72]
+    mov r15,[rsp-80]
+    ret
+.global _solve
+_solve:
+# FUNC solve (param 2, local 4): FUNC int (ARRAY [] of ARRAY [10] of int board, int row)
+# PARAM board (num 0, offset 0): ARRAY [] of ARRAY [10] of int
+# PARAM row (num 1, offset 4): int
+# LOCAL i (num 0, offset 0): int
+    push rbp
+    mov rbp, rsp
+    sub rsp, 80
+    mov [rbp-32],rbx
+    mov [rbp-40],r12
+    mov [rbp-48],r13
+    mov [rbp-56],r14
+    mov [rbp-64],r15
+    mov rbx, rdi
+    mov r12d, esi
+# nqueen.c(32)
+    cmp r12d, 9
+    jle .L24
+# nqueen.c(33)
+# CALL
+    mov rdi, rbx
+    call _print_board
+    mov r10d, eax
+# nqueen.c(34)
+    mov eax, 0
+    mov rbx,[rbp-32]
+    mov r12,[rbp-40]
+    mov r13,[rbp-48]
+    mov r14,[rbp-56]
+    mov r15,[rbp-64]
+    mov rsp, rbp
+    pop rbp
+    ret
+.L24:
+# nqueen.c(36)
+    mov r13d, 0
+# nqueen.c(39)
+    mov r14d, r12d
+    lea r14d, [r14+r14*4]
+    shl r14d, 1
+# nqueen.c(40)
+    mov r15d, r12d
+    add r15d, 1
+# nqueen.c(41)
+    mov eax, r12d
+    lea eax, [rax+rax*4]
+    shl eax, 1
+    mov [rbp-68], eax
+# nqueen.c(36)
+.L25:
+    cmp r13d, 10
+    jge .L29
+# nqueen.c(37)
+# CALL
+    mov rdi, rbx
+    mov esi, r12d
+    mov edx, r13d
+    call _conflict
+    mov r10d, eax
+    test r10d, r10d
+    jne .L28
+# nqueen.c(39)
+    mov r10d, r14d
+    add r10d, r13d
+    movsxd rcx, r10d
+    mov dword ptr [rbx+rcx*4], 1
+# nqueen.c(40)
+# CALL
+    mov rdi, rbx
+    mov esi, r15d
+    call _solve
+    mov r10d, eax
+# nqueen.c(41)
+    mov r10d, [rbp-68]
+    add r10d, r13d
+    movsxd rcx, r10d
+    mov dword ptr [rbx+rcx*4], 0
+.L28:
+# nqueen.c(36)
+    add r13d, 1
+    jmp .L25
+.L29:
+    mov rbx,[rbp-32]
+    mov r12,[rbp-40]
+    mov r13,[rbp-48]
+    mov r14,[rbp-56]
+    mov r15,[rbp-64]
+    mov rsp, rbp
+    pop rbp
+    ret
+.global _main
+_main:
+# FUNC main (param 0, local 404): FUNC int ()
+# LOCAL board (num 0, offset 396): ARRAY [100] of int
+# LOCAL i (num 0, offset 400): int
+    push rbp
+    mov rbp, rsp
+    sub rsp, 416
+# nqueen.c(49)
+    mov r10d, 0
+    pxor xmm0, xmm0
+.L31:
+    cmp r10d, 97
+    jge .L33
+# nqueen.c(50)
+    movsxd rcx, r10d
+    movdqu xmmword ptr [rbp+rcx*4-400], xmm0
+# nqueen.c(49)
+    add r10d, 4
+    jmp .L31
+.L33:
+    cmp r10d, 100
+    jge .L35
+# nqueen.c(50)
+    movsxd rcx, r10d
+    mov dword ptr [rbp+rcx*4-400], 0
+# nqueen.c(49)
+    add r10d, 1
+    jmp .L33
+.L35:
+# nqueen.c(51)
+# CALL
+    lea rdi, [rbp-400]
+    mov esi, 0
+    call _solve
+    mov r10d, eax
+# nqueen.c(52)
+    mov eax, 0
+    mov rsp, rbp
+    pop rbp
+    ret
+.L_S0:
+    .asciz "Q "
+.L_S1:
+    .asciz ". "
+.L_S2:
+    .asciz "\n"
+.L_S3:
+    .asciz "\n\n"
@@ -7,13 +7,15 @@
 # define LEAVE(fn)      ((void) 0)
 # define TRACE(fn)      ((void) 0)
 #else
-static int s_indent = 0;
 # define ENTER(fn)      if (is_debug("parser_trace")) \
-                            printf("%*sENTER %s\n", s_indent++, "", (fn))
+                            printf("%*sENTER %s\n", \
+                                    g_compiler->trace_indent++, "", (fn))
 # define LEAVE(fn)      if (is_debug("parser_trace")) \
-                            printf("%*sLEAVE %s\n", --s_indent, "", (fn))
+                            printf("%*sLEAVE %s\n", \
+                                    --g_compiler->trace_indent, "", (fn))
 # define TRACE(fn,s)    if (is_debug("parser_trace")) \
-                            printf("%*sTRACE %s %s\n", s_indent, "", (fn), (s))
+                            printf("%*sTRACE %s %s\n", \
+                                    g_compiler->trace_indent, "", (fn), (s))
 #endif
 
 const POS *get_pos(const PARSER *pars)
@@ -73,6 +75,10 @@ PARSER *open_parser_text(const char *filename, const char *text)
         return NULL;
     }
     pars->token = TK_EOF;
+    pars->case_value = NULL;
+    pars->num_case = pars->max_case = 0;
+    pars->case_base = -1;
+    pars->has_default = false;
     return pars;
 }
 
@@ -85,6 +91,10 @@ PARSER *open_parser(const char *filename)
         return NULL;
     }
     pars->token = TK_EOF;
+    pars->case_value = NULL;
+    pars->num_case = pars->max_case = 0;
+    pars->case_base = -1;
+    pars->has_default = false;
     return pars;
 }
 
@@ -93,6 +103,7 @@ bool close_parser(PARSER *pars)
     if (pars == NULL)
         return false;
     close_scanner(pars->scan);
+    free(pars->case_value);
     free(pars);
     return true;
 }
@@ -1069,6 +1080,33 @@ static bool parse_constant_expression(PARSER *pars, NODE **exp, int *result)
 
 static bool parse_compound_statement(PARSER *pars, NODE **node, int scope);
 
+/* record a case value of the innermost switch, diagnosing duplicates */
+static void add_case_value(PARSER *pars, const POS *pos, int v)
+{
+    int i;
+
+    if (pars->case_base < 0) {
+        error(pos, "case label not within a switch statement");
+        return;
+    }
+    for (i = pars->case_base; i < pars->num_case; i++) {
+        if (pars->case_value[i] == v) {
+            error(pos, "duplicate case value %d", v);
+            return;
+        }
+    }
+    if (pars->num_case == pars->max_case) {
+        pars->max_case = (pars->max_case == 0) ? 64 : pars->max_case * 2;
+        pars->case_value = (int*) realloc(pars->case_value,
+                                        sizeof (int) * pars->max_case);
+        if (pars->case_value == NULL) {
+            fprintf(stderr, "out of memory\n");
+            abort();
+        }
+    }
+    pars->case_value[pars->num_case++] = v;
+}
+
 /*
 statement
 	= labeled_statement
@@ -1125,9 +1163,9 @@ static bool parse_statement(PARSER *pars, NODE **node, int scope)
                 goto fail;
             if (!expect(pars, TK_COLON))
                 goto fail;
+            add_case_value(pars, &pos, v);
             if (!parse_statement(pars, &b, scope))
                 goto fail;
-            /*TODO check e exclusive */
             *node = new_node_num_node(NK_CASE, &pos, NULL, b, v);
         }
         break;
@@ -1140,6 +1178,11 @@ static bool parse_statement(PARSER *pars, NODE **node, int scope)
             next(pars);
             if (!expect(pars, TK_COLON))
                 goto fail;
+            if (pars->case_base < 0)
+                error(&pos, "'default' label not within a switch statement");
+            else if (pars->has_default)
+                error(&pos, "multiple default labels in one switch");
+            pars->has_default = true;
             if (!parse_statement(pars, &b, scope))
                 goto fail;
             *node = new_node1(NK_DEFAULT, &pos, NULL, b);
@@ -1190,6 +1233,9 @@ static bool parse_statement(PARSER *pars, NODE **node, int scope)
         {
             NODE *e = NULL, *b = NULL;
             POS pos = *get_pos(pars);
+            int base = pars->case_base;
+            bool has_default = pars->has_default;
+            bool result;
             next(pars);
             if (!expect(pars, TK_LPAR))
                 goto fail;
@@ -1198,9 +1244,14 @@ static bool parse_statement(PARSER *pars, NODE **node, int scope)
             type_check_integer(&pos, e->type);
             if (!expect(pars, TK_RPAR))
                 goto fail;
-            if (!parse_statement(pars, &b, scope))
+            pars->case_base = pars->num_case;
+            pars->has_default = false;
+            result = parse_statement(pars, &b, scope);
+            pars->num_case = pars->case_base;
+            pars->case_base = base;
+            pars->has_default = has_default;
+            if (!result)
                 goto fail;
-            /*TODO check case value (unique and exclusive) */
             *node = new_node2(NK_SWITCH, &pos, NULL, e, b);
         }
         break;
@@ -1479,6 +1530,7 @@ static bool parse_init_declarator(PARSER *pars, TYPE **pptyp, int scope)
 
     if (!parse_declarator(pars, pptyp, &id))
         return false;
+    stats_begin(PH_TYPE);
     sym = lookup_symbol(id);
     if (sym) {
         if (sym->kind == SK_FUNC && (*pptyp)->kind == T_FUNC) {
@@ -1495,8 +1547,9 @@ static bool parse_init_declarator(PARSER *pars, TYPE **pptyp, int scope)
     if (sym == NULL) {
         sym = new_symbol(((*pptyp)->kind == T_FUNC) ? SK_FUNC : SK_LOCAL,
                         id, *pptyp, scope);
-        sym->offset = get_current_func_local_offset();
+        sym->offset = get_current_func_local_offset(*pptyp);
     }
+    stats_end();
 
     if (is_token(pars, TK_ASSIGN)) {
         next(pars);
@@ -1728,6 +1781,7 @@ abstract_declarator
 static bool parse_abstract_declarator(PARSER *pars, TYPE **pptyp, char **id)
 {
     TYPE *typ = NULL;
+    TYPE **dim = pptyp;         /* where the next [] goes */
     ENTER("parse_abstract_declarator");
 
     assert(pars);
@@ -1761,8 +1815,9 @@ static bool parse_abstract_declarator(PARSER *pars, TYPE **pptyp, char **id)
             }
             if (!expect(pars,TK_RBRA))
                 return false;
-            *pptyp = new_type(T_ARRAY, *pptyp);
-            (*pptyp)->size = v;
+            *dim = new_type(T_ARRAY, *dim);
+            (*dim)->size = v;
+            dim = &(*dim)->type;
         } else if (is_token(pars, TK_LPAR)) {
             PARAM *param_list = NULL;
             next(pars);
@@ -1827,6 +1882,7 @@ static bool parse_parameter_abstract_declarator(PARSER *pars,
                 TYPE **pptyp, char **id)
 {
     TYPE *typ = NULL;
+    TYPE **dim = pptyp;         /* where the next [] goes */
     ENTER("parse_parameter_abstract_declarator");
 
     assert(pars);
@@ -1862,8 +1918,9 @@ static bool parse_parameter_abstract_declarator(PARSER *pars,
             }
             if (!expect(pars,TK_RBRA))
                 return false;
-            *pptyp = new_type(T_ARRAY, *pptyp);
-            (*pptyp)->size = v;
+            *dim = new_type(T_ARRAY, *dim);
+            (*dim)->size = v;
+            dim = &(*dim)->type;
         } else if (is_token(pars, TK_LPAR)) {
             PARAM *param = NULL;
             next(pars);
@@ -1965,6 +2022,7 @@ declarator
 static bool parse_declarator(PARSER *pars, TYPE **pptyp, char **id)
 {
     TYPE *typ = NULL;
+    TYPE **dim = pptyp;         /* where the next [] goes */
     ENTER("parse_declarator");
 
     assert(pars);
@@ -2004,8 +2062,9 @@ static bool parse_declarator(PARSER *pars, TYPE **pptyp, char **id)
             }
             if (!expect(pars,TK_RBRA))
                 return false;
-            *pptyp = new_type(T_ARRAY, *pptyp);
-            (*pptyp)->size = v;
+            *dim = new_type(T_ARRAY, *dim);
+            (*dim)->size = v;
+            dim = &(*dim)->type;
         } else if (is_token(pars, TK_LPAR)) {
             PARAM *param = NULL;
             next(pars);
@@ -2173,22 +2232,32 @@ static bool parse_struct_or_union_specifier(PARSER *pars)
 enumerator
     = IDENTIFIER ['=' constant_expression]
 */
-static bool parse_enumerator(PARSER *pars)
+static bool parse_enumerator(PARSER *pars, int *value)
 {
-    /*TODO Impl. enum*/
+    int scope = get_current_scope();
+    SYMBOL *sym;
+    char *id;
+
     ENTER("parse_enumerator");
     assert(pars);
+    assert(value);
 
     if (!expect_id(pars))
         return false;
+    id = get_id(pars);
     next(pars);
     if (is_token(pars, TK_ASSIGN)) {
         NODE *e = NULL;
-        int v = 0;
         next(pars);
-        if (!parse_constant_expression(pars, &e, &v))
+        if (!parse_constant_expression(pars, &e, value))
             return false;
     }
+    sym = lookup_symbol(id);
+    if (sym && sym->scope == scope)
+        parser_error(pars, "'%s' duplicated", id);
+    /* the value is read by fold_expr(), which replaces every use */
+    sym = new_symbol(SK_ENUM, id, &g_type_int, scope);
+    sym->num = (*value)++;
     LEAVE("parse_enumerator");
     return true;
 }
@@ -2199,15 +2268,16 @@ enumerator_list
 */
 static bool parse_enumerator_list(PARSER *pars)
 {
-    /*TODO Impl. enum*/
+    int value = 0;
+
     ENTER("parse_enumerator_list");
     assert(pars);
 
-    if (!parse_enumerator(pars))
+    if (!parse_enumerator(pars, &value))
         return false;
     while (is_token(pars, TK_COMMA)) {
         next(pars);
-        if (!parse_enumerator(pars))
+        if (!parse_enumerator(pars, &value))
             return false;
     }
     LEAVE("parse_enumerator_list");
@@ -2538,6 +2608,7 @@ static bool parse_external_declaration(PARSER *pars)
             if (!parse_declarator(pars, &ntyp, &id))
                 return false;
             count++;
+            stats_begin(PH_TYPE);
             sym = lookup_symbol(id);
             if (sym) {
                 if (sym->kind == SK_FUNC && ntyp->kind == T_FUNC) {
@@ -2554,6 +2625,7 @@ static bool parse_external_declaration(PARSER *pars)
                 sym = new_symbol((ntyp->kind == T_FUNC) ? SK_FUNC : SK_GLOBAL,
                                     id, ntyp, 0);
             }
+            stats_end();
 
             if (is_token(pars, TK_ASSIGN)) {
                 next(pars);
@@ -2570,7 +2642,9 @@ static bool parse_external_declaration(PARSER *pars)
     TRACE("parse_external_declaration", "");
     if (is_token(pars, TK_SEMI)) {
         next(pars);
-        if (count == 0)
+        /* a struct, union or enum declares its tag or constants */
+        if (count == 0 && typ->kind != T_STRUCT && typ->kind != T_UNION
+                && typ->kind != T_ENUM)
             parser_warning(pars, "empty declaration");
     } else {
         PARAM *p;
@@ -2589,6 +2663,7 @@ static bool parse_external_declaration(PARSER *pars)
             } else
                 break;
         }
+        stats_begin(PH_TYPE);
         if (sym->body != NULL) {
             parser_error(pars, "redefinition of '%s'", sym->id);
         }
@@ -2600,9 +2675,11 @@ static bool parse_external_declaration(PARSER *pars)
             psym->offset = psym->num * BYTE_INT; /*TODO consider type */
         }
         sym->num = num;
+        stats_end();
         if (!parse_compound_statement(pars, &np, 1))
             return false;
         sym->body = np;
+        fold_constants(sym);
         leave_function();
     }
     LEAVE("parse_external_declaration");
@@ -2620,12 +2697,14 @@ bool parse(PARSER *pars)
     ENTER("parse");
 
     assert(pars);
+    stats_begin(PH_PARSE);
 
     next(pars);
     while (!is_token(pars, TK_EOF)) {
         if (!parse_external_declaration(pars))
             result = false;
     }
+    stats_end();
 
     LEAVE("parse");
     return result;
@@ -0,0 +1,462 @@
+#include "minicc.h"
+
+/*
+ * peephole optimizer (-O1)
+ *
+ * The assembly of one function is split into a list of lines, each
+ * instruction broken into its mnemonic, operands and trailing comment.
+ * The rules of s_rule[] are tried at every instruction until none
+ * applies any more.  Comment lines are transparent to the rules, labels
+ * and directives stop them.  Lines no rule touched are written back
+ * exactly as gen.c produced them.
+ *
+ * The rules only use what the text shows: an operand is a register only
+ * when it is one of the names of s_reg_name[], anything else (such as
+ * "dword ptr [rax]") may be memory, and no rule assumes a register is
+ * dead, since the text does not say which values lower.c keeps live.
+ */
+typedef enum {
+    IK_INSN, IK_LABEL, IK_COMMENT, IK_OTHER,
+} INSN_KIND;
+
+typedef struct {
+    INSN_KIND kind;
+    const char *line;   /* original text, without the newline */
+    int len;
+    const char *op;     /* mnemonic, or the name of a label */
+    const char *a;      /* operands, NULL if absent */
+    const char *b;
+    const char *comment;
+    bool modified;
+    bool deleted;
+} INSN;
+
+typedef struct {
+    INSN *insn;
+    int num;
+    int max;
+    char *work;         /* copy of the text the fields point into */
+} PEEPHOLE;
+
+typedef bool (*RULE_FUNC)(PEEPHOLE *p, int i);
+
+static const struct {
+    const char *set;
+    const char *jump;
+    const char *inverse;
+} s_cond[] = {
+    { "sete",  "je",  "jne" },
+    { "setne", "jne", "je"  },
+    { "setl",  "jl",  "jge" },
+    { "setge", "jge", "jl"  },
+    { "setg",  "jg",  "jle" },
+    { "setle", "jle", "jg"  },
+    { "setb",  "jb",  "jae" },
+    { "setae", "jae", "jb"  },
+    { "seta",  "ja",  "jbe" },
+    { "setbe", "jbe", "ja"  },
+};
+
+#define NUM_COND    ((int) (sizeof s_cond / sizeof s_cond[0]))
+
+static bool is_op(const INSN *ip, const char *op)
+{
+    return ip->kind == IK_INSN && strcmp(ip->op, op) == 0;
+}
+
+static bool same(const char *s, const char *t)
+{
+    return s != NULL && t != NULL && strcmp(s, t) == 0;
+}
+
+static const char *s_reg_name[] = {
+    "rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "rsp",
+    "eax", "ebx", "ecx", "edx", "esi", "edi", "ebp", "esp",
+    "ax", "bx", "cx", "dx", "si", "di", "bp", "sp",
+    "al", "bl", "cl", "dl", "sil", "dil", "bpl", "spl",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d",
+    "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b",
+};
+
+#define NUM_REG_NAME    ((int) (sizeof s_reg_name / sizeof s_reg_name[0]))
+
+/* a general purpose register, not memory, an immediate or a label */
+static bool is_reg(const char *s)
+{
+    int i;
+
+    if (s == NULL)
+        return false;
+    for (i = 0; i < NUM_REG_NAME; i++) {
+        if (strcmp(s, s_reg_name[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* a stack slot or a global, whose address no register takes part in */
+static bool is_plain_mem(const char *s)
+{
+    const char *p;
+
+    if (s != NULL && (p = strstr(s, "ptr ")) != NULL)
+        s = p + 4;
+    return s != NULL && (strncmp(s, "[rbp", 4) == 0
+                        || strncmp(s, "[rsp", 4) == 0 || *s == '_');
+}
+
+/* the next line a rule may look at, -1 at the end */
+static int next_insn(const PEEPHOLE *p, int i)
+{
+    for (i++; i < p->num; i++) {
+        if (!p->insn[i].deleted && p->insn[i].kind != IK_COMMENT)
+            return i;
+    }
+    return -1;
+}
+
+static int find_cond(const char *op, bool set)
+{
+    int i;
+    for (i = 0; i < NUM_COND; i++) {
+        if (strcmp(op, set ? s_cond[i].set : s_cond[i].jump) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void set_insn(INSN *ip, const char *op, const char *a, const char *b)
+{
+    ip->op = op;
+    ip->a = a;
+    ip->b = b;
+    ip->comment = NULL;
+    ip->modified = true;
+}
+
+/* push X / pop Y  =>  mov Y, X */
+static bool rule_push_pop(PEEPHOLE *p, int i)
+{
+    INSN *ip = &p->insn[i];
+    int j = next_insn(p, i);
+
+    if (!is_op(ip, "push") || j < 0 || !is_op(&p->insn[j], "pop"))
+        return false;
+    if (!is_reg(ip->a) || !is_reg(p->insn[j].a))
+        return false;
+    if (same(ip->a, p->insn[j].a))
+        ip->deleted = true;
+    else
+        set_insn(ip, "mov", p->insn[j].a, ip->a);
+    p->insn[j].deleted = true;
+    return true;
+}
+
+/*
+ * setcc r8 / movzx r32, r8 / cmp r32, 0 / je L
+ *   =>  setcc r8 / movzx r32, r8 / jncc L
+ *
+ * setcc and movzx leave the flags alone, so the branch can test the flags
+ * of the comparison the value was set from.  The value itself is kept:
+ * lower.c sets variables this way and may read r32 after the branch.
+ */
+static bool rule_setcc_branch(PEEPHOLE *p, int i)
+{
+    INSN *ip = &p->insn[i];
+    INSN *lp;
+    int j, k, l, c;
+
+    if (ip->kind != IK_INSN || (c = find_cond(ip->op, true)) < 0
+            || !is_reg(ip->a))
+        return false;
+    if ((j = next_insn(p, i)) < 0 || !is_op(&p->insn[j], "movzx")
+            || !same(p->insn[j].b, ip->a) || !is_reg(p->insn[j].a))
+        return false;
+    if ((k = next_insn(p, j)) < 0 || !is_op(&p->insn[k], "cmp")
+            || !same(p->insn[k].a, p->insn[j].a)
+            || !same(p->insn[k].b, "0"))
+        return false;
+    if ((l = next_insn(p, k)) < 0)
+        return false;
+    lp = &p->insn[l];
+    if (is_op(lp, "je"))
+        set_insn(lp, s_cond[c].inverse, lp->a, NULL);
+    else if (is_op(lp, "jne"))
+        set_insn(lp, s_cond[c].jump, lp->a, NULL);
+    else
+        return false;
+    p->insn[k].deleted = true;
+    return true;
+}
+
+/* jcc L1 / jmp L2 / L1:  =>  jncc L2 / L1: */
+static bool rule_branch_over_jump(PEEPHOLE *p, int i)
+{
+    INSN *ip = &p->insn[i];
+    int j, k, c;
+
+    if (ip->kind != IK_INSN || (c = find_cond(ip->op, false)) < 0)
+        return false;
+    if ((j = next_insn(p, i)) < 0 || !is_op(&p->insn[j], "jmp"))
+        return false;
+    if ((k = next_insn(p, j)) < 0 || p->insn[k].kind != IK_LABEL
+            || !same(p->insn[k].op, ip->a))
+        return false;
+    set_insn(ip, s_cond[c].inverse, p->insn[j].a, NULL);
+    p->insn[j].deleted = true;
+    return true;
+}
+
+/* jmp L to a label that follows */
+static bool rule_jump_next(PEEPHOLE *p, int i)
+{
+    INSN *ip = &p->insn[i];
+    int j;
+
+    if (!is_op(ip, "jmp"))
+        return false;
+    for (j = next_insn(p, i); j >= 0 && p->insn[j].kind == IK_LABEL;
+            j = next_insn(p, j)) {
+        if (same(p->insn[j].op, ip->a)) {
+            ip->deleted = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* instructions after jmp or ret up to the next label */
+static bool rule_dead_code(PEEPHOLE *p, int i)
+{
+    INSN *ip = &p->insn[i];
+    bool found = false;
+    int j;
+
+    if (!is_op(ip, "jmp") && !is_op(ip, "ret"))
+        return false;
+    for (j = next_insn(p, i); j >= 0 && p->insn[j].kind == IK_INSN;
+            j = next_insn(p, j)) {
+        p->insn[j].deleted = true;
+        found = true;
+    }
+    return found;
+}
+
+/* mov X, X */
+static bool rule_self_move(PEEPHOLE *p, int i)
+{
+    INSN *ip = &p->insn[i];
+
+    if (!is_op(ip, "mov") || !same(ip->a, ip->b))
+        return false;
+    ip->deleted = true;
+    return true;
+}
+
+/* mov X, Y / mov Y, X  =>  mov X, Y */
+static bool rule_redundant_mov(PEEPHOLE *p, int i)
+{
+    INSN *ip = &p->insn[i];
+    int j = next_insn(p, i);
+
+    if (!is_op(ip, "mov") || j < 0 || !is_op(&p->insn[j], "mov"))
+        return false;
+    if (!same(ip->a, p->insn[j].b) || !same(ip->b, p->insn[j].a))
+        return false;
+    if (!(is_reg(ip->a) || is_plain_mem(ip->a))
+            || !(is_reg(ip->b) || is_plain_mem(ip->b)))
+        return false;
+    p->insn[j].deleted = true;
+    return true;
+}
+
+/* cmp R, 0  =>  test R, R */
+static bool rule_cmp_zero(PEEPHOLE *p, int i)
+{
+    INSN *ip = &p->insn[i];
+
+    if (!is_op(ip, "cmp") || !is_reg(ip->a) || !same(ip->b, "0"))
+        return false;
+    set_insn(ip, "test", ip->a, ip->a);
+    return true;
+}
+
+/* add rsp, 0 and sub rsp, 0 */
+static bool rule_zero_adjust(PEEPHOLE *p, int i)
+{
+    INSN *ip = &p->insn[i];
+
+    if (!is_op(ip, "add") && !is_op(ip, "sub"))
+        return false;
+    if (!same(ip->a, "rsp") || !same(ip->b, "0"))
+        return false;
+    ip->deleted = true;
+    return true;
+}
+
+static const struct {
+    PEEPHOLE_RULE rule;
+    const char *name;
+    RULE_FUNC func;
+} s_rule[NUM_PEEPHOLE_RULE] = {
+    { PR_PUSH_POP,          "push_pop",         rule_push_pop },
+    { PR_SETCC_BRANCH,      "setcc_branch",     rule_setcc_branch },
+    { PR_BRANCH_OVER_JUMP,  "branch_over_jump", rule_branch_over_jump },
+    { PR_JUMP_NEXT,         "jump_next",        rule_jump_next },
+    { PR_DEAD_CODE,         "dead_code",        rule_dead_code },
+    { PR_SELF_MOVE,         "self_move",        rule_self_move },
+    { PR_REDUNDANT_MOV,     "redundant_mov",    rule_redundant_mov },
+    { PR_CMP_ZERO,          "cmp_zero",         rule_cmp_zero },
+    { PR_ZERO_ADJUST,       "zero_adjust",      rule_zero_adjust },
+};
+
+const char *get_peephole_rule_name(PEEPHOLE_RULE rule)
+{
+    assert(rule >= 0 && rule < NUM_PEEPHOLE_RULE);
+    assert(s_rule[rule].rule == rule);
+    return s_rule[rule].name;
+}
+
+static char *trim(char *s)
+{
+    char *e;
+
+    while (*s == ' ' || *s == '\t')
+        s++;
+    e = s + strlen(s);
+    while (e > s && (e[-1] == ' ' || e[-1] == '\t'))
+        *--e = '\0';
+    return s;
+}
+
+/* split the instruction in s (the work copy of one line) into ip */
+static void parse_insn(INSN *ip, char *s)
+{
+    char *p, *a;
+    int depth = 0;
+
+    if ((p = strchr(s, '#')) != NULL) {
+        *p++ = '\0';
+        ip->comment = trim(p);
+    }
+    s = trim(s);
+    ip->op = s;
+    while (*s != '\0' && *s != ' ' && *s != '\t')
+        s++;
+    if (*s == '\0')
+        return;
+    *s++ = '\0';
+    a = s;
+    for (; *s != '\0'; s++) {
+        if (*s == '[')
+            depth++;
+        else if (*s == ']')
+            depth--;
+        else if (*s == ',' && depth == 0) {
+            *s++ = '\0';
+            ip->b = trim(s);
+            break;
+        }
+    }
+    ip->a = trim(a);
+}
+
+static void add_line(PEEPHOLE *p, const char *line, int len, char *work)
+{
+    INSN *ip;
+
+    if (p->num == p->max) {
+        p->max = (p->max == 0) ? 256 : p->max * 2;
+        p->insn = (INSN*) realloc(p->insn, p->max * sizeof (INSN));
+        if (p->insn == NULL) {
+            fprintf(stderr, "out of memory\n");
+            abort();
+        }
+    }
+    ip = &p->insn[p->num++];
+    memset(ip, 0, sizeof (INSN));
+    ip->line = line;
+    ip->len = len;
+    if (len > 0 && line[0] == '#')
+        ip->kind = IK_COMMENT;
+    else if (len > 1 && (line[0] == ' ' || line[0] == '\t')) {
+        ip->kind = IK_INSN;
+        parse_insn(ip, work);
+    } else if (len > 1 && line[len - 1] == ':'
+            && strchr(work, ' ') == NULL) {
+        ip->kind = IK_LABEL;
+        work[len - 1] = '\0';
+        ip->op = work;
+    } else
+        ip->kind = IK_OTHER;
+}
+
+static void write_insn(EMITTER *em, const INSN *ip)
+{
+    emit_str(em, "    ");
+    emit_str(em, ip->op);
+    if (ip->a) {
+        emit_char(em, ' ');
+        emit_str(em, ip->a);
+    }
+    if (ip->b) {
+        emit_str(em, ", ");
+        emit_str(em, ip->b);
+    }
+    if (ip->comment) {
+        emit_str(em, " # ");
+        emit_str(em, ip->comment);
+    }
+    emit_char(em, '\n');
+}
+
+/* optimize the text of one function and write it to em */
+void peephole(EMITTER *em, const char *text, size_t len)
+{
+    PEEPHOLE p;
+    const char *s, *e;
+    bool changed;
+    int i, r;
+
+    stats_begin(PH_OPT);
+    memset(&p, 0, sizeof p);
+    p.work = (char*) alloc(len + 1);
+    memcpy(p.work, text, len);
+    p.work[len] = '\0';
+    for (s = text; s < text + len; s = e + 1) {
+        e = memchr(s, '\n', text + len - s);
+        if (e == NULL)
+            e = text + len;
+        p.work[e - text] = '\0';
+        add_line(&p, s, e - s, p.work + (s - text));
+    }
+
+    do {
+        changed = false;
+        for (i = 0; i < p.num; i++) {
+            for (r = 0; r < NUM_PEEPHOLE_RULE && !p.insn[i].deleted; r++) {
+                if (p.insn[i].kind == IK_INSN && s_rule[r].func(&p, i)) {
+                    g_compiler->stats.peephole[r]++;
+                    changed = true;
+                }
+            }
+        }
+    } while (changed);
+
+    for (i = 0; i < p.num; i++) {
+        INSN *ip = &p.insn[i];
+        if (ip->deleted)
+            continue;
+        if (ip->modified)
+            write_insn(em, ip);
+        else {
+            emit_text(em, ip->line, ip->len);
+            emit_char(em, '\n');
+        }
+    }
+    free(p.insn);
+    free(p.work);
+    stats_end();
+}
@@ -0,0 +1,426 @@
+#include "minicc.h"
+
+/*
+ * linear scan register allocation (-O1)
+ *
+ * The body of a function is walked in the order gen.c evaluates it
+ * (operands by their Sethi-Ullman number, see get_expr_need()), giving
+ * each variable reference and each call a position.  A variable's live
+ * interval runs from its first to its last reference; a variable that
+ * is referenced inside a loop is kept alive across the whole outermost
+ * loop, since its value may flow around the back edge.  Parameters are
+ * live from the entry.
+ *
+ * Intervals that contain a call may only use callee-saved registers.
+ * The others prefer r10d and r11d, which gen.c then drops from its
+ * scratch pool.  When no
+ * register is free the interval that ends last is left in its stack
+ * slot (Poletto and Sarkar).
+ */
+enum {
+    R_R10, R_R11,                           /* caller-saved */
+    R_RBX, R_R12, R_R13, R_R14, R_R15       /* callee-saved */
+};
+
+#define FIRST_CALLEE_SAVED  R_RBX
+
+static const char *s_reg_name32[NUM_ALLOC_REG] = {
+    "r10d", "r11d", "ebx", "r12d", "r13d", "r14d", "r15d",
+};
+static const char *s_reg_name64[NUM_ALLOC_REG] = {
+    "r10", "r11", "rbx", "r12", "r13", "r14", "r15",
+};
+
+typedef struct {
+    SYMBOL *sym;
+    int start;
+    int end;
+    int first_loop;     /* outermost loops it is referenced in, -1 none */
+    int last_loop;
+    bool excluded;      /* address taken or not a scalar */
+    bool cross_call;
+} INTERVAL;
+
+typedef struct {
+    int start;
+    int end;
+} LOOP;
+
+typedef struct {
+    INTERVAL *iv;
+    int num_iv;
+    int max_iv;
+    int *call;
+    int num_call;
+    int max_call;
+    LOOP *loop;
+    int num_loop;
+    int max_loop;
+    int outer_loop;     /* outermost open loop, -1 outside loops */
+    int pos;
+    bool has_goto;
+} LIVENESS;
+
+const char *get_reg_name(int reg, int bits)
+{
+    assert(reg >= 0 && reg < NUM_ALLOC_REG);
+    return (bits == 64) ? s_reg_name64[reg] : s_reg_name32[reg];
+}
+
+static void *grow(void *p, int *max, size_t size)
+{
+    *max = (*max == 0) ? 16 : *max * 2;
+    p = realloc(p, *max * size);
+    if (p == NULL) {
+        fprintf(stderr, "out of memory\n");
+        abort();
+    }
+    return p;
+}
+
+static bool is_scalar_type(const TYPE *typ)
+{
+    if (typ == NULL || (typ->tqual & TQ_VOLATILE))
+        return false;
+    switch (typ->kind) {
+    case T_CHAR: case T_UCHAR: case T_SHORT: case T_USHORT:
+    case T_INT: case T_UINT: case T_LONG: case T_ULONG:
+    case T_ENUM: case T_POINTER: case T_SIGNED: case T_UNSIGNED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static INTERVAL *get_interval(LIVENESS *lv, SYMBOL *sym)
+{
+    INTERVAL *p;
+    int i;
+
+    for (i = lv->num_iv - 1; i >= 0; i--)
+        if (lv->iv[i].sym == sym)
+            return &lv->iv[i];
+    if (lv->num_iv == lv->max_iv)
+        lv->iv = (INTERVAL*) grow(lv->iv, &lv->max_iv, sizeof (INTERVAL));
+    p = &lv->iv[lv->num_iv++];
+    p->sym = sym;
+    p->start = (sym->kind == SK_PARAM) ? 0 : lv->pos;
+    p->end = lv->pos;
+    p->first_loop = p->last_loop = -1;
+    p->excluded = !is_scalar_type(sym->type);
+    p->cross_call = false;
+    return p;
+}
+
+static void ref_var(LIVENESS *lv, SYMBOL *sym)
+{
+    INTERVAL *p;
+
+    if (sym->kind != SK_LOCAL && sym->kind != SK_PARAM)
+        return;
+    lv->pos++;
+    p = get_interval(lv, sym);
+    p->end = lv->pos;
+    if (lv->outer_loop >= 0) {
+        if (p->first_loop < 0)
+            p->first_loop = lv->outer_loop;
+        p->last_loop = lv->outer_loop;
+    }
+}
+
+static void walk_expr(LIVENESS *lv, NODE *np);
+
+/* stack arguments, the callee, computed and then plain register arguments */
+static void walk_call(LIVENESS *lv, NODE *np)
+{
+    NODE *arg[MAX_ARGS];
+    NODE *a;
+    int i, n = 0;
+
+    for (a = np->u.link.right; a != NULL && n < MAX_ARGS; a = a->u.link.right)
+        arg[n++] = a->u.link.left;
+    for (i = n - 1; i >= NUM_REG_PARAM; i--)
+        walk_expr(lv, arg[i]);
+    if (np->u.link.left && np->u.link.left->kind != NK_ID)
+        walk_expr(lv, np->u.link.left);
+    for (i = (n < NUM_REG_PARAM ? n : NUM_REG_PARAM) - 1; i >= 0; i--)
+        if (!is_leaf_expr(arg[i]))
+            walk_expr(lv, arg[i]);
+    for (i = (n < NUM_REG_PARAM ? n : NUM_REG_PARAM) - 1; i >= 0; i--)
+        if (is_leaf_expr(arg[i]))
+            walk_expr(lv, arg[i]);
+}
+
+static void walk_expr(LIVENESS *lv, NODE *np)
+{
+    if (np == NULL)
+        return;
+    switch (np->kind) {
+    case NK_ID:
+        ref_var(lv, np->u.sym);
+        break;
+    case NK_ADDR:
+        if (np->u.link.left && np->u.link.left->kind == NK_ID) {
+            SYMBOL *sym = np->u.link.left->u.sym;
+            if (sym->kind == SK_LOCAL || sym->kind == SK_PARAM)
+                get_interval(lv, sym)->excluded = true;
+        }
+        walk_expr(lv, np->u.link.left);
+        break;
+    case NK_CALL:
+        walk_call(lv, np);
+        if (lv->num_call == lv->max_call)
+            lv->call = (int*) grow(lv->call, &lv->max_call, sizeof (int));
+        lv->call[lv->num_call++] = ++lv->pos;
+        break;
+    case NK_DOT:
+    case NK_PTR:
+        walk_expr(lv, np->u.idnode.node);
+        break;
+    case NK_SIZEOF:
+    case NK_CHAR_LIT: case NK_INT_LIT: case NK_UINT_LIT: case NK_LONG_LIT:
+    case NK_ULONG_LIT: case NK_FLOAT_LIT: case NK_DOUBLE_LIT:
+    case NK_STRING_LIT:
+        break;
+    case NK_ASSIGN:
+        walk_expr(lv, np->u.link.right);
+        walk_expr(lv, np->u.link.left);
+        break;
+    case NK_LAND:
+    case NK_LOR:
+        /* short circuit, always left to right */
+        walk_expr(lv, np->u.link.left);
+        walk_expr(lv, np->u.link.right);
+        break;
+    default:
+        /* the operand needing more registers is evaluated first */
+        if (get_expr_need(np->u.link.left)
+                >= get_expr_need(np->u.link.right)) {
+            walk_expr(lv, np->u.link.left);
+            walk_expr(lv, np->u.link.right);
+        } else {
+            walk_expr(lv, np->u.link.right);
+            walk_expr(lv, np->u.link.left);
+        }
+        break;
+    }
+}
+
+static int open_loop(LIVENESS *lv)
+{
+    int saved = lv->outer_loop;
+    if (lv->outer_loop < 0) {
+        if (lv->num_loop == lv->max_loop)
+            lv->loop = (LOOP*) grow(lv->loop, &lv->max_loop, sizeof (LOOP));
+        lv->loop[lv->num_loop].start = ++lv->pos;
+        lv->outer_loop = lv->num_loop++;
+    }
+    return saved;
+}
+
+static void close_loop(LIVENESS *lv, int saved)
+{
+    if (saved < 0)
+        lv->loop[lv->outer_loop].end = ++lv->pos;
+    lv->outer_loop = saved;
+}
+
+static void walk_stmt(LIVENESS *lv, NODE *np)
+{
+    int saved;
+
+    if (np == NULL)
+        return;
+    switch (np->kind) {
+    case NK_COMPOUND:
+        walk_stmt(lv, np->u.comp.node);
+        break;
+    case NK_LINK:
+        walk_stmt(lv, np->u.link.left);
+        walk_stmt(lv, np->u.link.right);
+        break;
+    case NK_IF:
+        walk_expr(lv, np->u.link.left);
+        walk_stmt(lv, np->u.link.right->u.link.left);
+        walk_stmt(lv, np->u.link.right->u.link.right);
+        break;
+    case NK_SWITCH:
+        walk_expr(lv, np->u.link.left);
+        walk_stmt(lv, np->u.link.right);
+        break;
+    case NK_CASE:
+        walk_stmt(lv, np->u.num_node.node);
+        break;
+    case NK_DEFAULT:
+        walk_stmt(lv, np->u.link.left);
+        break;
+    case NK_WHILE:
+        saved = open_loop(lv);
+        walk_expr(lv, np->u.link.left);
+        walk_stmt(lv, np->u.link.right);
+        close_loop(lv, saved);
+        break;
+    case NK_DO:
+        saved = open_loop(lv);
+        walk_stmt(lv, np->u.link.left);
+        walk_expr(lv, np->u.link.right);
+        close_loop(lv, saved);
+        break;
+    case NK_FOR:
+        walk_expr(lv, np->u.link.left);
+        saved = open_loop(lv);
+        np = np->u.link.right;
+        walk_expr(lv, np->u.link.left);
+        np = np->u.link.right;
+        walk_stmt(lv, np->u.link.right);
+        walk_expr(lv, np->u.link.left);
+        close_loop(lv, saved);
+        break;
+    case NK_GOTO:
+        lv->has_goto = true;
+        break;
+    case NK_LABEL:
+        lv->has_goto = true;
+        walk_stmt(lv, np->u.idnode.node);
+        break;
+    case NK_CONTINUE:
+    case NK_BREAK:
+        break;
+    case NK_RETURN:
+    case NK_EXPR:
+        walk_expr(lv, np->u.link.left);
+        break;
+    default:
+        walk_expr(lv, np);
+        break;
+    }
+}
+
+static int compare_start(const void *a, const void *b)
+{
+    const INTERVAL *x = *(const INTERVAL**) a;
+    const INTERVAL *y = *(const INTERVAL**) b;
+    if (x->start != y->start)
+        return (x->start < y->start) ? -1 : 1;
+    return x->sym->num - y->sym->num;
+}
+
+static void linear_scan(INTERVAL **list, int n)
+{
+    INTERVAL *active[NUM_ALLOC_REG];
+    int num_active = 0;
+    bool used[NUM_ALLOC_REG];
+    int i, j, r;
+
+    for (r = 0; r < NUM_ALLOC_REG; r++)
+        used[r] = false;
+    for (i = 0; i < n; i++) {
+        INTERVAL *cur = list[i];
+        int first = cur->cross_call ? FIRST_CALLEE_SAVED : 0;
+
+        /* expire intervals that ended before this one starts */
+        for (j = 0; j < num_active; ) {
+            if (active[j]->end < cur->start) {
+                used[active[j]->sym->reg] = false;
+                active[j] = active[--num_active];
+            } else
+                j++;
+        }
+        for (r = first; r < NUM_ALLOC_REG && used[r]; r++)
+            ;
+        if (r == NUM_ALLOC_REG) {
+            /* spill whichever of cur and the active intervals ends last */
+            INTERVAL *victim = cur;
+            int k = -1;
+            for (j = 0; j < num_active; j++) {
+                if (active[j]->sym->reg >= first
+                        && active[j]->end > victim->end) {
+                    victim = active[j];
+                    k = j;
+                }
+            }
+            if (victim == cur)
+                continue;
+            r = victim->sym->reg;
+            victim->sym->reg = REG_NONE;
+            active[k] = active[--num_active];
+        }
+        cur->sym->reg = r;
+        used[r] = true;
+        active[num_active++] = cur;
+    }
+}
+
+/*
+ * assign registers to the locals and parameters of func.  The
+ * callee-saved registers used are stored in saved[] (NUM_CALLEE_SAVED
+ * entries at most) and their number is returned; *used gets a mask of
+ * every register used and *is_leaf whether the body calls nothing.
+ */
+int alloc_registers(SYMBOL *func, int *saved, unsigned *used, bool *is_leaf)
+{
+    LIVENESS lv;
+    INTERVAL **list;
+    int i, j, n, num_saved = 0;
+
+    memset(&lv, 0, sizeof lv);
+    lv.outer_loop = -1;
+    walk_stmt(&lv, func->body);
+    *is_leaf = (lv.num_call == 0);
+
+    if (lv.has_goto) {
+        n = 0;
+        list = NULL;
+    } else {
+        list = (INTERVAL**) alloc(sizeof (INTERVAL*) * (lv.num_iv + 1));
+        for (i = n = 0; i < lv.num_iv; i++) {
+            INTERVAL *p = &lv.iv[i];
+            if (p->excluded)
+                continue;
+            if (p->first_loop >= 0 && lv.loop[p->first_loop].start < p->start)
+                p->start = lv.loop[p->first_loop].start;
+            if (p->last_loop >= 0 && lv.loop[p->last_loop].end > p->end)
+                p->end = lv.loop[p->last_loop].end;
+            for (j = 0; j < lv.num_call; j++) {
+                if (lv.call[j] > p->start && lv.call[j] < p->end) {
+                    p->cross_call = true;
+                    break;
+                }
+            }
+            list[n++] = p;
+        }
+        qsort(list, n, sizeof (INTERVAL*), compare_start);
+        linear_scan(list, n);
+    }
+
+    *used = 0;
+    for (j = 0; j < n; j++)
+        if (list[j]->sym->reg != REG_NONE)
+            *used |= 1u << list[j]->sym->reg;
+    for (i = FIRST_CALLEE_SAVED; i < NUM_ALLOC_REG; i++) {
+        for (j = 0; j < n; j++) {
+            if (list[j]->sym->reg == i) {
+                saved[num_saved++] = i;
+                break;
+            }
+        }
+    }
+#ifndef NDEBUG
+    if (is_debug("regalloc")) {
+        printf("regalloc %s:%s\n", func->id,
+                lv.has_goto ? " (goto, not allocated)" : "");
+        for (j = 0; j < n; j++) {
+            printf(" %-12s [%3d,%3d]%s %s\n", list[j]->sym->id,
+                    list[j]->start, list[j]->end,
+                    list[j]->cross_call ? " call" : "     ",
+                    list[j]->sym->reg == REG_NONE ? "stack"
+                        : s_reg_name32[list[j]->sym->reg]);
+        }
+    }
+#endif
+    free(list);
+    free(lv.iv);
+    free(lv.call);
+    free(lv.loop);
+    return num_saved;
+}
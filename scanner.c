@@ -1,258 +1,611 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "minicc.h"
 
-/* string buffer / number parse buffer */
+/* string buffer */
 #define MAX_BUFFER  256
 
-STRING_POOL g_string_pool = { NULL, NULL };
-static int s_string_num = 0;
+#define COUNT_OF(array) (sizeof (array) / sizeof (array[0]))
 
+
+/* interned identifier; the string is stored inline after the header */
 typedef struct ident {
-    struct ident *next;
-    char *id;
+    unsigned hash;
+    int len;
+    char id[1];
 } IDENT;
 
-static IDENT *s_ident_top = NULL;
+/* open addressing (linear probing) table of interned identifiers */
+#define IDENT_INIT_SIZE 256     /* must be a power of 2 */
+
 
 
 STRING *new_string(const char *s)
 {
-    STRING *p = (STRING*) alloc(sizeof (STRING));
-    p->s = str_dup(s);
-    p->num = s_string_num++;
+    STRING *p = (STRING*) arena_alloc(AK_STRING, sizeof (STRING));
+    p->s = (char*) arena_alloc(AK_STRING, strlen(s) + 1);
+    strcpy(p->s, s);
+    p->num = g_compiler->string_num++;
+    g_compiler->stats.strings++;
     p->next = NULL;
-    if (g_string_pool.head == NULL) {
-        assert(g_string_pool.tail == NULL);
-        g_string_pool.head = g_string_pool.tail = p;
+    if (g_compiler->string_pool.head == NULL) {
+        assert(g_compiler->string_pool.tail == NULL);
+        g_compiler->string_pool.head = g_compiler->string_pool.tail = p;
     } else {
-        assert(g_string_pool.tail);
-        g_string_pool.tail->next = p;
-        g_string_pool.tail = p;
+        assert(g_compiler->string_pool.tail);
+        g_compiler->string_pool.tail->next = p;
+        g_compiler->string_pool.tail = p;
     }
     return p;
 }
 
-char* new_ident(const char *s)
+/* forget the string literals of the translation unit */
+void clear_string_pool(void)
+{
+    g_compiler->string_pool.head = g_compiler->string_pool.tail = NULL;
+    g_compiler->string_num = 0;
+}
+
+static unsigned hash_ident(const char *s, int len)
+{
+    /* FNV-1a */
+    unsigned h = 2166136261u;
+    int i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void init_ident_tab(int size)
 {
-    IDENT *p = (IDENT*) alloc(sizeof (IDENT));
-    p->id = str_dup(s);
-    p->next = s_ident_top;
-    s_ident_top = p;
+    int i;
+    g_compiler->ident_tab = (IDENT**) alloc(size * sizeof (IDENT*));
+    for (i = 0; i < size; i++)
+        g_compiler->ident_tab[i] = NULL;
+    g_compiler->ident_size = size;
+    g_compiler->ident_count = 0;
+}
+
+static void grow_ident_tab(void)
+{
+    IDENT **old_tab = g_compiler->ident_tab;
+    int old_size = g_compiler->ident_size;
+    int i, j;
+
+    init_ident_tab(old_size * 2);
+    for (i = 0; i < old_size; i++) {
+        if (old_tab[i] == NULL)
+            continue;
+        j = old_tab[i]->hash & (g_compiler->ident_size - 1);
+        while (g_compiler->ident_tab[j] != NULL)
+            j = (j + 1) & (g_compiler->ident_size - 1);
+        g_compiler->ident_tab[j] = old_tab[i];
+        g_compiler->ident_count++;
+    }
+    free(old_tab);
+}
+
+static char *new_ident(int slot, const char *s, int len, unsigned hash)
+{
+    IDENT *p = (IDENT*) arena_alloc(AK_IDENT, sizeof (IDENT) + len);
+    p->hash = hash;
+    p->len = len;
+    memcpy(p->id, s, len);
+    p->id[len] = '\0';
+    g_compiler->ident_tab[slot] = p;
+    g_compiler->ident_count++;
+    g_compiler->stats.idents++;
     return p->id;
 }
 
 #ifndef NDEBUG
 void print_ident(void)
 {
-    IDENT *id = s_ident_top;
+    const COMPILER *cc = g_compiler;
+
     printf("ident [\n");
-    for (; id != NULL; id = id->next)
-        printf(" %p:%s\n", id, id->id);
+    printf(" entries %d, slots %d, load %.2f\n", cc->ident_count, cc->ident_size,
+            cc->ident_size ? (double) cc->ident_count / cc->ident_size : 0.0);
+    printf(" lookups %ld, probes %ld (avg %.2f, max %d)\n",
+            cc->ident_lookup, cc->ident_probe,
+            cc->ident_lookup ? (double) cc->ident_probe / cc->ident_lookup : 0.0,
+            cc->ident_max_probe);
     printf("]\n");
 }
 #endif
 
-char *intern(const char *s)
+static char *intern_len(const char *s, int len)
 {
-    IDENT *id = s_ident_top;
+    unsigned hash = hash_ident(s, len);
+    int i, n;
+    IDENT *id;
 
 #ifndef NDEBUG
-    if (is_debug("ident")) {
-        printf("intern(%s)\n", s);
-        print_ident();
-    }
+    if (is_debug("ident"))
+        printf("intern(%.*s)\n", len, s);
 #endif
 
-    for (; id != NULL; id = id->next)
-        if (strcmp(id->id, s) == 0)
-            return id->id;
-    return new_ident(s);
+    if (g_compiler->ident_tab == NULL)
+        init_ident_tab(IDENT_INIT_SIZE);
+    else if ((g_compiler->ident_count + 1) * 2 > g_compiler->ident_size)
+        grow_ident_tab();
+
+    g_compiler->ident_lookup++;
+    i = hash & (g_compiler->ident_size - 1);
+    for (n = 1; (id = g_compiler->ident_tab[i]) != NULL; n++) {
+        if (id->hash == hash && id->len == len && memcmp(id->id, s, len) == 0)
+            break;
+        i = (i + 1) & (g_compiler->ident_size - 1);
+    }
+    g_compiler->ident_probe += n;
+    if (n > g_compiler->ident_max_probe)
+        g_compiler->ident_max_probe = n;
+    if (id != NULL)
+        return id->id;
+    return new_ident(i, s, len, hash);
 }
 
-SCANNER *open_scanner_text(const char *filename, const char *text)
+char *intern(const char *s)
+{
+    return intern_len(s, strlen(s));
+}
+
+static void init_dfa(void);
+
+static SCANNER *new_scanner(const char *filename, const char *text, int size)
 {
     SCANNER *s = (SCANNER*) alloc(sizeof (SCANNER));
     if (s == NULL)
         return NULL;
+    init_dfa();
     s->source = text;
-    s->size = strlen(text);
+    s->size = size;
     s->current = 0;
-    s->ch = ' ';
+    s->line_mark = 0;
     s->pos.filename = filename;
     s->pos.line = 1;
     s->num = 0;
     s->id = NULL;
     s->str = NULL;
+    s->buffer = NULL;
+    s->map_size = 0;
     return s;
 }
 
-SCANNER *open_scanner_file(const char *filename)
+SCANNER *open_scanner_text(const char *filename, const char *text)
 {
-    FILE *fp;
-    size_t size;
-    char *s;
-    int rd;
+    return new_scanner(filename, text, strlen(text));
+}
 
-    fp = fopen(filename, "r");
-    if (fp == NULL)
-        return NULL;
+/*
+ * map a regular file read-only.  The mapping is rounded up so that at
+ * least one zero byte follows the contents: the tail of the last file
+ * page is zero filled by the kernel, and when the file ends exactly on a
+ * page boundary the extra anonymous page serves as the '\0' sentinel.
+ */
+static char *map_source(int fd, size_t size, size_t *map_size)
+{
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t len = (size + page) & ~(page - 1);
+    char *p;
 
-    if (fseek(fp, 0, SEEK_END) != 0) {
-        fclose(fp);
+    p = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    if (size > 0 && mmap(p, size, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+                            fd, 0) == MAP_FAILED) {
+        munmap(p, len);
         return NULL;
     }
+    *map_size = len;
+    return p;
+}
 
-    size = ftell(fp);
+/* read a pipe or terminal until EOF */
+static char *read_source(int fd, size_t *size)
+{
+    size_t cap = 4096, len = 0;
+    char *s = (char*) alloc(cap);
+    ssize_t rd;
 
-    if (fseek(fp, 0, SEEK_SET) != 0) {
-        fclose(fp);
-        return NULL;
+    for (;;) {
+        if (len + 1 >= cap) {
+            char *p = (char*) realloc(s, cap *= 2);
+            if (p == NULL) {
+                free(s);
+                return NULL;
+            }
+            s = p;
+        }
+        rd = read(fd, s + len, cap - len - 1);
+        if (rd == 0)
+            break;
+        if (rd < 0) {
+            free(s);
+            return NULL;
+        }
+        len += rd;
     }
+    s[len] = '\0';
+    *size = len;
+    return s;
+}
+
+/* filename "-" reads the standard input */
+SCANNER *open_scanner_file(const char *filename)
+{
+    SCANNER *scan;
+    struct stat st;
+    size_t size = 0, map_size = 0;
+    char *s;
+    int fd;
 
-    s = (char*) alloc(size + 1);
+    if (strcmp(filename, "-") == 0)
+        fd = STDIN_FILENO;
+    else if ((fd = open(filename, O_RDONLY)) < 0)
+        return NULL;
 
-    rd = fread(s, size, 1, fp);
-    if (rd != 1) {
-        fclose(fp);
-        free(s);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size = st.st_size;
+        s = map_source(fd, size, &map_size);
+    } else
+        s = read_source(fd, &size);
+    if (fd != STDIN_FILENO)
+        close(fd);
+    if (s == NULL)
         return NULL;
-    }
-    s[size-1] = '\0';
-    fclose(fp);
-    return open_scanner_text(filename, s);
+
+    scan = new_scanner(filename, s, size);
+    scan->buffer = s;
+    scan->map_size = map_size;
+    return scan;
 }
 
 bool close_scanner(SCANNER *s)
 {
-    s_ident_top = NULL;
+#ifndef NDEBUG
+    if (is_debug("ident"))
+        print_ident();
+#endif
+    /* forget the table; interned strings stay valid for the symbols */
+    free(g_compiler->ident_tab);
+    g_compiler->ident_tab = NULL;
+    g_compiler->ident_size = g_compiler->ident_count = 0;
+    g_compiler->ident_lookup = g_compiler->ident_probe = 0;
+    g_compiler->ident_max_probe = 0;
 
     if (s == NULL)
         return false;
+    if (s->map_size > 0)
+        munmap(s->buffer, s->map_size);
+    else
+        free(s->buffer);
     free(s);
     return true;
 }
 
-static int is_white(int ch)
-{
-    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r'
-        || ch == '\f' || ch == '\v';
-}
-
-static int is_alpha(int ch)
-{
-    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_';
-}
-
-static int is_alnum(int ch)
-{
-    return is_alpha(ch) || isdigit(ch);
-}
-
-static int next_char(SCANNER *scan)
+/*
+ * keyword perfect hash
+ *   (len + s_kw_asso[first] + s_kw_asso[last]) & (KW_HASH_SIZE-1)
+ * is collision free over the C89 keywords, so an identifier needs one
+ * probe and at most one memcmp.  Both tables are the output of
+ * test/gen_kwhash.c, which `make kwhash_test` checks them against; if a
+ * keyword is added, add it there and paste the new tables here.
+ */
+#define KW_MIN_LEN      2
+#define KW_MAX_LEN      8
+#define KW_HASH_SIZE    64
+
+struct keyword {
+    const char *name;
+    int len;
+    TOKEN token;
+};
+
+static const unsigned char s_kw_asso[26] = {
+     0,  0,  0,  9,  2, 12,  9,  1, 12,  0,  0,  9,  6,
+     7,  0,  0,  0,  3, 18,  4, 17, 22, 23,  0,  0,  0,
+};
+
+static const struct keyword s_kw_tab[KW_HASH_SIZE] = {
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { "auto", 4, TK_AUTO },
+    { "break", 5, TK_BREAK },
+    { "case", 4, TK_CASE },
+    { "char", 4, TK_CHAR },
+    { "else", 4, TK_ELSE },
+    { "const", 5, TK_CONST },
+    { "continue", 8, TK_CONTINUE },
+    { "do", 2, TK_DO },
+    { "enum", 4, TK_ENUM },
+    { "goto", 4, TK_GOTO },
+    { "register", 8, TK_REGISTER },
+    { "extern", 6, TK_EXTERN },
+    { "return", 6, TK_RETURN },
+    { "double", 6, TK_DOUBLE },
+    { "for", 3, TK_FOR },
+    { "int", 3, TK_INT },
+    { "default", 7, TK_DEFAULT },
+    { "float", 5, TK_FLOAT },
+    { "long", 4, TK_LONG },
+    { "typedef", 7, TK_TYPEDEF },
+    { "static", 6, TK_STATIC },
+    { "switch", 6, TK_SWITCH },
+    { "if", 2, TK_IF },
+    { "short", 5, TK_SHORT },
+    { "struct", 6, TK_STRUCT },
+    { "union", 5, TK_UNION },
+    { "while", 5, TK_WHILE },
+    { NULL, 0, TK_EOF },
+    { "volatile", 8, TK_VOLATILE },
+    { "signed", 6, TK_SIGNED },
+    { "unsigned", 8, TK_UNSIGNED },
+    { "void", 4, TK_VOID },
+    { "sizeof", 6, TK_SIZEOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+    { NULL, 0, TK_EOF },
+};
+
+static TOKEN lookup_keyword(const char *s, int len)
 {
-    if (scan->ch == '\n')
-        scan->pos.line++;
-    scan->ch = scan->source[scan->current++];
-#ifndef NDEBUG
-    if (is_debug("scanner"))
-        printf("%s(%d):next_char: '%c'\n",
-                scan->pos.filename, scan->pos.line, scan->ch);
-#endif
-    return scan->ch;
+    const struct keyword *kw;
+    int first = s[0], last = s[len-1];
+
+    if (len < KW_MIN_LEN || len > KW_MAX_LEN)
+        return TK_ID;
+    if (first < 'a' || first > 'z' || last < 'a' || last > 'z')
+        return TK_ID;
+    kw = &s_kw_tab[(len + s_kw_asso[first - 'a'] + s_kw_asso[last - 'a'])
+                    & (KW_HASH_SIZE - 1)];
+    if (kw->len == len && memcmp(kw->name, s, len) == 0)
+        return kw->token;
+    return TK_ID;
 }
 
-static void skip_comment(SCANNER *scan)
+/*
+ * lexer core
+ *
+ * Every byte is mapped to a character class by s_cclass[], and the
+ * token is recognized by running the DFA s_dfa[state][class] over the
+ * buffer with a raw pointer until a state has no transition (S_STOP).
+ * The final state gives the token, or selects an action for literals,
+ * identifiers and errors.  Whitespace, comments and '#' lines are
+ * transitions back to S_START.
+ */
+enum {
+    CC_OTHER, CC_EOF, CC_WHITE, CC_NEWLINE, CC_ALPHA, CC_DIGIT,
+    CC_QUOTE, CC_DQUOTE, CC_HASH, CC_COMMA, CC_TILDE, CC_SEMI, CC_COLON,
+    CC_QUES, CC_LPAR, CC_RPAR, CC_LBRA, CC_RBRA, CC_BEGIN, CC_END,
+    CC_DOT, CC_ASSIGN, CC_NOT, CC_STAR, CC_PERCENT, CC_HAT, CC_AND,
+    CC_OR, CC_PLUS, CC_MINUS, CC_LT, CC_GT, CC_SLASH,
+    NUM_CCLASS,
+    CC_ANY = NUM_CCLASS,    /* rule wildcard */
+};
+
+enum {
+    S_STOP, S_START, S_ID, S_NUM, S_CHAR, S_STR, S_ILLEGAL,
+    S_LINE, S_COMMENT, S_COMMENT_STAR,
+    S_COMMA, S_TILDE, S_SEMI, S_COLON, S_QUES, S_LPAR, S_RPAR,
+    S_LBRA, S_RBRA, S_BEGIN, S_END,
+    S_DOT, S_DOT2, S_ELLIPSIS, S_ASSIGN, S_EQ, S_NOT, S_NEQ,
+    S_STAR, S_MUL_AS, S_SLASH, S_DIV_AS, S_PERCENT, S_MOD_AS,
+    S_HAT, S_XOR_AS, S_AND, S_LAND, S_AND_AS, S_OR, S_LOR, S_OR_AS,
+    S_PLUS, S_INC, S_ADD_AS, S_MINUS, S_DEC, S_SUB_AS, S_PTR,
+    S_LT, S_LEFT, S_LEFT_AS, S_LE, S_GT, S_RIGHT, S_RIGHT_AS, S_GE,
+    NUM_STATE,
+};
+
+static const struct {
+    unsigned char from, cclass, to;
+} s_dfa_rule[] = {
+    /* S_ANY rules come first, later rules override them */
+    { S_LINE, CC_ANY, S_LINE },
+    { S_COMMENT, CC_ANY, S_COMMENT },
+    { S_COMMENT_STAR, CC_ANY, S_COMMENT },
+    { S_START, CC_ANY, S_ILLEGAL },
+
+    { S_START, CC_EOF, S_STOP },
+    { S_START, CC_WHITE, S_START },
+    { S_START, CC_NEWLINE, S_START },
+    { S_START, CC_HASH, S_LINE },
+    { S_LINE, CC_NEWLINE, S_START },
+    { S_LINE, CC_EOF, S_STOP },
+    { S_SLASH, CC_STAR, S_COMMENT },
+    { S_COMMENT, CC_STAR, S_COMMENT_STAR },
+    { S_COMMENT, CC_EOF, S_STOP },
+    { S_COMMENT_STAR, CC_STAR, S_COMMENT_STAR },
+    { S_COMMENT_STAR, CC_SLASH, S_START },
+    { S_COMMENT_STAR, CC_EOF, S_STOP },
+
+    { S_START, CC_ALPHA, S_ID },
+    { S_ID, CC_ALPHA, S_ID },
+    { S_ID, CC_DIGIT, S_ID },
+    { S_START, CC_DIGIT, S_NUM },
+    { S_NUM, CC_DIGIT, S_NUM },
+    { S_START, CC_QUOTE, S_CHAR },
+    { S_START, CC_DQUOTE, S_STR },
+
+    { S_START, CC_COMMA, S_COMMA },
+    { S_START, CC_TILDE, S_TILDE },
+    { S_START, CC_SEMI, S_SEMI },
+    { S_START, CC_COLON, S_COLON },
+    { S_START, CC_QUES, S_QUES },
+    { S_START, CC_LPAR, S_LPAR },
+    { S_START, CC_RPAR, S_RPAR },
+    { S_START, CC_LBRA, S_LBRA },
+    { S_START, CC_RBRA, S_RBRA },
+    { S_START, CC_BEGIN, S_BEGIN },
+    { S_START, CC_END, S_END },
+
+    { S_START, CC_DOT, S_DOT },
+    { S_DOT, CC_DOT, S_DOT2 },
+    { S_DOT2, CC_DOT, S_ELLIPSIS },
+    { S_START, CC_ASSIGN, S_ASSIGN },
+    { S_ASSIGN, CC_ASSIGN, S_EQ },
+    { S_START, CC_NOT, S_NOT },
+    { S_NOT, CC_ASSIGN, S_NEQ },
+    { S_START, CC_STAR, S_STAR },
+    { S_STAR, CC_ASSIGN, S_MUL_AS },
+    { S_START, CC_SLASH, S_SLASH },
+    { S_SLASH, CC_ASSIGN, S_DIV_AS },
+    { S_START, CC_PERCENT, S_PERCENT },
+    { S_PERCENT, CC_ASSIGN, S_MOD_AS },
+    { S_START, CC_HAT, S_HAT },
+    { S_HAT, CC_ASSIGN, S_XOR_AS },
+    { S_START, CC_AND, S_AND },
+    { S_AND, CC_AND, S_LAND },
+    { S_AND, CC_ASSIGN, S_AND_AS },
+    { S_START, CC_OR, S_OR },
+    { S_OR, CC_OR, S_LOR },
+    { S_OR, CC_ASSIGN, S_OR_AS },
+    { S_START, CC_PLUS, S_PLUS },
+    { S_PLUS, CC_PLUS, S_INC },
+    { S_PLUS, CC_ASSIGN, S_ADD_AS },
+    { S_START, CC_MINUS, S_MINUS },
+    { S_MINUS, CC_MINUS, S_DEC },
+    { S_MINUS, CC_ASSIGN, S_SUB_AS },
+    { S_MINUS, CC_GT, S_PTR },
+    { S_START, CC_LT, S_LT },
+    { S_LT, CC_LT, S_LEFT },
+    { S_LEFT, CC_ASSIGN, S_LEFT_AS },
+    { S_LT, CC_ASSIGN, S_LE },
+    { S_START, CC_GT, S_GT },
+    { S_GT, CC_GT, S_RIGHT },
+    { S_RIGHT, CC_ASSIGN, S_RIGHT_AS },
+    { S_GT, CC_ASSIGN, S_GE },
+};
+
+static const struct {
+    unsigned char state;
+    TOKEN token;
+} s_dfa_accept[] = {
+    { S_COMMA, TK_COMMA }, { S_TILDE, TK_TILDE }, { S_SEMI, TK_SEMI },
+    { S_COLON, TK_COLON }, { S_QUES, TK_QUES }, { S_LPAR, TK_LPAR },
+    { S_RPAR, TK_RPAR }, { S_LBRA, TK_LBRA }, { S_RBRA, TK_RBRA },
+    { S_BEGIN, TK_BEGIN }, { S_END, TK_END }, { S_DOT, TK_DOT },
+    { S_ELLIPSIS, TK_ELLIPSIS }, { S_ASSIGN, TK_ASSIGN }, { S_EQ, TK_EQ },
+    { S_NOT, TK_NOT }, { S_NEQ, TK_NEQ }, { S_STAR, TK_STAR },
+    { S_MUL_AS, TK_MUL_AS }, { S_SLASH, TK_SLASH }, { S_DIV_AS, TK_DIV_AS },
+    { S_PERCENT, TK_PERCENT }, { S_MOD_AS, TK_MOD_AS }, { S_HAT, TK_HAT },
+    { S_XOR_AS, TK_XOR_AS }, { S_AND, TK_AND }, { S_LAND, TK_LAND },
+    { S_AND_AS, TK_AND_AS }, { S_OR, TK_OR }, { S_LOR, TK_LOR },
+    { S_OR_AS, TK_OR_AS }, { S_PLUS, TK_PLUS }, { S_INC, TK_INC },
+    { S_ADD_AS, TK_ADD_AS }, { S_MINUS, TK_MINUS }, { S_DEC, TK_DEC },
+    { S_SUB_AS, TK_SUB_AS }, { S_PTR, TK_PTR }, { S_LT, TK_LT },
+    { S_LEFT, TK_LEFT }, { S_LEFT_AS, TK_LEFT_AS }, { S_LE, TK_LE },
+    { S_GT, TK_GT }, { S_RIGHT, TK_RIGHT }, { S_RIGHT_AS, TK_RIGHT_AS },
+    { S_GE, TK_GE },
+};
+
+static unsigned char s_cclass[256];
+static unsigned char s_dfa[NUM_STATE][NUM_CCLASS];
+static TOKEN s_state_token[NUM_STATE];
+static pthread_once_t s_dfa_once = PTHREAD_ONCE_INIT;
+
+static void build_dfa(void)
 {
-    next_char(scan);
-    for (;;) {
-        if (scan->ch == '\0') {
-            error(&scan->pos, "unterminated comment");
-            return;
-        }
-        if (scan->ch != '*')
-            next_char(scan);
-        else if (next_char(scan) == '/') {
-            next_char(scan);
-            break;
-        }
+    static const char punct[] = "'\"#,~;:?()[]{}.=!*%^&|+-<>/";
+    static const unsigned char punct_class[] = {
+        CC_QUOTE, CC_DQUOTE, CC_HASH, CC_COMMA, CC_TILDE, CC_SEMI,
+        CC_COLON, CC_QUES, CC_LPAR, CC_RPAR, CC_LBRA, CC_RBRA, CC_BEGIN,
+        CC_END, CC_DOT, CC_ASSIGN, CC_NOT, CC_STAR, CC_PERCENT, CC_HAT,
+        CC_AND, CC_OR, CC_PLUS, CC_MINUS, CC_LT, CC_GT, CC_SLASH,
+    };
+    int i, c;
+
+    for (c = 0; c < 256; c++) {
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+            s_cclass[c] = CC_ALPHA;
+        else if (c >= '0' && c <= '9')
+            s_cclass[c] = CC_DIGIT;
+        else
+            s_cclass[c] = CC_OTHER;
     }
-}
-
-static void skip_line(SCANNER *scan)
-{
-    while (scan->ch != '\0' && scan->ch != '\n') {
-        next_char(scan);
+    s_cclass['\0'] = CC_EOF;
+    s_cclass[' '] = s_cclass['\t'] = s_cclass['\r'] = CC_WHITE;
+    s_cclass['\f'] = s_cclass['\v'] = CC_WHITE;
+    s_cclass['\n'] = CC_NEWLINE;
+    for (i = 0; punct[i] != '\0'; i++)
+        s_cclass[(unsigned char) punct[i]] = punct_class[i];
+
+    memset(s_dfa, S_STOP, sizeof s_dfa);
+    for (i = 0; i < COUNT_OF(s_dfa_rule); i++) {
+        if (s_dfa_rule[i].cclass == CC_ANY)
+            memset(s_dfa[s_dfa_rule[i].from], s_dfa_rule[i].to, NUM_CCLASS);
+        else
+            s_dfa[s_dfa_rule[i].from][s_dfa_rule[i].cclass] = s_dfa_rule[i].to;
     }
+    for (i = 0; i < NUM_STATE; i++)
+        s_state_token[i] = TK_EOF;
+    for (i = 0; i < COUNT_OF(s_dfa_accept); i++)
+        s_state_token[s_dfa_accept[i].state] = s_dfa_accept[i].token;
 }
 
-static TOKEN scan_id(SCANNER *scan)
+/* the tables are shared by every compiler context */
+static void init_dfa(void)
 {
-    char buffer[MAX_IDENT+1];
-    int i = 0;
-    while (is_alnum(scan->ch)) {
-        if (i < MAX_IDENT)
-            buffer[i++] = scan->ch;
-        next_char(scan);
-    }
-    buffer[i] = '\0';
-    if (strcmp(buffer, "sizeof") == 0) return TK_SIZEOF;
-    if (strcmp(buffer, "typedef") == 0) return TK_TYPEDEF;
-    if (strcmp(buffer, "extern") == 0) return TK_EXTERN;
-    if (strcmp(buffer, "static") == 0) return TK_STATIC;
-    if (strcmp(buffer, "auto") == 0) return TK_AUTO;
-    if (strcmp(buffer, "register") == 0) return TK_REGISTER;
-    if (strcmp(buffer, "char") == 0) return TK_CHAR;
-    if (strcmp(buffer, "short") == 0) return TK_SHORT;
-    if (strcmp(buffer, "int") == 0) return TK_INT;
-    if (strcmp(buffer, "long") == 0) return TK_LONG;
-    if (strcmp(buffer, "signed") == 0) return TK_SIGNED;
-    if (strcmp(buffer, "unsigned") == 0) return TK_UNSIGNED;
-    if (strcmp(buffer, "float") == 0) return TK_FLOAT;
-    if (strcmp(buffer, "double") == 0) return TK_DOUBLE;
-    if (strcmp(buffer, "const") == 0) return TK_CONST;
-    if (strcmp(buffer, "volatile") == 0) return TK_VOLATILE;
-    if (strcmp(buffer, "void") == 0) return TK_VOID;
-    if (strcmp(buffer, "struct") == 0) return TK_STRUCT;
-    if (strcmp(buffer, "union") == 0) return TK_UNION;
-    if (strcmp(buffer, "enum") == 0) return TK_ENUM;
-    if (strcmp(buffer, "if") == 0) return TK_IF;
-    if (strcmp(buffer, "else") == 0) return TK_ELSE;
-    if (strcmp(buffer, "switch") == 0) return TK_SWITCH;
-    if (strcmp(buffer, "case") == 0) return TK_CASE;
-    if (strcmp(buffer, "default") == 0) return TK_DEFAULT;
-    if (strcmp(buffer, "while") == 0) return TK_WHILE;
-    if (strcmp(buffer, "do") == 0) return TK_DO;
-    if (strcmp(buffer, "for") == 0) return TK_FOR;
-    if (strcmp(buffer, "goto") == 0) return TK_GOTO;
-    if (strcmp(buffer, "continue") == 0) return TK_CONTINUE;
-    if (strcmp(buffer, "break") == 0) return TK_BREAK;
-    if (strcmp(buffer, "return") == 0) return TK_RETURN;
-    scan->id = intern(buffer);
-/*
-    if (is_typedef_name(buffer)) return TK_TYPEDEF_NAME;
-*/
-    return TK_ID;
+    pthread_once(&s_dfa_once, build_dfa);
 }
 
-static TOKEN scan_num(SCANNER *scan)
+/*
+ * The line number is not tracked per character.  pos.line is brought
+ * up to date from the newlines between the last mark and p when a
+ * position is needed, i.e. once per token and before a diagnostic.
+ */
+static void update_pos(SCANNER *scan, const char *p)
 {
-    char buffer[MAX_BUFFER+1];
-    int i = 0;
-    while (isdigit(scan->ch)) {
-        if (i < MAX_BUFFER)
-            buffer[i++] = scan->ch;
-        next_char(scan);
+    const char *s = scan->source + scan->line_mark;
+    const char *nl;
+
+    while ((nl = memchr(s, '\n', p - s)) != NULL) {
+        scan->pos.line++;
+        s = nl + 1;
     }
-    buffer[i] = '\0';
-    scan->num = atoi(buffer);
-    /* TODO impl unsigned, long, float, double */
-    return TK_INT_LIT;
+    scan->line_mark = p - scan->source;
 }
 
-static unsigned char scan_a_char(SCANNER *scan)
+/* the sentinel is not consumed, the caller reports the missing quote */
+static const char *scan_a_char(const char *p, int *value)
 {
-    int c = scan->ch;
-    if (c == '\\') {
-        switch (next_char(scan)) {
+    int c = (unsigned char) *p;
+    if (c == '\0') {
+        *value = '\0';
+        return p;
+    } else if (c == '\\') {
+        switch (*++p) {
         case '0': c = '\0'; break;
         case 'a': c = '\a'; break;
         case 'b': c = '\b'; break;
@@ -265,201 +618,154 @@ static unsigned char scan_a_char(SCANNER *scan)
         case '?': c = '?'; break;
         case '\'': c = '\''; break;
         case '"': c = '"'; break;
+        case '\0':
+            *value = '\\';
+            return p;
         case 'x':
         case 'o':
         default:
             /*TODO impl 0xHH, 0OO*/
-            c = scan->ch;
+            c = (unsigned char) *p;
             break;
         }
     }
-    next_char(scan);
-    return c;
+    *value = (unsigned char) c;
+    return p + 1;
 }
 
-static TOKEN scan_char(SCANNER *scan)
+static const char *scan_char(SCANNER *scan, const char *p)
 {
-    next_char(scan);  /* skip ' */
-    scan->num = scan_a_char(scan);
-    if (scan->ch != '\'')
+    p = scan_a_char(p, &scan->num);
+    if (*p == '\0') {
+        update_pos(scan, p);
+        error(&scan->pos, "unterminated character constant");
+    } else if (*p != '\'') {
+        update_pos(scan, p);
         error(&scan->pos, "missing ' character");
-    else
-        next_char(scan);
-    return TK_CHAR_LIT;
+    } else
+        p++;
+    return p;
 }
 
-static TOKEN scan_str(SCANNER *scan)
+static const char *scan_str(SCANNER *scan, const char *p)
 {
     /*TODO string pool */
-    static char buffer[MAX_BUFFER+1];
+    char buffer[MAX_BUFFER+1];  /* per call, scanners may run in parallel */
     int i = 0;
 
-    next_char(scan);  /* skip " */
-
-    while (scan->ch != '\"') {
-        int c = scan_a_char(scan);
+    while (*p != '"' && *p != '\0') {
+        int c;
+        p = scan_a_char(p, &c);
         if (i < MAX_BUFFER)
             buffer[i++] = c;
     }
     buffer[i] = '\0';
     scan->str = new_string(buffer);
 
-    if (scan->ch != '\"')
+    if (*p != '"') {
+        update_pos(scan, p);
         error(&scan->pos, "missing \" character");
-    else
-        next_char(scan);
-    return TK_STRING_LIT;
+    } else
+        p++;
+    return p;
 }
 
 bool is_next_colon(SCANNER *scan)
 {
-    while (is_white(scan->ch))
-        next_char(scan);
-    return (scan->ch == ':');
+    const char *p = scan->source + scan->current;
+    while (s_cclass[(unsigned char) *p] == CC_WHITE
+            || s_cclass[(unsigned char) *p] == CC_NEWLINE)
+        p++;
+    scan->current = p - scan->source;
+    return (*p == ':');
 }
 
-TOKEN next_token(SCANNER *scan)
+static TOKEN scan_token(SCANNER *scan)
 {
+    const char *p = scan->source + scan->current;
+    const char *start;
+    int state, next;
+    TOKEN tk;
+
 retry:
-    while (is_white(scan->ch))
-        next_char(scan);
-    if (scan->ch == '\0')
-        return TK_EOF;
-    if (is_alpha(scan->ch))
-        return scan_id(scan);
-    if (isdigit(scan->ch))
-        return scan_num(scan);
-    switch (scan->ch) {
-    case '\'':  return scan_char(scan);
-    case '\"':  return scan_str(scan);
-    case '#':   skip_line(scan);    goto retry;
-    case ',':   next_char(scan);    return TK_COMMA;
-    case '~':   next_char(scan);    return TK_TILDE;
-    case ';':   next_char(scan);    return TK_SEMI;
-    case ':':   next_char(scan);    return TK_COLON;
-    case '?':   next_char(scan);    return TK_QUES;
-    case '(':   next_char(scan);    return TK_LPAR;
-    case ')':   next_char(scan);    return TK_RPAR;
-    case '[':   next_char(scan);    return TK_LBRA;
-    case ']':   next_char(scan);    return TK_RBRA;
-    case '{':   next_char(scan);    return TK_BEGIN;
-    case '}':   next_char(scan);    return TK_END;
-    case '.':
-        if (next_char(scan) == '.') {
-            if (next_char(scan) == '.') {
-                next_char(scan);
-                return TK_ELLIPSIS;
-            }
-            error(&scan->pos, "need '...' (missing '.')");
-            next_char(scan);
-            goto retry;
-        }
-        return TK_DOT;
-    case '=':
-        if (next_char(scan) != '=')
-            return TK_ASSIGN;
-        next_char(scan);
-        return TK_EQ;
-    case '!':
-        if (next_char(scan) != '=')
-            return TK_NOT;
-        next_char(scan);
-        return TK_NEQ;
-    case '*':
-        if (next_char(scan) != '=')
-            return TK_STAR;
-        next_char(scan);
-        return TK_MUL_AS;
-    case '%':
-        if (next_char(scan) != '=')
-            return TK_PERCENT;
-        next_char(scan);
-        return TK_MOD_AS;
-    case '^':
-        if (next_char(scan) != '=')
-            return TK_HAT;
-        next_char(scan);
-        return TK_XOR_AS;
-    case '&':
-        if (next_char(scan) == '&') {
-            next_char(scan);
-            return TK_LAND;
-        } else if (scan->ch == '=') {
-            next_char(scan);
-            return TK_AND_AS;
-        }
-        return TK_AND;
-    case '|':
-        if (next_char(scan) == '|') {
-            next_char(scan);
-            return TK_LOR;
-        } else if (scan->ch == '=') {
-            next_char(scan);
-            return TK_OR_AS;
-        }
-        return TK_OR;
-    case '+':
-        if (next_char(scan) == '+') {
-            next_char(scan);
-            return TK_INC;
-        } else if (scan->ch == '=') {
-            next_char(scan);
-            return TK_ADD_AS;
-        }
-        return TK_PLUS;
-    case '<':
-        if (next_char(scan) == '<') {
-            if (next_char(scan) == '=') {
-                next_char(scan);
-                return TK_LEFT_AS;
-            }
-            return TK_LEFT;
-        } else if (scan->ch == '=') {
-            next_char(scan);
-            return TK_LE;
-        }
-        return TK_LT;
-    case '>':
-        if (next_char(scan) == '>') {
-            if (next_char(scan) == '=') {
-                next_char(scan);
-                return TK_RIGHT_AS;
-            }
-            return TK_RIGHT;
-        } else if (scan->ch == '=') {
-            next_char(scan);
-            return TK_GE;
-        }
-        return TK_GT;
-    case '/':
-        if (next_char(scan) == '=') {
-            next_char(scan);
-            return TK_DIV_AS;
-        } else if (scan->ch == '*') {
-            skip_comment(scan);
-            goto retry;
-        }
-        return TK_SLASH;
-    case '-':
-        if (next_char(scan) == '-') {
-            next_char(scan);
-            return TK_DEC;
-        } else if (scan->ch == '=') {
-            next_char(scan);
-            return TK_SUB_AS;
-        } else if (scan->ch == '>') {
-            next_char(scan);
-            return TK_PTR;
+    state = S_START;
+    start = p;
+    while ((next = s_dfa[state][s_cclass[(unsigned char) *p]]) != S_STOP) {
+        if (state == S_START)
+            start = p;
+        state = next;
+        p++;
+    }
+
+    switch (state) {
+    case S_ID:
+        tk = lookup_keyword(start, p - start);
+        if (tk == TK_ID)
+            scan->id = intern_len(start, (p - start > MAX_IDENT)
+                                                ? MAX_IDENT : p - start);
+/*
+        if (is_typedef_name(buffer)) return TK_TYPEDEF_NAME;
+*/
+        break;
+    case S_NUM:
+        {
+            const char *s;
+            unsigned n = 0;
+            for (s = start; s < p; s++)
+                n = n * 10 + (*s - '0');
+            scan->num = (int) n;
+            /* TODO impl unsigned, long, float, double */
+            tk = TK_INT_LIT;
         }
-        return TK_MINUS;
+        break;
+    case S_CHAR:
+        p = scan_char(scan, p);
+        tk = TK_CHAR_LIT;
+        break;
+    case S_STR:
+        p = scan_str(scan, p);
+        tk = TK_STRING_LIT;
+        break;
+    case S_COMMENT:
+    case S_COMMENT_STAR:
+        update_pos(scan, p);
+        error(&scan->pos, "unterminated comment");
+        tk = TK_EOF;
+        break;
+    case S_DOT2:
+        update_pos(scan, p);
+        error(&scan->pos, "need '...' (missing '.')");
+        goto retry;
+    case S_ILLEGAL:
+        update_pos(scan, start);
+        error(&scan->pos,
+            (isprint((unsigned char) *start) ? "illegal character '%c'"
+                        : "illegal character (code=%02d)"), *start);
+        goto retry;
     default:
+        tk = s_state_token[state];
         break;
     }
-    error(&scan->pos,
-        (isprint(scan->ch) ? "illegal character '%c'"
-                          : "illegal character (code=%02d)"), scan->ch);
-    next_char(scan);
-    goto retry;
+
+    scan->current = p - scan->source;
+    update_pos(scan, p);
+#ifndef NDEBUG
+    if (is_debug("scanner"))
+        printf("%s(%d):next_token: '%.*s'\n", scan->pos.filename,
+                scan->pos.line, (int) (p - start), start);
+#endif
+    return tk;
+}
+
+TOKEN next_token(SCANNER *scan)
+{
+    TOKEN tk;
+
+    stats_begin(PH_SCAN);
+    tk = scan_token(scan);
+    stats_end();
+    g_compiler->stats.tokens++;
+    return tk;
 }
 
 
@@ -0,0 +1,170 @@
+#include "minicc.h"
+
+/*
+ * division by a constant
+ *
+ * plan_div() chooses how gen.c divides a 32 bit value by the constant d
+ * without the divider: nothing for 1, neg for -1, shifts for a power of
+ * two (biased towards zero when signed), and otherwise a multiplication
+ * by a magic number followed by shifts (Granlund and Montgomery; the
+ * magic numbers are computed as in Hacker's Delight, chapter 10).
+ *
+ * eval_div_plan() computes what the emitted instructions compute, step
+ * by step, so the plans can be checked against the hardware divider
+ * (see test/test_divmagic.c).  Keep both in step with gen_div_const().
+ */
+
+static bool is_power_of_2(unsigned d)
+{
+    return d != 0 && (d & (d - 1)) == 0;
+}
+
+static int log2_of(unsigned d)
+{
+    int k = 0;
+    while (d > 1) {
+        d >>= 1;
+        k++;
+    }
+    return k;
+}
+
+/* d >= 3, not a power of two */
+static void signed_magic(DIV_PLAN *plan, unsigned d)
+{
+    const unsigned two31 = 0x80000000u;
+    unsigned anc, delta, q1, r1, q2, r2;
+    int p = 31;
+
+    anc = two31 - 1 - two31 % d;        /* |nc| */
+    q1 = two31 / anc;
+    r1 = two31 - q1 * anc;
+    q2 = two31 / d;
+    r2 = two31 - q2 * d;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= d) {
+            q2++;
+            r2 -= d;
+        }
+        delta = d - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    plan->magic = q2 + 1;
+    plan->shift = p - 32;
+    plan->add = ((int) plan->magic < 0);
+}
+
+/* d >= 3, not a power of two */
+static void unsigned_magic(DIV_PLAN *plan, unsigned d)
+{
+    unsigned p32 = 0, q, r, delta;
+    int p = 31;
+
+    plan->add = false;
+    q = 0x7fffffffu / d;
+    r = 0x7fffffffu - q * d;
+    do {
+        p++;
+        p32 = (p == 32) ? 1 : p32 * 2;
+        if (r + 1 >= d - r) {
+            if (q >= 0x7fffffffu)
+                plan->add = true;
+            q = 2 * q + 1;
+            r = 2 * r + 1 - d;
+        } else {
+            if (q >= 0x80000000u)
+                plan->add = true;
+            q = 2 * q;
+            r = 2 * r + 1;
+        }
+        delta = d - 1 - r;
+    } while (p < 64 && p32 < delta);
+    plan->magic = q + 1;
+    plan->shift = p - 32;
+}
+
+void plan_div(DIV_PLAN *plan, int d, bool is_unsigned)
+{
+    memset(plan, 0, sizeof (DIV_PLAN));
+    plan->is_unsigned = is_unsigned;
+    if (is_unsigned) {
+        plan->divisor = (unsigned) d;
+    } else {
+        plan->negative = (d < 0);
+        plan->divisor = (d < 0) ? -(unsigned) d : (unsigned) d;
+    }
+    if (plan->divisor == 0)
+        plan->method = DM_DIVIDE;
+    else if (plan->divisor == 1)
+        plan->method = plan->negative ? DM_NEGATE : DM_IDENTITY;
+    else if (is_power_of_2(plan->divisor)) {
+        plan->method = DM_SHIFT;
+        plan->shift = log2_of(plan->divisor);
+    } else {
+        plan->method = DM_MAGIC;
+        if (is_unsigned)
+            unsigned_magic(plan, plan->divisor);
+        else
+            signed_magic(plan, plan->divisor);
+    }
+}
+
+/* the quotient (or remainder) of n the code for plan leaves */
+int eval_div_plan(const DIV_PLAN *plan, int n, bool mod)
+{
+    unsigned x = (unsigned) n;
+    unsigned q, t;
+    long h;
+
+    switch (plan->method) {
+    case DM_IDENTITY:
+        return mod ? 0 : n;
+    case DM_NEGATE:
+        return mod ? 0 : (int) -x;
+    case DM_SHIFT:
+        if (plan->is_unsigned)
+            return (int) (mod ? x & (plan->divisor - 1) : x >> plan->shift);
+        /* add divisor - 1 to a negative n */
+        t = (unsigned) (n >> 31) >> (32 - plan->shift);
+        t += x;
+        if (mod)
+            return (int) (x - (t & -plan->divisor));
+        q = (unsigned) ((int) t >> plan->shift);
+        break;
+    case DM_MAGIC:
+        if (plan->is_unsigned) {
+            h = (long) ((unsigned long) x * plan->magic >> 32);
+            q = (unsigned) h;
+            if (plan->add) {
+                t = ((x - q) >> 1) + q;
+                q = t >> (plan->shift - 1);
+            } else {
+                q >>= plan->shift;
+            }
+            return (int) (mod ? x - q * plan->divisor : q);
+        }
+        h = (long) n * (int) plan->magic;
+        if (plan->add) {
+            q = (unsigned) (h >> 32) + x;
+            q = (unsigned) ((int) q >> plan->shift);
+        } else {
+            q = (unsigned) (h >> (32 + plan->shift));
+        }
+        q += q >> 31;
+        if (mod)
+            return (int) (x - q * plan->divisor);
+        break;
+    default:
+        assert(0);
+        return 0;
+    }
+    return (int) (plan->negative ? -q : q);
+}
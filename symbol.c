@@ -1,33 +1,104 @@
 #include "minicc.h"
 
-static SYMTAB *global_symtab = NULL;
-static SYMTAB *current_symtab = NULL;
-static SYMBOL *current_function = NULL;
+/*
+ * symbols of all scopes are hashed on the interned id pointer.  A chain
+ * holds the innermost declaration first, so the first live match is the
+ * visible one.  Leaving a scope only clears SYMTAB::live; the symbols of
+ * dead scopes are unlinked lazily when a lookup or rehash meets them.
+ */
+#define SYM_HASH_INIT_SIZE  256     /* must be a power of 2 */
+
+static unsigned hash_sym_id(const char *id)
+{
+    unsigned long n = (unsigned long) id;
+    return (unsigned) ((n >> 4) ^ (n >> 16)) * 2654435761u;
+}
+
+static void init_sym_hash(int size)
+{
+    int i;
+    g_compiler->sym_hash = (SYMBOL**) alloc(size * sizeof (SYMBOL*));
+    for (i = 0; i < size; i++)
+        g_compiler->sym_hash[i] = NULL;
+    g_compiler->sym_hash_size = size;
+    g_compiler->sym_hash_count = 0;
+}
+
+static void grow_sym_hash(void)
+{
+    SYMBOL **old_hash = g_compiler->sym_hash;
+    int old_size = g_compiler->sym_hash_size;
+    SYMBOL *sym, *next, *rev;
+    int i, h;
+
+    init_sym_hash(old_size * 2);
+    for (i = 0; i < old_size; i++) {
+        /* reverse the chain so pushing keeps innermost first */
+        rev = NULL;
+        for (sym = old_hash[i]; sym != NULL; sym = next) {
+            next = sym->hash_next;
+            sym->hash_next = rev;
+            rev = sym;
+        }
+        for (sym = rev; sym != NULL; sym = next) {
+            next = sym->hash_next;
+            if (!sym->owner->live)
+                continue;
+            h = hash_sym_id(sym->id) & (g_compiler->sym_hash_size - 1);
+            sym->hash_next = g_compiler->sym_hash[h];
+            g_compiler->sym_hash[h] = sym;
+            g_compiler->sym_hash_count++;
+        }
+    }
+    free(old_hash);
+}
+
+static void hash_symbol(SYMBOL *sym)
+{
+    int h;
+    if (g_compiler->sym_hash_count >= g_compiler->sym_hash_size)
+        grow_sym_hash();
+    h = hash_sym_id(sym->id) & (g_compiler->sym_hash_size - 1);
+    sym->hash_next = g_compiler->sym_hash[h];
+    g_compiler->sym_hash[h] = sym;
+    g_compiler->sym_hash_count++;
+}
 
 SYMTAB *get_global_symtab(void)
 {
-    return global_symtab;
+    return g_compiler->global_symtab;
+}
+
+int get_current_scope(void)
+{
+    return g_compiler->current_symtab->scope;
 }
 
 SYMTAB *new_symtab(SYMTAB *up)
 {
-    SYMTAB *tab = (SYMTAB*) alloc(sizeof (SYMTAB));
+    SYMTAB *tab = (SYMTAB*) arena_alloc(AK_SYMTAB, sizeof (SYMTAB));
     tab->head = tab->tail = NULL;
     tab->up = up;
     tab->scope = up ? up->scope+1 : 0;
+    tab->live = true;
     return tab;
 }
 
 bool init_symtab(void)
 {
-    global_symtab = new_symtab(NULL);
-    current_symtab = global_symtab;
+    g_compiler->global_symtab = new_symtab(NULL);
+    g_compiler->current_symtab = g_compiler->global_symtab;
+    init_sym_hash(SYM_HASH_INIT_SIZE);
     return true;
 }
 
 void term_symtab(void)
 {
-    current_symtab = global_symtab = NULL;
+    g_compiler->current_symtab = g_compiler->global_symtab = NULL;
+    g_compiler->current_function = NULL;
+    free(g_compiler->sym_hash);
+    g_compiler->sym_hash = NULL;
+    g_compiler->sym_hash_size = g_compiler->sym_hash_count = 0;
 }
 
 
@@ -35,15 +106,16 @@ SYMBOL *new_symbol(SYMBOL_KIND kind, const char *id, TYPE *type, int scope)
 {
     SYMBOL *p;
 
-    assert(current_symtab);
-    p = (SYMBOL*) alloc(sizeof (SYMBOL));
+    assert(g_compiler->current_symtab);
+    p = (SYMBOL*) arena_alloc(AK_SYMBOL, sizeof (SYMBOL));
+    g_compiler->stats.symbols++;
     p->next = NULL;
-    if (current_symtab->tail == NULL) {
-        assert(current_symtab->head == NULL);
-        current_symtab->head = current_symtab->tail = p;
+    if (g_compiler->current_symtab->tail == NULL) {
+        assert(g_compiler->current_symtab->head == NULL);
+        g_compiler->current_symtab->head = g_compiler->current_symtab->tail = p;
     } else {
-        current_symtab->tail->next = p;
-        current_symtab->tail = p;
+        g_compiler->current_symtab->tail->next = p;
+        g_compiler->current_symtab->tail = p;
     }
     p->kind = kind;
     p->id = id;
@@ -51,21 +123,32 @@ SYMBOL *new_symbol(SYMBOL_KIND kind, const char *id, TYPE *type, int scope)
     p->scope = scope;
     p->num = 0;
     p->offset = 0;
+    p->reg = REG_NONE;
     p->tab = NULL;
     p->body = NULL;
+    p->owner = g_compiler->current_symtab;
+    hash_symbol(p);
     return p;
 }
 
 SYMBOL *lookup_symbol(const char *id)
 {
-    SYMTAB *tab;
+    SYMBOL **pp;
     SYMBOL *sym;
 
-    for (tab = current_symtab; tab != NULL; tab = tab->up) {
-        for (sym = tab->head; sym != NULL; sym = sym->next) {
-            if (sym->id == id)
-                return sym;
+    if (g_compiler->sym_hash == NULL)
+        return NULL;
+    pp = &g_compiler->sym_hash[hash_sym_id(id)
+                                & (g_compiler->sym_hash_size - 1)];
+    while ((sym = *pp) != NULL) {
+        if (!sym->owner->live) {
+            *pp = sym->hash_next;
+            g_compiler->sym_hash_count--;
+            continue;
         }
+        if (sym->id == id)
+            return sym;
+        pp = &sym->hash_next;
     }
     return NULL;
 }
@@ -73,58 +156,72 @@ SYMBOL *lookup_symbol(const char *id)
 
 SYMTAB *enter_scope(void)
 {
-    SYMTAB *tab = new_symtab(current_symtab);
-    return current_symtab = tab;
+    SYMTAB *tab = new_symtab(g_compiler->current_symtab);
+    return g_compiler->current_symtab = tab;
 }
 
 void leave_scope(void)
 {
-    assert(current_symtab->up);
-    current_symtab = current_symtab->up;
+    assert(g_compiler->current_symtab->up);
+    g_compiler->current_symtab->live = false;
+    g_compiler->current_symtab = g_compiler->current_symtab->up;
 }
 
 void enter_function(SYMBOL *sym)
 {
-    current_function = sym;
+    g_compiler->current_function = sym;
     sym->tab = enter_scope();
 }
 
 void leave_function(void)
 {
     leave_scope();
-    current_function = NULL;
+    g_compiler->current_function = NULL;
 }
 
 bool sym_is_left_value(const SYMBOL *sym)
 {
     assert(sym);
-    if (sym->kind == SK_FUNC)
+    if (sym->kind == SK_FUNC || sym->kind == SK_ENUM)
         return false;
     if (is_const_type(sym->type))
         return false;
     return true;
 }
 
-bool sym_is_static(const SYMBOL *sym)
+/* the storage class of a function is kept with its return type */
+static STORAGE_CLASS get_sclass(const SYMBOL *sym)
 {
     assert(sym);
     assert(sym->type);
-    return sym->type->sclass == SC_STATIC;
+    if (sym->type->kind == T_FUNC && sym->type->type)
+        return sym->type->type->sclass;
+    return sym->type->sclass;
+}
+
+bool sym_is_static(const SYMBOL *sym)
+{
+    return get_sclass(sym) == SC_STATIC;
 }
 
 bool sym_is_extern(const SYMBOL *sym)
 {
-    assert(sym);
-    assert(sym->type);
-    return sym->type->sclass == SC_EXTERN;
+    return get_sclass(sym) == SC_EXTERN;
 }
 
-int get_current_func_local_offset(void)
+/*
+ * a scalar takes BYTE_INT bytes, an array its size rounded up to them.
+ * The offset is that of the last BYTE_INT bytes, so an array starts at
+ * [rbp-(offset+BYTE_INT)] like a scalar.
+ */
+int get_current_func_local_offset(const TYPE *typ)
 {
-    int offset;
-    assert(current_function);
-    offset = current_function->offset;
-    current_function->offset += BYTE_INT;
+    int offset, size = BYTE_INT;
+    assert(g_compiler->current_function);
+    if (typ->kind == T_ARRAY && get_type_size(typ) > BYTE_INT)
+        size = (get_type_size(typ) + BYTE_INT - 1) / BYTE_INT * BYTE_INT;
+    offset = g_compiler->current_function->offset + size - BYTE_INT;
+    g_compiler->current_function->offset += size;
     return offset;
 }
 
@@ -137,6 +234,7 @@ const char *get_sym_kind_string(SYMBOL_KIND kind)
     case SK_GLOBAL:     return "GLOBAL";
     case SK_PARAM:      return "PARAM";
     case SK_FUNC:       return "FUNC";
+    case SK_ENUM:       return "ENUM";
     }
     return NULL;
 }
@@ -197,5 +295,5 @@ void print_symtab(const SYMTAB *tab)
 void print_global_symtab(void)
 {
     printf("GLOBAL SYMTAB\n");
-    print_symtab(global_symtab);
+    print_symtab(g_compiler->global_symtab);
 }
@@ -0,0 +1,141 @@
+#include "minicc.h"
+
+/*
+ * tail recursion elimination on the IR (-O2)
+ *
+ * A call of the function to itself that is directly followed by a ret
+ * of its result, or by a bare ret, becomes assignments of the arguments
+ * to the parameters and a jump back to the entry block, so the
+ * recursion runs as a loop in one frame.  An argument that reads a
+ * parameter already assigned is copied to a temporary first.  A call
+ * passing a local array is left alone, the next iteration would share
+ * the array, and so is one passing a pointer parameter anywhere but to
+ * itself, since temporaries only have 32 bits.  Tail calls to other
+ * functions are left to lower_ir().
+ */
+
+static IR_INSN *new_insn(IR_OP op, const POS *pos)
+{
+    IR_INSN *ip = (IR_INSN*) arena_alloc(AK_IR, sizeof (IR_INSN));
+    memset(ip, 0, sizeof (IR_INSN));
+    ip->op = op;
+    ip->pos = pos;
+    return ip;
+}
+
+/* adds ip before the terminator of bp */
+static void insert_insn(IR_BLOCK *bp, IR_INSN *ip)
+{
+    IR_INSN *at = bp->tail;
+
+    ip->next = at;
+    ip->prev = at->prev;
+    if (at->prev)
+        at->prev->next = ip;
+    else
+        bp->head = ip;
+    at->prev = ip;
+}
+
+/* the index in ir->var of the parameter num, or -1 if it is never used */
+static int param_var(const IR_FUNC *ir, int num)
+{
+    int i;
+
+    for (i = 0; i < ir->num_var; i++) {
+        if (ir->var[i]->kind == SK_PARAM && ir->var[i]->num == num)
+            return i;
+    }
+    return -1;
+}
+
+static bool is_param(const OPERAND *o)
+{
+    return o->kind == OPD_VAR && o->sym->kind == SK_PARAM;
+}
+
+static bool is_tail_recursion(const IR_FUNC *ir, const IR_INSN *ip)
+{
+    const IR_INSN *ret = ip->next;
+    int i;
+
+    if (ip->op != IR_CALL || ip->a.kind != OPD_FUNC || ip->a.sym != ir->func)
+        return false;
+    if (ret == NULL || ret->op != IR_RET)
+        return false;
+    if (ret->a.kind != OPD_NONE && (ret->a.kind != ip->dst.kind
+                                    || ret->a.num != ip->dst.num))
+        return false;
+    if (ip->num_arg != ir->func->num)
+        return false;
+    for (i = 0; i < ip->num_arg; i++) {
+        const OPERAND *o = &ip->arg[i];
+        if (o->kind == OPD_ARRAY)
+            return false;
+        if (ir_is_pointer(ir, o) && !(is_param(o) && o->sym->num == i))
+            return false;
+    }
+    return true;
+}
+
+/* replaces the call ip and the ret after it in bp */
+static void loop_back(IR_FUNC *ir, IR_BLOCK *bp, IR_INSN *ip)
+{
+    OPERAND *arg = ip->arg;
+    IR_INSN *mov;
+    int i, v;
+
+    /* the jmp takes the place of the ret, the call goes */
+    bp->tail->op = IR_JMP;
+    bp->tail->a.kind = OPD_NONE;
+    bp->tail->target[0] = ir->entry;
+    if (ip->prev)
+        ip->prev->next = bp->tail;
+    else
+        bp->head = bp->tail;
+    bp->tail->prev = ip->prev;
+
+    for (i = 0; i < ip->num_arg; i++) {
+        if (!is_param(&arg[i]) || arg[i].sym->num >= i)
+            continue;
+        mov = new_insn(IR_MOV, ip->pos);
+        mov->dst.kind = OPD_TEMP;
+        mov->dst.num = ir->num_temp++;
+        mov->a = arg[i];
+        insert_insn(bp, mov);
+        arg[i] = mov->dst;
+    }
+    for (i = 0; i < ip->num_arg; i++) {
+        if ((v = param_var(ir, i)) < 0)
+            continue;
+        if (is_param(&arg[i]) && arg[i].sym->num == i)
+            continue;
+        mov = new_insn(IR_MOV, ip->pos);
+        mov->dst.kind = OPD_VAR;
+        mov->dst.num = v;
+        mov->dst.sym = ir->var[v];
+        mov->a = arg[i];
+        insert_insn(bp, mov);
+    }
+}
+
+/* returns the number of calls replaced */
+int eliminate_tail_recursion(IR_FUNC *ir)
+{
+    IR_BLOCK *bp;
+    IR_INSN *ip;
+    int n = 0;
+
+    for (bp = ir->entry; bp != NULL; bp = bp->next) {
+        for (ip = bp->head; ip != NULL; ip = ip->next) {
+            if (is_tail_recursion(ir, ip)) {
+                loop_back(ir, bp, ip);
+                n++;
+                break;
+            }
+        }
+    }
+    if (n > 0)
+        ir_build_cfg(ir);
+    return n;
+}
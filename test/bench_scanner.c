@@ -0,0 +1,62 @@
+#include <time.h>
+#include "minicc.h"
+
+#define NUM_LINES   200000
+#define NUM_ROUNDS  5
+
+static const char *lines[] = {
+    "static int conflict(int board[][10], int row, int col)\n",
+    "    for (index = 0; index < row_count; index++) {\n",
+    "        if (board_value[index][column] && flag_count > 0)\n",
+    "            return result_value + offset * 2;\n",
+    "    unsigned long total_size = sizeof (struct node_entry);\n",
+    "    while (current_node != 0 && current_node->next_node)\n",
+    "        current_node = current_node->next_node; /* walk */\n",
+    "    switch (token_kind) { case 1: break; default: continue; }\n",
+};
+
+static char *make_source(void)
+{
+    size_t size = 0;
+    char *s, *p;
+    int i, n = sizeof lines / sizeof lines[0];
+
+    for (i = 0; i < NUM_LINES; i++)
+        size += strlen(lines[i % n]);
+    p = s = (char*) alloc(size + 1);
+    for (i = 0; i < NUM_LINES; i++) {
+        strcpy(p, lines[i % n]);
+        p += strlen(p);
+    }
+    return s;
+}
+
+int main(void)
+{
+    char *source = make_source();
+    double best = 0;
+    long tokens = 0;
+    int i;
+
+    for (i = 0; i < NUM_ROUNDS; i++) {
+        SCANNER *scan;
+        clock_t start;
+        double sec;
+
+        scan = open_scanner_text("bench", source);
+        if (scan == NULL)
+            return 1;
+        tokens = 0;
+        start = clock();
+        while (next_token(scan) != TK_EOF)
+            tokens++;
+        sec = (double) (clock() - start) / CLOCKS_PER_SEC;
+        close_scanner(scan);
+        if (best == 0 || sec < best)
+            best = sec;
+    }
+    printf("%ld tokens, best of %d: %.3f sec, %.0f tokens/sec\n",
+            tokens, NUM_ROUNDS, best, best > 0 ? tokens / best : 0.0);
+    free(source);
+    return 0;
+}
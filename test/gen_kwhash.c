@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * generate the keyword perfect hash of scanner.c
+ *
+ *   (len + s_kw_asso[first] + s_kw_asso[last]) & (KW_HASH_SIZE-1)
+ *
+ * The association values are found by a depth first search over the
+ * letters in the order they first appear as the first or last letter
+ * of a keyword, smallest value first, so the output only changes with
+ * the keyword list.  Each letter is placed once every keyword using it
+ * has its other letter placed too, and must not send any of them to a
+ * slot already taken.  The tables are printed as scanner.c has them;
+ * `make kwhash_test` compares the two.
+ */
+
+#define KW_HASH_SIZE    64
+#define NUM_LETTER      26
+
+static const struct {
+    const char *name;
+    const char *token;
+} s_keyword[] = {
+    { "auto", "TK_AUTO" }, { "break", "TK_BREAK" }, { "case", "TK_CASE" },
+    { "char", "TK_CHAR" }, { "const", "TK_CONST" },
+    { "continue", "TK_CONTINUE" }, { "default", "TK_DEFAULT" },
+    { "do", "TK_DO" }, { "double", "TK_DOUBLE" }, { "else", "TK_ELSE" },
+    { "enum", "TK_ENUM" }, { "extern", "TK_EXTERN" },
+    { "float", "TK_FLOAT" }, { "for", "TK_FOR" }, { "goto", "TK_GOTO" },
+    { "if", "TK_IF" }, { "int", "TK_INT" }, { "long", "TK_LONG" },
+    { "register", "TK_REGISTER" }, { "return", "TK_RETURN" },
+    { "short", "TK_SHORT" }, { "signed", "TK_SIGNED" },
+    { "sizeof", "TK_SIZEOF" }, { "static", "TK_STATIC" },
+    { "struct", "TK_STRUCT" }, { "switch", "TK_SWITCH" },
+    { "typedef", "TK_TYPEDEF" }, { "union", "TK_UNION" },
+    { "unsigned", "TK_UNSIGNED" }, { "void", "TK_VOID" },
+    { "volatile", "TK_VOLATILE" }, { "while", "TK_WHILE" },
+};
+
+#define NUM_KEYWORD ((int) (sizeof s_keyword / sizeof s_keyword[0]))
+
+static int s_asso[NUM_LETTER];
+static int s_placed[NUM_LETTER];
+static int s_order[NUM_LETTER];
+static int s_num_order;
+static int s_slot[KW_HASH_SIZE];    /* keyword index + 1, 0 if free */
+
+static int first_of(int k)
+{
+    return s_keyword[k].name[0] - 'a';
+}
+
+static int last_of(int k)
+{
+    const char *s = s_keyword[k].name;
+    return s[strlen(s) - 1] - 'a';
+}
+
+static int hash(int k)
+{
+    return ((int) strlen(s_keyword[k].name) + s_asso[first_of(k)]
+            + s_asso[last_of(k)]) & (KW_HASH_SIZE - 1);
+}
+
+/* places the keywords completed by letter c, or takes them back */
+static int place(int c, int take_back)
+{
+    int k;
+
+    for (k = 0; k < NUM_KEYWORD; k++) {
+        int f = first_of(k), l = last_of(k);
+        if ((f != c && l != c) || !s_placed[f] || !s_placed[l])
+            continue;
+        if (take_back) {
+            if (s_slot[hash(k)] == k + 1)
+                s_slot[hash(k)] = 0;
+            continue;
+        }
+        if (s_slot[hash(k)] != 0)
+            return 0;
+        s_slot[hash(k)] = k + 1;
+    }
+    return 1;
+}
+
+static int search(int i)
+{
+    int c, v;
+
+    if (i == s_num_order)
+        return 1;
+    c = s_order[i];
+    s_placed[c] = 1;
+    for (v = 0; v < KW_HASH_SIZE; v++) {
+        s_asso[c] = v;
+        if (place(c, 0) && search(i + 1))
+            return 1;
+        place(c, 1);
+    }
+    s_asso[c] = 0;
+    s_placed[c] = 0;
+    return 0;
+}
+
+static void add_letter(int c)
+{
+    int i;
+
+    for (i = 0; i < s_num_order; i++) {
+        if (s_order[i] == c)
+            return;
+    }
+    s_order[s_num_order++] = c;
+}
+
+int main(void)
+{
+    int i, k;
+
+    for (k = 0; k < NUM_KEYWORD; k++) {
+        add_letter(first_of(k));
+        add_letter(last_of(k));
+    }
+    if (!search(0)) {
+        fprintf(stderr, "no collision free association values\n");
+        return 1;
+    }
+    for (k = 0; k < NUM_KEYWORD; k++) {
+        if (s_slot[hash(k)] != k + 1) {
+            fprintf(stderr, "'%s' is not in its own slot\n",
+                    s_keyword[k].name);
+            return 1;
+        }
+    }
+
+    printf("static const unsigned char s_kw_asso[%d] = {", NUM_LETTER);
+    for (i = 0; i < NUM_LETTER; i++)
+        printf("%s%2d,", (i % 13) ? " " : "\n    ", s_asso[i]);
+    printf("\n};\n\n");
+    printf("static const struct keyword s_kw_tab[KW_HASH_SIZE] = {\n");
+    for (i = 0; i < KW_HASH_SIZE; i++) {
+        if (s_slot[i] == 0) {
+            printf("    { NULL, 0, TK_EOF },\n");
+            continue;
+        }
+        k = s_slot[i] - 1;
+        printf("    { \"%s\", %d, %s },\n", s_keyword[k].name,
+                (int) strlen(s_keyword[k].name), s_keyword[k].token);
+    }
+    printf("};\n");
+    return 0;
+}
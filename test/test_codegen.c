@@ -0,0 +1,868 @@
+#include <unistd.h>
+#include "minicc.h"
+
+/*
+ * Each case is compiled by mcc at -O0, -O1 and -O2, linked with a
+ * driver that calls it and run; the driver's output is compared with
+ * what the case expects.  mcc prefixes symbols with '_', the driver's
+ * prototypes name them with asm labels.  At the levels in its at mask a
+ * case may also check the assembly, which is followed by the --stats of
+ * the unit as a comment, for lines of text it must or must not contain.
+ */
+#define CF_PIE      0x01    /* link as a position independent executable */
+#define CF_AVX2     0x02    /* compile with -mavx2 */
+#define CF_IR       0x04    /* uses arrays or ?:, which only -O2 compiles */
+#define CF_NO_INLINE 0x08   /* compile with --inline-threshold=0 */
+
+#define AT_O1       (1 << 1)
+#define AT_O2       (1 << 2)
+
+typedef struct {
+    const char *name;
+    const char *source;
+    const char *decls;      /* the driver's prototypes */
+    const char *body;       /* of the driver's main() */
+    const char *expect;
+    unsigned flags;         /* CF_ */
+    unsigned at;            /* AT_, the levels has and lacks are checked at */
+    const char *has;        /* lines of text the assembly must contain */
+    const char *lacks;      /* and those it must not */
+} CASE;
+
+/* a remainder, n <= 0 and pointers any distance apart */
+#define VECTOR_SOURCE \
+    "void add(int *a, int *b, int *c, int n)\n" \
+    "{\n" \
+    "    int i;\n" \
+    "    for (i = 0; i < n; i++)\n" \
+    "        a[i] = b[i] + c[i];\n" \
+    "}\n" \
+    "void inc(int *a, int *b, int n)\n" \
+    "{\n" \
+    "    int i;\n" \
+    "    for (i = 0; i < n; i++)\n" \
+    "        a[i] = b[i] + 1;\n" \
+    "}\n"
+
+#define VECTOR_DECLS \
+    "void add(int *, int *, int *, int) __asm__(\"_add\");\n" \
+    "void inc(int *, int *, int) __asm__(\"_inc\");\n" \
+    "static int check(void)\n" \
+    "{\n" \
+    "    int a[24], b[24], c[24], buf[40], ref[40];\n" \
+    "    int n, d, i, bad = 0;\n" \
+    "    for (n = -3; n <= 20; n++) {\n" \
+    "        for (i = 0; i < 24; i++) {\n" \
+    "            a[i] = -1;\n" \
+    "            b[i] = i * 7 - 50;\n" \
+    "            c[i] = 1000 - i * i;\n" \
+    "        }\n" \
+    "        add(a, b, c, n);\n" \
+    "        for (i = 0; i < 24; i++)\n" \
+    "            bad += a[i] != ((i < n) ? b[i] + c[i] : -1);\n" \
+    "    }\n" \
+    "    for (d = -7; d <= 7; d++) {\n" \
+    "        for (n = 0; n <= 20; n++) {\n" \
+    "            for (i = 0; i < 40; i++)\n" \
+    "                buf[i] = ref[i] = i * 3;\n" \
+    "            inc(buf + 10 + d, buf + 10, n);\n" \
+    "            for (i = 0; i < n; i++)\n" \
+    "                ref[10 + d + i] = ref[10 + i] + 1;\n" \
+    "            for (i = 0; i < 40; i++)\n" \
+    "                bad += buf[i] != ref[i];\n" \
+    "        }\n" \
+    "    }\n" \
+    "    return bad;\n" \
+    "}\n"
+
+/* an iteration reads what the one before stored */
+#define DEPENDENCE_SOURCE \
+    "void chain(int *a, int n)\n" \
+    "{\n" \
+    "    int i;\n" \
+    "    for (i = 0; i < n; i++)\n" \
+    "        a[i + 1] = a[i] + 1;\n" \
+    "}\n"
+
+#define DEPENDENCE_DECLS \
+    "void chain(int *, int) __asm__(\"_chain\");\n"
+
+#define DEPENDENCE_BODY \
+    "int a[20] = { 5 };\n" \
+    "    chain(a, 19);\n" \
+    "    printf(\"%d %d\\n\", a[10], a[19]);\n"
+
+/* a static helper small enough to inline */
+#define INLINE_SOURCE \
+    "static int sq(int x)\n" \
+    "{\n" \
+    "    return x * x;\n" \
+    "}\n" \
+    "int f(int a)\n" \
+    "{\n" \
+    "    return sq(a) + sq(a + 1);\n" \
+    "}\n"
+
+static const CASE s_case[] = {
+    /* a parameter dead on entry must not take a live one's register */
+    { "dead_param",
+      "int f(int a, int b)\n"
+      "{\n"
+      "    int x;\n"
+      "    x = a;\n"
+      "    b = 5;\n"
+      "    return x + b;\n"
+      "}\n"
+      "int g(int a, int b, int c, int d, int e, int f, int g, int h)\n"
+      "{\n"
+      "    int x;\n"
+      "    x = a + g;\n"
+      "    h = 5;\n"
+      "    g = 7;\n"
+      "    return x + h + g;\n"
+      "}\n",
+      "int f(int, int) __asm__(\"_f\");\n"
+      "int g(int, int, int, int, int, int, int, int) __asm__(\"_g\");\n",
+      "printf(\"%d %d\\n\", f(10, 20), g(1, 2, 3, 4, 5, 6, 80, 8));\n",
+      "15 93\n" },
+    /* enumeration constants are folded to literals, in case labels too */
+    { "enum_const",
+      "enum color { RED, GREEN = 5, BLUE, LAST = BLUE * 2 + RED };\n"
+      "int f(int x)\n"
+      "{\n"
+      "    enum { A = 3, B };\n"
+      "    switch (x) {\n"
+      "    case BLUE:\n"
+      "        return RED + GREEN;\n"
+      "    case LAST:\n"
+      "        return B;\n"
+      "    }\n"
+      "    return x * B + A;\n"
+      "}\n",
+      "int f(int) __asm__(\"_f\");\n",
+      "printf(\"%d %d %d\\n\", f(6), f(12), f(2));\n",
+      "5 4 11\n" },
+    /* a jump table must link into a position independent executable */
+    { "switch_table",
+      "int f(int x)\n"
+      "{\n"
+      "    switch (x) {\n"
+      "    case 1: return 10;\n"
+      "    case 2: return 20;\n"
+      "    case 3: return 30;\n"
+      "    case 4: return 40;\n"
+      "    case 6: return 60;\n"
+      "    default: return -1;\n"
+      "    }\n"
+      "}\n",
+      "int f(int) __asm__(\"_f\");\n",
+      "int i;\n"
+      "    for (i = -1; i < 9; i++)\n"
+      "        printf(\"%d \", f(i));\n"
+      "    printf(\"\\n\");\n",
+      "-1 -1 10 20 30 40 -1 60 -1 -1 \n",
+      CF_PIE },
+    /* shifts by a variable count, through cl */
+    { "shift",
+      "int shl(int a, int b)\n"
+      "{\n"
+      "    return a << b;\n"
+      "}\n"
+      "int sar(int a, int b)\n"
+      "{\n"
+      "    return a >> b;\n"
+      "}\n"
+      "unsigned int shr(unsigned int a, int b)\n"
+      "{\n"
+      "    return a >> b;\n"
+      "}\n"
+      "int mix(int a, int b, int c, int d)\n"
+      "{\n"
+      "    return (a << (b + c)) + ((a * b) >> c)\n"
+      "        + ((d << ((d >> (c << ((a >> 1) >> (b >> 1)))) + (a << 1)))\n"
+      "        >> ((b << (c >> 1)) - (a >> (d >> 1))));\n"
+      "}\n",
+      "int shl(int, int) __asm__(\"_shl\");\n"
+      "int sar(int, int) __asm__(\"_sar\");\n"
+      "unsigned shr(unsigned, int) __asm__(\"_shr\");\n"
+      "int mix(int, int, int, int) __asm__(\"_mix\");\n"
+      "static int ref(int a, int b, int c, int d)\n"
+      "{\n"
+      "    return (a << (b + c)) + ((a * b) >> c)\n"
+      "        + ((d << ((d >> (c << ((a >> 1) >> (b >> 1)))) + (a << 1)))\n"
+      "        >> ((b << (c >> 1)) - (a >> (d >> 1))));\n"
+      "}\n",
+      "printf(\"%d %d %u %d %d\\n\", shl(3, 4), sar(-64, 3),\n"
+      "           shr(0x80000000u, 4), mix(5, 2, 1, 7) == ref(5, 2, 1, 7),\n"
+      "           mix(2, 3, 2, 9) == ref(2, 3, 2, 9));\n",
+      "48 -8 134217728 1 1\n" },
+    /* a condition set into a variable that is branched on and read after */
+    { "setcc_value",
+      "int f(int a, int b)\n"
+      "{\n"
+      "    int x;\n"
+      "    x = a < b;\n"
+      "    if (x)\n"
+      "        a = a + 10;\n"
+      "    return a + x;\n"
+      "}\n"
+      "int g(int a, int b)\n"
+      "{\n"
+      "    int x;\n"
+      "    x = a < b;\n"
+      "    while (x) {\n"
+      "        a = a + 10;\n"
+      "        x = a < b;\n"
+      "    }\n"
+      "    return a + x;\n"
+      "}\n",
+      "int f(int, int) __asm__(\"_f\");\n"
+      "int g(int, int) __asm__(\"_g\");\n",
+      "printf(\"%d %d %d %d\\n\", f(1, 2), f(3, 2), g(1, 25), g(3, 2));\n",
+      "12 3 31 3\n" },
+    { "vector", VECTOR_SOURCE, VECTOR_DECLS,
+      "printf(\"%d mismatch\\n\", check());\n",
+      "0 mismatch\n", CF_IR, AT_O2,
+      "paddd\n\"vectorized\": 1}, {\"name\": \"inc\"\n\"vectorized\": 1}]\n" },
+    { "vector_avx2", VECTOR_SOURCE, VECTOR_DECLS,
+      "printf(\"%d mismatch\\n\", check());\n",
+      "0 mismatch\n", CF_IR | CF_AVX2, AT_O2,
+      "vpaddd\n\"vectorized\": 1}, {\"name\": \"inc\"\n\"vectorized\": 1}]\n" },
+    { "vector_dependence", DEPENDENCE_SOURCE, DEPENDENCE_DECLS,
+      DEPENDENCE_BODY, "15 24\n", CF_IR, AT_O2,
+      "\"vectorized\": 0}\n", "xmm\n" },
+    { "vector_dependence_avx2", DEPENDENCE_SOURCE, DEPENDENCE_DECLS,
+      DEPENDENCE_BODY, "15 24\n", CF_IR | CF_AVX2, AT_O2,
+      "\"vectorized\": 0}\n", "xmm\nymm\n" },
+    /* the stack parameters are assigned in place, [rsp+8] and [rsp+16] */
+    { "tail_recursion",
+      "int sum(int a, int b, int c, int d, int e, int f, int g, int h)\n"
+      "{\n"
+      "    if (a == 0)\n"
+      "        return b + c + d + e + f + g + h;\n"
+      "    return sum(a - 1, b + 1, c, d, e, f, g + a, h * 3 % 1000 + g);\n"
+      "}\n",
+      "int sum(int, int, int, int, int, int, int, int) __asm__(\"_sum\");\n"
+      "static int ref(int a, int b, int c, int d, int e, int f, int g, int h)\n"
+      "{\n"
+      "    if (a == 0)\n"
+      "        return b + c + d + e + f + g + h;\n"
+      "    return ref(a - 1, b + 1, c, d, e, f, g + a, h * 3 % 1000 + g);\n"
+      "}\n",
+      "printf(\"%d\\n\", sum(50, 1, 2, 3, 4, 5, 6, 7)\n"
+      "           - ref(50, 1, 2, 3, 4, 5, 6, 7));\n",
+      "0\n", 0, AT_O2,
+      "\"tail_recursion\": 1\n[rsp+8]\n[rsp+16]\n", "call _sum\n" },
+    /* a sibling call is a jmp unless its stack arguments do not fit ours */
+    { "tail_call",
+      "int twice(int x);\n"
+      "int sibling(int x)\n"
+      "{\n"
+      "    return twice(x + 1);\n"
+      "}\n"
+      "int add8(int a, int b, int c, int d, int e, int f, int g, int h);\n"
+      "int spill(int x)\n"
+      "{\n"
+      "    return add8(x, 1, 2, 3, 4, 5, 6, 7);\n"
+      "}\n",
+      "int sibling(int) __asm__(\"_sibling\");\n"
+      "int spill(int) __asm__(\"_spill\");\n"
+      "int twice(int) __asm__(\"_twice\");\n"
+      "int twice(int x)\n"
+      "{\n"
+      "    return 2 * x;\n"
+      "}\n"
+      "int add8(int, int, int, int, int, int, int, int) __asm__(\"_add8\");\n"
+      "int add8(int a, int b, int c, int d, int e, int f, int g, int h)\n"
+      "{\n"
+      "    return a + b + c + d + e + f + g + h * 100;\n"
+      "}\n",
+      "printf(\"%d %d\\n\", sibling(20), spill(1000));\n",
+      "42 1721\n", 0, AT_O2,
+      "jmp _twice\ncall _add8\n", "call _twice\njmp _add8\n" },
+    /* the callee may use the local array, which a jmp would free */
+    { "tail_call_array",
+      "int first(int *a);\n"
+      "int local(int x)\n"
+      "{\n"
+      "    int a[4];\n"
+      "    a[0] = x;\n"
+      "    return first(a);\n"
+      "}\n",
+      "int local(int) __asm__(\"_local\");\n"
+      "int first(int *) __asm__(\"_first\");\n"
+      "int first(int *a)\n"
+      "{\n"
+      "    return a[0] + 1;\n"
+      "}\n",
+      "printf(\"%d\\n\", local(41));\n",
+      "42\n", CF_IR, AT_O2,
+      "call _first\n", "jmp _first\n" },
+    /* sq is left out once its calls are inlined */
+    { "inline", INLINE_SOURCE,
+      "int f(int) __asm__(\"_f\");\n",
+      "printf(\"%d\\n\", f(3));\n",
+      "25\n", 0, AT_O2,
+      "\"inlined\": 2\n", "_sq:\ncall\n" },
+    { "inline_off", INLINE_SOURCE,
+      "int f(int) __asm__(\"_f\");\n",
+      "printf(\"%d\\n\", f(3));\n",
+      "25\n", CF_NO_INLINE, AT_O2,
+      "_sq:\ncall _sq\n\"inlined\": 0\n", "\"inlined\": 2\n" },
+    /*
+     * g, with a volatile local, is generated from the tree, whose calls
+     * are not searched, so sq is kept
+     */
+    { "inline_fallback",
+      INLINE_SOURCE
+      "int g(int a)\n"
+      "{\n"
+      "    volatile int v;\n"
+      "    v = a;\n"
+      "    return v + 1;\n"
+      "}\n",
+      "int f(int) __asm__(\"_f\");\n"
+      "int g(int) __asm__(\"_g\");\n",
+      "printf(\"%d %d\\n\", f(3), g(3));\n",
+      "25 4\n", 0, AT_O2,
+      "_sq:\n\"inlined\": 2\n", "call _sq\n" },
+    /*
+     * nothing may be hoisted: a division the loop never runs, a global
+     * stored in the loop or by a call, and x, live into the header
+     */
+    { "licm_keep",
+      "int g;\n"
+      "void bump(void);\n"
+      "void inc_g(void)\n"
+      "{\n"
+      "    g = g + 1;\n"
+      "}\n"
+      "int zdiv(int x, int d, int n)\n"
+      "{\n"
+      "    int i, s;\n"
+      "    s = 0;\n"
+      "    i = 0;\n"
+      "    while (i < n) {\n"
+      "        s = s + x / d;\n"
+      "        i = i + 1;\n"
+      "    }\n"
+      "    return s;\n"
+      "}\n"
+      "int store(int n)\n"
+      "{\n"
+      "    int i, s;\n"
+      "    g = 1;\n"
+      "    s = 0;\n"
+      "    i = 0;\n"
+      "    while (i < n) {\n"
+      "        s = s + g * 2;\n"
+      "        g = g + 1;\n"
+      "        i = i + 1;\n"
+      "    }\n"
+      "    return s;\n"
+      "}\n"
+      "int call(int n)\n"
+      "{\n"
+      "    int i, s;\n"
+      "    g = 1;\n"
+      "    s = 0;\n"
+      "    i = 0;\n"
+      "    while (i < n) {\n"
+      "        s = s + g * 2;\n"
+      "        bump();\n"
+      "        i = i + 1;\n"
+      "    }\n"
+      "    return s;\n"
+      "}\n"
+      "int live(int a, int n)\n"
+      "{\n"
+      "    int i, x, s;\n"
+      "    x = 100;\n"
+      "    s = 0;\n"
+      "    i = 0;\n"
+      "    while (i < n) {\n"
+      "        s = s + x;\n"
+      "        x = a * 3;\n"
+      "        i = i + 1;\n"
+      "    }\n"
+      "    return s;\n"
+      "}\n",
+      "int zdiv(int, int, int) __asm__(\"_zdiv\");\n"
+      "int store(int) __asm__(\"_store\");\n"
+      "int call(int) __asm__(\"_call\");\n"
+      "int live(int, int) __asm__(\"_live\");\n"
+      "void inc_g(void) __asm__(\"_inc_g\");\n"
+      "void bump(void) __asm__(\"_bump\");\n"
+      "void bump(void)\n"
+      "{\n"
+      "    inc_g();\n"
+      "}\n",
+      "printf(\"%d %d %d %d\\n\", zdiv(7, 0, 0), store(4), call(4),\n"
+      "           live(5, 4));\n",
+      "0 20 20 145\n", 0, AT_O2,
+      "\"hoisted\": 0\n", "\"hoisted\": 1\n" },
+    { "licm_hoist",
+      "int hoist(int a, int b, int n)\n"
+      "{\n"
+      "    int i, s;\n"
+      "    s = 0;\n"
+      "    i = 0;\n"
+      "    while (i < n) {\n"
+      "        s = s + a * b + i;\n"
+      "        i = i + 1;\n"
+      "    }\n"
+      "    return s;\n"
+      "}\n",
+      "int hoist(int, int, int) __asm__(\"_hoist\");\n",
+      "printf(\"%d\\n\", hoist(3, 4, 5));\n",
+      "70\n", 0, AT_O2,
+      "\"hoisted\": 1,\n" },
+    /* a[i] of a 2-D local array advances by a row */
+    { "indvar_2d",
+      "int grid(int n)\n"
+      "{\n"
+      "    int a[8][5];\n"
+      "    int i, j, s;\n"
+      "    i = 0;\n"
+      "    while (i < 8) {\n"
+      "        j = 0;\n"
+      "        while (j < 5) {\n"
+      "            a[i][j] = i * 10 + j;\n"
+      "            j = j + 1;\n"
+      "        }\n"
+      "        i = i + 1;\n"
+      "    }\n"
+      "    s = 0;\n"
+      "    i = 0;\n"
+      "    while (i < 8) {\n"
+      "        s = s + a[i][n] * (i + 1);\n"
+      "        i = i + 1;\n"
+      "    }\n"
+      "    return s;\n"
+      "}\n",
+      "int grid(int) __asm__(\"_grid\");\n",
+      "printf(\"%d %d\\n\", grid(0), grid(4));\n",
+      "1680 1824\n", CF_IR, AT_O2,
+      "\"iv_reduced\": 3\n" },
+    /*
+     * a negative step, a step of 3 with i read after the loop, and
+     * counters whose bound or whose multiples' bound is near INT_MAX;
+     * the results are those of gcc -fwrapv
+     */
+    { "indvar",
+      "int down(void)\n"
+      "{\n"
+      "    int i, s;\n"
+      "    s = 0;\n"
+      "    i = 40;\n"
+      "    while (i > 0) {\n"
+      "        s = s + i * 7;\n"
+      "        i = i - 2;\n"
+      "    }\n"
+      "    return s;\n"
+      "}\n"
+      "int step3(void)\n"
+      "{\n"
+      "    int i, s;\n"
+      "    s = 0;\n"
+      "    i = 1;\n"
+      "    while (i < 50) {\n"
+      "        s = s + i * 4;\n"
+      "        i = i + 3;\n"
+      "    }\n"
+      "    return s * 100 + i;\n"
+      "}\n"
+      "int near_max(void)\n"
+      "{\n"
+      "    int i, s;\n"
+      "    s = 0;\n"
+      "    i = 2147483600;\n"
+      "    while (i < 2147483647) {\n"
+      "        s = s ^ i * 8;\n"
+      "        i = i + 1;\n"
+      "    }\n"
+      "    return s;\n"
+      "}\n"
+      "int near_max3(void)\n"
+      "{\n"
+      "    int i, s;\n"
+      "    s = 0;\n"
+      "    i = 2147483630;\n"
+      "    while (i < 2147483645) {\n"
+      "        s = s + (i << 2);\n"
+      "        i = i + 3;\n"
+      "    }\n"
+      "    return s + i;\n"
+      "}\n"
+      "int wraps(void)\n"
+      "{\n"
+      "    int i, s;\n"
+      "    s = 0;\n"
+      "    i = 268435400;\n"
+      "    while (i < 268435500) {\n"
+      "        s = s + (i * 8 & 255);\n"
+      "        i = i + 1;\n"
+      "    }\n"
+      "    return s;\n"
+      "}\n",
+      "int down(void) __asm__(\"_down\");\n"
+      "int step3(void) __asm__(\"_step3\");\n"
+      "int near_max(void) __asm__(\"_near_max\");\n"
+      "int near_max3(void) __asm__(\"_near_max3\");\n"
+      "int wraps(void) __asm__(\"_wraps\");\n",
+      "printf(\"%d %d %d %d %d\\n\", down(), step3(), near_max(),\n"
+      "           near_max3(), wraps());\n",
+      "2940 170052 -8 2147483405 12208\n", 0, AT_O2,
+      "\"iv_reduced\": 1\n", "\"iv_reduced\": 0\n" },
+    /* a leaf without a frame finds its stack parameters above rsp */
+    { "frameless",
+      "int sum8(int a, int b, int c, int d, int e, int f, int g, int h)\n"
+      "{\n"
+      "    return a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6 + g * 7 + h * 8;\n"
+      "}\n",
+      "int sum8(int, int, int, int, int, int, int, int) __asm__(\"_sum8\");\n",
+      "printf(\"%d\\n\", sum8(1, 2, 3, 4, 5, 6, 7, 8));\n",
+      "204\n", 0, AT_O1 | AT_O2,
+      "[rsp+8]\n[rsp+16]\n", "push rbp\nmov rbp, rsp\n" },
+    /* at -O1 a leaf that pushes, to divide or to spill, gets a frame */
+    { "frame_divide",
+      "int quot(int a, int b, int c)\n"
+      "{\n"
+      "    return (a + b) / c + a % b;\n"
+      "}\n",
+      "int quot(int, int, int) __asm__(\"_quot\");\n",
+      "printf(\"%d\\n\", quot(17, 5, 3));\n",
+      "9\n", 0, AT_O1,
+      "push rbp\nmov rbp, rsp\n" },
+    { "frame_spill",
+      "int spill(int a, int b, int c, int d)\n"
+      "{\n"
+      "    return ((((a + b) * (c - d)) - ((a - c) * (b + d)))\n"
+      "            + (((a * d) - (b * c)) * ((a + d) - (b - c))))\n"
+      "        * ((((b + c) * (a - d)) + ((c * d) - (a * b)))\n"
+      "            - (((d - a) * (c + b)) ^ ((a * c) + (b * d))));\n"
+      "}\n",
+      "int spill(int, int, int, int) __asm__(\"_spill\");\n",
+      "printf(\"%d %d\\n\", spill(3, 5, 7, 12), spill(-2, 9, 4, 1));\n",
+      "-4500 -16995\n", 0, AT_O1,
+      "push rbp\nmov rbp, rsp\n" },
+    /* ?: with a constant condition has the type of both arms converted */
+    { "cond_fold",
+      "int f(int x)\n"
+      "{\n"
+      "    char c;\n"
+      "    unsigned int u;\n"
+      "    c = x;\n"
+      "    u = 0;\n"
+      "    return (1 ? c : u) > 0;\n"
+      "}\n"
+      "int g(int x)\n"
+      "{\n"
+      "    unsigned int u;\n"
+      "    u = 0;\n"
+      "    return (1 ? -1 : u) > x;\n"
+      "}\n"
+      "int h(int x)\n"
+      "{\n"
+      "    char c;\n"
+      "    c = x;\n"
+      "    return (1 ? c : 0) + (0 ? 5 : c);\n"
+      "}\n",
+      "int f(int) __asm__(\"_f\");\n"
+      "int g(int) __asm__(\"_g\");\n"
+      "int h(int) __asm__(\"_h\");\n",
+      "printf(\"%d %d %d %d\\n\", f(-1), f(0), g(7), h(-3));\n",
+      "1 0 1 -6\n", CF_IR },
+};
+
+#define NUM_CASE    ((int) (sizeof s_case / sizeof s_case[0]))
+
+/*
+ * division and modulo by constants, which are strength reduced, against
+ * the divider: a function per divisor and operation, called by the
+ * driver with edge values, every dividend in [-4096, 4095] and random
+ * ones.  An unsigned divisor must fit an int literal.
+ */
+static const int s_sdivisor[] = {
+    1, -1, 2, -2, 4, -8, 1024, -65536, 1073741824,
+    3, -3, 5, 6, 7, -7, 10, 11, 13, 25, 100, 125, 641, -1000,
+    1000000007, 2147483647, -2147483647,
+};
+static const int s_udivisor[] = {
+    1, 2, 8, 1024, 1073741824,
+    3, 5, 6, 7, 10, 11, 13, 25, 100, 125, 641, 1000, 65537,
+    1000000007, 2147483647,
+};
+
+#define NUM_SDIVISOR    ((int) (sizeof s_sdivisor / sizeof s_sdivisor[0]))
+#define NUM_UDIVISOR    ((int) (sizeof s_udivisor / sizeof s_udivisor[0]))
+
+static const char s_div_check[] =
+    "static const int edge[] = {\n"
+    "    0, 1, -1, 2, -2, 3, -3, 7, -7, 2147483647, -2147483647 - 1,\n"
+    "    -2147483647, 1073741824, 1073741823, -1073741824, -1073741825,\n"
+    "};\n"
+    "#define NUM_EDGE    (sizeof edge / sizeof edge[0])\n"
+    "#define RANGE       4096\n"
+    "#define NUM_RANDOM  4096\n"
+    "static unsigned seed = 12345;\n"
+    "static int dividend(int i)\n"
+    "{\n"
+    "    if (i < NUM_EDGE)\n"
+    "        return edge[i];\n"
+    "    if ((i -= NUM_EDGE) < 2 * RANGE)\n"
+    "        return i - RANGE;\n"
+    "    seed = seed * 1103515245u + 12345u;\n"
+    "    return (int) ((seed >> 16) | (seed << 16));\n"
+    "}\n"
+    "static int check(void)\n"
+    "{\n"
+    "    volatile int vd;\n"
+    "    volatile unsigned vu;\n"
+    "    int i, k, n, bad = 0;\n"
+    "    for (i = 0; i < NUM_EDGE + 2 * RANGE + NUM_RANDOM; i++) {\n"
+    "        n = dividend(i);\n"
+    "        for (k = 0; k < NUM_SDIVISOR; k++) {\n"
+    "            vd = sdivisor[k];\n"
+    "            if (n == -2147483647 - 1 && vd == -1)\n"
+    "                continue;\n"
+    "            if (sdiv[k](n) != n / vd || smod[k](n) != n % vd) {\n"
+    "                if (bad++ < 10)\n"
+    "                    printf(\"%d / %d: expect %d %d, got %d %d\\n\", n, vd,\n"
+    "                           n / vd, n % vd, sdiv[k](n), smod[k](n));\n"
+    "            }\n"
+    "        }\n"
+    "        for (k = 0; k < NUM_UDIVISOR; k++) {\n"
+    "            unsigned u = n;\n"
+    "            vu = udivisor[k];\n"
+    "            if (udiv[k](u) != u / vu || umod[k](u) != u % vu) {\n"
+    "                if (bad++ < 10)\n"
+    "                    printf(\"%u / %u: expect %u %u, got %u %u\\n\", u, vu,\n"
+    "                           u / vu, u % vu, udiv[k](u), umod[k](u));\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "    return bad;\n"
+    "}\n";
+
+static char *div_source(void)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&buf, &size);
+    int i;
+
+    if (fp == NULL)
+        return NULL;
+    for (i = 0; i < NUM_SDIVISOR; i++) {
+        fprintf(fp, "int sdiv%d(int x)\n{\n    return x / %d;\n}\n",
+                i, s_sdivisor[i]);
+        fprintf(fp, "int smod%d(int x)\n{\n    return x %% %d;\n}\n",
+                i, s_sdivisor[i]);
+    }
+    for (i = 0; i < NUM_UDIVISOR; i++) {
+        fprintf(fp, "unsigned int udiv%d(unsigned int x)\n"
+                    "{\n    return x / %d;\n}\n", i, s_udivisor[i]);
+        fprintf(fp, "unsigned int umod%d(unsigned int x)\n"
+                    "{\n    return x %% %d;\n}\n", i, s_udivisor[i]);
+    }
+    fclose(fp);
+    return buf;
+}
+
+static void print_table(FILE *fp, const char *type, const char *name, int n)
+{
+    int i;
+
+    fprintf(fp, "static %s %s[] = {", type, name);
+    for (i = 0; i < n; i++)
+        fprintf(fp, "%s%s%d,", (i % 8) ? " " : "\n    ", name, i);
+    fprintf(fp, "\n};\n");
+}
+
+static char *div_decls(void)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&buf, &size);
+    int i;
+
+    if (fp == NULL)
+        return NULL;
+    for (i = 0; i < NUM_SDIVISOR; i++) {
+        fprintf(fp, "int sdiv%d(int) __asm__(\"_sdiv%d\");\n", i, i);
+        fprintf(fp, "int smod%d(int) __asm__(\"_smod%d\");\n", i, i);
+    }
+    for (i = 0; i < NUM_UDIVISOR; i++) {
+        fprintf(fp, "unsigned udiv%d(unsigned) __asm__(\"_udiv%d\");\n", i, i);
+        fprintf(fp, "unsigned umod%d(unsigned) __asm__(\"_umod%d\");\n", i, i);
+    }
+    fprintf(fp, "typedef int (*SFN)(int);\n"
+                "typedef unsigned (*UFN)(unsigned);\n");
+    print_table(fp, "SFN", "sdiv", NUM_SDIVISOR);
+    print_table(fp, "SFN", "smod", NUM_SDIVISOR);
+    print_table(fp, "UFN", "udiv", NUM_UDIVISOR);
+    print_table(fp, "UFN", "umod", NUM_UDIVISOR);
+    fprintf(fp, "static const int sdivisor[] = {");
+    for (i = 0; i < NUM_SDIVISOR; i++)
+        fprintf(fp, " %d,", s_sdivisor[i]);
+    fprintf(fp, " };\nstatic const unsigned udivisor[] = {");
+    for (i = 0; i < NUM_UDIVISOR; i++)
+        fprintf(fp, " %d,", s_udivisor[i]);
+    fprintf(fp, " };\n#define NUM_SDIVISOR %d\n#define NUM_UDIVISOR %d\n%s",
+            NUM_SDIVISOR, NUM_UDIVISOR, s_div_check);
+    fclose(fp);
+    return buf;
+}
+
+static char s_dir[] = "/tmp/test_codegenXXXXXX";
+
+/* the output of the program built from c at opt_level, or NULL */
+static char *run_case(const CASE *c, int opt_level)
+{
+    char path[256], cmd[1024];
+    char *out = NULL;
+    size_t size = 0, n;
+    char buf[256];
+    COMPILER *cc;
+    FILE *fp;
+    bool ok;
+
+    sprintf(path, "%s/t.s", s_dir);
+    if ((fp = fopen(path, "w")) == NULL)
+        return NULL;
+    cc = new_compiler();
+    cc->opt_level = opt_level;
+    cc->avx2 = (c->flags & CF_AVX2) != 0;
+    if (c->flags & CF_NO_INLINE)
+        cc->inline_threshold = -1;
+    ok = compile_buffer(cc, c->name, c->source, fp);
+    if (ok) {
+        fprintf(fp, "# ");
+        fprint_stats(fp, cc);
+        fprintf(fp, "\n");
+    }
+    free_compiler(cc);
+    if (fclose(fp) != 0 || !ok)
+        return NULL;
+
+    sprintf(path, "%s/driver.c", s_dir);
+    if ((fp = fopen(path, "w")) == NULL)
+        return NULL;
+    fprintf(fp, "#include <stdio.h>\n%s\nint main(void)\n{\n    %s"
+                "    return 0;\n}\n", c->decls, c->body);
+    if (fclose(fp) != 0)
+        return NULL;
+
+    sprintf(cmd, "cc -w%s -o %s/t %s/driver.c %s/t.s 2>/dev/null && %s/t",
+            (c->flags & CF_PIE) ? "" : " -no-pie", s_dir, s_dir, s_dir, s_dir);
+    if ((fp = popen(cmd, "r")) == NULL)
+        return NULL;
+    while ((n = fread(buf, 1, sizeof buf, fp)) > 0) {
+        out = (char*) realloc(out, size + n + 1);
+        memcpy(out + size, buf, n);
+        size += n;
+        out[size] = '\0';
+    }
+    if (pclose(fp) != 0) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+/*
+ * whether the lines of list are all in text (or none of them if has is
+ * false), printing those that are not (or are)
+ */
+static bool check_lines(const char *text, const char *list, bool has)
+{
+    char line[256];
+    const char *e;
+    bool ok = true;
+
+    for (; list != NULL && *list != '\0'; list = e + 1) {
+        e = strchr(list, '\n');
+        sprintf(line, "%.*s", (int) (e - list), list);
+        if ((strstr(text, line) != NULL) != has) {
+            printf("%s: %s\n", has ? "missing" : "unexpected", line);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/* whether the assembly run_case() left checks out */
+static bool check_asm(const CASE *c)
+{
+    char path[256];
+    char *text;
+    long size;
+    FILE *fp;
+    bool ok;
+
+    sprintf(path, "%s/t.s", s_dir);
+    if ((fp = fopen(path, "r")) == NULL)
+        return false;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    text = (char*) malloc(size + 1);
+    text[fread(text, 1, size, fp)] = '\0';
+    fclose(fp);
+    ok = check_lines(text, c->has, true);
+    ok = check_lines(text, c->lacks, false) && ok;
+    free(text);
+    return ok;
+}
+
+/* returns the number of opt levels c failed at */
+static int check_case(const CASE *c)
+{
+    int opt, failed = 0;
+
+    for (opt = (c->flags & CF_IR) ? 2 : 0; opt <= 2; opt++) {
+        char *out = run_case(c, opt);
+        bool ok = out && strcmp(out, c->expect) == 0;
+        if (out && (c->at & (1 << opt)) && !check_asm(c))
+            ok = false;
+        printf("%s -O%d: %s\n", c->name, opt, ok ? "ok" : "FAILED");
+        if (!ok) {
+            if (out)
+                fputs(out, stdout);
+            failed++;
+        }
+        free(out);
+    }
+    return failed;
+}
+
+int main(void)
+{
+    CASE div;
+    char cmd[256];
+    int i, failed = 0;
+
+    if (mkdtemp(s_dir) == NULL)
+        return 1;
+    for (i = 0; i < NUM_CASE; i++)
+        failed += check_case(&s_case[i]);
+
+    memset(&div, 0, sizeof div);
+    div.name = "div_const";
+    div.source = div_source();
+    div.decls = div_decls();
+    div.body = "printf(\"%d mismatch\\n\", check());\n";
+    div.expect = "0 mismatch\n";
+    if (div.source && div.decls)
+        failed += check_case(&div);
+    else
+        failed++;
+    free((char*) div.source);
+    free((char*) div.decls);
+
+    sprintf(cmd, "rm -rf %s", s_dir);
+    if (system(cmd) != 0)
+        failed++;
+    return failed != 0;
+}
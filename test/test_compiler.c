@@ -0,0 +1,92 @@
+#include <pthread.h>
+#include "minicc.h"
+
+#define NUM_THREAD  8
+#define NUM_LOOP    50
+
+const char *source =
+    "int count;\n"
+    "char *name;\n"
+    "char *greeting()\n"
+    "{\n"
+    "    return \"hello, world\";\n"
+    "}\n"
+    "int fact(int n)\n"
+    "{\n"
+    "    int m, f;\n"
+    "    m = 1;\n"
+    "    f = 1;\n"
+    "    while (m <= n) {\n"
+    "        f = f * m;\n"
+    "        m = m + 1;\n"
+    "    }\n"
+    "    if (f > 100)\n"
+    "        count = count + 1;\n"
+    "    return f;\n"
+    "}\n"
+    "int main()\n"
+    "{\n"
+    "    name = \"factorial of five\";\n"
+    "    return fact(5) - 120;\n"
+    "}\n";
+
+static char *s_expect;
+
+static char *compile_to_string(COMPILER *cc)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&buf, &size);
+
+    if (fp == NULL)
+        return NULL;
+    if (!compile_buffer(cc, "test", source, fp)) {
+        fclose(fp);
+        free(buf);
+        return NULL;
+    }
+    fclose(fp);
+    return buf;
+}
+
+static void *thread_main(void *arg)
+{
+    COMPILER *cc = new_compiler();
+    long failed = 0;
+    int i;
+
+    for (i = 0; i < NUM_LOOP; i++) {
+        char *s = compile_to_string(cc);
+        if (s == NULL || strcmp(s, s_expect) != 0)
+            failed++;
+        free(s);
+    }
+    free_compiler(cc);
+    return (void*) failed;
+}
+
+int main(void)
+{
+    COMPILER *cc;
+    pthread_t th[NUM_THREAD];
+    long failed = 0;
+    int i;
+
+    cc = new_compiler();
+    s_expect = compile_to_string(cc);
+    free_compiler(cc);
+    if (s_expect == NULL)
+        return 1;
+    printf("%s", s_expect);
+
+    for (i = 0; i < NUM_THREAD; i++)
+        pthread_create(&th[i], NULL, thread_main, NULL);
+    for (i = 0; i < NUM_THREAD; i++) {
+        void *r;
+        pthread_join(th[i], &r);
+        failed += (long) r;
+    }
+    printf("# %d threads x %d: %ld mismatch\n", NUM_THREAD, NUM_LOOP, failed);
+    free(s_expect);
+    return failed != 0;
+}
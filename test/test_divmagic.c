@@ -0,0 +1,115 @@
+#include <limits.h>
+#include "minicc.h"
+
+/*
+ * check the plans for division by a constant (strength.c) against the
+ * divider: every divisor up to 4096 in magnitude, every power of two and
+ * its neighbours, and a sample of large ones, each with the dividends
+ * where a wrong magic number shows up first; for small divisors every
+ * dividend in [-65536, 65535] as well.
+ */
+
+#define MAX_SMALL_DIVISOR   4096
+#define NUM_RANDOM          4096
+#define MAX_EXHAUSTIVE      64
+#define EXHAUSTIVE_RANGE    65536
+#define MAX_REPORT          10
+
+static unsigned s_seed = 12345;
+static long s_num_check;
+static long s_num_error;
+
+static unsigned next_random(void)
+{
+    s_seed = s_seed * 1103515245u + 12345u;
+    return (s_seed >> 16) | (s_seed << 16);
+}
+
+static void check_one(const DIV_PLAN *plan, int d, int n)
+{
+    int q, r, q2, r2;
+
+    if (plan->is_unsigned) {
+        q = (int) ((unsigned) n / (unsigned) d);
+        r = (int) ((unsigned) n % (unsigned) d);
+    } else {
+        if (n == INT_MIN && d == -1)
+            return;
+        q = n / d;
+        r = n % d;
+    }
+    q2 = eval_div_plan(plan, n, false);
+    r2 = eval_div_plan(plan, n, true);
+    s_num_check++;
+    if (q == q2 && r == r2)
+        return;
+    if (s_num_error++ < MAX_REPORT)
+        printf("%s %d / %d: expect %d %d, got %d %d\n",
+                plan->is_unsigned ? "unsigned" : "signed", n, d, q, r, q2, r2);
+}
+
+static void check_divisor(int d, bool is_unsigned, bool exhaustive)
+{
+    static const int edge[] = {
+        0, 1, 2, 3, -1, -2, -3, INT_MAX, INT_MAX - 1, INT_MIN, INT_MIN + 1,
+        0x40000000, 0x3fffffff, -0x40000000, -0x40000001,
+    };
+    DIV_PLAN plan;
+    unsigned ad;
+    int i, n;
+
+    if (d == 0)
+        return;
+    plan_div(&plan, d, is_unsigned);
+    for (i = 0; i < (int) (sizeof edge / sizeof edge[0]); i++)
+        check_one(&plan, d, edge[i]);
+    /* around the multiples of d nearest to 0 and to the extremes */
+    ad = (!is_unsigned && d < 0) ? -(unsigned) d : (unsigned) d;
+    for (i = -1; i <= 1; i++) {
+        check_one(&plan, d, (int) (ad + i));
+        check_one(&plan, d, (int) -(ad + i));
+        check_one(&plan, d, (int) (INT_MAX / ad * ad + i));
+        check_one(&plan, d, (int) (UINT_MAX / ad * ad + i));
+        check_one(&plan, d, (int) -(0x80000000u / ad * ad + i));
+    }
+    for (i = 0; i < 64; i++)
+        check_one(&plan, d, (int) next_random());
+    if (exhaustive) {
+        for (n = -EXHAUSTIVE_RANGE; n < EXHAUSTIVE_RANGE; n++)
+            check_one(&plan, d, n);
+    }
+}
+
+static void check(bool is_unsigned)
+{
+    int d, k;
+
+    s_num_check = s_num_error = 0;
+    for (d = 1; d <= MAX_SMALL_DIVISOR; d++) {
+        check_divisor(d, is_unsigned, d <= MAX_EXHAUSTIVE);
+        check_divisor(-d, is_unsigned, d <= MAX_EXHAUSTIVE);
+    }
+    for (k = 0; k < 32; k++) {
+        for (d = -1; d <= 1; d++) {
+            check_divisor((int) ((1u << k) + d), is_unsigned, false);
+            check_divisor((int) -((1u << k) + d), is_unsigned, false);
+        }
+    }
+    check_divisor(INT_MAX, is_unsigned, true);
+    check_divisor(INT_MIN, is_unsigned, true);
+    for (k = 0; k < NUM_RANDOM; k++)
+        check_divisor((int) next_random(), is_unsigned, false);
+    printf("%s: %ld checks, %ld errors\n",
+            is_unsigned ? "unsigned" : "signed", s_num_check, s_num_error);
+}
+
+int main(void)
+{
+    int errors = 0;
+
+    check(false);
+    errors += s_num_error;
+    check(true);
+    errors += s_num_error;
+    return errors ? 1 : 0;
+}
@@ -30,6 +30,7 @@ int scan_test(const char *source)
 
 int main(void)
 {
-    return scan_test(source);
+    /* the input ends inside a character constant */
+    return scan_test(source) || scan_test("a '") || scan_test("b '\\");
 }
 
@@ -6,7 +6,7 @@ TYPE g_type_int = { T_INT, SC_DEFAULT, TQ_DEFAULT, NULL, NULL, NULL };
 
 PARAM *new_param(char *id, TYPE *typ)
 {
-    PARAM *param = (PARAM*) alloc(sizeof (PARAM));
+    PARAM *param = (PARAM*) arena_alloc(AK_PARAM, sizeof (PARAM));
     param->next = NULL;
     param->id = id;
     param->type = typ;
@@ -24,7 +24,8 @@ void add_param(PARAM *top, PARAM *param)
 
 TYPE *new_type(TYPE_KIND kind, TYPE *typ)
 {
-    TYPE *tp = (TYPE*) alloc(sizeof (TYPE));
+    TYPE *tp = (TYPE*) arena_alloc(AK_TYPE, sizeof (TYPE));
+    g_compiler->stats.types++;
     tp->kind = kind;
     tp->sclass = SC_DEFAULT;
     tp->tqual = TQ_DEFAULT;
@@ -37,7 +38,8 @@ TYPE *new_type(TYPE_KIND kind, TYPE *typ)
 
 TYPE *dup_type(TYPE *typ)
 {
-    TYPE *tp = (TYPE*) alloc(sizeof (TYPE));
+    TYPE *tp = (TYPE*) arena_alloc(AK_TYPE, sizeof (TYPE));
+    g_compiler->stats.types++;
     tp->kind = typ->kind;
     tp->sclass = typ->sclass;
     tp->tqual = typ->tqual;
@@ -94,7 +96,7 @@ static bool is_pointer_type(const TYPE *t)
     return (t->kind == T_POINTER);
 }
 
-static bool is_integer_type(const TYPE *t)
+bool is_integer_type(const TYPE *t)
 {
     assert(t);
     switch (t->kind) {
@@ -277,11 +279,79 @@ static TYPE *implicit_conv(TYPE *lhs, TYPE *rhs)
     return lhs;
 }
 
+bool is_unsigned_type(const TYPE *t)
+{
+    assert(t);
+    switch (t->kind) {
+    case T_UCHAR:
+    case T_USHORT:
+    case T_UINT:
+    case T_ULONG:
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
+/* integral promotion: types narrower than int become int */
+TYPE *promote_type(TYPE *t)
+{
+    assert(t);
+    switch (t->kind) {
+    case T_NULL:
+    case T_CHAR:
+    case T_UCHAR:
+    case T_SHORT:
+    case T_USHORT:
+    case T_ENUM:
+        return &g_type_int;
+    default:
+        break;
+    }
+    return t;
+}
+
+/* usual arithmetic conversions */
+TYPE *arith_conv_type(TYPE *lhs, TYPE *rhs)
+{
+    if (is_real_type(lhs) || is_real_type(rhs))
+        return implicit_conv(lhs, rhs);
+    return implicit_conv(promote_type(lhs), promote_type(rhs));
+}
+
+/* the size of an object of type t in bytes, 0 if unknown */
+int get_type_size(const TYPE *t)
+{
+    switch (t->kind) {
+    case T_CHAR:
+    case T_UCHAR:
+        return 1;
+    case T_SHORT:
+    case T_USHORT:
+        return 2;
+    case T_LONG:
+    case T_ULONG:
+    case T_DOUBLE:
+    case T_POINTER:
+        return 8;
+    case T_ARRAY:
+        return (t->size < 0) ? 0 : t->size * get_type_size(t->type);
+    case T_STRUCT:
+    case T_UNION:
+    case T_FUNC:
+        return 0;
+    default:
+        return BYTE_INT;
+    }
+}
+
 TYPE *type_check_array(const POS *pos, const TYPE *arr, const TYPE *e)
 {
     /*TODO impl */
-    /* check arr is array type */
     /* check e is number type */
+    if (arr->kind == T_ARRAY || arr->kind == T_POINTER)
+        return arr->type;
     return &g_type_int;
 }
 
@@ -368,10 +438,12 @@ TYPE *type_check_bin(const POS *pos, NODE_KIND kind,
     case NK_SHL:
     case NK_SHR:
         /*TODO check integer */
+        if (is_integer_type(lhs))
+            return promote_type(lhs);
         return lhs;
     case NK_ADD:
         if (is_number_type(lhs) && is_number_type(rhs))
-            return implicit_conv(lhs, rhs);
+            return arith_conv_type(lhs, rhs);
         if (is_pointer_type(lhs) && is_integer_type(rhs))
             return lhs;
         if (is_integer_type(lhs) && is_pointer_type(rhs))
@@ -379,7 +451,7 @@ TYPE *type_check_bin(const POS *pos, NODE_KIND kind,
         break;
     case NK_SUB:
         if (is_number_type(lhs) && is_number_type(rhs))
-            return implicit_conv(lhs, rhs);
+            return arith_conv_type(lhs, rhs);
         if (is_pointer_type(lhs) && is_integer_type(rhs))
             return lhs;
         break;
@@ -387,12 +459,14 @@ TYPE *type_check_bin(const POS *pos, NODE_KIND kind,
     case NK_DIV:
     case NK_MOD:
         if (is_number_type(lhs) && is_number_type(rhs))
-            return implicit_conv(lhs, rhs);
+            return arith_conv_type(lhs, rhs);
         break;
     case NK_AND:
     case NK_XOR:
     case NK_OR:
         /*TODO check number */
+        if (is_integer_type(lhs) && is_integer_type(rhs))
+            return arith_conv_type(lhs, rhs);
         return &g_type_int;
     case NK_LAND:
         /*TODO check number */
@@ -402,6 +476,8 @@ TYPE *type_check_bin(const POS *pos, NODE_KIND kind,
         return &g_type_int;
     case NK_COND2:
         /*TODO impl */
+        if (is_number_type(lhs) && is_number_type(rhs))
+            return arith_conv_type(lhs, rhs);
         return lhs;
     case NK_SIZEOF:
         /*TODO impl */
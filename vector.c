@@ -0,0 +1,647 @@
+#include <limits.h>
+#include "minicc.h"
+
+/*
+ * loop vectorization on the IR (-O2)
+ *
+ * A loop of a header "if i < n goto B" and one body block B ending with
+ * i = i + 1 is run VF elements at a time, 4 with SSE2 and 8 with -mavx2,
+ * when every other instruction of B is
+ *  - a load or store of base[i + d], d a constant or loop invariant;
+ *  - i + d itself, used only as such an index;
+ *  - + - * & | ^ ~ or unary - on the values loaded and on invariants,
+ *    or a shift of them by a constant, into a temporary that is not
+ *    used after the loop.
+ * An iteration then depends on no other one as long as the elements
+ * stored to are reached by no other access at a different d.  That
+ * holds for the same base when the d are the same and for different
+ * local arrays; a pointer parameter can not point into the locals of
+ * this call, and two pointers are checked at run time to be at least a
+ * vector apart (for constant d only).
+ *
+ * The vector loop is put in front of the loop, which is left as it was
+ * and does the elements from where the vector loop stopped, at most
+ * VF - 1 of them.  The vector loop runs while i < n - (VF - 1), after a
+ * check that this does not overflow; as loads and stores are unaligned
+ * no prologue is needed to align them.
+ *
+ * The vector values are OPD_VEC operands, numbered here: a register for
+ * each invariant, broadcast before the loop, and for each vector
+ * temporary.  lower.c keeps the last two registers for itself.
+ */
+#define MAX_VEC_REG     14
+
+typedef struct {
+    const IR_INSN *insn;    /* load or store */
+    OPERAND offset;         /* d of base[i + d] */
+} ACCESS;
+
+typedef struct {
+    OPERAND a;              /* base of the store, or of the first access */
+    OPERAND b;
+    int delta;              /* offset of a minus that of b, in bytes */
+} CHECK;
+
+/* the state of one loop, analysed before anything is changed */
+typedef struct {
+    IR_FUNC *ir;
+    const IR_LOOP *loop;
+    IR_BLOCK *header;
+    IR_BLOCK *body;
+    IR_INSN *step;          /* i = i + 1 */
+    OPERAND counter;        /* i */
+    OPERAND limit;          /* n */
+    int vf;
+    int *num_def;           /* by vreg, assignments in the loop */
+    int *vec;               /* by temp, its vector register or -1 */
+    OPERAND *offset;        /* by temp, d of an index i + d */
+    bool *is_index;         /* by temp */
+    OPERAND splat[MAX_VEC_REG];     /* the invariant in each register */
+    int num_vec;
+    ACCESS *access;
+    int num_access;
+    CHECK *check;
+    int num_check;
+} VLOOP;
+
+static OPERAND imm(int n)
+{
+    OPERAND o;
+
+    memset(&o, 0, sizeof o);
+    o.kind = OPD_IMM;
+    o.num = n;
+    return o;
+}
+
+static OPERAND vec_operand(int reg)
+{
+    OPERAND o;
+
+    memset(&o, 0, sizeof o);
+    o.kind = OPD_VEC;
+    o.num = reg;
+    return o;
+}
+
+static OPERAND new_temp(IR_FUNC *ir)
+{
+    OPERAND o;
+
+    memset(&o, 0, sizeof o);
+    o.kind = OPD_TEMP;
+    o.num = ir->num_temp++;
+    return o;
+}
+
+static bool same_operand(const OPERAND *a, const OPERAND *b)
+{
+    if (a->kind != b->kind)
+        return false;
+    switch (a->kind) {
+    case OPD_IMM: case OPD_TEMP: case OPD_VAR:
+        return a->num == b->num;
+    case OPD_GLOBAL: case OPD_ARRAY:
+        return a->sym == b->sym;
+    default:
+        return false;
+    }
+}
+
+/*
+ * analysis
+ */
+static bool is_invariant(const VLOOP *vl, const OPERAND *o)
+{
+    int v;
+
+    if (o->kind == OPD_IMM)
+        return true;
+    v = ir_vreg(vl->ir, o);
+    return v >= 0 && vl->num_def[v] == 0 && !ir_is_pointer(vl->ir, o);
+}
+
+static bool is_counter(const VLOOP *vl, const OPERAND *o)
+{
+    return same_operand(o, &vl->counter);
+}
+
+/* a temporary assigned once in the body and dead after the loop */
+static bool is_body_temp(const VLOOP *vl, const OPERAND *o)
+{
+    return o->kind == OPD_TEMP && vl->num_def[o->num] == 1
+        && !SET_HAS(vl->header->live_in, o->num);
+}
+
+static bool is_vector_temp(const VLOOP *vl, const OPERAND *o)
+{
+    return o->kind == OPD_TEMP && vl->vec[o->num] >= 0;
+}
+
+static bool is_index_temp(const VLOOP *vl, const OPERAND *o)
+{
+    return o->kind == OPD_TEMP && vl->is_index[o->num];
+}
+
+/* the register broadcasting the invariant o, -1 if there are none left */
+static int get_splat(VLOOP *vl, const OPERAND *o)
+{
+    int i;
+
+    for (i = 0; i < vl->num_vec; i++) {
+        if (vl->splat[i].kind != OPD_NONE && same_operand(&vl->splat[i], o))
+            return i;
+    }
+    if (vl->num_vec == MAX_VEC_REG)
+        return -1;
+    vl->splat[vl->num_vec] = *o;
+    return vl->num_vec++;
+}
+
+/* an operand of a vector instruction */
+static bool is_vector_source(VLOOP *vl, const OPERAND *o)
+{
+    if (is_vector_temp(vl, o))
+        return true;
+    return is_invariant(vl, o) && get_splat(vl, o) >= 0;
+}
+
+static bool def_vector(VLOOP *vl, const OPERAND *dst)
+{
+    if (!is_body_temp(vl, dst) || vl->num_vec == MAX_VEC_REG)
+        return false;
+    memset(&vl->splat[vl->num_vec], 0, sizeof (OPERAND));
+    vl->vec[dst->num] = vl->num_vec++;
+    return true;
+}
+
+/* records the access of a load or store, base[i] or base[i + d] */
+static bool add_access(VLOOP *vl, const IR_INSN *ip)
+{
+    ACCESS *ap = &vl->access[vl->num_access];
+
+    if (ip->a.kind != OPD_ARRAY && !ir_is_pointer(vl->ir, &ip->a))
+        return false;
+    if (is_counter(vl, &ip->b))
+        ap->offset = imm(0);
+    else if (is_index_temp(vl, &ip->b))
+        ap->offset = vl->offset[ip->b.num];
+    else
+        return false;
+    ap->insn = ip;
+    vl->num_access++;
+    return true;
+}
+
+/* i + d, or i - d for a constant d */
+static bool add_index(VLOOP *vl, const IR_INSN *ip)
+{
+    OPERAND d;
+
+    if (ip->op == IR_ADD && is_counter(vl, &ip->a))
+        d = ip->b;
+    else if (ip->op == IR_ADD && is_counter(vl, &ip->b))
+        d = ip->a;
+    else if (ip->op == IR_SUB && is_counter(vl, &ip->a)
+                && ip->b.kind == OPD_IMM && ip->b.num != INT_MIN)
+        d = imm(-ip->b.num);
+    else
+        return false;
+    if (!is_invariant(vl, &d) || !is_body_temp(vl, &ip->dst))
+        return false;
+    vl->is_index[ip->dst.num] = true;
+    vl->offset[ip->dst.num] = d;
+    return true;
+}
+
+static bool is_vector_op(IR_OP op)
+{
+    switch (op) {
+    case IR_NEG: case IR_NOT: case IR_ADD: case IR_SUB: case IR_MUL:
+    case IR_AND: case IR_OR: case IR_XOR: case IR_SHL: case IR_SHR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool check_insn(VLOOP *vl, IR_INSN *ip)
+{
+    switch (ip->op) {
+    case IR_LOAD:
+        return add_access(vl, ip) && def_vector(vl, &ip->dst);
+    case IR_STORE:
+        return add_access(vl, ip) && is_vector_source(vl, &ip->c);
+    case IR_NEG:
+    case IR_NOT:
+        return is_vector_temp(vl, &ip->a) && def_vector(vl, &ip->dst);
+    case IR_SHL:
+    case IR_SHR:
+        return is_vector_temp(vl, &ip->a) && ip->b.kind == OPD_IMM
+            && ip->b.num >= 0 && ip->b.num < 32 && def_vector(vl, &ip->dst);
+    default:
+        if (add_index(vl, ip))
+            return true;
+        if (!is_vector_op(ip->op))
+            return false;
+        /* one of them is loaded, or it would have been hoisted */
+        if (!is_vector_temp(vl, &ip->a) && !is_vector_temp(vl, &ip->b))
+            return false;
+        return is_vector_source(vl, &ip->a) && is_vector_source(vl, &ip->b)
+            && def_vector(vl, &ip->dst);
+    }
+}
+
+/* i and i + d are only used as indexes */
+static bool check_uses(const VLOOP *vl)
+{
+    const OPERAND *use[MAX_ARGS + 2];
+    const IR_INSN *ip;
+    int j, n;
+
+    for (ip = vl->body->head; ip != vl->step; ip = ip->next) {
+        n = ir_uses(ip, use, MAX_ARGS + 2);
+        for (j = 0; j < n; j++) {
+            if (!is_counter(vl, use[j]) && !is_index_temp(vl, use[j]))
+                continue;
+            if ((ip->op == IR_LOAD || ip->op == IR_STORE) && use[j] == &ip->b)
+                continue;
+            if (is_counter(vl, use[j]) && is_index_temp(vl, &ip->dst))
+                continue;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool same_base(const OPERAND *a, const OPERAND *b)
+{
+    return same_operand(a, b);
+}
+
+static bool add_check(VLOOP *vl, const ACCESS *x, const ACCESS *y)
+{
+    long delta;
+    int i;
+
+    if (x->offset.kind != OPD_IMM || y->offset.kind != OPD_IMM)
+        return false;
+    delta = ((long) x->offset.num - y->offset.num) * BYTE_INT;
+    if (delta < INT_MIN / 2 || delta > INT_MAX / 2)
+        return false;
+    for (i = 0; i < vl->num_check; i++) {
+        CHECK *cp = &vl->check[i];
+        if (same_base(&cp->a, &x->insn->a) && same_base(&cp->b, &y->insn->a)
+                && cp->delta == delta)
+            return true;
+    }
+    vl->check[vl->num_check].a = x->insn->a;
+    vl->check[vl->num_check].b = y->insn->a;
+    vl->check[vl->num_check].delta = (int) delta;
+    vl->num_check++;
+    return true;
+}
+
+/*
+ * y, a load before the store x, reads an element x stores to in a later
+ * iteration, as in a[i] = a[i + 1]: the vector loop reads those before
+ * it stores too
+ */
+static bool reads_ahead(const ACCESS *y, const ACCESS *x, bool before)
+{
+    return before && y->insn->op == IR_LOAD && x->offset.kind == OPD_IMM
+        && y->offset.kind == OPD_IMM && y->offset.num > x->offset.num;
+}
+
+/* no store reaches an element another iteration accesses */
+static bool check_dependences(VLOOP *vl)
+{
+    int i, j;
+
+    for (i = 0; i < vl->num_access; i++) {
+        const ACCESS *x = &vl->access[i];
+        if (x->insn->op != IR_STORE)
+            continue;
+        for (j = 0; j < vl->num_access; j++) {
+            const ACCESS *y = &vl->access[j];
+            const OPERAND *a = &x->insn->a, *b = &y->insn->a;
+            if (i == j || (y->insn->op == IR_STORE && j < i))
+                continue;
+            if (same_base(a, b)) {
+                if (!same_operand(&x->offset, &y->offset)
+                        && !reads_ahead(y, x, j < i))
+                    return false;
+            } else if (a->kind == OPD_VAR && b->kind == OPD_VAR) {
+                if (!add_check(vl, x, y))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* the header and the step, the counter and the limit */
+static bool check_shape(VLOOP *vl)
+{
+    const IR_LOOP *lp = vl->loop;
+    IR_INSN *br = vl->header->head;
+    IR_INSN *ip;
+
+    if (lp->size != 2 || br != vl->header->tail || br->op != IR_BR
+            || br->is_unsigned)
+        return false;
+    vl->body = br->target[0];
+    if (!lp->body[vl->body->id] || lp->body[br->target[1]->id]
+            || vl->body->num_pred != 1)
+        return false;
+    if (br->cond == IC_LT) {
+        vl->counter = br->a;
+        vl->limit = br->b;
+    } else if (br->cond == IC_GT) {
+        vl->counter = br->b;
+        vl->limit = br->a;
+    } else {
+        return false;
+    }
+    ip = vl->body->tail;
+    if (ip->op != IR_JMP || (ip = ip->prev) == NULL || ip->op != IR_ADD
+            || !same_operand(&ip->dst, &vl->counter)
+            || !((is_counter(vl, &ip->a) && ip->b.kind == OPD_IMM
+                    && ip->b.num == 1)
+                || (is_counter(vl, &ip->b) && ip->a.kind == OPD_IMM
+                    && ip->a.num == 1)))
+        return false;
+    vl->step = ip;
+    if (vl->counter.kind != OPD_VAR && vl->counter.kind != OPD_TEMP)
+        return false;
+    if (vl->num_def[ir_vreg(vl->ir, &vl->counter)] != 1
+            || !is_invariant(vl, &vl->limit))
+        return false;
+    /* too short to be worth it, and n - (VF - 1) may not overflow */
+    return vl->limit.kind != OPD_IMM || vl->limit.num >= vl->vf;
+}
+
+static bool analyze_loop(VLOOP *vl)
+{
+    IR_BLOCK *bp;
+    IR_INSN *ip;
+    int v, n = 0;
+
+    for (bp = vl->ir->entry; bp != NULL; bp = bp->next) {
+        if (!vl->loop->body[bp->id])
+            continue;
+        for (ip = bp->head; ip != NULL; ip = ip->next) {
+            if ((v = ir_vreg(vl->ir, &ip->dst)) >= 0)
+                vl->num_def[v]++;
+            n++;
+        }
+    }
+    if (!check_shape(vl))
+        return false;
+    vl->access = (ACCESS*) alloc(sizeof (ACCESS) * (n + 1));
+    vl->check = (CHECK*) alloc(sizeof (CHECK) * (n * n + 1));
+    for (ip = vl->body->head; ip != vl->step; ip = ip->next) {
+        if (!check_insn(vl, ip))
+            return false;
+    }
+    return vl->num_vec > 0 && vl->num_access > 0 && check_uses(vl)
+        && check_dependences(vl);
+}
+
+/*
+ * transformation
+ */
+static IR_INSN *new_insn(IR_OP op, const POS *pos)
+{
+    IR_INSN *ip = (IR_INSN*) arena_alloc(AK_IR, sizeof (IR_INSN));
+    memset(ip, 0, sizeof (IR_INSN));
+    ip->op = op;
+    ip->pos = pos;
+    return ip;
+}
+
+/* adds ip to bp, before its terminator once it has one */
+static IR_INSN *add_insn(IR_BLOCK *bp, IR_INSN *ip)
+{
+    IR_INSN *at = (bp->tail && ir_is_terminator(bp->tail->op))
+                    ? bp->tail : NULL;
+
+    ip->next = at;
+    ip->prev = at ? at->prev : bp->tail;
+    if (ip->prev)
+        ip->prev->next = ip;
+    else
+        bp->head = ip;
+    if (at)
+        at->prev = ip;
+    else
+        bp->tail = ip;
+    return ip;
+}
+
+/* a new block in layout before the loop header */
+static IR_BLOCK *new_block(VLOOP *vl)
+{
+    IR_BLOCK *bp = (IR_BLOCK*) arena_alloc(AK_IR, sizeof (IR_BLOCK));
+    IR_BLOCK *p;
+
+    memset(bp, 0, sizeof (IR_BLOCK));
+    bp->id = vl->ir->num_block;     /* renumbered after */
+    for (p = vl->ir->entry; p->next != vl->header; p = p->next)
+        ;
+    p->next = bp;
+    bp->next = vl->header;
+    return bp;
+}
+
+static void add_jmp(IR_BLOCK *bp, IR_BLOCK *to, const POS *pos)
+{
+    IR_INSN *ip = add_insn(bp, new_insn(IR_JMP, pos));
+    ip->target[0] = to;
+}
+
+/* if a cond b goto t else f */
+static void add_br(IR_BLOCK *bp, OPERAND a, IR_COND cond, OPERAND b,
+                IR_BLOCK *t, IR_BLOCK *f, const POS *pos)
+{
+    IR_INSN *ip = add_insn(bp, new_insn(IR_BR, pos));
+    ip->a = a;
+    ip->cond = cond;
+    ip->b = b;
+    ip->target[0] = t;
+    ip->target[1] = f;
+}
+
+/* the operand of the vector instruction for o */
+static OPERAND vector_of(VLOOP *vl, const OPERAND *o)
+{
+    if (is_vector_temp(vl, o))
+        return vec_operand(vl->vec[o->num]);
+    return vec_operand(get_splat(vl, o));
+}
+
+/* the vector body, into bp */
+static void build_body(VLOOP *vl, IR_BLOCK *bp, IR_BLOCK *vh)
+{
+    OPERAND *index = (OPERAND*) alloc(sizeof (OPERAND)
+                                        * (vl->ir->num_temp + 1));
+    const IR_INSN *ip;
+    IR_INSN *np;
+
+    for (ip = vl->body->head; ip != vl->step; ip = ip->next) {
+        np = new_insn(ip->op, ip->pos);
+        np->is_unsigned = ip->is_unsigned;
+        if (is_index_temp(vl, &ip->dst)) {
+            index[ip->dst.num] = new_temp(vl->ir);
+            np->dst = index[ip->dst.num];
+            np->a = ip->a;
+            np->b = ip->b;
+        } else {
+            if (ip->dst.kind != OPD_NONE)
+                np->dst = vec_operand(vl->vec[ip->dst.num]);
+            if (ip->op == IR_LOAD || ip->op == IR_STORE) {
+                np->a = ip->a;
+                np->b = is_index_temp(vl, &ip->b) ? index[ip->b.num] : ip->b;
+            } else {
+                np->a = vector_of(vl, &ip->a);
+                if (ip->op == IR_SHL || ip->op == IR_SHR)
+                    np->b = ip->b;
+                else if (ip->b.kind != OPD_NONE)
+                    np->b = vector_of(vl, &ip->b);
+            }
+            if (ip->op == IR_STORE)
+                np->c = vector_of(vl, &ip->c);
+        }
+        add_insn(bp, np);
+    }
+    np = add_insn(bp, new_insn(IR_ADD, vl->step->pos));
+    np->dst = vl->counter;
+    np->a = vl->counter;
+    np->b = imm(vl->vf);
+    add_jmp(bp, vh, vl->step->pos);
+    free(index);
+}
+
+static void vectorize(VLOOP *vl)
+{
+    IR_FUNC *ir = vl->ir;
+    IR_BLOCK *h = vl->header;
+    const POS *pos = h->tail->pos;
+    IR_BLOCK *pre, *bp, *next, *vh, *vb;
+    OPERAND lim, ok;
+    IR_INSN *ip;
+    int i;
+
+    pre = ir_make_preheader(ir, vl->loop);
+    bp = new_block(vl);
+    pre->tail->target[0] = bp;
+
+    /* lim = n - (VF - 1), if that does not overflow */
+    if (vl->limit.kind == OPD_IMM) {
+        lim = imm(vl->limit.num - (vl->vf - 1));
+    } else {
+        next = new_block(vl);
+        add_br(bp, vl->limit, IC_LT, imm(INT_MIN + vl->vf - 1), h, next, pos);
+        bp = next;
+        lim = new_temp(ir);
+        ip = add_insn(bp, new_insn(IR_SUB, pos));
+        ip->dst = lim;
+        ip->a = vl->limit;
+        ip->b = imm(vl->vf - 1);
+    }
+    for (i = 0; i < vl->num_check; i++) {
+        ok = new_temp(ir);
+        ip = add_insn(bp, new_insn(IR_NOALIAS, pos));
+        ip->dst = ok;
+        ip->a = vl->check[i].a;
+        ip->b = vl->check[i].b;
+        ip->c = imm(vl->check[i].delta);
+        next = new_block(vl);
+        add_br(bp, ok, IC_EQ, imm(0), h, next, pos);
+        bp = next;
+    }
+    for (i = 0; i < vl->num_vec; i++) {
+        if (vl->splat[i].kind == OPD_NONE)
+            continue;
+        ip = add_insn(bp, new_insn(IR_MOV, pos));
+        ip->dst = vec_operand(i);
+        ip->a = vl->splat[i];
+    }
+    vh = new_block(vl);
+    vb = new_block(vl);
+    add_jmp(bp, vh, pos);
+    add_br(vh, vl->counter, IC_LT, lim, vb, h, pos);
+    build_body(vl, vb, vh);
+}
+
+/* returns 1 if lp was vectorized */
+static int vectorize_loop(IR_FUNC *ir, const IR_LOOP *lp)
+{
+    int num_vreg = ir_num_vreg(ir);
+    int result = 0;
+    VLOOP vl;
+
+    memset(&vl, 0, sizeof vl);
+    vl.ir = ir;
+    vl.loop = lp;
+    vl.header = lp->header;
+    vl.vf = g_compiler->avx2 ? 8 : 4;
+    vl.num_def = (int*) alloc(sizeof (int) * (num_vreg + 1));
+    vl.vec = (int*) alloc(sizeof (int) * (ir->num_temp + 1));
+    vl.offset = (OPERAND*) alloc(sizeof (OPERAND) * (ir->num_temp + 1));
+    vl.is_index = (bool*) alloc(sizeof (bool) * (ir->num_temp + 1));
+    memset(vl.num_def, 0, sizeof (int) * (num_vreg + 1));
+    memset(vl.vec, -1, sizeof (int) * (ir->num_temp + 1));
+    memset(vl.is_index, 0, sizeof (bool) * (ir->num_temp + 1));
+    if (analyze_loop(&vl)) {
+        vectorize(&vl);
+        result = 1;
+    }
+    free(vl.num_def);
+    free(vl.vec);
+    free(vl.offset);
+    free(vl.is_index);
+    free(vl.access);
+    free(vl.check);
+    return result;
+}
+
+/* returns the number of loops vectorized */
+int vectorize_loops(IR_FUNC *ir)
+{
+    IR_BLOCK **done = NULL;
+    int num_done = 0;
+    IR_LOOPS li;
+    int i, n = 0;
+
+    ir_liveness(ir);
+    for (;;) {
+        ir_find_loops(&li, ir);
+        for (i = 0; i < li.num_loop; i++) {
+            int j;
+            for (j = 0; j < num_done; j++) {
+                if (done[j] == li.loop[i].header)
+                    break;
+            }
+            if (j == num_done)
+                break;
+        }
+        if (i == li.num_loop) {
+            ir_free_loops(&li);
+            break;
+        }
+        done = (IR_BLOCK**) realloc(done, sizeof (IR_BLOCK*) * (num_done + 1));
+        if (done == NULL) {
+            fprintf(stderr, "out of memory\n");
+            abort();
+        }
+        done[num_done++] = li.loop[i].header;
+        n += vectorize_loop(ir, &li.loop[i]);
+        ir_free_loops(&li);
+        ir_number_blocks(ir);
+        ir_build_cfg(ir);
+        ir_liveness(ir);
+    }
+    free(done);
+    return n;
+}